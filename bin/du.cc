@@ -1,49 +1,64 @@
+// Usage: du [-j nthreads] [path]
+//
+// Print the total size of path (by default .) and everything below it,
+// walking the tree with nthreads threads (by default one per CPU).
+
 #include "types.h"
-#include <sys/stat.h>
-#include "user.h"
-#include "fs.h"
+#include "libutil.h"
+#include "treewalk.hh"
 
-#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
-static int
-du(int fd)
+class du_walk : public treewalk
 {
-  struct stat st;
-  if (fstat(fd, &st) < 0) {
-    fprintf(stderr, "du: cannot stat\n");
-    close(fd);
-    return 0;
-  }
+  struct total
+  {
+    long bytes;
+  } __mpalign__;
 
-  int size = st.st_size;
-  if (S_ISDIR(st.st_mode)) {
-    struct dirent de;
-    while (read(fd, &de, sizeof(de)) == sizeof(de)) {
-      if (de.inum == 0)
-        continue;
+  per_thread<total> totals_;
 
-      char buf[DIRSIZ+1];
-      memmove(buf, de.name, DIRSIZ);
-      buf[DIRSIZ] = 0;
+public:
+  du_walk(int nthreads) : totals_(nthreads) { }
 
-      if (!strcmp(buf, ".") || !strcmp(buf, ".."))
-        continue;
+  long bytes()
+  {
+    long sum = 0;
+    for (int i = 0; i < totals_.size(); i++)
+      sum += totals_[i].bytes;
+    return sum;
+  }
 
-      int nfd = openat(fd, buf, 0);
-      if (nfd >= 0)
-        size += du(nfd);  // should go into work queue
-    }
+protected:
+  bool visit(int thread, const entry &e) override
+  {
+    totals_[thread].bytes += e.st.st_size;
+    return true;
   }
 
-  close(fd);
-  return size;
-}
+  void error(int thread, const char *path) override
+  {
+    fprintf(stderr, "du: cannot read %s\n", path);
+  }
+};
 
 int
 main(int ac, char **av)
 {
-  printf("%d\n", du(open(".", 0)));
+  int nthreads = treewalk::default_threads();
+  if (ac > 2 && strcmp(av[1], "-j") == 0) {
+    nthreads = atoi(av[2]);
+    ac -= 2;
+    av += 2;
+  }
+  if (ac > 2 || nthreads <= 0)
+    die("usage: du [-j nthreads] [path]");
+
+  du_walk w(nthreads);
+  if (w.run(ac > 1 ? av[1] : ".", nthreads) < 0)
+    return 1;
+  printf("%ld\n", w.bytes());
   return 0;
 }
@@ -0,0 +1,420 @@
+// Run fxmark microbenchmarks and dbench at increasing core counts and
+// emit one CSV or JSON report per run, so scalefs builds can be compared
+// by diffing reports.  On sv6, each data point also records the change
+// in kernel statistics (/dev/kstats) over the run.
+//
+//   fssweep [-C cores] [-c maxcpu] [-s step] [-d secs] [-r root] [-j]
+//           [bench...]
+//
+// bench is an fxmark type (MWCL, DRBL, ...) or "dbench"; by default all
+// of them are run.  The core counts are 1, step, 2*step, ..., maxcpu.
+// A run on n cores pins fxmark's workers to the first n entries of the
+// comma-separated core list, which defaults to every core we may run on.
+// fxmark, dbench and dbench's client.txt are expected in the same
+// directory as fssweep, and root must be an absolute path.
+
+#include "libutil.h"
+#ifdef XV6_USER
+#include "types.h"
+#include "user.h"
+#include "kstats.hh"
+#endif
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#ifndef XV6_USER
+#include <sched.h>
+#endif
+
+#include <vector>
+
+static const char *fxmark_types[] = {
+  "MWCL", "DWAL", "DWOL", "MWRM", "DWSL", "DWOM", "MWRL", "DRBL", "DRBL_bg",
+  "DRBM", "DRBM_bg", "DRBH", "DRBH_bg", "MRDL", "MRDL_bg", "MRDM", "MRDM_bg",
+  "MRPL", "MRPM", "MRPM_bg", "MRPH", "MWCM", "MWUM", "MWUL", "DWTL",
+};
+
+static int duration = 5;
+static bool json;
+static char bindir[PATH_MAX];
+static std::vector<int> cores;
+#ifdef XV6_USER
+static const char *root = "/sweep";
+#else
+static const char *root = "/tmp/fssweep";
+#endif
+
+struct result
+{
+  double secs;
+  double works;
+  double rate;
+  const char *unit;
+#ifdef XV6_USER
+  kstats delta;
+#endif
+};
+
+#ifdef XV6_USER
+static void
+read_kstats(kstats *out)
+{
+  int fd = open("/dev/kstats", O_RDONLY);
+  if (fd < 0)
+    die("Couldn't open /dev/kstats");
+  if (xread(fd, out, sizeof *out) != sizeof *out)
+    die("Short read from /dev/kstats");
+  close(fd);
+}
+#endif
+
+// Parse an unsigned decimal such as "1234.5678", advancing *s past it.
+static double
+parse_double(const char **s)
+{
+  const char *p = *s;
+  double v = 0, scale = 1;
+  for (; *p >= '0' && *p <= '9'; p++)
+    v = v * 10 + (*p - '0');
+  if (*p == '.')
+    for (p++; *p >= '0' && *p <= '9'; p++)
+      v += (*p - '0') * (scale /= 10);
+  *s = p;
+  return v;
+}
+
+static struct dirent *
+next_dirent(DIR *d, struct dirent *ent)
+{
+#ifdef XV6_USER
+  struct dirent *e;
+  if (readdir_r(d, ent, &e) != 0)
+    return nullptr;
+  return e;
+#else
+  return readdir(d);
+#endif
+}
+
+static void
+rmtree(const char *path)
+{
+  struct stat st;
+  if (lstat(path, &st) < 0)
+    return;
+  if (S_ISDIR(st.st_mode)) {
+    DIR *d = opendir(path);
+    if (d) {
+      struct dirent ent, *e;
+      char child[PATH_MAX];
+      while ((e = next_dirent(d, &ent))) {
+        if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+          continue;
+        snprintf(child, sizeof child, "%s/%s", path, e->d_name);
+        rmtree(child);
+      }
+      closedir(d);
+    }
+  }
+  unlink(path);
+}
+
+// Run argv[0] from bindir and return its standard output, or an empty
+// string if it failed.
+static std::vector<char>
+run_capture(const char * const argv[])
+{
+  int fds[2];
+  if (pipe(fds) < 0)
+    die("pipe");
+
+  int pid = fork();
+  if (pid < 0)
+    die("fork");
+  if (pid == 0) {
+    close(fds[0]);
+    dup2(fds[1], 1);
+    close(fds[1]);
+    // dbench looks for client.txt in its working directory
+    if (chdir(bindir) < 0)
+      die("chdir %s", bindir);
+    execv(argv[0], const_cast<char * const *>(argv));
+    die("exec %s", argv[0]);
+  }
+
+  close(fds[1]);
+  std::vector<char> out;
+  char buf[512];
+  ssize_t n;
+  while ((n = read(fds[0], buf, sizeof buf)) > 0)
+    for (ssize_t i = 0; i < n; i++)
+      out.push_back(buf[i]);
+  close(fds[0]);
+  out.push_back('\0');
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0 || status != 0)
+    out[0] = '\0';
+  return out;
+}
+
+// fxmark reports "# ncpu secs works works/sec" and then a line of data.
+static bool
+run_fxmark(const char *type, int ncpu, const char *dir, result *r)
+{
+  char ncore[16], secs[16], corelist[1024];
+  snprintf(ncore, sizeof ncore, "%d", ncpu);
+  snprintf(secs, sizeof secs, "%d", duration);
+  // Pass the placement explicitly rather than relying on the core
+  // policy compiled into fxmark, which describes some other machine.
+  size_t len = 0;
+  for (int i = 0; i < ncpu && len < sizeof corelist; i++)
+    len += snprintf(corelist + len, sizeof corelist - len, "%s%d",
+                    i ? "," : "", cores[i]);
+  if (len >= sizeof corelist)
+    die("fssweep: core list too long");
+  const char *argv[] = { "./fxmark", "-t", type, "-n", ncore, "-g", "0",
+                         "-d", secs, "-r", dir, "-c", corelist, nullptr };
+
+  std::vector<char> out = run_capture(argv);
+  const char *p = strstr(out.data(), "works/sec");
+  if (!p || !(p = strchr(p, '\n')))
+    return false;
+  auto field = [&p]() {
+    while (*p == ' ' || *p == '\n')
+      p++;
+    return parse_double(&p);
+  };
+  field();                      // ncpu
+  r->secs = field();
+  r->works = field();
+  r->rate = field();
+  r->unit = "works/sec";
+  return true;
+}
+
+// dbench runs for a fixed time and reports "Throughput N MB/sec".
+static bool
+run_dbench(int ncpu, const char *dir, result *r)
+{
+  char nprocs[16], secs[16];
+  snprintf(nprocs, sizeof nprocs, "%d", ncpu);
+  snprintf(secs, sizeof secs, "%d", duration);
+  const char *argv[] = { "./dbench", "-t", secs, nprocs, dir, nullptr };
+
+  if (mkdir(dir, 0777) < 0)
+    return false;
+  std::vector<char> out = run_capture(argv);
+  const char *p = strstr(out.data(), "Throughput ");
+  if (!p)
+    return false;
+  p += strlen("Throughput ");
+  r->secs = duration;
+  r->rate = parse_double(&p);
+  r->works = r->rate * duration;
+  r->unit = "MB/sec";
+  return true;
+}
+
+static void
+print_header(void)
+{
+  struct utsname u;
+  if (uname(&u) < 0)
+    memset(&u, 0, sizeof u);
+
+  if (json) {
+    printf("{\"kernel\": \"%s %s %s\", \"duration\": %d, \"results\": [",
+           u.sysname, u.release, u.version, duration);
+    return;
+  }
+  printf("# %s %s %s\n", u.sysname, u.release, u.version);
+  printf("bench,ncpu,secs,works,rate,unit");
+#ifdef XV6_USER
+#define X(type, name) printf("," #name);
+  KSTATS_ALL(X);
+#undef X
+#endif
+  printf("\n");
+}
+
+static void
+print_result(const char *bench, int ncpu, const result &r)
+{
+  static bool first = true;
+
+  if (json) {
+    printf("%s\n  {\"bench\": \"%s\", \"ncpu\": %d, \"secs\": %f, "
+           "\"works\": %f, \"rate\": %f, \"unit\": \"%s\"",
+           first ? "" : ",", bench, ncpu, r.secs, r.works, r.rate, r.unit);
+#ifdef XV6_USER
+    const char *sep = "";
+    printf(", \"kstats\": {");
+#define X(type, name) \
+    printf("%s\"" #name "\": %lu", sep, (u64)r.delta.name); sep = ", ";
+    KSTATS_ALL(X);
+#undef X
+    printf("}");
+#endif
+    printf("}");
+  } else {
+    printf("%s,%d,%f,%f,%f,%s", bench, ncpu, r.secs, r.works, r.rate, r.unit);
+#ifdef XV6_USER
+#define X(type, name) printf(",%lu", (u64)r.delta.name);
+    KSTATS_ALL(X);
+#undef X
+#endif
+    printf("\n");
+  }
+  first = false;
+}
+
+static void
+sweep(const char *bench, const std::vector<int> &ncpus)
+{
+  for (int ncpu : ncpus) {
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof dir, "%s/%s.%d", root, bench, ncpu);
+    rmtree(dir);
+
+    result r;
+#ifdef XV6_USER
+    kstats before, after;
+    read_kstats(&before);
+#endif
+    bool ok = strcmp(bench, "dbench") == 0 ?
+      run_dbench(ncpu, dir, &r) : run_fxmark(bench, ncpu, dir, &r);
+#ifdef XV6_USER
+    read_kstats(&after);
+    r.delta = after - before;
+#endif
+    rmtree(dir);
+
+    if (!ok) {
+      fprintf(stderr, "fssweep: %s at %d cores failed\n", bench, ncpu);
+      continue;
+    }
+    print_result(bench, ncpu, r);
+  }
+}
+
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-C cores] [-c maxcpu] [-s step] [-d secs] "
+          "[-r root] [-j] [bench...]\n", argv0);
+  exit(2);
+}
+
+// Parse a comma-separated core list such as "0,2,4,6".
+static bool
+parse_cores(const char *s)
+{
+  cores.clear();
+  for (;;) {
+    char *end;
+    long c = strtol(s, &end, 10);
+    if (end == s || c < 0)
+      return false;
+    cores.push_back(c);
+    if (*end == '\0')
+      return true;
+    if (*end != ',')
+      return false;
+    s = end + 1;
+  }
+}
+
+// The cores we may run on, in order.
+static void
+default_cores(void)
+{
+#ifdef XV6_USER
+  for (int c = 0; c < NCPU; c++)
+    cores.push_back(c);
+#else
+  cpu_set_t set;
+  if (sched_getaffinity(0, sizeof set, &set) < 0)
+    die("sched_getaffinity");
+  for (int c = 0; c < CPU_SETSIZE; c++)
+    if (CPU_ISSET(c, &set))
+      cores.push_back(c);
+#endif
+}
+
+int
+main(int argc, char **argv)
+{
+  int maxcpu = 0;
+  int step = 1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "C:c:s:d:r:j")) != -1) {
+    switch (opt) {
+    case 'C':
+      if (!parse_cores(optarg))
+        usage(argv[0]);
+      break;
+    case 'c':
+      maxcpu = atoi(optarg);
+      break;
+    case 's':
+      step = atoi(optarg);
+      break;
+    case 'd':
+      duration = atoi(optarg);
+      break;
+    case 'r':
+      root = optarg;
+      break;
+    case 'j':
+      json = true;
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (cores.empty())
+    default_cores();
+  if (!maxcpu)
+    maxcpu = cores.size();
+  if (maxcpu <= 0 || maxcpu > (int)cores.size() || step <= 0 ||
+      duration <= 0 || root[0] != '/')
+    usage(argv[0]);
+
+  const char *slash = strrchr(argv[0], '/');
+  if (slash)
+    snprintf(bindir, sizeof bindir, "%.*s", (int)(slash - argv[0]), argv[0]);
+  if (!bindir[0])
+    strcpy(bindir, slash ? "/" : ".");
+
+  std::vector<int> ncpus;
+  ncpus.push_back(1);
+  for (int n = step; n <= maxcpu; n += step)
+    if (n > 1)
+      ncpus.push_back(n);
+  if (ncpus.back() != maxcpu)
+    ncpus.push_back(maxcpu);
+
+  mkdir(root, 0777);
+  print_header();
+  if (optind == argc) {
+    for (const char *type : fxmark_types)
+      sweep(type, ncpus);
+    sweep("dbench", ncpus);
+  } else {
+    for (int i = optind; i < argc; i++)
+      sweep(argv[i], ncpus);
+  }
+  if (json)
+    printf("\n]}\n");
+  return 0;
+}
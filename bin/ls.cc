@@ -12,10 +12,14 @@
 #ifdef XV6_USER
 #include "fs.h"
 #include "sysstubs.h"
+#include "pthread.h"
 #else
 #include <dirent.h>
+#include <pthread.h>
 #endif
 
+#include "treewalk.hh"
+
 char
 filetype(mode_t m)
 {
@@ -97,12 +101,80 @@ ls(const std::string &path)
   close(fd);
 }
 
+// ls -R.  Each directory is listed by the thread that read it, so
+// directories come out in no particular order, but each one's listing
+// is sorted and printed whole.
+class ls_walk : public treewalk
+{
+  struct item
+  {
+    std::string path;
+    struct stat st;
+  };
+
+  struct listing
+  {
+    std::vector<item> entries;
+  } __mpalign__;
+
+  per_thread<listing> listings_;
+  pthread_mutex_t print_lock_;
+
+public:
+  ls_walk(int nthreads) : listings_(nthreads)
+  {
+    pthread_mutex_init(&print_lock_, nullptr);
+  }
+
+protected:
+  bool visit(int thread, const entry &e) override
+  {
+    // The root isn't part of any listing.
+    if (e.dirfd != AT_FDCWD)
+      listings_[thread].entries.push_back(item{e.path, e.st});
+    return true;
+  }
+
+  void listed(int thread, const entry &dir) override
+  {
+    auto &entries = listings_[thread].entries;
+    std::sort(entries.begin(), entries.end(),
+              [](const item &a, const item &b) { return a.path < b.path; });
+    pthread_mutex_lock(&print_lock_);
+    printf("%s:\n", dir.path);
+    for (auto &e : entries)
+      printout(&e.st, e.path);
+    printf("\n");
+    pthread_mutex_unlock(&print_lock_);
+    entries.clear();
+  }
+
+  void error(int thread, const char *path) override
+  {
+    fprintf(stderr, "ls: cannot read %s\n", path);
+  }
+};
+
 int
 main(int argc, char *argv[])
 {
   int i;
+  bool recursive = false;
 
-  if(argc < 2){
+  if(argc > 1 && strcmp(argv[1], "-R") == 0){
+    recursive = true;
+    argc--;
+    argv++;
+  }
+
+  if(recursive){
+    int nthreads = treewalk::default_threads();
+    ls_walk w(nthreads);
+    if(argc < 2)
+      w.run(".", nthreads);
+    for(i=1; i<argc; i++)
+      w.run(argv[i], nthreads);
+  } else if(argc < 2){
     ls(".");
   } else {
     for(i=1; i<argc; i++)
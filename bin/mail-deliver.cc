@@ -1,17 +1,41 @@
 #include "libutil.h"
+#include "mailstamp.h"
 #include "shutil.h"
 #include "xsys.h"
 
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/un.h>
 
+#include <atomic>
 #include <string>
+#include <thread>
+#include <vector>
 
 using std::string;
 
+// Ack datagrams carry at most this many bytes, so that mail-qman can
+// NUL-terminate them in a 1K buffer.
+enum { max_ack = 1023 };
+
+// fsync path.  A path that can't be opened is skipped, like a maildir
+// whose new/ can't be opened as a directory.
+static void
+fsync_path(const string &path, int flags)
+{
+  int fd = open(path.c_str(), flags);
+  if (fd < 0)
+    return;
+  if (fsync(fd) < 0)
+    edie("fsync %s failed", path.c_str());
+  close(fd);
+}
+
 class maildir_writer
 {
   string maildir_;
@@ -27,7 +51,15 @@ public:
       die("No such mailbox: %s", maildir.c_str());
   }
 
-  void deliver(int msgfd, size_t limit = (size_t)-1)
+  const string &maildir() const
+  {
+    return maildir_;
+  }
+
+  // Deliver a message from msgfd and return its path in new/.  Unless
+  // sync is true, the message isn't durable until the caller fsyncs that
+  // path and then the maildir's new/.
+  string deliver(int msgfd, size_t limit = (size_t)-1, bool sync = true)
   {
     // Generate unique tmp path
     char unique[16];
@@ -40,12 +72,12 @@ public:
     int fd = open(tmppath.c_str(), O_CREAT|O_EXCL|O_WRONLY, 0600);
     if (fd < 0)
       edie("open %s failed", tmppath.c_str());
-    if (copy_fd_n(fd, 0, limit) < 0)
+    if (copy_fd_n(fd, msgfd, limit) < 0)
       edie("copy_fd failed");
     struct stat st;
     if (fstatx(fd, &st, STAT_OMIT_NLINK) < 0)
       edie("fstat %s failed", tmppath.c_str());
-    if (fsync(fd) < 0)
+    if (sync && fsync(fd) < 0)
       edie("fsync %s failed", tmppath.c_str());
     close(fd);
 
@@ -55,15 +87,9 @@ public:
     newpath.append("/new/").append(unique);
     if (rename(tmppath.c_str(), newpath.c_str()) < 0)
       edie("rename %s %s failed", tmppath.c_str(), newpath.c_str());
-
-    string newdir(maildir_);
-    newdir.append("/new");
-    fd = open(newdir.c_str(), O_RDONLY|O_DIRECTORY);
-    if (fd >= 0) {
-      if (fsync(fd) < 0)
-        edie("fsync %s failed", newdir.c_str());
-      close(fd);
-    }
+    if (sync)
+      fsync_path(maildir_ + "/new", O_RDONLY|O_DIRECTORY);
+    return newpath;
   }
 };
 
@@ -85,15 +111,223 @@ do_batch_mode(int fd, int resultfd, maildir_writer *writer)
   }
 }
 
+static void
+bind_socket(int fd, const string &path, struct sockaddr_un *sun)
+{
+  *sun = {};
+  sun->sun_family = AF_UNIX;
+  snprintf(sun->sun_path, sizeof sun->sun_path, "%s", path.c_str());
+  unlink(sun->sun_path);
+  if (bind(fd, (struct sockaddr*)sun, SUN_LEN(sun)) < 0)
+    edie("bind %s failed", path.c_str());
+}
+
+// Server mode, for mail-qman -w: a long-lived delivery worker.  Each
+// request on sockpath is a datagram "<id> <recipient> <message path>".
+// Messages are delivered without syncing, and acknowledged to ackpath
+// with "<id> <latency usec>" lines only once their whole batch is
+// durable.  A batch is synced when it reaches batch_size messages, or
+// about window_usec after it began, by fsyncing each of its messages
+// and then each maildir it touched once.  This only writes back this
+// worker's own files, so workers on other CPUs don't wait for each
+// other's deliveries, as they would with a syncfs of the mailroot.
+class delivery_server
+{
+  struct writer
+  {
+    string recipient;
+    maildir_writer *w;
+  };
+
+  struct delivered
+  {
+    string id;
+    uint64_t stamp;
+    string path;
+    maildir_writer *w;
+  };
+
+  string mailroot_;
+  int sockfd_, ackfd_;
+  struct sockaddr_un sun_, ack_sun_;
+  size_t batch_size_;
+  unsigned window_usec_;
+  std::vector<writer> writers_;
+  std::vector<delivered> batch_;
+
+  // Set when a batch begins.  The ticker thread clears it and sends us
+  // a FLUSH once the window is up.
+  std::atomic<bool> armed_;
+  std::atomic<bool> done_;
+
+  maildir_writer *get_writer(const string &recipient)
+  {
+    for (auto &w : writers_)
+      if (w.recipient == recipient)
+        return w.w;
+    writers_.push_back(writer{recipient,
+                              new maildir_writer(mailroot_ + "/" + recipient)});
+    return writers_.back().w;
+  }
+
+  void send_ack(const char *buf, size_t len)
+  {
+    if (sendto(ackfd_, buf, len, 0,
+               (struct sockaddr*)&ack_sun_, SUN_LEN(&ack_sun_)) < 0)
+      edie("mail-deliver: send ack failed");
+  }
+
+  void flush()
+  {
+    armed_ = false;
+    if (batch_.empty())
+      return;
+
+    // Make the messages durable before the directory entries naming
+    // them, and each new/ directory only once.
+    std::vector<maildir_writer*> dirs;
+    for (auto &d : batch_) {
+      fsync_path(d.path, O_RDONLY);
+      bool seen = false;
+      for (auto w : dirs)
+        if (w == d.w)
+          seen = true;
+      if (!seen)
+        dirs.push_back(d.w);
+    }
+    for (auto w : dirs)
+      fsync_path(w->maildir() + "/new", O_RDONLY|O_DIRECTORY);
+
+    // Acknowledge the batch, in datagrams of up to max_ack bytes.
+    uint64_t now = now_usec();
+    string ack;
+    for (auto &d : batch_) {
+      char line[64];
+      snprintf(line, sizeof line, "%s %lu\n", d.id.c_str(),
+               d.stamp ? (unsigned long)(now - d.stamp) : 0ul);
+      if (ack.size() + strlen(line) > max_ack) {
+        send_ack(ack.data(), ack.size());
+        ack.clear();
+      }
+      ack.append(line);
+    }
+    send_ack(ack.data(), ack.size());
+    batch_.clear();
+  }
+
+  void deliver(char *req)
+  {
+    char *recipient = strchr(req, ' ');
+    char *path = recipient ? strchr(recipient + 1, ' ') : nullptr;
+    if (!path)
+      die("mail-deliver: bad request %s", req);
+    *recipient++ = 0;
+    *path++ = 0;
+
+    int msgfd = open(path, O_RDONLY|O_CLOEXEC|O_ANYFD);
+    if (msgfd < 0)
+      edie("mail-deliver: open %s failed", path);
+    uint64_t stamp = mailstamp_read(msgfd);
+    maildir_writer *w = get_writer(recipient);
+    string newpath = w->deliver(msgfd, (size_t)-1, false);
+    close(msgfd);
+
+    if (batch_.empty())
+      armed_ = true;
+    batch_.push_back(delivered{req, stamp, newpath, w});
+    if (batch_.size() >= batch_size_)
+      flush();
+  }
+
+  static void ticker(delivery_server *s)
+  {
+    s->tick();
+  }
+
+  void tick()
+  {
+    int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0)
+      edie("mail-deliver: socket failed");
+    while (!done_) {
+      usleep(window_usec_);
+      if (armed_.exchange(false))
+        if (sendto(fd, "FLUSH", 5, 0,
+                   (struct sockaddr*)&sun_, SUN_LEN(&sun_)) < 0)
+          edie("mail-deliver: send FLUSH failed");
+    }
+    close(fd);
+  }
+
+public:
+  delivery_server(const string &mailroot, const string &sockpath,
+                  const string &ackpath, size_t batch_size,
+                  unsigned window_usec)
+    : mailroot_(mailroot), batch_size_(batch_size ? batch_size : 1),
+      window_usec_(window_usec), armed_(false), done_(false)
+  {
+    sockfd_ = socket(AF_UNIX, SOCK_DGRAM, 0);
+    ackfd_ = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (sockfd_ < 0 || ackfd_ < 0)
+      edie("mail-deliver: socket failed");
+    bind_socket(sockfd_, sockpath, &sun_);
+
+    ack_sun_ = {};
+    ack_sun_.sun_family = AF_UNIX;
+    snprintf(ack_sun_.sun_path, sizeof ack_sun_.sun_path, "%s",
+             ackpath.c_str());
+  }
+
+  void run()
+  {
+    // mail-qman waits for this before sending requests, so none can
+    // arrive before we've bound the socket.
+    send_ack("READY", 5);
+
+    std::thread t;
+    if (window_usec_)
+      t = std::thread(ticker, this);
+
+    while (true) {
+      char buf[512];
+      ssize_t r = recv(sockfd_, buf, sizeof buf - 1, 0);
+      if (r < 0)
+        edie("mail-deliver: recv failed");
+      buf[r] = 0;
+      if (strcmp(buf, "FLUSH") == 0) {
+        flush();
+      } else if (strcmp(buf, "EXIT") == 0) {
+        flush();
+        break;
+      } else {
+        deliver(buf);
+      }
+    }
+
+    done_ = true;
+    if (window_usec_)
+      t.join();
+    unlink(sun_.sun_path);
+    send_ack("EXIT", 4);
+  }
+};
+
 static void
 usage(const char *argv0)
 {
   fprintf(stderr, "Usage: %s mailroot user <message\n", argv0);
   fprintf(stderr, "Usage: %s -b mailroot user <message-stream\n", argv0);
+  fprintf(stderr, "Usage: %s -s sockpath -a ackpath [-c cpu] [-n batch] "
+          "[-d usec] mailroot\n", argv0);
   fprintf(stderr, "\n");
   fprintf(stderr,
           "In batch mode, message-stream is a sequence of <u64 N><char[N]> and\n"
           "a <u64> return code will be written to stdout after every delivery.\n"
+          "\n"
+          "In server mode, deliver requests from sockpath until told to exit,\n"
+          "syncing every batch messages (default 16) or usec microseconds\n"
+          "(default 1000; 0 to sync only full batches), and acknowledge each\n"
+          "synced message to ackpath.\n"
     );
   exit(2);
 }
@@ -103,16 +337,47 @@ main(int argc, char **argv)
 {
   int opt;
   bool batch_mode = false;
-  while ((opt = getopt(argc, argv, "b")) != -1) {
+  const char *sockpath = nullptr, *ackpath = nullptr;
+  int cpu = -1;
+  size_t sync_batch = 16;
+  unsigned window_usec = 1000;
+  while ((opt = getopt(argc, argv, "bs:a:c:n:d:")) != -1) {
     switch (opt) {
     case 'b':
       batch_mode = true;
       break;
+    case 's':
+      sockpath = optarg;
+      break;
+    case 'a':
+      ackpath = optarg;
+      break;
+    case 'c':
+      cpu = atoi(optarg);
+      break;
+    case 'n':
+      sync_batch = atoi(optarg);
+      break;
+    case 'd':
+      window_usec = atoi(optarg);
+      break;
     default:
       usage(argv[0]);
     }
   }
 
+  if (sockpath) {
+    if (!ackpath || batch_mode || argc - optind != 1)
+      usage(argv[0]);
+    // Requests come from the mail-qman thread on this CPU.
+    if (cpu >= 0)
+      setaffinity(cpu);
+    delivery_server server{argv[optind], sockpath, ackpath, sync_batch,
+                           window_usec};
+    server.run();
+    return 0;
+  }
+
   if (argc - optind != 2)
     usage(argv[0]);
 
@@ -6,8 +6,11 @@
 // * todo/<message inumber> - envelope files
 // * notify - a UNIX socket that receives an <inumber> when a message
 //   is added to the spool
+// * worker<cpu>, ack<cpu> - with -w, the UNIX sockets for talking to
+//   the delivery worker on each CPU
 
 #include "libutil.h"
+#include "mailstamp.h"
 #include "shutil.h"
 #include "xsys.h"
 
@@ -24,6 +27,7 @@
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <vector>
 
 using std::string;
 using std::thread;
@@ -31,6 +35,8 @@ using std::thread;
 extern char **environ;
 
 static bool alt;
+static bool workers;
+static const char *sync_batch = "16", *window_usec = "1000";
 
 class spool_reader
 {
@@ -93,13 +99,17 @@ public:
     return res;
   }
 
+  string path(const string &name)
+  {
+    return spooldir_ + "/" + name;
+  }
+
   int open_message(const string &id)
   {
-    char path[256];
-    snprintf(path, sizeof path, "%s/mess/%s", spooldir_.c_str(), id.c_str());
-    int fd = open(path, O_RDONLY|O_CLOEXEC|(alt ? O_ANYFD : 0));
+    string p = path("mess/" + id);
+    int fd = open(p.c_str(), O_RDONLY|O_CLOEXEC|(alt ? O_ANYFD : 0));
     if (fd < 0)
-      edie("open %s failed", path);
+      edie("open %s failed", p.c_str());
     return fd;
   }
 
@@ -141,6 +151,57 @@ public:
   }
 };
 
+static pid_t
+start_child(const char *argv[], int stdin, int stdout)
+{
+  pid_t pid;
+#if defined(XV6_USER)
+  // xv6 doesn't define errno.
+  int errno = 0;
+#endif
+  if (alt) {
+    posix_spawn_file_actions_t actions;
+    if ((errno = posix_spawn_file_actions_init(&actions)))
+      edie("posix_spawn_file_actions_init failed");
+    if (stdin >= 0)
+      if ((errno = posix_spawn_file_actions_adddup2(&actions, stdin, 0)))
+        edie("posix_spawn_file_actions_adddup2 failed");
+    if (stdout >= 0)
+      if ((errno = posix_spawn_file_actions_adddup2(&actions, stdout, 1)))
+        edie("posix_spawn_file_actions_adddup2 failed");
+    if ((errno = posix_spawn(&pid, argv[0], &actions, nullptr,
+                             const_cast<char *const*>(argv), environ)))
+      edie("posix_spawn failed");
+    if ((errno = posix_spawn_file_actions_destroy(&actions)))
+      edie("posix_spawn_file_actions_destroy failed");
+  } else {
+    pid = fork();
+    if (pid < 0)
+      edie("fork failed");
+    if (pid == 0) {
+      // Note that this doesn't handle the case where stdin/stdout are
+      // 0/1 and have O_CLOEXEC set, but that never happens here.
+      if (stdin >= 0 && dup2(stdin, 0) < 0)
+        edie("dup2 stdin failed");
+      if (stdout >= 0 && dup2(stdout, 1) < 0)
+        edie("dup2 stdout failed");
+      execv(argv[0], const_cast<char *const*>(argv));
+      edie("execv %s failed", argv[0]);
+    }
+  }
+  return pid;
+}
+
+static void
+wait_child(pid_t pid)
+{
+  int status;
+  if (waitpid(pid, &status, 0) < 0)
+    edie("waitpid failed");
+  if (!WIFEXITED(status) || WEXITSTATUS(status))
+    die("deliver failed: status %d", status);
+}
+
 class deliverer
 {
   pid_t pid_;
@@ -149,44 +210,6 @@ class deliverer
   string pool_recipient_;
   int msgpipe[2], respipe[2];
 
-  void start_child(const char *argv[], int stdin, int stdout)
-  {
-#if defined(XV6_USER)
-    // xv6 doesn't define errno.
-    int errno = 0;
-#endif
-    if (alt) {
-      posix_spawn_file_actions_t actions;
-      if ((errno = posix_spawn_file_actions_init(&actions)))
-        edie("posix_spawn_file_actions_init failed");
-      if (stdin >= 0)
-        if ((errno = posix_spawn_file_actions_adddup2(&actions, stdin, 0)))
-          edie("posix_spawn_file_actions_adddup2 failed");
-      if (stdout >= 0)
-        if ((errno = posix_spawn_file_actions_adddup2(&actions, stdout, 1)))
-          edie("posix_spawn_file_actions_adddup2 failed");
-      if ((errno = posix_spawn(&pid_, argv[0], &actions, nullptr,
-                               const_cast<char *const*>(argv), environ)))
-        edie("posix_spawn failed");
-      if ((errno = posix_spawn_file_actions_destroy(&actions)))
-        edie("posix_spawn_file_actions_destroy failed");
-    } else {
-      pid_ = fork();
-      if (pid_ < 0)
-        edie("fork failed");
-      if (pid_ == 0) {
-        // Note that this doesn't handle the case where stdin/stdout are
-        // 0/1 and have O_CLOEXEC set, but that never happens here.
-        if (stdin >= 0 && dup2(stdin, 0) < 0)
-          edie("dup2 stdin failed");
-        if (stdout >= 0 && dup2(stdout, 1) < 0)
-          edie("dup2 stdout failed");
-        execv(argv[0], const_cast<char *const*>(argv));
-        edie("execv %s failed", argv[0]);
-      }
-    }
-  }
-
   void wait_child()
   {
     if (pool_) {
@@ -194,11 +217,7 @@ class deliverer
       close(respipe[0]);
     }
 
-    int status;
-    if (waitpid(pid_, &status, 0) < 0)
-      edie("waitpid failed");
-    if (!WIFEXITED(status) || WEXITSTATUS(status))
-      die("deliver failed: status %d", status);
+    ::wait_child(pid_);
     pid_ = 0;
   }
 
@@ -229,7 +248,7 @@ public:
           edie("pipe msgpipe failed");
         if (pipe2(respipe, O_CLOEXEC|O_ANYFD) < 0)
           edie("pipe respipe failed");
-        start_child(argv, msgpipe[0], respipe[1]);
+        pid_ = start_child(argv, msgpipe[0], respipe[1]);
         close(msgpipe[0]);
         close(respipe[1]);
       }
@@ -257,16 +276,148 @@ public:
     } else {
       const char *argv[] = {"./mail-deliver", mailroot_.c_str(),
                             recipient.c_str(), nullptr};
-      start_child(argv, msgfd, -1);
+      pid_ = start_child(argv, msgfd, -1);
       wait_child();
     }
   }
 };
 
+// A long-lived mail-deliver -s worker on one CPU.  Messages are handed
+// to it by name, so their contents don't cross the socket, and an ack
+// thread removes them from the spool once the worker reports that they
+// are durable.  The worker syncs messages in batches, so this doesn't
+// wait for each delivery.
+class delivery_worker
+{
+  spool_reader *spool_;
+  int cpu_;
+  string ackpath_;
+  int reqfd_, ackfd_;
+  struct sockaddr_un worker_sun_;
+  pid_t pid_;
+  thread acker_;
+  std::vector<uint64_t> *latencies_;
+
+  // Receive an ack into buf, which holds 1K, and NUL-terminate it.
+  // mail-deliver keeps each ack to 1023 bytes so the NUL fits.
+  void recv_ack(char *buf)
+  {
+    ssize_t r = recv(ackfd_, buf, 1023, 0);
+    if (r < 0)
+      edie("mail-qman: recv ack failed");
+    buf[r] = 0;
+  }
+
+  void send(const string &msg)
+  {
+    if (sendto(reqfd_, msg.data(), msg.size(), 0,
+               (struct sockaddr*)&worker_sun_, SUN_LEN(&worker_sun_)) < 0)
+      edie("mail-qman: send to mail-deliver failed");
+  }
+
+  static void ack_thread(delivery_worker *w)
+  {
+    w->do_acks();
+  }
+
+  // Each ack is a set of "<id> <latency usec>" lines.
+  void do_acks()
+  {
+    setaffinity(cpu_);
+    char buf[1024];
+    while (true) {
+      recv_ack(buf);
+      if (strcmp(buf, "EXIT") == 0)
+        return;
+      for (char *line = buf, *nl; (nl = strchr(line, '\n')); line = nl + 1) {
+        *nl = 0;
+        char *sp = strchr(line, ' ');
+        if (!sp)
+          die("mail-qman: bad ack from mail-deliver");
+        *sp = 0;
+        spool_->remove(line);
+        uint64_t latency = strtoul(sp + 1, nullptr, 10);
+        if (latency)
+          latencies_->push_back(latency);
+      }
+    }
+  }
+
+public:
+  delivery_worker(spool_reader *spool, const string &mailroot, int cpu,
+                  std::vector<uint64_t> *latencies)
+    : spool_(spool), cpu_(cpu), latencies_(latencies)
+  {
+    char name[32];
+    snprintf(name, sizeof name, "ack%d", cpu);
+    ackpath_ = spool->path(name);
+    snprintf(name, sizeof name, "worker%d", cpu);
+    string sockpath = spool->path(name);
+
+    ackfd_ = socket(AF_UNIX, SOCK_DGRAM, 0);
+    reqfd_ = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (ackfd_ < 0 || reqfd_ < 0)
+      edie("socket failed");
+    struct sockaddr_un sun{};
+    sun.sun_family = AF_UNIX;
+    snprintf(sun.sun_path, sizeof sun.sun_path, "%s", ackpath_.c_str());
+    unlink(sun.sun_path);
+    if (bind(ackfd_, (struct sockaddr*)&sun, SUN_LEN(&sun)) < 0)
+      edie("bind %s failed", ackpath_.c_str());
+    worker_sun_ = {};
+    worker_sun_.sun_family = AF_UNIX;
+    snprintf(worker_sun_.sun_path, sizeof worker_sun_.sun_path, "%s",
+             sockpath.c_str());
+
+    char cpu_str[16];
+    snprintf(cpu_str, sizeof cpu_str, "%d", cpu);
+    const char *argv[] = {"./mail-deliver", "-s", sockpath.c_str(),
+                          "-a", ackpath_.c_str(), "-c", cpu_str,
+                          "-n", sync_batch, "-d", window_usec,
+                          mailroot.c_str(), nullptr};
+    pid_ = start_child(argv, -1, -1);
+    char buf[1024];
+    recv_ack(buf);
+    if (strcmp(buf, "READY") != 0)
+      die("mail-qman: mail-deliver worker failed to start");
+    acker_ = thread(ack_thread, this);
+  }
+
+  ~delivery_worker()
+  {
+    // The worker syncs and acknowledges what it has before exiting.
+    send("EXIT");
+    acker_.join();
+    ::wait_child(pid_);
+    close(reqfd_);
+    close(ackfd_);
+    unlink(ackpath_.c_str());
+  }
+
+  void deliver(const string &id, const string &recipient)
+  {
+    send(id + " " + recipient + " " + spool_->path("mess/" + id));
+  }
+};
+
 static void
 do_process(spool_reader *spool, const string &mailroot, bool pool,
-           int nthread, int cpu)
+           int nthread, int cpu, std::vector<uint64_t> *latencies)
 {
+  if (workers) {
+    delivery_worker w{spool, mailroot, cpu, latencies};
+    while (true) {
+      string id = spool->dequeue();
+      if (id == "EXIT") {
+        spool->exit_others(cpu, nthread);
+        return;
+      }
+      if (id == "EXIT2")
+        return;
+      w.deliver(id, spool->get_recipient(id));
+    }
+  }
+
   deliverer d{mailroot, pool};
   while (true) {
     string id = spool->dequeue();
@@ -279,6 +430,9 @@ do_process(spool_reader *spool, const string &mailroot, bool pool,
     string recip = spool->get_recipient(id);
     int msgfd = spool->open_message(id);
     d.deliver(recip, msgfd);
+    uint64_t stamp = mailstamp_read(msgfd);
+    if (stamp)
+      latencies->push_back(now_usec() - stamp);
     close(msgfd);
     spool->remove(id);
   }
@@ -291,6 +445,10 @@ usage(const char *argv0)
   fprintf(stderr, "  -a none   Use regular APIs (default)\n");
   fprintf(stderr, "     all    Use alternate APIs\n");
   fprintf(stderr, "  -p        Use pooled mail-deliver\n");
+  fprintf(stderr, "  -w        Use a persistent mail-deliver worker per thread\n");
+  fprintf(stderr, "  -n N      With -w, sync deliveries in batches of N (default 16)\n");
+  fprintf(stderr, "  -d usec   With -w, sync a batch within usec (default 1000)\n");
+  fprintf(stderr, "  -l file   Write delivery latencies (u64 usec) to file\n");
   fprintf(stderr, "  -c cpu    Pin to cpu (nthread must be 1)\n");
   exit(2);
 }
@@ -301,7 +459,8 @@ main(int argc, char **argv)
   int opt;
   bool pool = false, do_pin = false;
   int cpuid = 0;
-  while ((opt = getopt(argc, argv, "a:pc:")) != -1) {
+  const char *latency_path = nullptr;
+  while ((opt = getopt(argc, argv, "a:pwn:d:l:c:")) != -1) {
     switch (opt) {
     case 'a':
       if (strcmp(optarg, "all") == 0)
@@ -314,6 +473,18 @@ main(int argc, char **argv)
     case 'p':
       pool = true;
       break;
+    case 'w':
+      workers = true;
+      break;
+    case 'n':
+      sync_batch = optarg;
+      break;
+    case 'd':
+      window_usec = optarg;
+      break;
+    case 'l':
+      latency_path = optarg;
+      break;
     case 'c':
       cpuid = atoi(optarg);
       do_pin = true;
@@ -342,16 +513,29 @@ main(int argc, char **argv)
   spool_reader reader{spooldir};
 
   thread *threads = new thread[nthread];
+  std::vector<uint64_t> *latencies = new std::vector<uint64_t>[nthread];
 
   for (int i = 0; i < nthread; ++i) {
     setaffinity(do_pin ? cpuid : i);
     threads[i] = std::move(thread(do_process, &reader, mailroot, pool,
-                                  nthread, do_pin ? cpuid : i));
+                                  nthread, do_pin ? cpuid : i,
+                                  &latencies[i]));
   }
 
   setaffinity(-1);
 
   for (int i = 0; i < nthread; ++i)
     threads[i].join();
+
+  if (latency_path) {
+    int fd = open(latency_path, O_CREAT|O_WRONLY|O_TRUNC, 0666);
+    if (fd < 0)
+      edie("open %s failed", latency_path);
+    for (int i = 0; i < nthread; ++i)
+      if (!latencies[i].empty())
+        xwrite(fd, latencies[i].data(),
+               latencies[i].size() * sizeof latencies[i][0]);
+    close(fd);
+  }
   return 0;
 }
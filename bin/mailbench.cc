@@ -2,6 +2,7 @@
 #include "distribution.hh"
 #include "spinbarrier.hh"
 #include "libutil.h"
+#include "mailstamp.h"
 #include "xsys.h"
 
 #include <fcntl.h>
@@ -13,6 +14,7 @@
 #include <sys/stat.h>
 #include <sys/wait.h>
 
+#include <algorithm>
 #include <string>
 #include <thread>
 #include <vector>
@@ -111,8 +113,8 @@ do_mua(int cpu, string spooldir, string msgpath, string* userdirs, int nusers,
   setaffinity(cpu);
 
   // Open message file (alternatively, we could use an open spawn
-  // action)
-  int msgfd = open(msgpath.c_str(), O_RDONLY|O_CLOEXEC|O_ANYFD);
+  // action).  It's ours alone, so we can restamp it for each message.
+  int msgfd = open(msgpath.c_str(), O_RDWR|O_CLOEXEC|O_ANYFD);
   if (msgfd < 0)
     edie("open %s failed", msgpath.c_str());
 
@@ -121,6 +123,7 @@ do_mua(int cpu, string spooldir, string msgpath, string* userdirs, int nusers,
   bool mywarmup = true;
   uint64_t mycount = 0;
   pid_t pid = 0;
+  char stamp[mailstamp_len + 1];
   int msgpipe[2], respipe[2];
 
   while (!stop) {
@@ -142,6 +145,7 @@ do_mua(int cpu, string spooldir, string msgpath, string* userdirs, int nusers,
       argv.push_back(userdirs[cpu].c_str());
     argv.push_back(nullptr);
 
+    mailstamp_make(stamp);
     if (pid == 0) {
       posix_spawn_file_actions_t actions;
       if ((errno = posix_spawn_file_actions_init(&actions)))
@@ -156,6 +160,8 @@ do_mua(int cpu, string spooldir, string msgpath, string* userdirs, int nusers,
         if ((errno = posix_spawn_file_actions_adddup2(&actions, respipe[1], 1)))
           edie("posix_spawn_file_actions_adddup2 respipe failed");
       } else {
+        if (pwrite(msgfd, stamp, mailstamp_len, 0) != mailstamp_len)
+          edie("pwrite stamp failed");
         if (lseek(msgfd, 0, SEEK_SET) < 0)
           edie("lseek failed");
         if ((errno = posix_spawn_file_actions_adddup2(&actions, msgfd, 0)))
@@ -175,9 +181,10 @@ do_mua(int cpu, string spooldir, string msgpath, string* userdirs, int nusers,
 
     if (batch_size) {
       // Send message in batch mode
-      uint64_t msg_len = strlen(message);
+      uint64_t msg_len = mailstamp_len + strlen(message);
       xwrite(msgpipe[1], &msg_len, sizeof msg_len);
-      xwrite(msgpipe[1], message, msg_len);
+      xwrite(msgpipe[1], stamp, mailstamp_len);
+      xwrite(msgpipe[1], message, msg_len - mailstamp_len);
 
       // Get batch-mode response
       uint64_t res;
@@ -208,6 +215,24 @@ do_mua(int cpu, string spooldir, string msgpath, string* userdirs, int nusers,
   count.add(mycount);
 }
 
+// Read the delivery latencies mail-qman wrote to path into out.
+static void
+read_latencies(const string &path, std::vector<uint64_t> *out)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+    edie("open %s failed", path.c_str());
+  uint64_t buf[512];
+  ssize_t r;
+  while ((r = read(fd, buf, sizeof buf)) > 0)
+    for (size_t i = 0; i < r / sizeof buf[0]; i++)
+      out->push_back(buf[i]);
+  if (r < 0)
+    edie("read %s failed", path.c_str());
+  close(fd);
+  unlink(path.c_str());
+}
+
 static void
 xmkdir(const string &d)
 {
@@ -251,6 +276,9 @@ usage(const char *argv0)
   fprintf(stderr, "     N      Spool in batches of size N\n");
   fprintf(stderr, "     inf    Spool in unbounded batches\n");
   fprintf(stderr, "  -p        Use delivery process pooling\n");
+  fprintf(stderr, "  -w        Use persistent delivery workers\n");
+  fprintf(stderr, "  -n N      With -w, sync deliveries in batches of N\n");
+  fprintf(stderr, "  -d usec   With -w, sync a batch within usec\n");
   fprintf(stderr, "  -c        Use nthreads spool directories\n");
   fprintf(stderr, "  -u N      Use N user mailboxes (N should be between 1 and 1000)\n");
   fprintf(stderr, "  -r        Pick users at random for message delivery\n");
@@ -270,12 +298,14 @@ main(int argc, char **argv)
   size_t batch_size = 0;
   bool verbose = false;
   bool pool = false;
+  bool workers = false;
+  const char *sync_batch = "16", *window_usec = "1000";
   bool percpu_spooldirs = false;
   bool random_order = false;
   int nusers = 1;
   bool do_warmup = true;
   int opt;
-  while ((opt = getopt(argc, argv, "a:b:pcru:vW")) != -1) {
+  while ((opt = getopt(argc, argv, "a:b:pwn:d:cru:vW")) != -1) {
     switch (opt) {
     case 'a':
       alt_str = optarg;
@@ -289,6 +319,15 @@ main(int argc, char **argv)
     case 'p':
       pool = true;
       break;
+    case 'w':
+      workers = true;
+      break;
+    case 'n':
+      sync_batch = optarg;
+      break;
+    case 'd':
+      window_usec = optarg;
+      break;
     case 'c':
       percpu_spooldirs = true;
       break;
@@ -358,12 +397,25 @@ main(int argc, char **argv)
   sync();
 
   pid_t qman_pid[128];
+  string latency_paths[128];
   if (START_QMAN) {
     for (int i = 0; i < nthreads; i++) {
       // Start queue manager
       std::vector<const char*> qman{"./mail-qman", "-a", alt_str};
       if (pool)
         qman.push_back("-p");
+      if (workers) {
+        qman.push_back("-w");
+        qman.push_back("-n");
+        qman.push_back(sync_batch);
+        qman.push_back("-d");
+        qman.push_back(window_usec);
+      }
+      char lat_str[32];
+      snprintf(lat_str, sizeof(lat_str), "/latency%d", i);
+      latency_paths[i] = basedir + lat_str;
+      qman.push_back("-l");
+      qman.push_back(latency_paths[i].c_str());
 
       if (percpu_spooldirs) {
         char cpu_str[32];
@@ -393,12 +445,21 @@ main(int argc, char **argv)
     }
   }
 
-  // Write message to a file
-  int fd = open((basedir + "/msg").c_str(), O_CREAT|O_WRONLY, 0666);
-  if (fd < 0)
-    edie("open");
-  xwrite(fd, message, strlen(message));
-  close(fd);
+  // Write message to a file for each thread, leaving room for the stamp
+  string msgpaths[128];
+  char stamp[mailstamp_len + 1];
+  mailstamp_make(stamp);
+  for (int i = 0; i < nthreads; ++i) {
+    char str[32];
+    snprintf(str, sizeof(str), "/msg%d", i);
+    msgpaths[i] = basedir + str;
+    int fd = open(msgpaths[i].c_str(), O_CREAT|O_WRONLY, 0666);
+    if (fd < 0)
+      edie("open");
+    xwrite(fd, stamp, mailstamp_len);
+    xwrite(fd, message, strlen(message));
+    close(fd);
+  }
 
   printf("# --cores=%d --duration=%ds --alt=%s",
          nthreads, duration, alt_str);
@@ -406,7 +467,12 @@ main(int argc, char **argv)
     printf(" --batch-size=inf");
   else
     printf(" --batch-size=%zu", batch_size);
-  printf(" --pool=%s\n", pool ? "true" : "false");
+  printf(" --pool=%s", pool ? "true" : "false");
+  if (workers)
+    printf(" --workers=true --sync-batch=%s --window=%susec\n",
+           sync_batch, window_usec);
+  else
+    printf(" --workers=false\n");
 
   // Run benchmark
   bar.init(nthreads + 1);
@@ -416,7 +482,7 @@ main(int argc, char **argv)
   std::thread *threads = new std::thread[nthreads];
   for (int i = 0; i < nthreads; ++i)
     threads[i] = std::thread(do_mua, i, percpu_spooldirs ? spooldirs[i] : spooldirs[0],
-                             basedir + "/msg", userdirs, nusers, random_order, batch_size,
+                             msgpaths[i], userdirs, nusers, random_order, batch_size,
                              verbose);
 
   // Wait
@@ -424,6 +490,10 @@ main(int argc, char **argv)
   for (int i = 0; i < nthreads; ++i)
     threads[i].join();
 
+  // qman delivers everything queued before it exits, so once it has,
+  // every message has made it from end to end.
+  uint64_t delivered_usec = 0;
+  std::vector<uint64_t> latencies;
   if (START_QMAN) {
     for (int i = 0; i < nthreads; i++) {
       // Kill qman and wait for it to exit
@@ -443,6 +513,14 @@ main(int argc, char **argv)
 
     // Break the affinity
     setaffinity(-1);
+    delivered_usec = now_usec();
+
+    for (int i = 0; i < nthreads; i++) {
+      read_latencies(latency_paths[i], &latencies);
+      if (!percpu_spooldirs)
+        break;
+    }
+    std::sort(latencies.begin(), latencies.end());
   }
 
   // Summarize
@@ -458,6 +536,17 @@ main(int argc, char **argv)
     printf("%lu cycles/message\n",
            (stop_tsc.sum() - start_tsc.sum()) / messages);
     printf("%lu messages/sec\n", messages * 1000000 / usec);
+    if (delivered_usec)
+      printf("%lu delivered messages/sec\n",
+             messages * 1000000 / (delivered_usec - start_usec.mean()));
+  }
+  if (!latencies.empty()) {
+    // These include messages queued during warmup.
+    size_t n = latencies.size();
+    printf("%lu usec p50 latency\n", latencies[n / 2]);
+    printf("%lu usec p90 latency\n", latencies[n * 9 / 10]);
+    printf("%lu usec p99 latency\n", latencies[n * 99 / 100]);
+    printf("%lu usec max latency\n", latencies[n - 1]);
   }
 
   printf("\n");
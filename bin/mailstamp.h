@@ -0,0 +1,39 @@
+#pragma once
+
+// mailbench starts each message it sends with a header giving the time
+// it queued the message, so the delivery side can report end-to-end
+// latencies.  The stamp has a fixed width, so it can be rewritten in
+// place.
+
+#include "libutil.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAILSTAMP_HDR "X-Mailbench-Queued: "
+enum { mailstamp_len = sizeof(MAILSTAMP_HDR) - 1 + 20 + 1 };
+
+// Fill buf, which must hold mailstamp_len + 1 bytes, with a stamp for
+// now.
+static inline void
+mailstamp_make(char *buf)
+{
+  snprintf(buf, mailstamp_len + 1, MAILSTAMP_HDR "%020lu\n",
+           (unsigned long)now_usec());
+}
+
+// Return the stamp at the start of message fd, or 0 if it has none.
+// This doesn't move fd's offset.
+static inline uint64_t
+mailstamp_read(int fd)
+{
+  char buf[mailstamp_len + 1];
+  if (pread(fd, buf, mailstamp_len, 0) != mailstamp_len)
+    return 0;
+  buf[mailstamp_len] = 0;
+  if (strncmp(buf, MAILSTAMP_HDR, sizeof(MAILSTAMP_HDR) - 1) != 0)
+    return 0;
+  return strtoul(buf + sizeof(MAILSTAMP_HDR) - 1, nullptr, 10);
+}
@@ -5,7 +5,10 @@
 #include "uspinlock.h"
 #include "pthread.h"
 
+#include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
 #include <sys/mman.h>
 
 static volatile char *p;
@@ -48,9 +51,61 @@ thr(void*)
   }
 }
 
+// Stores through a shared file mapping reach the file on msync, and
+// stores made after an msync are caught again by the next one.
+static void
+msynctest(void)
+{
+  char buf[2 * 4096];
+  int fd = open("maptest.msync", O_CREAT|O_RDWR|O_TRUNC, 0666);
+  if (fd < 0)
+    die("msync: open failed");
+  memset(buf, 0, sizeof(buf));
+  if (write(fd, buf, sizeof(buf)) != sizeof(buf))
+    die("msync: write failed");
+
+  char *m = (char*)mmap(nullptr, sizeof(buf), PROT_READ|PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+  if (m == MAP_FAILED)
+    die("msync: mmap failed");
+
+  m[0] = 'a';
+  m[4096 + 1] = 'b';
+  if (msync(m, sizeof(buf), MS_SYNC) < 0)
+    die("msync: MS_SYNC failed");
+  if (pread(fd, buf, sizeof(buf), 0) != sizeof(buf) ||
+      buf[0] != 'a' || buf[4096 + 1] != 'b')
+    die("msync: file doesn't have the mapped writes");
+
+  m[2] = 'c';
+  if (msync(m, 4096, MS_ASYNC) < 0)
+    die("msync: MS_ASYNC failed");
+  if (pread(fd, buf, 4, 0) != 4 || buf[2] != 'c')
+    die("msync: file doesn't have the second write");
+
+  if (msync(m + 1, 4096, MS_SYNC) >= 0)
+    die("msync: unaligned address accepted");
+  if (msync(m, 4096, MS_SYNC|MS_ASYNC) >= 0)
+    die("msync: MS_SYNC|MS_ASYNC accepted");
+  munmap(m, sizeof(buf));
+  if (msync(m, 4096, MS_SYNC) >= 0)
+    die("msync: unmapped range accepted");
+
+  // The last writes also survive unmapping and reopening.
+  close(fd);
+  fd = open("maptest.msync", O_RDONLY);
+  if (fd < 0 || pread(fd, buf, 4, 0) != 4 || buf[0] != 'a' || buf[2] != 'c')
+    die("msync: reopened file lost the mapped writes");
+  close(fd);
+  unlink("maptest.msync");
+  printf("msync ok\n");
+}
+
 int
 main(void)
 {
+  msynctest();
+
   p = (char *) 0x80000;
   if (mmap((void *) p, 8192, PROT_READ|PROT_WRITE,
            MAP_PRIVATE|MAP_FIXED|MAP_ANONYMOUS, -1, 0) < 0) {
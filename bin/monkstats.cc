@@ -1,3 +1,12 @@
+// Report kernel statistics (/dev/kstats).
+//
+//   monkstats command...   Run command and print how the kstats changed.
+//   monkstats -i ms        Every ms milliseconds, print the kstats that
+//                          changed since the last sample.
+//
+// Both read kstats through a read-only mapping of /dev/kstats, so taking
+// a sample needs no system calls.
+
 #include "types.h"
 #include "user.h"
 #include "kstats.hh"
@@ -5,29 +14,89 @@
 
 #include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 
 #include <vector>
 
+static const kstats_header *hdr;
+
 static void
-read_kstats(kstats *out)
+map_kstats(void)
 {
   int fd = open("/dev/kstats", O_RDONLY);
   if (fd < 0)
     die("Couldn't open /dev/kstats");
-  int r = xread(fd, out, sizeof *out);
-  if (r != sizeof *out)
-    die("Short read from /dev/kstats");
+  hdr = (const kstats_header*)mmap(nullptr, 4096, PROT_READ, MAP_SHARED,
+                                   fd, 0);
+  if (hdr == MAP_FAILED)
+    die("Couldn't mmap /dev/kstats");
+  if (hdr->magic != KSTATS_MAGIC || hdr->layout != KSTATS_LAYOUT)
+    die("/dev/kstats has a different layout; rebuild monkstats");
+
+  size_t len = hdr->cpu_offset + hdr->ncpu * hdr->cpu_stride;
+  munmap((void*)hdr, 4096);
+  hdr = (const kstats_header*)mmap(nullptr, len, PROT_READ, MAP_SHARED,
+                                   fd, 0);
+  if (hdr == MAP_FAILED)
+    die("Couldn't mmap /dev/kstats");
   close(fd);
 }
 
+static void
+read_kstats(kstats *out)
+{
+  *out = kstats{};
+  for (size_t i = 0; i < hdr->ncpu; i++)
+    *out += *(const kstats*)((const char*)hdr + hdr->cpu_offset +
+                             i * hdr->cpu_stride);
+}
+
+static void
+print_kstats(const kstats &k, bool changed_only)
+{
+  // XXX Assumes uint64_t.  Use to_stream instead.
+  // XXX Would be nice if this knew what fields were relative to other
+  // fields and could divide them for you.
+#define X(type, name)                                   \
+  if (!changed_only || k.name)                          \
+    printf("%lu " #name "\n", k.name);
+  KSTATS_ALL(X);
+#undef X
+  printf("\n");
+}
+
+static void
+usage(const char *argv0)
+{
+  die("usage: %s command...\n"
+      "       %s -i ms", argv0, argv0);
+}
+
 int
 main(int ac, char * const av[])
 {
   struct kstats kstats_before, kstats_after;
 
   if (ac <= 1)
-    die("usage: %s command...", av[0]);
+    usage(av[0]);
+
+  map_kstats();
+
+  if (strcmp(av[1], "-i") == 0) {
+    if (ac != 3 || atoi(av[2]) <= 0)
+      usage(av[0]);
+    int ms = atoi(av[2]);
+    read_kstats(&kstats_before);
+    for (;;) {
+      usleep(ms * 1000);
+      read_kstats(&kstats_after);
+      print_kstats(kstats_after - kstats_before, true);
+      kstats_before = kstats_after;
+    }
+  }
 
   read_kstats(&kstats_before);
 
@@ -46,14 +115,6 @@ main(int ac, char * const av[])
 
   read_kstats(&kstats_after);
 
-  struct kstats kstats = kstats_after - kstats_before;
-
-  // XXX Assumes uint64_t.  Use to_stream instead.
-  // XXX Would be nice if this knew what fields were relative to other
-  // fields and could divide them for you.
-#define X(type, name) printf("%lu " #name "\n", kstats.name);
-  KSTATS_ALL(X);
-#undef X
-  printf("\n");
+  print_kstats(kstats_after - kstats_before, false);
   return 0;
 }
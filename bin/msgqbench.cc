@@ -0,0 +1,312 @@
+// Compare message-passing IPC between two processes: msgq (shared-memory
+// rings with futex wakeups), pipes, and local datagram sockets.  For each
+// transport, measure round-trip latency (ping-pong) and one-way throughput
+// (the child streams messages to the parent).
+
+#include "types.h"
+#include "user.h"
+#include "amd64.h"
+#include "msgq.hh"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#define SOCK_PARENT "/msgqbench.p"
+#define SOCK_CHILD  "/msgqbench.c"
+
+static int iters = 100000;
+static size_t msglen = 64;
+
+// A bidirectional channel between the parent and a child, so the
+// benchmarks don't care which transport is underneath.
+struct chan
+{
+  virtual ~chan() { }
+  virtual void child_side() { }
+  virtual void parent_side() { }
+  virtual void send(const char *buf, size_t len) = 0;
+  virtual void recv(char *buf, size_t len) = 0;
+};
+
+struct msgq_chan : public chan
+{
+  int fd;
+  msgq *q;
+
+  msgq_chan() : q(nullptr)
+  {
+    fd = msgq::create(256, msglen);
+    if (fd < 0)
+      die("msgq::create");
+  }
+
+  ~msgq_chan()
+  {
+    delete q;
+    close(fd);
+  }
+
+  void attach(int side)
+  {
+    q = msgq::attach(fd, side);
+    if (!q)
+      die("msgq::attach");
+  }
+
+  void child_side() override { attach(1); }
+  void parent_side() override { attach(0); }
+
+  void send(const char *buf, size_t len) override
+  {
+    if (q->send(buf, len) < 0)
+      die("msgq send");
+  }
+
+  void recv(char *buf, size_t len) override
+  {
+    if (q->recv(buf, len) < 0)
+      die("msgq recv");
+  }
+};
+
+struct pipe_chan : public chan
+{
+  int down[2], up[2];
+  int rfd, wfd;
+
+  pipe_chan()
+  {
+    if (pipe(down) < 0 || pipe(up) < 0)
+      die("pipe");
+  }
+
+  ~pipe_chan()
+  {
+    close(rfd);
+    close(wfd);
+  }
+
+  void child_side() override
+  {
+    close(down[1]);
+    close(up[0]);
+    rfd = down[0];
+    wfd = up[1];
+  }
+
+  void parent_side() override
+  {
+    close(down[0]);
+    close(up[1]);
+    rfd = up[0];
+    wfd = down[1];
+  }
+
+  void send(const char *buf, size_t len) override
+  {
+    if (write(wfd, buf, len) != len)
+      die("pipe write");
+  }
+
+  void recv(char *buf, size_t len) override
+  {
+    for (size_t n = 0; n < len; ) {
+      ssize_t r = read(rfd, buf + n, len - n);
+      if (r <= 0)
+        die("pipe read");
+      n += r;
+    }
+  }
+};
+
+struct sock_chan : public chan
+{
+  int psock, csock;
+  int sock;
+  struct sockaddr_un peer;
+
+  static int bound(const char *path)
+  {
+    struct sockaddr_un name;
+    int s = socket(AF_LOCAL, SOCK_DGRAM, 0);
+    if (s < 0)
+      die("socket");
+    unlink(path);
+    name.sun_family = AF_LOCAL;
+    strncpy(name.sun_path, path, sizeof(name.sun_path));
+    name.sun_path[sizeof(name.sun_path) - 1] = '\0';
+    if (bind(s, (struct sockaddr *)&name, SUN_LEN(&name)) < 0)
+      die("bind %s", path);
+    return s;
+  }
+
+  sock_chan()
+  {
+    psock = bound(SOCK_PARENT);
+    csock = bound(SOCK_CHILD);
+  }
+
+  ~sock_chan()
+  {
+    close(sock);
+    unlink(SOCK_PARENT);
+    unlink(SOCK_CHILD);
+  }
+
+  void side(int mine, int other, const char *peerpath)
+  {
+    close(other);
+    sock = mine;
+    peer.sun_family = AF_LOCAL;
+    strcpy(peer.sun_path, peerpath);
+  }
+
+  void child_side() override { side(csock, psock, SOCK_PARENT); }
+  void parent_side() override { side(psock, csock, SOCK_CHILD); }
+
+  void send(const char *buf, size_t len) override
+  {
+    if (sendto(sock, buf, len, 0, (struct sockaddr *)&peer,
+               SUN_LEN(&peer)) != len)
+      die("sendto");
+  }
+
+  void recv(char *buf, size_t len) override
+  {
+    if (recvfrom(sock, buf, len, 0, nullptr, 0) != len)
+      die("recvfrom");
+  }
+};
+
+// Run child in a forked process and parent here; return the parent's
+// elapsed nanoseconds.
+static u64
+run(chan *c, void (*child)(chan*, char*), void (*parent)(chan*, char*))
+{
+  char *buf = (char*)malloc(msglen);
+  memset(buf, 'x', msglen);
+
+  int pid = fork();
+  if (pid < 0)
+    die("fork");
+  if (pid == 0) {
+    c->child_side();
+    child(c, buf);
+    exit(0);
+  }
+
+  c->parent_side();
+  u64 start = time_nsec();
+  parent(c, buf);
+  u64 ns = time_nsec() - start;
+  wait(NULL);
+  free(buf);
+  return ns;
+}
+
+static void
+echo_child(chan *c, char *buf)
+{
+  for (int i = 0; i < iters; i++) {
+    c->recv(buf, msglen);
+    c->send(buf, msglen);
+  }
+}
+
+static void
+pingpong_parent(chan *c, char *buf)
+{
+  for (int i = 0; i < iters; i++) {
+    c->send(buf, msglen);
+    c->recv(buf, msglen);
+  }
+}
+
+static void
+stream_child(chan *c, char *buf)
+{
+  for (int i = 0; i < iters; i++)
+    c->send(buf, msglen);
+}
+
+static void
+stream_parent(chan *c, char *buf)
+{
+  for (int i = 0; i < iters; i++)
+    c->recv(buf, msglen);
+}
+
+template<class C>
+static void
+bench(const char *name)
+{
+  C *c = new C();
+  u64 ns = run(c, echo_child, pingpong_parent);
+  delete c;
+  printf("%-6s pingpong %lu ns/roundtrip\n", name, ns / iters);
+
+  c = new C();
+  ns = run(c, stream_child, stream_parent);
+  delete c;
+  printf("%-6s stream   %lu msgs/sec\n", name,
+         ns ? (u64)iters * 1000000000 / ns : 0);
+}
+
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-n iters] [-s msgsize] [msgq|pipe|sock]...\n",
+          argv0);
+  exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  int opt;
+  while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+    switch (opt) {
+    case 'n':
+      iters = atoi(optarg);
+      break;
+    case 's':
+      msglen = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (iters <= 0 || msglen == 0)
+    usage(argv[0]);
+
+  printf("# iters=%d msgsize=%lu\n", iters, msglen);
+
+  bool all = optind == argc;
+  for (int i = optind; i < argc; i++)
+    if (strcmp(argv[i], "msgq") && strcmp(argv[i], "pipe") &&
+        strcmp(argv[i], "sock"))
+      usage(argv[0]);
+
+  auto want = [&](const char *name) {
+    if (all)
+      return true;
+    for (int i = optind; i < argc; i++)
+      if (strcmp(argv[i], name) == 0)
+        return true;
+    return false;
+  };
+
+  if (want("msgq"))
+    bench<msgq_chan>("msgq");
+  if (want("pipe"))
+    bench<pipe_chan>("pipe");
+  if (want("sock"))
+    bench<sock_chan>("sock");
+  return 0;
+}
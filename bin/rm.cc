@@ -1,51 +1,39 @@
 #include "types.h"
 #include "user.h"
-#include "fs.h"                 // DIRSIZ
 #include "libutil.h"
 
 #include <fcntl.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
-#include <string>
-#include <vector>
+#include "treewalk.hh"
 
-using std::string;
-using std::vector;
-
-static void
-rmtree(const char *base)
+// rm -r: unlink files as they're found and directories once everything
+// below them has been unlinked.
+class rm_walk : public treewalk
 {
-  struct stat st;
-  if (lstat(base, &st) < 0)
-    edie("rm: failed to stat %s", base);
-  if ((st.st_mode & S_IFMT) == S_IFDIR) {
-    // Get all directory entries
-    vector<string> names;
-    int fd = open(base, O_RDONLY);
-    if (fd < 0)
-      edie("rm: failed to open %s", base);
-    char buf[DIRSIZ];
-    char *prev = nullptr;
-    while (true) {
-      int r = readdir(fd, prev, buf);
-      prev = buf;
-      if (r < 0)
-        edie("rm: failed to readdir %s", base);
-      if (r == 0)
-        break;
-      if (strcmp(buf, ".") == 0 || strcmp(buf, "..") == 0)
-        continue;
-      names.push_back(string(base).append("/").append(buf));
-    }
-    close(fd);
-    // Delete children
-    for (auto &name : names)
-      rmtree(name.c_str());
+protected:
+  bool visit(int thread, const entry &e) override
+  {
+    if (S_ISDIR(e.st.st_mode))
+      return true;
+    if (unlink(e.path) < 0)
+      edie("rm: failed to unlink %s", e.path);
+    return false;
   }
-  if (unlink(base) < 0)
-    edie("rm: failed to unlink %s", base);
-}
+
+  void leave(int thread, const entry &dir) override
+  {
+    if (unlink(dir.path) < 0)
+      edie("rm: failed to unlink %s", dir.path);
+  }
+
+  void error(int thread, const char *path) override
+  {
+    edie("rm: failed to read %s", path);
+  }
+};
 
 int
 main(int argc, char *argv[])
@@ -64,7 +52,7 @@ main(int argc, char *argv[])
 
   for(i = 1; i < argc; i++){
     if (recursive)
-      rmtree(argv[i]);
+      rm_walk().run(argv[i], treewalk::default_threads());
     else if(unlink(argv[i]) < 0)
       die("rm: %s failed to delete\n", argv[i]);
   }
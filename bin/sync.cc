@@ -1,8 +1,28 @@
+// Usage: sync [path...]
+//
+// With no arguments, write back everything.  Otherwise write back just
+// the subtrees rooted at each path (see syncfs).
+
+#include <fcntl.h>
 #include <unistd.h>
 
+#include "libutil.h"
+
 int
 main(int argc, char *argv[])
 {
-  sync();
+  if (argc < 2) {
+    sync();
+    return 0;
+  }
+
+  for (int i = 1; i < argc; i++) {
+    int fd = open(argv[i], O_RDONLY);
+    if (fd < 0)
+      die("sync: cannot open %s", argv[i]);
+    if (syncfs(fd) < 0)
+      die("sync: syncfs %s failed", argv[i]);
+    close(fd);
+  }
   return 0;
 }
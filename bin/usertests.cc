@@ -14,6 +14,10 @@
 #include <setjmp.h>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
 
 #include <utility>
 
@@ -265,9 +269,9 @@ preempt(void)
   }
   close(pfds[0]);
   printf("kill... ");
-  kill(pid1);
-  kill(pid2);
-  kill(pid3);
+  kill(pid1, SIGKILL);
+  kill(pid2, SIGKILL);
+  kill(pid3, SIGKILL);
   printf("wait... ");
   wait(NULL);
   wait(NULL);
@@ -299,6 +303,79 @@ exitwait(void)
   printf("exitwait ok\n");
 }
 
+// waitpid with WNOHANG returns 0 while matching children are still
+// running and reaps each exited child exactly once.
+void
+waitnohang(void)
+{
+  enum { nchild = 5 };
+  int pfd[2], pid, status;
+  char c;
+
+  printf("waitnohang\n");
+
+  if (waitpid(-1, &status, WNOHANG) != -1)
+    die("waitnohang: waitpid with no children didn't fail");
+
+  if (pipe(pfd) < 0)
+    die("waitnohang: pipe failed");
+  pid = fork();
+  if (pid < 0)
+    die("waitnohang: fork failed");
+  if (pid == 0) {
+    close(pfd[1]);
+    read(pfd[0], &c, 1);
+    exit(3);
+  }
+  close(pfd[0]);
+
+  if (waitpid(pid, &status, WNOHANG) != 0)
+    die("waitnohang: running child reaped by pid");
+  if (waitpid(-1, &status, WNOHANG) != 0)
+    die("waitnohang: running child reaped by -1");
+  if (waitpid(getpid(), &status, WNOHANG) != -1)
+    die("waitnohang: waitpid on a non-child didn't fail");
+
+  close(pfd[1]);
+  int r;
+  while ((r = waitpid(pid, &status, WNOHANG)) == 0)
+    usleep(1000);
+  if (r != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 3)
+    die("waitnohang: waitpid returned %d status %d", r, status);
+  if (waitpid(pid, &status, WNOHANG) != -1)
+    die("waitnohang: child reaped twice");
+
+  // Every exited child shows up once through waitpid(-1, WNOHANG).
+  int pids[nchild];
+  for (int i = 0; i < nchild; i++) {
+    pids[i] = fork();
+    if (pids[i] < 0)
+      die("waitnohang: fork failed");
+    if (pids[i] == 0)
+      exit(i);
+  }
+  for (int left = nchild; left; ) {
+    r = waitpid(-1, &status, WNOHANG);
+    if (r < 0)
+      die("waitnohang: lost %d children", left);
+    if (r == 0) {
+      usleep(1000);
+      continue;
+    }
+    int i;
+    for (i = 0; i < nchild && pids[i] != r; i++)
+      ;
+    if (i == nchild || WEXITSTATUS(status) != i)
+      die("waitnohang: unexpected pid %d status %d", r, status);
+    pids[i] = 0;
+    left--;
+  }
+  if (waitpid(-1, &status, WNOHANG) != -1)
+    die("waitnohang: extra child reaped");
+
+  printf("waitnohang ok\n");
+}
+
 void
 killtest(void)
 {
@@ -326,7 +403,7 @@ killtest(void)
     return;
   }
   sleep(1);
-  kill(pid);
+  kill(pid, SIGKILL);
   sleep(1);
   if(wait(NULL) < 0)
     die("wait should have return the killed child");
@@ -381,7 +458,7 @@ mem(void)
     m1 = malloc(1024*20);
     if(m1 == 0){
       printf("couldn't allocate mem?!!\n");
-      kill(ppid);
+      kill(ppid, SIGKILL);
       exit(0);
     }
     free(m1);
@@ -1323,7 +1400,7 @@ sbrktest(void)
     if(pid < 0)
       die("fork failed");
     if(pid == 0)
-      kill(ppid);
+      kill(ppid, SIGKILL);
       die("oops could read %x = %x", a, *a);
     }
   wait(NULL);
@@ -1352,7 +1429,7 @@ sbrktest(void)
   for(i = 0; i < sizeof(pids)/sizeof(pids[0]); i++){
     if(pids[i] == -1)
       continue;
-    kill(pids[i]);
+    kill(pids[i], SIGKILL);
     wait(NULL);
   }
   if(c == (char*)0xffffffff)
@@ -1385,7 +1462,7 @@ validatetest(void)
     }
     nsleep(0);
     nsleep(0);
-    kill(pid);
+    kill(pid, SIGKILL);
     wait(NULL);
 
     // try to crash the kernel by passing in a bad string pointer
@@ -1443,6 +1520,218 @@ sigtest(void)
   fprintf(stderr, "sigtest ok\n");
 }
 
+static volatile int sigq_signo, sigq_value, sigq_code, sigq_nested;
+static volatile sigset_t sigq_mask;
+
+static void
+sigqhand(int signo, siginfo_t *info, void *ctx)
+{
+  sigset_t mask;
+  sigq_signo = signo;
+  sigq_value = info->si_value.sival_int;
+  sigq_code = info->si_code;
+  if (sigprocmask(SIG_BLOCK, nullptr, &mask) < 0)
+    die("sigqhand: sigprocmask failed");
+  sigq_mask = mask;
+  sigq_nested++;
+}
+
+// rt_sigaction, rt_sigprocmask, rt_sigqueueinfo, rt_sigtimedwait and
+// signalfd, and handler return through sigreturn.
+void
+sigqueuetest(void)
+{
+  struct sigaction sa, osa;
+  sigset_t set, old;
+  siginfo_t info;
+  struct timespec zero = { 0, 0 };
+
+  printf("sigqueuetest\n");
+
+  // A queued signal runs its SA_SIGINFO handler with the signal
+  // blocked, and returning from the handler restores the mask.
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_sigaction = sigqhand;
+  sa.sa_flags = SA_SIGINFO;
+  if (sigaction(SIGUSR1, &sa, nullptr) < 0)
+    die("sigqueuetest: sigaction failed");
+  if (sigaction(SIGUSR1, nullptr, &osa) < 0 || osa.sa_sigaction != sigqhand)
+    die("sigqueuetest: sigaction did not return the handler");
+  if (sigprocmask(SIG_BLOCK, nullptr, &old) < 0)
+    die("sigqueuetest: sigprocmask failed");
+
+  union sigval v;
+  v.sival_int = 42;
+  if (sigqueue(getpid(), SIGUSR1, v) < 0)
+    die("sigqueuetest: sigqueue failed");
+  if (sigq_nested != 1 || sigq_signo != SIGUSR1)
+    die("sigqueuetest: handler ran %d times, signal %d",
+        sigq_nested, sigq_signo);
+  if (sigq_value != 42 || sigq_code != SI_QUEUE)
+    die("sigqueuetest: handler got value %d code %d",
+        sigq_value, sigq_code);
+  if (!sigismember((sigset_t*)&sigq_mask, SIGUSR1))
+    die("sigqueuetest: SIGUSR1 not blocked in its handler");
+  if (sigprocmask(SIG_BLOCK, nullptr, &set) < 0 || set != old)
+    die("sigqueuetest: mask not restored after the handler");
+
+  // Blocked real-time signals queue one entry each and sigtimedwait
+  // takes them in order.
+  sigemptyset(&set);
+  sigaddset(&set, SIGRTMIN);
+  sigaddset(&set, SIGUSR2);
+  if (sigprocmask(SIG_BLOCK, &set, nullptr) < 0)
+    die("sigqueuetest: sigprocmask block failed");
+  for (int i = 1; i <= 3; i++) {
+    v.sival_int = i;
+    if (sigqueue(getpid(), SIGRTMIN, v) < 0)
+      die("sigqueuetest: sigqueue %d failed", i);
+  }
+  if (sigq_nested != 1)
+    die("sigqueuetest: blocked signal ran its handler");
+  for (int i = 1; i <= 3; i++) {
+    if (sigtimedwait(&set, &info, &zero) != SIGRTMIN)
+      die("sigqueuetest: sigtimedwait %d failed", i);
+    if (info.si_value.sival_int != i || info.si_pid != getpid())
+      die("sigqueuetest: sigtimedwait %d got value %d pid %d",
+          i, info.si_value.sival_int, info.si_pid);
+  }
+  if (sigtimedwait(&set, &info, &zero) >= 0)
+    die("sigqueuetest: sigtimedwait found a signal in an empty queue");
+
+  // A signalfd dequeues blocked signals in its mask.
+  sigemptyset(&set);
+  sigaddset(&set, SIGUSR2);
+  int fd = signalfd(-1, &set, SFD_NONBLOCK);
+  if (fd < 0)
+    die("sigqueuetest: signalfd failed");
+  struct signalfd_siginfo ssi;
+  if (read(fd, &ssi, sizeof(ssi)) >= 0)
+    die("sigqueuetest: empty signalfd read succeeded");
+  v.sival_int = 7;
+  if (sigqueue(getpid(), SIGUSR2, v) < 0)
+    die("sigqueuetest: sigqueue SIGUSR2 failed");
+  if (read(fd, &ssi, sizeof(ssi)) != sizeof(ssi))
+    die("sigqueuetest: signalfd read failed");
+  if (ssi.ssi_signo != SIGUSR2 || ssi.ssi_int != 7 ||
+      ssi.ssi_code != SI_QUEUE)
+    die("sigqueuetest: signalfd read signal %d value %d code %d",
+        ssi.ssi_signo, ssi.ssi_int, ssi.ssi_code);
+  close(fd);
+
+  if (sigprocmask(SIG_SETMASK, &old, nullptr) < 0)
+    die("sigqueuetest: sigprocmask restore failed");
+  if (signal(SIGUSR1, SIG_DFL) == SIG_ERR)
+    die("sigqueuetest: failed to reset SIGUSR1");
+  printf("sigqueuetest ok\n");
+}
+
+// setitimer, POSIX timers and timerfd.  Timer signals are blocked and
+// collected with sigtimedwait, so the test doesn't race with handlers.
+void
+timertest(void)
+{
+  struct timespec wait2s = { 2, 0 }, wait50ms = { 0, 50000000 };
+  struct itimerval itv = {}, oitv;
+  struct itimerspec its = {}, oits;
+  struct sigevent sev;
+  sigset_t set, old;
+  siginfo_t info;
+  timer_t id;
+  u64 n;
+
+  printf("timertest\n");
+
+  sigemptyset(&set);
+  sigaddset(&set, SIGALRM);
+  sigaddset(&set, SIGRTMIN + 1);
+  if (sigprocmask(SIG_BLOCK, &set, &old) < 0)
+    die("timertest: sigprocmask failed");
+
+  // A one-shot ITIMER_REAL posts one SIGALRM and then reads as disarmed.
+  if (setitimer(ITIMER_VIRTUAL, &itv, nullptr) >= 0)
+    die("timertest: setitimer accepted ITIMER_VIRTUAL");
+  itv.it_value.tv_usec = 20000;
+  if (setitimer(ITIMER_REAL, &itv, nullptr) < 0)
+    die("timertest: setitimer failed");
+  if (sigtimedwait(&set, &info, &wait2s) != SIGALRM)
+    die("timertest: no SIGALRM from setitimer");
+  if (getitimer(ITIMER_REAL, &oitv) < 0 ||
+      oitv.it_value.tv_sec != 0 || oitv.it_value.tv_usec != 0)
+    die("timertest: expired itimer still armed");
+
+  // Disarming an itimer before it fires posts nothing.
+  itv.it_value.tv_usec = 20000;
+  if (setitimer(ITIMER_REAL, &itv, nullptr) < 0)
+    die("timertest: setitimer failed");
+  memset(&itv, 0, sizeof(itv));
+  if (setitimer(ITIMER_REAL, &itv, &oitv) < 0)
+    die("timertest: setitimer disarm failed");
+  if (oitv.it_value.tv_sec == 0 && oitv.it_value.tv_usec == 0)
+    die("timertest: setitimer lost the armed value");
+  if (sigtimedwait(&set, &info, &wait50ms) >= 0)
+    die("timertest: disarmed itimer posted signal %d", info.si_signo);
+
+  // A periodic POSIX timer posts its sigevent value with SI_TIMER.
+  memset(&sev, 0, sizeof(sev));
+  sev.sigev_notify = SIGEV_SIGNAL;
+  sev.sigev_signo = SIGRTMIN + 1;
+  sev.sigev_value.sival_int = 99;
+  if (timer_create(CLOCK_MONOTONIC, &sev, &id) < 0)
+    die("timertest: timer_create failed");
+  if (timer_create(12345, &sev, &id) >= 0)
+    die("timertest: timer_create accepted a bad clock");
+  its.it_value.tv_nsec = 10000000;
+  its.it_interval.tv_nsec = 10000000;
+  if (timer_settime(id, 0, &its, nullptr) < 0)
+    die("timertest: timer_settime failed");
+  for (int i = 0; i < 3; i++) {
+    if (sigtimedwait(&set, &info, &wait2s) != SIGRTMIN + 1)
+      die("timertest: no signal from periodic timer");
+    if (info.si_code != SI_TIMER || info.si_value.sival_int != 99)
+      die("timertest: timer signal code %d value %d",
+          info.si_code, info.si_value.sival_int);
+  }
+  if (timer_gettime(id, &oits) < 0 ||
+      oits.it_interval.tv_sec != 0 || oits.it_interval.tv_nsec != 10000000)
+    die("timertest: timer_gettime returned the wrong interval");
+  if (timer_delete(id) < 0)
+    die("timertest: timer_delete failed");
+  if (timer_delete(id) >= 0)
+    die("timertest: timer_delete of a deleted timer succeeded");
+  while (sigtimedwait(&set, &info, &wait50ms) >= 0)
+    ;
+
+  // A timerfd counts expirations and read resets the count.
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+  if (fd < 0)
+    die("timertest: timerfd_create failed");
+  if (read(fd, &n, sizeof(n)) >= 0)
+    die("timertest: read of an unarmed timerfd succeeded");
+  close(fd);
+  fd = timerfd_create(CLOCK_MONOTONIC, 0);
+  if (fd < 0)
+    die("timertest: timerfd_create failed");
+  its.it_value.tv_nsec = 10000000;
+  its.it_interval.tv_nsec = 10000000;
+  if (timerfd_settime(fd, 0, &its, nullptr) < 0)
+    die("timertest: timerfd_settime failed");
+  for (int i = 0; i < 3; i++)
+    if (read(fd, &n, sizeof(n)) != sizeof(n) || n == 0)
+      die("timertest: timerfd read failed");
+  memset(&its, 0, sizeof(its));
+  if (timerfd_settime(fd, 0, &its, nullptr) < 0)
+    die("timertest: timerfd disarm failed");
+  if (timerfd_gettime(fd, &oits) < 0 ||
+      oits.it_value.tv_sec != 0 || oits.it_value.tv_nsec != 0)
+    die("timertest: disarmed timerfd still armed");
+  close(fd);
+
+  if (sigprocmask(SIG_SETMASK, &old, nullptr) < 0)
+    die("timertest: sigprocmask restore failed");
+  printf("timertest ok\n");
+}
+
 // does unintialized data start out zero?
 char uninit[10000];
 void
@@ -1543,7 +1832,7 @@ unopentest(void)
       unlink(name);
     }
   }
-  kill(pid);
+  kill(pid, SIGKILL);
   wait(NULL);
 
   fprintf(stdout, "concurrent unlink/open ok\n");
@@ -1596,6 +1885,331 @@ preads(void)
   printf("concurrent preads OK\n");
 }
 
+static off_t
+fdsize(int fd)
+{
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+    die("fstat failed");
+  return st.st_size;
+}
+
+// Check that [off, off+n) of fd reads back as byte c.
+static void
+checkfill(int fd, off_t off, size_t n, char c, const char *what)
+{
+  static char rbuf[4096];
+  while (n) {
+    size_t chunk = n < sizeof(rbuf) ? n : sizeof(rbuf);
+    if (pread(fd, rbuf, chunk, off) != chunk)
+      die("%s: short read at %d", what, (int)off);
+    for (size_t i = 0; i < chunk; i++)
+      if (rbuf[i] != c)
+        die("%s: byte %d is %d, not %d", what, (int)(off + i), rbuf[i], c);
+    off += chunk;
+    n -= chunk;
+  }
+}
+
+// ftruncate, truncate, fallocate and O_TRUNC.
+void
+truncatetest(void)
+{
+  static char wbuf[3 * 4096];
+  int fd;
+
+  printf("truncatetest\n");
+
+  fd = open("truncate.x", O_CREAT|O_RDWR, 0666);
+  if (fd < 0)
+    die("truncatetest: open failed");
+  memset(wbuf, 'a', sizeof(wbuf));
+  if (write(fd, wbuf, sizeof(wbuf)) != sizeof(wbuf))
+    die("truncatetest: write failed");
+
+  // Shrinking drops the tail; growing again reads back zeroes, not the
+  // old data.
+  if (ftruncate(fd, 5000) < 0 || fdsize(fd) != 5000)
+    die("truncatetest: ftruncate shrink failed");
+  if (ftruncate(fd, sizeof(wbuf)) < 0 || fdsize(fd) != sizeof(wbuf))
+    die("truncatetest: ftruncate grow failed");
+  checkfill(fd, 0, 5000, 'a', "truncatetest");
+  checkfill(fd, 5000, sizeof(wbuf) - 5000, 0, "truncatetest");
+
+  // truncate by name.
+  if (truncate("truncate.x", 10) < 0 || fdsize(fd) != 10)
+    die("truncatetest: truncate failed");
+  if (truncate("truncate.nonexistent", 0) >= 0)
+    die("truncatetest: truncate of a missing file succeeded");
+
+  // fallocate extends the file with zeroes and never shrinks it.
+  if (fallocate(fd, 0, 0, 20000) < 0 || fdsize(fd) != 20000)
+    die("truncatetest: fallocate failed");
+  checkfill(fd, 0, 10, 'a', "truncatetest fallocate");
+  checkfill(fd, 10, 20000 - 10, 0, "truncatetest fallocate");
+  if (fallocate(fd, 0, 0, 100) < 0 || fdsize(fd) != 20000)
+    die("truncatetest: fallocate shrank the file");
+  if (fallocate(fd, 1, 0, 100) >= 0)
+    die("truncatetest: fallocate accepted an unsupported mode");
+  if (pwrite(fd, wbuf, 100, 20000 - 100) != 100)
+    die("truncatetest: write into fallocated range failed");
+  checkfill(fd, 20000 - 100, 100, 'a', "truncatetest fallocate");
+  close(fd);
+
+  // A read-only descriptor can't be truncated.
+  fd = open("truncate.x", O_RDONLY);
+  if (fd < 0)
+    die("truncatetest: reopen failed");
+  if (ftruncate(fd, 0) >= 0)
+    die("truncatetest: ftruncate on a read-only fd succeeded");
+  close(fd);
+
+  // O_TRUNC empties the file.
+  fd = open("truncate.x", O_RDWR|O_TRUNC);
+  if (fd < 0)
+    die("truncatetest: open O_TRUNC failed");
+  if (fdsize(fd) != 0)
+    die("truncatetest: O_TRUNC left %d bytes", (int)fdsize(fd));
+  close(fd);
+
+  if (unlink("truncate.x") < 0)
+    die("truncatetest: unlink failed");
+  printf("truncatetest ok\n");
+}
+
+// memfd_create and shm_open objects are shared by every mapping and
+// every descriptor, including across fork.
+void
+shmtest(void)
+{
+  enum { size = 2 * 4096 };
+  char *p, *q;
+  int fd, fd2, pid;
+
+  printf("shmtest\n");
+
+  fd = memfd_create("usertests", MFD_CLOEXEC);
+  if (fd < 0)
+    die("shmtest: memfd_create failed");
+  if (memfd_create("usertests", 0x100) >= 0)
+    die("shmtest: memfd_create accepted bad flags");
+  if (fdsize(fd) != 0 || ftruncate(fd, size) < 0 || fdsize(fd) != size)
+    die("shmtest: memfd ftruncate failed");
+  p = (char*)mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    die("shmtest: memfd mmap failed");
+  if (p[0] != 0 || p[size - 1] != 0)
+    die("shmtest: memfd not zero-filled");
+
+  // A child's stores through the inherited mapping reach the parent's
+  // mapping and the file.
+  pid = fork();
+  if (pid < 0)
+    die("shmtest: fork failed");
+  if (pid == 0) {
+    memset(p, 'm', size);
+    exit(0);
+  }
+  if (waitpid(pid, nullptr, 0) != pid)
+    die("shmtest: waitpid failed");
+  if (p[0] != 'm' || p[size - 1] != 'm')
+    die("shmtest: child's memfd writes not visible");
+  checkfill(fd, 0, size, 'm', "shmtest memfd");
+  munmap(p, size);
+  close(fd);
+
+  shm_unlink("/usertests.shm");
+  fd = shm_open("/usertests.shm", O_CREAT|O_EXCL|O_RDWR, 0666);
+  if (fd < 0)
+    die("shmtest: shm_open create failed");
+  if (shm_open("/usertests.shm", O_CREAT|O_EXCL|O_RDWR, 0666) >= 0)
+    die("shmtest: shm_open O_EXCL of an existing object succeeded");
+  if (shm_open("/a/b", O_CREAT|O_RDWR, 0666) >= 0)
+    die("shmtest: shm_open accepted a name with a slash");
+  if (ftruncate(fd, size) < 0)
+    die("shmtest: shm ftruncate failed");
+  p = (char*)mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    die("shmtest: shm mmap failed");
+
+  // Another process opening the same name sees the same pages.
+  pid = fork();
+  if (pid < 0)
+    die("shmtest: fork failed");
+  if (pid == 0) {
+    int cfd = shm_open("/usertests.shm", O_RDWR, 0);
+    if (cfd < 0)
+      die("shmtest: child shm_open failed");
+    q = (char*)mmap(nullptr, size, PROT_READ|PROT_WRITE, MAP_SHARED, cfd, 0);
+    if (q == MAP_FAILED)
+      die("shmtest: child shm mmap failed");
+    memset(q, 's', size);
+    exit(0);
+  }
+  if (waitpid(pid, nullptr, 0) != pid)
+    die("shmtest: waitpid failed");
+  if (p[0] != 's' || p[size - 1] != 's')
+    die("shmtest: child's shm writes not visible");
+
+  // O_TRUNC empties the object; the name goes away with shm_unlink but
+  // open descriptors keep working.
+  fd2 = shm_open("/usertests.shm", O_RDWR|O_TRUNC, 0);
+  if (fd2 < 0 || fdsize(fd2) != 0)
+    die("shmtest: shm_open O_TRUNC failed");
+  close(fd2);
+  munmap(p, size);
+  if (shm_unlink("/usertests.shm") < 0)
+    die("shmtest: shm_unlink failed");
+  if (shm_open("/usertests.shm", O_RDWR, 0) >= 0)
+    die("shmtest: shm_open found an unlinked object");
+  if (ftruncate(fd, 100) < 0 || fdsize(fd) != 100)
+    die("shmtest: unlinked shm object unusable");
+  close(fd);
+
+  printf("shmtest ok\n");
+}
+
+// syncfs on a directory, a file, a memory-only file and a non-file.
+void
+syncfstest(void)
+{
+  char path[32];
+  int fd, dfd, pfd[2];
+
+  printf("syncfstest\n");
+
+  if (mkdir("syncfs.d", 0777) < 0)
+    die("syncfstest: mkdir failed");
+  for (int i = 0; i < 4; i++) {
+    snprintf(path, sizeof(path), "syncfs.d/f%d", i);
+    fd = open(path, O_CREAT|O_RDWR, 0666);
+    if (fd < 0 || write(fd, path, sizeof(path)) != sizeof(path))
+      die("syncfstest: create %s failed", path);
+    close(fd);
+  }
+  if (mkdir("syncfs.d/sub", 0777) < 0)
+    die("syncfstest: mkdir sub failed");
+
+  dfd = open("syncfs.d", O_RDONLY);
+  if (dfd < 0)
+    die("syncfstest: open dir failed");
+  if (syncfs(dfd) < 0)
+    die("syncfstest: syncfs of a directory failed");
+  // Nothing is dirty the second time.
+  if (syncfs(dfd) < 0)
+    die("syncfstest: second syncfs failed");
+
+  fd = open("syncfs.d/f0", O_RDWR);
+  if (fd < 0 || write(fd, "x", 1) != 1)
+    die("syncfstest: rewrite failed");
+  if (syncfs(fd) < 0)
+    die("syncfstest: syncfs of a file failed");
+  close(fd);
+  close(dfd);
+
+  fd = memfd_create("syncfs", 0);
+  if (fd < 0 || syncfs(fd) < 0)
+    die("syncfstest: syncfs of a memfd failed");
+  close(fd);
+
+  if (pipe(pfd) < 0)
+    die("syncfstest: pipe failed");
+  if (syncfs(pfd[0]) >= 0)
+    die("syncfstest: syncfs of a pipe succeeded");
+  close(pfd[0]);
+  close(pfd[1]);
+  if (syncfs(-1) >= 0)
+    die("syncfstest: syncfs of a bad fd succeeded");
+
+  for (int i = 0; i < 4; i++) {
+    snprintf(path, sizeof(path), "syncfs.d/f%d", i);
+    unlink(path);
+  }
+  unlink("syncfs.d/sub");
+  unlink("syncfs.d");
+  printf("syncfstest ok\n");
+}
+
+// copy_file_range with file offsets and explicit offsets.
+void
+copyrangetest(void)
+{
+  enum { size = 3 * 4096 + 100 };
+  static char src[size], got[size];
+  off_t oin, oout;
+  ssize_t r, total;
+  int in, out;
+
+  printf("copyrangetest\n");
+
+  for (int i = 0; i < size; i++)
+    src[i] = i % 251;
+  in = open("copyrange.in", O_CREAT|O_RDWR|O_TRUNC, 0666);
+  out = open("copyrange.out", O_CREAT|O_RDWR|O_TRUNC, 0666);
+  if (in < 0 || out < 0)
+    die("copyrangetest: open failed");
+  if (write(in, src, size) != size || lseek(in, 0, SEEK_SET) != 0)
+    die("copyrangetest: write failed");
+
+  // Null offsets use and advance the files' own offsets.
+  for (total = 0; (r = copy_file_range(in, nullptr, out, nullptr,
+                                       size, 0)) > 0; total += r)
+    ;
+  if (r < 0 || total != size)
+    die("copyrangetest: copied %d of %d bytes", (int)total, size);
+  if (lseek(in, 0, SEEK_CUR) != size || lseek(out, 0, SEEK_CUR) != size)
+    die("copyrangetest: file offsets not advanced");
+  if (fdsize(out) != size || pread(out, got, size, 0) != size ||
+      memcmp(got, src, size) != 0)
+    die("copyrangetest: copy differs");
+
+  // Explicit offsets are updated in place and leave the file offsets
+  // alone.  Copying past the end of the output extends it.
+  oin = 100;
+  oout = size + 50;
+  if (copy_file_range(in, &oin, out, &oout, 5000, 0) != 5000)
+    die("copyrangetest: copy with offsets failed");
+  if (oin != 5100 || oout != size + 5050)
+    die("copyrangetest: offsets not updated");
+  if (lseek(in, 0, SEEK_CUR) != size || lseek(out, 0, SEEK_CUR) != size)
+    die("copyrangetest: explicit offsets moved file offsets");
+  if (fdsize(out) != size + 5050 ||
+      pread(out, got, 5000, size + 50) != 5000 ||
+      memcmp(got, src + 100, 5000) != 0)
+    die("copyrangetest: copy with offsets differs");
+  checkfill(out, size, 50, 0, "copyrangetest gap");
+
+  // At end of input there is nothing to copy.
+  oin = size;
+  if (copy_file_range(in, &oin, out, nullptr, 10, 0) != 0)
+    die("copyrangetest: copy at end of input returned data");
+
+  // Overlapping ranges in one file, flags and read-only outputs fail.
+  oin = 0;
+  oout = 10;
+  if (copy_file_range(in, &oin, in, &oout, 100, 0) >= 0)
+    die("copyrangetest: overlapping copy succeeded");
+  oout = 4096;
+  if (copy_file_range(in, &oin, in, &oout, 100, 0) != 100 ||
+      pread(in, got, 100, 4096) != 100 || memcmp(got, src, 100) != 0)
+    die("copyrangetest: copy within a file failed");
+  if (copy_file_range(in, nullptr, out, nullptr, 10, 1) >= 0)
+    die("copyrangetest: copy with flags succeeded");
+  close(out);
+  out = open("copyrange.out", O_RDONLY);
+  if (out < 0)
+    die("copyrangetest: reopen failed");
+  oin = 0;
+  if (copy_file_range(in, &oin, out, nullptr, 10, 0) >= 0)
+    die("copyrangetest: copy to a read-only fd succeeded");
+
+  close(in);
+  close(out);
+  unlink("copyrange.in");
+  unlink("copyrange.out");
+  printf("copyrangetest ok\n");
+}
+
 void
 tls_test(void)
 {
@@ -2086,17 +2700,24 @@ main(int argc, char *argv[])
 
   TEST(validatetest);
   TEST(sigtest);
+  TEST(sigqueuetest);
+  TEST(timertest);
 
   TEST(opentest);
   TEST(writetest);
 //  TEST(writetest1);   // Currently broken
   TEST(createtest);
   TEST(preads);
+  TEST(truncatetest);
+  TEST(shmtest);
+  TEST(syncfstest);
+  TEST(copyrangetest);
 
   TEST(pipe1);
   TEST(preempt);
   TEST(exitwait);
   TEST(zombietest);
+  TEST(waitnohang);
   TEST(killtest); 
 
   TEST(rmdot);
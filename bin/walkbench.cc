@@ -0,0 +1,69 @@
+// Usage: walkbench [-c maxcpu] [-r rounds] dir
+//
+// Walk the tree below dir with treewalk at 1 to maxcpu threads and
+// print the throughput in directory entries per second at each thread
+// count, to show how the walk scales with cores.  A mail spool built by
+// mailbench is a good tree to point this at.
+
+#include "libutil.h"
+#include "treewalk.hh"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+class count_walk : public treewalk
+{
+protected:
+  bool visit(int thread, const entry &e) override
+  {
+    return true;
+  }
+};
+
+static void
+usage(const char *argv0)
+{
+  fprintf(stderr, "Usage: %s [-c maxcpu] [-r rounds] dir\n", argv0);
+  exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+  int maxcpu = treewalk::default_threads();
+  int rounds = 3;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "c:r:")) != -1) {
+    switch (opt) {
+    case 'c':
+      maxcpu = atoi(optarg);
+      break;
+    case 'r':
+      rounds = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  if (optind != argc - 1 || maxcpu <= 0 || rounds <= 0)
+    usage(argv[0]);
+  const char *dir = argv[optind];
+
+  // Warm up the caches, so the first data point isn't penalized.
+  if (count_walk().run(dir, maxcpu) < 0)
+    die("walkbench: cannot walk %s", dir);
+
+  printf("# threads dirents dirents/sec\n");
+  for (int n = 1; n <= maxcpu; n++) {
+    long dirents = 0;
+    uint64_t start = now_usec();
+    for (int r = 0; r < rounds; r++)
+      dirents += count_walk().run(dir, n);
+    uint64_t usec = now_usec() - start;
+    printf("%d %ld %lu\n", n, dirents / rounds,
+           usec ? dirents * 1000000 / usec : 0);
+  }
+  return 0;
+}
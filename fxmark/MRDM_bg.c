@@ -88,7 +88,7 @@ static int fg_work(struct worker *worker)
 		dir = opendir(dir_path);
 		if (!dir) goto err_out;
 		for (; !bench->stop; ++iter) {
-			rc = readdir_r(dir, &entry, &result);
+			rc = fx_readdir(dir, &entry, &result);
 			if (rc) goto err_out;
 		}
 		closedir(dir);
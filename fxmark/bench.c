@@ -40,13 +40,22 @@ static int setaffinity(int c)
         return sched_setaffinity(0, sizeof(cpuset), &cpuset);
 }
 
-struct bench *alloc_bench(int ncpu, int nbg)
+/* workers are pinned to cores[0..ncpu-1], or to seq_cores if cores is NULL */
+struct bench *alloc_bench(int ncpu, int nbg,
+			  const unsigned int *cores, int ncores)
 {
         struct bench *bench; 
         struct worker *worker;
         void *shmem;
         int shmem_size = sizeof(*bench) + sizeof(*worker) * ncpu;
         int i;
+
+        if (!cores) {
+                cores = seq_cores;
+                ncores = sizeof(seq_cores) / sizeof(seq_cores[0]);
+        }
+        if (ncpu > ncores)
+                return NULL;
         
         /* alloc shared memory using mmap */
         shmem = mmap(0, shmem_size, PROT_READ | PROT_WRITE, 
@@ -63,7 +72,8 @@ struct bench *alloc_bench(int ncpu, int nbg)
         for (i = 0; i < ncpu; ++i) {
                 worker = &bench->workers[i];
                 worker->bench = bench;
-                worker->id = seq_cores[i];
+                worker->id = i;
+                worker->core = cores[i];
 		worker->is_bg = i >= (ncpu - nbg);
         }
 
@@ -87,7 +97,7 @@ static void worker_main(void *arg)
         int err = 0;
 
         /* set affinity */ 
-        setaffinity(worker->id);
+        setaffinity(worker->core);
 
         /* pre-work */
         if (bench->ops.pre_work) {
@@ -112,9 +122,11 @@ static void worker_main(void *arg)
 		/* make things more deterministic */
 		sync();
 
+#ifndef XV6_USER
 		/* start performance profiling */
 		if (bench->profile_start_cmd[0])
 			system(bench->profile_start_cmd);
+#endif
 
                 /* ok, before running, set timer */
                 if (signal(SIGALRM, sighandler) == SIG_ERR) {
@@ -142,9 +154,11 @@ static void worker_main(void *arg)
         e_clk = rdtsc_end();
         e_us = usec();
 
+#ifndef XV6_USER
 	/* stop performance profiling */
         if (!worker->id && bench->profile_stop_cmd[0])
 		system(bench->profile_stop_cmd);
+#endif
 
         /* post-work */ 
         if (bench->ops.post_work)
@@ -214,6 +228,7 @@ void report_bench(struct bench *bench, FILE *out)
 
 	/* get profiling result */ 
 	profile_name = profile_data = empty_str;
+#ifndef XV6_USER
 	if (bench->profile_stat_file[0]) {
 		FILE *fp = fopen(bench->profile_stat_file, "r");
 		size_t len;
@@ -225,6 +240,7 @@ void report_bench(struct bench *bench, FILE *out)
 			fclose(fp);
 		}
 	}
+#endif
 
         fprintf(out, "# ncpu secs works works/sec %s\n", profile_name);
         fprintf(out, "%d %f %f %f %s\n", 
@@ -4,7 +4,9 @@
 #include <stdio.h>
 #ifdef XV6_USER
 #include "types.h"
-#include "fs.h"
+#include <limits.h>
+#include <errno.h>
+static int errno;   // xv6 has no errno
 #else
 #include <linux/limits.h>
 #endif
@@ -47,6 +49,7 @@ struct bench {
 struct worker {
 	struct bench *bench;
 	int id;
+	int core;
 	int is_bg;
 
 	volatile int ready;
@@ -59,7 +62,8 @@ struct worker {
 	uint64_t private[WORKER_MAX_PRIVATE];
 } CACHELINE_ALIGNED;
 
-struct bench *alloc_bench(int ncpu, int nbg);
+struct bench *alloc_bench(int ncpu, int nbg,
+			  const unsigned int *cores, int ncores);
 void run_bench(struct bench *bench);
 void report_bench(struct bench *bench, FILE *out);
 
@@ -1,8 +1,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <getopt.h>
 #include <errno.h>
+#ifdef XV6_USER
+#include <unistd.h>
+#else
+#include <getopt.h>
+#endif
 #include "fxmark.h"
 
 struct bench_desc {
@@ -103,26 +107,35 @@ static struct bench_operations *find_ops(char *type)
 
 static int parse_option(int argc, char *argv[], struct cmd_opt *opt)
 {
+#ifndef XV6_USER
 	static struct option options[] = {
 		{"type",      required_argument, 0, 't'}, 
 		{"ncore",     required_argument, 0, 'n'}, 
 		{"nbg",       required_argument, 0, 'g'}, 
 		{"duration",  required_argument, 0, 'd'}, 
 		{"root",      required_argument, 0, 'r'}, 
+		{"cores",     required_argument, 0, 'c'},
 		{"profbegin", required_argument, 0, 'b'},
 		{"profend",   required_argument, 0, 'e'},
 		{"proflog",   required_argument, 0, 'l'},
 		{0,           0,                 0, 0},
 	};
+#endif
 	int arg_cnt;
 
 	opt->profile_start_cmd = "";
 	opt->profile_stop_cmd  = "";
 	opt->profile_stat_file = "";
 	for(arg_cnt = 0; 1; ++arg_cnt) {
-		int c, idx = 0;
+		int c;
+#ifdef XV6_USER
+		/* no long options; profiling commands are unsupported */
+		c = getopt(argc, argv, "t:n:g:d:r:c:");
+#else
+		int idx = 0;
 		c = getopt_long(argc, argv, 
-				"t:n:g:d:r:b:e:l:", options, &idx);
+				"t:n:g:d:r:c:b:e:l:", options, &idx);
+#endif
 		if (c == -1)
 			break; 
 		switch(c) {
@@ -143,6 +156,9 @@ static int parse_option(int argc, char *argv[], struct cmd_opt *opt)
 		case 'r':
 			opt->root = optarg;
 			break;
+		case 'c':
+			opt->cores = optarg;
+			break;
 		case 'b':
 			opt->profile_start_cmd = optarg;
 			break;
@@ -164,6 +180,17 @@ static void usage(FILE *out, const char *myname)
 	struct bench_desc *bd = bench_table; 
 
 	fprintf(out, "Usage: %s\n", myname);
+#ifdef XV6_USER
+	fprintf(out, "  -t = benchmark type\n");
+	for (; bd->name != NULL; ++bd)
+		fprintf(out, "    %s: %s\n", bd->name, bd->desc);
+	fprintf(out, "  -n = number of core\n");
+	fprintf(out, "  -g = number of background worker\n");
+	fprintf(out, "  -d = duration in seconds\n");
+	fprintf(out, "  -r = test root directory\n");
+	fprintf(out, "  -c = comma-separated cores to pin workers to\n");
+	return;
+#endif
 	fprintf(out, "  --type     = benchmark type\n");
 	for (; bd->name != NULL; ++bd)
 		fprintf(out, "    %s: %s\n", bd->name, bd->desc);
@@ -171,11 +198,33 @@ static void usage(FILE *out, const char *myname)
 	fprintf(out, "  --nbg       = number of background worker\n");
 	fprintf(out, "  --duration  = duration in seconds\n");
 	fprintf(out, "  --root      = test root directory\n");
+	fprintf(out, "  --cores     = comma-separated cores to pin workers to\n");
 	fprintf(out, "  --profbegin = profiling start command\n");
 	fprintf(out, "  --profend   = profiling stop command\n");
 	fprintf(out, "  --proflog   = profiling log file\n");
 }
 
+/* parse a comma-separated core list such as "0,2,4,6" */
+static int parse_cores(const char *list, unsigned int **cores)
+{
+	const char *p;
+	char *end;
+	int n = 1, i;
+
+	for (p = list; *p; ++p)
+		if (*p == ',')
+			++n;
+	*cores = malloc(n * sizeof(**cores));
+	if (!*cores)
+		return -ENOMEM;
+	for (i = 0, p = list; i < n; ++i, p = end + 1) {
+		(*cores)[i] = strtoul(p, &end, 10);
+		if (end == p || (*end != ',' && *end != '\0'))
+			return -EINVAL;
+	}
+	return n;
+}
+
 static void init_bench(struct bench *bench, struct cmd_opt *opt)
 {
 	struct fx_opt *fx_opt = fx_opt_bench(bench);
@@ -187,7 +236,8 @@ static void init_bench(struct bench *bench, struct cmd_opt *opt)
 		opt->profile_stop_cmd, BENCH_PROFILE_CMD_BYTES);
 	strncpy(bench->profile_stat_file,
 		opt->profile_stat_file, PATH_MAX);
-	strncpy(fx_opt->root, opt->root, PATH_MAX);
+	strncpy(fx_opt->root, opt->root, PATH_MAX - 1);
+	fx_opt->root[PATH_MAX - 1] = '\0';
 	bench->ops = *opt->ops;
 }
 
@@ -195,15 +245,27 @@ int main(int argc, char *argv[])
 {
 	struct cmd_opt opt = {NULL, 0, 0, 0, NULL};
 	struct bench *bench; 
+	unsigned int *cores = NULL;
+	int ncores = 0;
 
 	/* parse command line options */
 	if (parse_option(argc, argv, &opt) < 4) {
 		usage(stderr, argv[0]);
 		exit(1);
 	}
+	if (opt.cores && (ncores = parse_cores(opt.cores, &cores)) < 0) {
+		usage(stderr, argv[0]);
+		exit(1);
+	}
 
 	/* create, initialize, and run a bench */ 
-	bench = alloc_bench(opt.ncore, opt.nbg);
+	bench = alloc_bench(opt.ncore, opt.nbg, cores, ncores);
+	if (!bench) {
+		fprintf(stderr, "%s: can't set up %d workers "
+			"(more than the cores to pin them to?)\n",
+			argv[0], opt.ncore);
+		exit(1);
+	}
 	init_bench(bench, &opt);
 	run_bench(bench);
 	report_bench(bench, stdout);
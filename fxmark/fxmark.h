@@ -2,11 +2,10 @@
 #define __FX_H__
 #ifdef XV6_USER
 #include "types.h"
-#include "fs.h"
+#include <limits.h>
 #include <stdio.h>
 #include <errno.h>
 #define sprintf(buf, args...) snprintf(buf, 4096, args)
-static int errno;   // xv6 has no errno
 #else
 #include <linux/limits.h>
 #endif
@@ -28,6 +27,7 @@ struct cmd_opt {
 	int nbg;
 	int duration;
 	char *root;
+	char *cores;
 	char *profile_start_cmd;
 	char *profile_stop_cmd;
 	char *profile_stat_file;
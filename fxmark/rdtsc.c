@@ -1,10 +1,22 @@
 #include "rdtsc.h"
 
-#include <err.h>
-#include <math.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#ifdef XV6_USER
+#include "types.h"
+
+// xv6 has no libm
+static double sqrt(double x)
+{
+    double r;
+    __asm("sqrtsd %1, %0" : "=x" (r) : "x" (x));
+    return r;
+}
+#else
+#include <err.h>
+#include <math.h>
+#endif
 
 uint64_t rdtsc_overhead(double *stddev_out)
 {
@@ -44,6 +56,10 @@ uint64_t rdtsc_overhead(double *stddev_out)
 
 uint64_t cpu_freq(void)
 {
+#ifdef XV6_USER
+    // No /proc/cpuinfo
+    return cpu_freq_measured();
+#else
     uint64_t hz = 0;
 
     FILE *fp = fopen("/proc/cpuinfo", "r");
@@ -59,8 +75,10 @@ uint64_t cpu_freq(void)
             hz = (uint64_t) (mhz * 1000 * 1000);
     }
     free(line);
+    fclose(fp);
 
     return hz;
+#endif
 }
 
 uint64_t cpu_freq_measured(void)
@@ -1,10 +1,37 @@
 #include <stdio.h>
-#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef XV6_USER
+#include "types.h"
+#include <limits.h>
+#else
 #include <linux/limits.h>
+#endif
 
+/*
+ * Create path and any missing parents.  This used to shell out to
+ * "mkdir -p", but sv6 has no system() and a shell per call adds noise
+ * to every benchmark's setup on Linux as well.
+ */
 int mkdir_p(const char *path)
 {
-	char cmd[PATH_MAX*2];
-	snprintf(cmd, PATH_MAX*2, "mkdir -p %s", path);
-	return system(cmd);
+	char buf[PATH_MAX];
+	struct stat st;
+	char *p;
+
+	strncpy(buf, path, PATH_MAX - 1);
+	buf[PATH_MAX - 1] = '\0';
+	for (p = buf + 1; *p; ++p) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		mkdir(buf, 0777);
+		*p = '/';
+	}
+	mkdir(buf, 0777);
+
+	if (stat(buf, &st) < 0 || !S_ISDIR(st.st_mode))
+		return -1;
+	return 0;
 }
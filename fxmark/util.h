@@ -1,8 +1,29 @@
 #ifndef __UTIL_H__
 #define __UTIL_H__
 
+#include <dirent.h>
+#include <errno.h>
+
 int mkdir_p(const char *path);
 
+/*
+ * Read dir's next entry into *result, or NULL at the end.  glibc
+ * deprecates readdir_r, but on sv6 the name readdir belongs to the
+ * system call, so each platform gets the one it supports.
+ */
+inline static int fx_readdir(DIR *dir, struct dirent *entry,
+			     struct dirent **result)
+{
+#ifdef XV6_USER
+	return readdir_r(dir, entry, result);
+#else
+	(void)entry;
+	errno = 0;
+	*result = readdir(dir);
+	return *result ? 0 : errno;
+#endif
+}
+
 inline static unsigned int pseudo_random(unsigned int x_n)
 {
 	/* 
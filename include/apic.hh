@@ -40,6 +40,15 @@ public:
   // Start an AP
   virtual void start_ap(struct cpu *c, u32 addr) = 0;
 
+  // Make this CPU's next timer interrupt come ns nanoseconds from now,
+  // replacing the pending one.  Returns false if the timer is periodic
+  // and can't be armed.  A one-shot timer must be rearmed from every
+  // timer interrupt.
+  virtual bool arm_timer(u64 ns)
+  {
+    return false;
+  }
+
   // Return true if is an x2APIC (and thus supports 32-bit APIC IDs)
   virtual bool is_x2apic()
   {
@@ -9,6 +9,20 @@
 #include "weakcache.hh"
 #include "disk.hh"
 
+// The page holding a block's contents.  A buf shares its page with the
+// transactions it has been added to, so a page with more than one
+// reference is frozen: the buf must move to a copy before modifying it.
+class bufpage : public referenced {
+public:
+  static_assert(BSIZE <= PGSIZE, "a block must fit in a page");
+
+  char *data;
+
+  bufpage() : data(kalloc("bufpage")) {}
+  ~bufpage() { kfree(data); }
+  NEW_DELETE_OPS(bufpage);
+};
+
 class buf : public refcache::weak_referenced {
 public:
   struct bufdata {
@@ -47,8 +61,10 @@ public:
       dec();
   }
 
+  // A write() may move data_ to a new page, so the reader must reload
+  // it on every attempt.
   seq_reader<bufdata> read() {
-    return seq_reader<bufdata>(data_, &seq_);
+    return seq_reader<bufdata>(&data_, &seq_);
   }
 
   class buf_dirty {
@@ -62,25 +78,27 @@ public:
     buf* b_;
   };
 
-  class buf_writer : public ptr_wrap<bufdata>,
-                     public lock_guard<sleeplock>,
+  // The bases are constructed in order, so the buf is unshared only
+  // once the write lock and the write seqlock are held.
+  class buf_writer : public lock_guard<sleeplock>,
                      public seq_writer,
+                     public ptr_wrap<bufdata>,
                      public buf_dirty {
   public:
-    buf_writer(bufdata* d, sleeplock* l, seqcount<u32>* s, buf* b)
-      : ptr_wrap<bufdata>(d), lock_guard<sleeplock>(l),
-        seq_writer(s), buf_dirty(b) {}
+    buf_writer(buf* b, bool dirty)
+      : lock_guard<sleeplock>(&b->write_lock_), seq_writer(&b->seq_),
+        ptr_wrap<bufdata>(b->unshare()), buf_dirty(dirty ? b : nullptr) {}
   };
 
   buf_writer write() {
-    return buf_writer(data_, &write_lock_, &seq_, this);
+    return buf_writer(this, true);
   }
 
   // Same as write(), except that the block is not marked dirty.
   // Used to get exclusive (i.e., write) access to the block without
   // disturbing the dirty flag or the reference count.
   buf_writer write_clean() {
-    return buf_writer(data_, &write_lock_, &seq_, nullptr);
+    return buf_writer(this, false);
   }
 
 private:
@@ -93,20 +111,18 @@ private:
   std::atomic<bool> dirty_;
   sref<disk_completion> dc_;
 
+  // page_ holds the block's contents and data_ points into it.  Both
+  // change only with write_lock_ and the write seqlock held.
+  sref<bufpage> page_;
   bufdata *data_;
 
   buf(u32 dev, u64 block)
-    : dev_(dev), block_(block), dirty_(false)
-  {
-    data_ = (bufdata *) kmalloc(sizeof(bufdata), "bufdata");
-  }
+    : dev_(dev), block_(block), dirty_(false),
+      page_(make_sref<bufpage>()), data_((bufdata *) page_->data) {}
   void onzero() override;
   NEW_DELETE_OPS(buf);
 
-  ~buf()
-  {
-    kmfree(data_, sizeof(bufdata));
-  }
+  bufdata *unshare();
 
   void mark_dirty() {
     if (cmpxch(&dirty_, false, true))
@@ -118,10 +134,3 @@ private:
       dec();
   }
 };
-
-template<>
-inline u64
-hash(const buf::key_t& k)
-{
-  return k.first ^ k.second;
-}
@@ -0,0 +1,46 @@
+#pragma once
+
+// Build-time checks of how data structures lie on cache lines.
+//
+// __mpalign__ and __padout__ say where a structure should break lines,
+// but nothing stops a later field from landing on a line it shouldn't,
+// or a fast-path group from silently spilling onto a second line.
+// These annotations turn the intended layout into static_asserts:
+//
+//   CACHELINE_SAME(type, a, b)   a through b lie on one cache line
+//   CACHELINE_APART(type, a, b)  no cache line holds both a and b
+//   CACHELINE_START(type, m)     m begins a cache line
+//
+// Members are named as for offsetof.  Put the annotations after the
+// structure, or, for private members, in one of its member functions.
+
+#include <cstddef>
+
+#define __cacheline_first(type, m) \
+  (offsetof(type, m) / CACHELINE)
+#define __cacheline_last(type, m) \
+  ((offsetof(type, m) + sizeof(((type*)0)->m) - 1) / CACHELINE)
+
+// offsetof on a non-standard-layout type is conditionally supported,
+// but GCC computes it just as it does for standard-layout types.
+#define __cacheline_assert(cond, msg)                                   \
+  _Pragma("GCC diagnostic push")                                        \
+  _Pragma("GCC diagnostic ignored \"-Winvalid-offsetof\"")              \
+  static_assert(cond, msg);                                             \
+  _Pragma("GCC diagnostic pop")
+
+#define CACHELINE_SAME(type, a, b)                                      \
+  __cacheline_assert(__cacheline_first(type, a) ==                      \
+                     __cacheline_last(type, b),                         \
+                     #type "::" #a " through " #b " span cache lines")
+
+#define CACHELINE_APART(type, a, b)                                     \
+  __cacheline_assert(__cacheline_last(type, a) <                        \
+                     __cacheline_first(type, b) ||                      \
+                     __cacheline_last(type, b) <                        \
+                     __cacheline_first(type, a),                        \
+                     #type "::" #a " and " #b " share a cache line")
+
+#define CACHELINE_START(type, m)                                        \
+  __cacheline_assert(offsetof(type, m) % CACHELINE == 0,                \
+                     #type "::" #m " doesn't start a cache line")
@@ -4,6 +4,7 @@
 #include <atomic>
 #include "spinlock.hh"
 #include "spercpu.hh"
+#include "cacheline.hh"
 
 using std::atomic;
 namespace MMU_SCHEME {
@@ -14,38 +15,50 @@ namespace MMU_SCHEME {
 struct cpu {
   // XXX(Austin) We should move more of this out to static_percpu's.
   // The only things that need to live here are the fast-access
-  // %gs-relative fields at the end (with a little more
-  // sophistication, we could probably get rid of those, too).
+  // %gs-relative fields (with a little more sophistication, we could
+  // probably get rid of those, too).
 
+  // Cpu-local storage variables; see below and in spercpu.hh.  %gs
+  // points here and their offsets are hard-coded in assembly.  They
+  // and the fields after them on this line are used on nearly every
+  // kernel entry, so they share a single cache line.
+  struct cpu *cpu;
+  struct proc *proc;           // The currently-running process.
+  struct cpu_mem *mem;         // The per-core memory metadata
+  u64 syscallno;               // Temporary used by sysentry
+  void *percpu_base;           // Per-CPU memory region base
+  uint64_t no_sched_count;     // sched disable count; high bit means
+                               // yield requested
   cpuid_t id;                  // Index into cpus[] below
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
-  struct segdesc gdt[NSEGS];   // x86 global descriptor table
-  struct taskstate ts;         // Used by x86 to find stack for interrupt
-  struct context *scheduler;   // swtch() here to enter scheduler
-
   int timer_printpc;
-  __mpalign__
-  atomic<u64> tlbflush_done;   // last tlb flush req done on this cpu
-  atomic<u64> tlb_cr3;         // current value of cr3 on this cpu
-  __padout__;
+
+  struct context *scheduler;   // swtch() here to enter scheduler
   struct proc *prev;           // The previously-running process
   atomic<struct proc*> fpu_owner; // The proc with the current FPU state
   struct numa_node *node;
+  struct segdesc gdt[NSEGS];   // x86 global descriptor table
+  struct taskstate ts;         // Used by x86 to find stack for interrupt
 
-  hwid_t hwid __mpalign__;     // Local APIC ID, accessed by other CPUs
+  // Accessed by other CPUs.  A TLB shootdown reads tlb_cr3, sends its
+  // IPI to hwid, and polls tlbflush_done, so they share a line, and
+  // the only local writes to it are from context switches and flushes.
+  atomic<u64> tlbflush_done __mpalign__; // last tlb flush req done on this cpu
+  atomic<u64> tlb_cr3;         // current value of cr3 on this cpu
+  hwid_t hwid;                 // Local APIC ID
   __padout__;
-
-  // Cpu-local storage variables; see below and in spercpu.hh
-  struct cpu *cpu;
-  struct proc *proc;           // The currently-running process.
-  struct cpu_mem *mem;         // The per-core memory metadata
-  u64 syscallno;               // Temporary used by sysentry
-  void *percpu_base;           // Per-CPU memory region base
-  uint64_t no_sched_count;     // sched disable count; high bit means
-                               // yield requested
 } __mpalign__;
 
+CACHELINE_START(cpu, cpu);
+CACHELINE_SAME(cpu, cpu, timer_printpc);
+CACHELINE_SAME(cpu, tlbflush_done, hwid);
+CACHELINE_APART(cpu, ts, tlbflush_done);
+static_assert(offsetof(cpu, proc) == 8 && offsetof(cpu, syscallno) == 24 &&
+              offsetof(cpu, percpu_base) == 32 &&
+              offsetof(cpu, no_sched_count) == 40,
+              "%gs offsets of struct cpu fields changed");
+
 DECLARE_PERCPU(struct cpu, cpus);
 
 // Per-CPU variables, holding pointers to the
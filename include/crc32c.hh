@@ -0,0 +1,62 @@
+#pragma once
+
+// CRC32C (Castagnoli polynomial 0x1EDC6F41, bit-reflected).  These use
+// SSE 4.2's crc32 instruction once initcrc32c has found it, and a table
+// before that or on CPUs without it.  Both compute the same CRC, so a
+// value computed one way can be checked, or looked up in a hash table,
+// the other way.
+//
+// Like crc16, these take and return the raw CRC register.  For the
+// standard CRC32C of a buffer, start with ~0 and invert the result.
+
+#include "types.h"
+
+extern bool crc32c_hw;
+extern u32 const crc32c_table[256];
+
+void initcrc32c(void);
+
+// Return the CRC of buffer, continuing from crc.
+u32 crc32c(u32 crc, const void *buffer, size_t len);
+
+static inline u32
+crc32c_byte(u32 crc, u8 data)
+{
+  if (crc32c_hw) {
+    __asm("crc32b %1, %0" : "+r" (crc) : "rm" (data));
+    return crc;
+  }
+  return (crc >> 8) ^ crc32c_table[(crc ^ data) & 0xff];
+}
+
+static inline u32
+crc32c_u64(u32 crc, u64 data)
+{
+  if (crc32c_hw) {
+    u64 c = crc;
+    __asm("crc32q %1, %0" : "+r" (c) : "rm" (data));
+    return c;
+  }
+  for (int i = 0; i < 8; i++, data >>= 8)
+    crc = (crc >> 8) ^ crc32c_table[(crc ^ data) & 0xff];
+  return crc;
+}
+
+// Return the CRC of the NUL-terminated string s, which is at most n
+// bytes long, continuing from crc.  Bytes after the NUL don't affect
+// the result.  This works a word at a time, finding the NUL without a
+// branch per byte.
+static inline u32
+crc32c_string(u32 crc, const char *s, size_t n)
+{
+  for (size_t i = 0; i < n; i += 8) {
+    u64 w = 0;
+    __builtin_memcpy(&w, s + i, n - i < 8 ? n - i : 8);
+    // The lowest set bit of z is the top bit of the first zero byte.
+    u64 z = (w - 0x0101010101010101ull) & ~w & 0x8080808080808080ull;
+    if (z)
+      return crc32c_u64(crc, w & ((z & -z) - 1));
+    crc = crc32c_u64(crc, w);
+  }
+  return crc;
+}
@@ -317,6 +317,9 @@ struct devsw {
   int (*write)(mdev*, const char*, u32);
   int (*pwrite)(mdev*, const char*, u32, u32);
   void (*stat)(mdev*, struct stat*);
+  // Return a file mnode whose pages mmap should map in place of the
+  // device, or null if it can't be mapped with protection prot.
+  sref<mnode> (*mmap)(mdev*, int prot);
 };
 
 extern struct devsw devsw[];
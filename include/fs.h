@@ -89,6 +89,12 @@ struct dinode {
   u32 addrs[NDIRECT+2]; // Data block addresses
 };
 
+// Set in a data block address (never an indirect one) whose block was
+// allocated by fallocate() but has not been written since; such a block
+// reads as zeroes. Block numbers never reach bit 31.
+#define BLOCK_UNWRITTEN 0x80000000u
+#define BLOCK_ADDR(a) ((a) & ~BLOCK_UNWRITTEN)
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
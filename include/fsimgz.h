@@ -0,0 +1,30 @@
+#pragma once
+
+// Compressed file system image format, written by tools/mkimgz and
+// unpacked by initdisk.
+//
+// The image is divided into FSIMGZ_CHUNK-byte chunks, each compressed
+// independently, so chunks can be unpacked in any order and chunks the
+// file system doesn't use needn't be unpacked at all.  The file is an
+// fsimgz_header, then an fsimgz_chunk for each chunk of the image, then
+// the zlib streams of the FSIMGZ_DATA chunks.
+
+#define FSIMGZ_MAGIC 0x317a676d69367673ull  // "sv6imgz1"
+#define FSIMGZ_CHUNK (1 << 20)
+
+struct fsimgz_header {
+  u64 magic;
+  u64 size;             // Size of the uncompressed image (bytes)
+  u64 nchunks;
+};
+
+// Chunk types.
+#define FSIMGZ_HOLE 0   // All zeroes, and no block is allocated
+#define FSIMGZ_ZERO 1   // All zeroes, but some blocks are allocated
+#define FSIMGZ_DATA 2   // Compressed at off
+
+struct fsimgz_chunk {
+  u64 off;              // Offset of zlib stream from start of file
+  u32 len;              // Length of zlib stream
+  u32 type;
+};
@@ -1,8 +1,13 @@
 #pragma once
 
 #include "cpputil.hh"
+#include "crc32c.hh"
 #include "fs.h"
 
+// Hashes for the kernel's hash tables, built on CRC32C so they are a
+// few cycles on CPUs with the crc32 instruction.  A table keyed by a
+// new type needs only a hash<> specialization (or overload) here.
+
 template<class T>
 u64
 hash(const T& v);
@@ -11,8 +16,7 @@ template<>
 inline u64
 hash(const u64& v)
 {
-  u64 x = v ^ (v >> 32) ^ (v >> 20) ^ (v >> 12);
-  return x ^ (x >> 7) ^ (x >> 4);
+  return crc32c_u64(~0u, v);
 }
 
 template<>
@@ -26,13 +30,7 @@ template<>
 inline u64
 hash(const strbuf<DIRSIZ>& v)
 {
-  u64 h = 0;
-  for (int i = 0; i < DIRSIZ && v.buf_[i]; i++) {
-    u64 c = v.buf_[i];
-    // Lifted from dcache.h in Linux v3.3
-    h = (h + (c << 4) + (c >> 4)) * 11;
-  }
-  return h;
+  return crc32c_string(~0u, v.buf_, DIRSIZ);
 }
 
 template<class A>
@@ -46,5 +44,5 @@ template<class A, class B>
 inline u64
 hash(const pair<A, B>& v)
 {
-  return hash(v.first) ^ hash(v.second);
+  return crc32c_u64(hash(v.first), hash(v.second));
 }
@@ -7,6 +7,49 @@
 
 struct pgmap;
 
+// Collects the hardware dirty bits of the PTEs that
+// page_map_cache::invalidate clears, for the npages pages starting at
+// virtual address start.  With per-core page tables, remote cores clear
+// their PTEs while the shootdown is performed, so the bits are only
+// complete after shootdown::perform returns.  Covers at most max_pages
+// pages, so it needs no allocation; callers harvest larger ranges a
+// chunk at a time.
+class dirty_bits
+{
+public:
+  enum { max_pages = 4096 };
+
+private:
+  uintptr_t start_;
+  size_t npages_;
+  std::atomic<u64> bits_[max_pages / 64];
+
+public:
+  dirty_bits(uintptr_t start, size_t npages)
+    : start_(start), npages_(npages), bits_{}
+  {
+    assert(npages <= max_pages);
+  }
+
+  // Record that the page at va was dirty.  Pages outside the range
+  // (which may be swept up by a merged shootdown) are ignored.
+  void set(uintptr_t va)
+  {
+    size_t i = (va - start_) / PGSIZE;
+    if (va < start_ || i >= npages_)
+      return;
+    bits_[i / 64].fetch_or(1ull << (i % 64), std::memory_order_relaxed);
+  }
+
+  bool test(uintptr_t va) const
+  {
+    size_t i = (va - start_) / PGSIZE;
+    if (va < start_ || i >= npages_)
+      return false;
+    return bits_[i / 64].load(std::memory_order_relaxed) & (1ull << (i % 64));
+  }
+};
+
 // A TLB shootdown gatherer that doesn't track anything, but as a
 // result can be batched with other TLB shootdowns.
 class batched_shootdown
@@ -103,7 +146,8 @@ namespace mmu_shared_page_table {
     struct pgmap * const pml4;
 
     void __insert(uintptr_t va, pme_t pte);
-    void __invalidate(uintptr_t start, uintptr_t len, shootdown *sd);
+    void __invalidate(uintptr_t start, uintptr_t len, shootdown *sd,
+                      dirty_bits *dirty);
 
   public:
     page_map_cache();
@@ -133,13 +177,15 @@ namespace mmu_shared_page_table {
     // at @c start.  Any pages that need to be shot-down will have
     // their trackers accumulated in @c sd and cleared.  As for
     // insert, the caller must prevent concurrent use of the same
-    // page tracker.
+    // page tracker.  If @c dirty is non-null, the dirty bits of the
+    // cleared PTEs are recorded in it.
     template<class ForwardIterator>
     void invalidate(uintptr_t start, uintptr_t len,
-                    ForwardIterator tracker_it, shootdown *sd)
+                    ForwardIterator tracker_it, shootdown *sd,
+                    dirty_bits *dirty = nullptr)
     {
       // This page_map_cache doesn't use the page tracker.
-      __invalidate(start, len, sd);
+      __invalidate(start, len, sd, dirty);
     }
 
     // Switch to this page_map_cache on this CPU.
@@ -181,11 +227,13 @@ namespace mmu_per_core_page_table {
     class page_map_cache *cache;
     uintptr_t start, end;
     bitset<NCPU> targets;
+    dirty_bits *dirty;
 
     friend class page_map_cache;
 
   public:
-    constexpr shootdown() : cache(nullptr), start(~0), end(0), targets() { }
+    constexpr shootdown()
+      : cache(nullptr), start(~0), end(0), targets(), dirty(nullptr) { }
 
     void perform() const;
 
@@ -203,8 +251,9 @@ namespace mmu_per_core_page_table {
     percpu<struct pgmap*> pml4;
     friend class shootdown;
 
-    // Clear and TLB flush a region of this core's page table.
-    void clear(uintptr_t start, uintptr_t end);
+    // Clear and TLB flush a region of this core's page table,
+    // recording the cleared PTEs' dirty bits in dirty, if non-null.
+    void clear(uintptr_t start, uintptr_t end, dirty_bits *dirty);
 
   public:
     page_map_cache()
@@ -222,7 +271,8 @@ namespace mmu_per_core_page_table {
 
     template<class ForwardIterator>
     void invalidate(uintptr_t start, uintptr_t len,
-                    ForwardIterator tracker_it, shootdown *sd)
+                    ForwardIterator tracker_it, shootdown *sd,
+                    dirty_bits *dirty = nullptr)
     {
       assert(start + len <= USERTOP);
 
@@ -242,7 +292,7 @@ namespace mmu_per_core_page_table {
       // shooting down its own insert).
       assert(check_critical(NO_SCHED));
       if (present[myid()]) {
-        clear(start, start + len);
+        clear(start, start + len, dirty);
         present.reset(myid());
       }
 
@@ -253,6 +303,10 @@ namespace mmu_per_core_page_table {
       if (present.any()) {
         sd->targets |= present;
         sd->cache = this;
+        if (dirty) {
+          assert(!sd->dirty || sd->dirty == dirty);
+          sd->dirty = dirty;
+        }
         if (start < sd->start)
           sd->start = start;
         if (sd->end < start + len)
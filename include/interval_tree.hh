@@ -0,0 +1,194 @@
+#pragma once
+
+// An interval tree of half-open [lo, hi) ranges, each carrying a value
+// of type T.  This is a treap ordered by (lo, value, node address), in
+// which each node also records the largest hi in its subtree, so a
+// query for the intervals overlapping a range only visits subtrees that
+// can contain one.
+//
+// T must be copyable and have operator<.  The tree does no locking.
+
+template<typename T>
+class interval_tree
+{
+public:
+  struct node
+  {
+    const u64 lo, hi;
+    const T val;
+
+    NEW_DELETE_OPS(node);
+
+  private:
+    friend class interval_tree;
+
+    node(u64 lo, u64 hi, const T &val)
+      : lo(lo), hi(hi), val(val), max_(hi), left_(nullptr), right_(nullptr)
+    {
+      // Any well-mixed function of the address will do for the heap
+      // priority (this is the 64-bit finalizer from MurmurHash3).
+      u64 x = (uptr)this;
+      x ^= x >> 33;
+      x *= 0xff51afd7ed558ccdull;
+      x ^= x >> 33;
+      x *= 0xc4ceb9fe1a85ec53ull;
+      x ^= x >> 33;
+      prio_ = x;
+    }
+
+    u64 max_;                   // Largest hi in this subtree
+    u64 prio_;
+    node *left_, *right_;
+  };
+
+  interval_tree() : root_(nullptr), size_(0) { }
+  interval_tree(const interval_tree &o) = delete;
+  interval_tree &operator=(const interval_tree &o) = delete;
+
+  ~interval_tree()
+  {
+    destroy(root_);
+  }
+
+  size_t size() const
+  {
+    return size_;
+  }
+
+  bool empty() const
+  {
+    return !root_;
+  }
+
+  void insert(u64 lo, u64 hi, const T &val)
+  {
+    assert(lo < hi);
+    root_ = insert(root_, new node(lo, hi, val));
+    size_++;
+  }
+
+  // Remove and free n, which must be in this tree.
+  void erase(node *n)
+  {
+    root_ = erase(root_, n);
+    delete n;
+    size_--;
+  }
+
+  // Call fn(node*) for each interval overlapping [lo, hi), in order.
+  // fn must not modify the tree.
+  template<typename F>
+  void query(u64 lo, u64 hi, F &&fn) const
+  {
+    query(root_, lo, hi, fn);
+  }
+
+private:
+  node *root_;
+  size_t size_;
+
+  static bool less(const node *a, const node *b)
+  {
+    if (a->lo != b->lo)
+      return a->lo < b->lo;
+    if (a->val < b->val)
+      return true;
+    if (b->val < a->val)
+      return false;
+    return a < b;
+  }
+
+  static void update(node *t)
+  {
+    t->max_ = t->hi;
+    if (t->left_ && t->left_->max_ > t->max_)
+      t->max_ = t->left_->max_;
+    if (t->right_ && t->right_->max_ > t->max_)
+      t->max_ = t->right_->max_;
+  }
+
+  // Split t into the nodes ordered before key and the rest.
+  static void split(node *t, const node *key, node **l, node **r)
+  {
+    if (!t) {
+      *l = *r = nullptr;
+    } else if (less(t, key)) {
+      split(t->right_, key, &t->right_, r);
+      *l = t;
+      update(t);
+    } else {
+      split(t->left_, key, l, &t->left_);
+      *r = t;
+      update(t);
+    }
+  }
+
+  // Join l and r, where every node in l is ordered before r.
+  static node *merge(node *l, node *r)
+  {
+    if (!l)
+      return r;
+    if (!r)
+      return l;
+    if (l->prio_ > r->prio_) {
+      l->right_ = merge(l->right_, r);
+      update(l);
+      return l;
+    }
+    r->left_ = merge(l, r->left_);
+    update(r);
+    return r;
+  }
+
+  static node *insert(node *t, node *n)
+  {
+    if (!t)
+      return n;
+    if (n->prio_ > t->prio_) {
+      split(t, n, &n->left_, &n->right_);
+      update(n);
+      return n;
+    }
+    if (less(n, t))
+      t->left_ = insert(t->left_, n);
+    else
+      t->right_ = insert(t->right_, n);
+    update(t);
+    return t;
+  }
+
+  static node *erase(node *t, node *n)
+  {
+    assert(t);
+    if (t == n)
+      return merge(t->left_, t->right_);
+    if (less(n, t))
+      t->left_ = erase(t->left_, n);
+    else
+      t->right_ = erase(t->right_, n);
+    update(t);
+    return t;
+  }
+
+  template<typename F>
+  static void query(node *t, u64 lo, u64 hi, F &fn)
+  {
+    if (!t || t->max_ <= lo)
+      return;
+    query(t->left_, lo, hi, fn);
+    if (t->lo >= hi)
+      return;
+    if (t->hi > lo)
+      fn(t);
+    query(t->right_, lo, hi, fn);
+  }
+
+  static void destroy(node *t)
+  {
+    if (!t)
+      return;
+    destroy(t->left_);
+    destroy(t->right_);
+    delete t;
+  }
+};
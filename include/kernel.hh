@@ -113,6 +113,7 @@ void            iupdate(sref<inode>, transaction *trans);
 void            iunlock(sref<inode>);
 void            drop_bufcache(sref<inode> ip);
 void            itrunc(sref<inode>, u32 offset = 0, transaction *trans = NULL);
+u32             iprealloc(sref<inode>, u32 size, transaction *trans);
 int             readi(sref<inode>, char*, u32, u32);
 void            stati(sref<inode>, struct stat*);
 int             writei(sref<inode>, const char*, u32, u32, transaction *trans = NULL,
@@ -216,6 +217,9 @@ void            yield(void);
 struct proc*    threadalloc(void (*fn)(void*), void *arg);
 struct proc*    threadpin(void (*fn)(void*), void *arg, const char *name, int cpu);
 
+// rtc.cc
+u64             rtc_epoch_nsec(void);
+
 // sampler.c
 void            sampstart(void);
 int             sampintr(struct trapframe*);
@@ -235,6 +239,9 @@ int             steal(void);
 void            addrun(struct proc*);
 int             dwork_push(struct dwork*, int);
 
+// signal.cc
+void            handle_signals(struct trapframe*);
+
 // syscall.c
 int             fetchint64(uptr, u64*);
 int             fetchstr(char*, const char*, u64);
@@ -245,7 +252,7 @@ u64             syscall(u64 a0, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 num)
 // sysfile.cc
 #include "userptr.hh"
 #include "ref.hh"
-int             wait(int, userptr<int>);
+int             wait(int, userptr<int>, int);
 int             doexec(userptr_str upath,
                        userptr<userptr_str> uargv);
 int             fdalloc(sref<file>&& f, int omode);
@@ -255,6 +262,10 @@ sref<mnode>     create(sref<mnode>, const char *, short, short, short, bool);
 // swtch.S
 void            swtch(struct context**, struct context*);
 
+// systimer.cc
+void            timers_exec(struct proc*);
+void            timers_exit(struct proc*);
+
 // trap.c
 extern struct segdesc bootgdt[NSEGS];
 void            pushcli(void);
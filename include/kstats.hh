@@ -78,12 +78,27 @@
   X(uint64_t, write_count)                      \
   X(uint64_t, mnode_alloc)                      \
   X(uint64_t, mnode_free)                       \
+  X(uint64_t, mnode_cache_hit)                  \
+  X(uint64_t, mnode_cache_miss)                 \
+  X(uint64_t, mnode_cache_resize)               \
+  /* mdir::lookup found a name whose mnode was \
+   * freed before it could be revived. */       \
+  X(uint64_t, mnode_lookup_retry)               \
+  /* fstat had to compute a link count. */      \
+  X(uint64_t, mnode_nlink_snap_miss)            \
 
 #define KSTATS_SCHED(X)                         \
   X(uint64_t, sched_tick_count)                 \
   X(uint64_t, sched_blocked_tick_count)         \
   X(uint64_t, sched_delayed_tick_count)         \
 
+// Only counted if SYSCALL_STATS is set.
+#define KSTATS_SYSCALL(X)                       \
+  X(uint64_t, syscall_count)                    \
+  /* Cycles from dispatch to return, including \
+   * argument decoding. */                     \
+  X(uint64_t, syscall_cycles)                   \
+
 #define KSTATS_ALL(X)                           \
   KSTATS_TLB(X)                                 \
   KSTATS_VM(X)                                  \
@@ -92,10 +107,12 @@
   KSTATS_SOCKET(X)                              \
   KSTATS_SCHED(X)                               \
   KSTATS_FILE(X)                                \
+  KSTATS_SYSCALL(X)                             \
 
 struct kstats;
 #ifdef XV6_KERNEL
-DECLARE_PERCPU(struct kstats, mykstats, NO_CRITICAL);
+struct kstats_cpu;
+DECLARE_PERCPU(struct kstats_cpu, mykstats, NO_CRITICAL);
 #endif
 
 struct kstats
@@ -106,10 +123,7 @@ struct kstats
 
 #ifdef XV6_KERNEL
   template<class T>
-  static void inc(T kstats::* field, T delta = 1)
-  {
-    (*mykstats).*field += delta;
-  }
+  static void inc(T kstats::* field, T delta = 1);
 
   class timer
   {
@@ -156,6 +170,66 @@ struct kstats
   }
 };
 
+#ifdef XV6_KERNEL
+// A CPU's kstats.  A CPU counts into early until initkstats moves its
+// counters to a page of their own, which /dev/kstats can map; after
+// that, they are off bytes past early.  (This is an offset rather
+// than a pointer so that a zeroed kstats_cpu is ready to count.)
+struct kstats_cpu
+{
+  kstats early;
+  intptr_t off;
+
+  kstats *get()
+  {
+    return (kstats*)((char*)&early + off);
+  }
+};
+
+template<class T>
+void
+kstats::inc(T kstats::* field, T delta)
+{
+  (*mykstats->get()).*field += delta;
+}
+#endif
+
+// A hash of the types and names of kstats' fields, so readers of the
+// mapped kstats can check they were built against the same fields.
+struct kstats_layout_hash
+{
+  uint64_t h;
+
+  // FNV-1a, one character per step.
+  constexpr kstats_layout_hash operator+(const char *s) const
+  {
+    return *s ? (kstats_layout_hash{(h ^ (uint8_t)*s) * 0x100000001b3ull} +
+                 (s + 1))
+              : *this;
+  }
+};
+
+#define X(type, name) + #type " " #name ";"
+static constexpr uint64_t KSTATS_LAYOUT =
+  (kstats_layout_hash{0xcbf29ce484222325ull} KSTATS_ALL(X)).h;
+#undef X
+
+// The layout of /dev/kstats when it is mmap'd.  The first page is a
+// kstats_header.  CPU i's kstats is at cpu_offset + i * cpu_stride,
+// on a page that only CPU i writes.  Counters are updated in place,
+// without synchronization, so a reader summing them sees each at a
+// slightly different moment.
+#define KSTATS_MAGIC 0x73746174736b3676ull  // "v6kstats"
+
+struct kstats_header
+{
+  uint64_t magic;
+  uint64_t layout;              // KSTATS_LAYOUT
+  uint64_t ncpu;
+  uint64_t cpu_offset;
+  uint64_t cpu_stride;
+};
+
 __attribute__((unused))
 static void
 to_stream(print_stream *s, const kstats &o)
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "ilist.hh"
+#include <atomic>
+
+// A kernel timer.  Subclasses implement expire(), which runs in the
+// timer interrupt of the core that armed the timer, so it must not
+// sleep.  Each core keeps its own queue of armed timers, ordered by
+// deadline, so arming and expiring timers never touches another core's
+// state.
+//
+// Deadlines are absolute nsectime() values.  They are rounded up to a
+// multiple of the timer's slack, so timers with nearby deadlines expire
+// together in one pass over the queue.
+struct ktimer {
+  enum { default_slack_ns = 50000 };
+
+  ktimer() : deadline_(0), interval_(0), slack_(default_slack_ns),
+             cpu_(-1), running_(false) {}
+  virtual ~ktimer() {}
+
+  // Called with the number of periods that have elapsed since the last
+  // expiry (1, unless the timer fell behind).
+  virtual void expire(u64 nexp) = 0;
+
+  // Arm the timer to expire at deadline and then every interval
+  // nanoseconds (or only once if interval is 0).  Cancels any earlier
+  // arming first.  A deadline of 0 just cancels.
+  void arm(u64 deadline, u64 interval);
+
+  // Disarm the timer, waiting for a running expire() to finish.
+  void cancel();
+
+  // The next deadline, or 0 if the timer isn't armed.
+  u64 deadline() const { return deadline_; }
+  u64 interval() const { return interval_; }
+  void set_slack(u64 ns) { slack_ = ns ? ns : 1; }
+
+  ilink<ktimer> link_;
+
+private:
+  u64 deadline_;
+  u64 interval_;
+  u64 slack_;
+  std::atomic<int> cpu_;        // Queue this timer is on, or -1
+  std::atomic<bool> running_;   // expire() is in progress
+
+  friend void ktimer_expire(void);
+};
+
+// Run the timers that have expired on this core.  Called from every
+// core's timer interrupt.
+void ktimer_expire(void);
+
+// The LAPIC timer is one-shot where it can be: each core arms it for the
+// earlier of its next scheduling tick and its earliest ktimer deadline,
+// so timers expire on time rather than at the next tick.  The timer
+// interrupt calls ktimer_tick to learn whether this interrupt is also a
+// scheduling tick, and ktimer_rearm, after running the timers, to arm
+// the next one.
+bool ktimer_tick(void);
+void ktimer_rearm(void);
@@ -33,6 +33,17 @@ public:
     }
   }
 
+  // Like above, but *vp, the pointer to the value, is itself updated
+  // under seq, so it is reloaded on every attempt.
+  seq_reader(T* const* vp, const seqcount<u32>* seq) {
+    for (;;) {
+      auto r = seq->read_begin();
+      state_ = **(T* const volatile*)vp;
+      if (!r.need_retry())
+        return;
+    }
+  }
+
   const T* operator->() const {
     return &state_;
   }
@@ -6,12 +6,15 @@
 extern u64 root_mnum;
 extern mfs* root_fs;
 extern mfs* anon_fs;
+extern sref<mnode> shm_root;  // Directory of shm_open objects
 
 sref<mnode> namei(sref<mnode> cwd, const char* path);
 sref<mnode> nameiparent(sref<mnode> cwd, const char* path, strbuf<DIRSIZ>* buf);
 s64 readm(sref<mnode> m, char* buf, u64 start, u64 nbytes);
 s64 writem(sref<mnode> m, const char* buf, u64 start, u64 nbytes,
            mfile::resizer* resize = nullptr);
+s64 copym(sref<mnode> in, u64 in_start, sref<mnode> out, u64 out_start,
+          u64 nbytes);
 
 class print_stream;
 void mfsprint(print_stream *s);
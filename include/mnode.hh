@@ -5,6 +5,9 @@
 #include "chainhash.hh"
 #include "radix_array.hh"
 #include "page_info.hh"
+#include "rmap.hh"
+#include "mnodecache.hh"
+#include "kstats.hh"
 #include "kalloc.hh"
 #include "fs.h"
 #include "scalefs.hh"
@@ -26,6 +29,7 @@ class mnode : public refcache::weak_referenced
 {
 private:
   friend class mfs;
+  friend class mnode_cache;
   struct mnumber {
     u64 v_;
     static const int type_bits = 8;
@@ -43,6 +47,10 @@ private:
     u8 type() {
       return v_ & ((1 << type_bits) - 1);
     }
+
+    u64 cpu() {
+      return (v_ >> type_bits) & ((1 << cpu_bits) - 1);
+    }
   };
 
 public:
@@ -75,20 +83,40 @@ public:
   class linkcount : public FS_NLINK_REFCOUNT referenced {
   public:
     linkcount() {};
+    // These hide referenced's, so every link count change, whether
+    // through an sref<linkcount> or directly, invalidates fstat's
+    // snapshot of it.
+    void inc();
+    void dec();
     void onzero() override;
   };
 
   mfs* const fs_;
   const u64 mnum_;
   linkcount nlink_ __mpalign__;
+private:
+  // fstat's snapshot of nlink_: the count, valid and pending bits, and
+  // above them a generation.  A link count change bumps the generation
+  // only if a snapshot is valid or being taken, so while links churn
+  // without fstats, changes just read this.  It's read whenever nlink_
+  // changes, so it shares nlink_'s line.
+  std::atomic<u64> nlink_snap_;
   __padout__;
 
+public:
+  // Return the link count for fstat.  This is usually a snapshot
+  // published by an earlier call, which costs a load of a line that
+  // only changes with the link count.  Computing the count afresh
+  // reads every CPU's refcache.
+  u64 stat_nlink();
+
 protected:
   mnode(mfs* fs, u64 mnum);
   std::atomic<bool> initialized_;
 
 private:
   void onzero() override;
+  void nlink_changed();
 
   std::atomic<bool> cache_pin_;
   std::atomic<bool> dirty_;
@@ -151,12 +179,17 @@ class mfs {
 private:
   friend class mnode;
   percpu<u64> next_mnum_;
+  mnode_cache cache_;
 
 public:
   NEW_DELETE_OPS(mfs);
 
   sref<mnode> mget(u64 mnum);
   mlinkref alloc(u8 type, u64 parent_mnum = 0);
+  void cache_stats(struct mnode_cache::stats *stats) const
+  {
+    cache_.get_stats(stats);
+  }
   sleeplock dir_rename_lock __mpalign__;
 };
 
@@ -258,6 +291,7 @@ public:
        * Retry the lookup.  Crash if we repeatedly can't find
        * the same mnode (to make such bugs easier to track down).
        */
+      kstats::inc(&kstats::mnode_lookup_retry);
       assert(mnum != mprev);
       mprev = mnum;
     }
@@ -369,7 +403,7 @@ mnode::as_dir() const
 class mfile : public mnode {
 private:
   mfile(mfs* fs, u64 mnum, u64 parent_mnum) : mnode(fs, mnum),
-        parent_mnum_(parent_mnum), size_(0) {}
+        parent_mnum_(parent_mnum), size_(0), shared_mapped_(false) {}
   NEW_DELETE_OPS(mfile);
   friend class mnode;
   friend class mfs;
@@ -521,6 +555,12 @@ private:
   // Only one fsync can execute on the mnode at a time
   sleeplock fsync_lock_;
 
+  // The vmaps that map this file's pages
+  file_rmap rmap_;
+  // Set once any vmap maps this file shared.  Only then can writes to it
+  // be sitting in PTE dirty bits.
+  std::atomic<bool> shared_mapped_;
+
 public:
   class resizer : public lock_guard<sleeplock>,
                   public seq_writer {
@@ -537,7 +577,9 @@ public:
     u64 read_size() { return mf_->size_; }
     void resize_nogrow(u64 size);
     void resize_append(u64 size, sref<page_info> pi);
+    bool resize_grow(u64 size);
     void initialize_from_disk(u64 size);
+    void extend_from_disk(u64 size);
   };
 
   resizer write_size() {
@@ -548,10 +590,22 @@ public:
     return seq_reader<u64>(&size_, &size_seq_);
   }
 
+  file_rmap *rmap() { return &rmap_; }
+
+  void note_shared_mapping()
+  {
+    if (!shared_mapped_.load(std::memory_order_relaxed))
+      shared_mapped_ = true;
+  }
+  bool shared_mapped() const { return shared_mapped_; }
+
   page_state get_page(u64 pageidx);
   void put_page(u64 pageidx);
   void set_page_dirty(u64 pageidx);
+  void harvest_mappings();
   void sync_file(int cpu);
+  void fsync();
+  bool preallocate(u64 newsize);
   void remove_pgtable_mappings(u64 start_offset);
   void drop_pagecache();
 };
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "spinlock.hh"
+#include "refcache.hh"
+
+#include <atomic>
+
+class mnode;
+
+// The cache of an mfs's live mnodes, indexed by mnode number.  It holds
+// only weak references, so an mnode stays cached for as long as
+// anything else references it.
+//
+// The cache is split into one shard per CPU, and an mnode lives in the
+// shard of the CPU that allocated it (the CPU encoded in its mnode
+// number).  Inserts and removals happen on that CPU and so almost never
+// contend.  Each shard is a chained hash table that doubles in size as
+// it fills, so the cache costs nothing until it is used and grows with
+// the number of mnodes instead of being sized up front.
+//
+// Lookups are lock-free: they walk a bucket chain inside a GC epoch and
+// revive the mnode through its weak reference, and they write nothing
+// in the shard, so concurrent lookups of the same directory don't
+// bounce its cache lines between cores.
+class mnode_cache
+{
+public:
+  struct stats
+  {
+    size_t items;
+    size_t total_buckets, used_buckets;
+    size_t max_chain;
+  };
+
+  mnode_cache() = default;
+  ~mnode_cache();
+  mnode_cache(const mnode_cache &o) = delete;
+  mnode_cache &operator=(const mnode_cache &o) = delete;
+
+  // Return the cached mnode numbered mnum, or null if there is none.
+  sref<mnode> lookup(u64 mnum) const;
+
+  // Cache m as mnode mnum.  Returns false if mnum is already cached.
+  bool insert(u64 mnum, mnode *m);
+
+  // Remove the entry whose weak reference is refp, as the mnode it
+  // refers to is freed.
+  void cleanup(refcache::weakref<refcache::weak_referenced> *refp);
+
+  void get_stats(struct stats *stats) const;
+
+private:
+  struct item;
+  struct table;
+
+  struct shard
+  {
+    spinlock lock_;
+    std::atomic<table*> table_;
+    size_t items_;
+    // Set while a replaced table may still have readers.  Its chains
+    // run through the other of each item's two links, so the shard
+    // can't grow again until it is freed.
+    std::atomic<bool> retiring_;
+
+    constexpr shard()
+      : lock_("mnode_cache::shard", LOCKSTAT_FS), table_(nullptr),
+        items_(0), retiring_(false) { }
+
+    void grow();
+    void remove(item *victim);
+  } __mpalign__;
+
+  shard shards_[NCPU];
+
+  const shard *shard_for(u64 mnum) const;
+  shard *shard_for(u64 mnum)
+  {
+    return const_cast<shard*>(
+      const_cast<const mnode_cache*>(this)->shard_for(mnum));
+  }
+};
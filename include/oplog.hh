@@ -356,6 +356,12 @@ namespace oplog {
                        cb.get_timestamp(), std::forward<CB>(cb)));
     }
 
+    // Number of operations logged since the last flush.
+    size_t size() const
+    {
+      return ops_.size();
+    }
+
     static bool compare_tsc(const std::unique_ptr<op> &op1, const std::unique_ptr<op> &op2) {
       return (op1->tsc < op2->tsc);
     }
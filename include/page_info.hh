@@ -70,94 +70,6 @@ protected:
   }
 
 public:
-  typedef std::pair<vmap*, uptr> rmap_entry;
-  // rmap is a reverse map of the vmaps that contain a mapping for the page
-  // corresponding to this page_info. Rmap is implemented using oplog and is
-  // used when a file page is no longer valid and the vmaps mapping it need to
-  // be informed of the change.
-  #define MAX_OPS 1000000
-  class rmap: public tsc_logged_object {
-    public:
-      rmap(bool use_sleeplock) : tsc_logged_object(use_sleeplock) {}
-
-      NEW_DELETE_OPS(rmap);
-      // Oplog operation that implements adding a <vmap*,va> pair to the rmap
-      struct add_op {
-        add_op(rmap *p, rmap_entry map): parent(p), mapping(map) {
-          assert(p);
-        }
-        void operator()() {
-          std::vector<rmap_entry>::iterator it;
-          it = std::find(parent->rmap_vec.begin(), parent->rmap_vec.end(), mapping);
-          if(it == parent->rmap_vec.end())
-            parent->rmap_vec.push_back(std::move(mapping));
-        }
-        void print() {
-          cprintf("Rmap::add_op rmap:%016lX vmap:%016lX va:%016lX\n", 
-                      (u64)parent, (u64)mapping.first, mapping.second); 
-        }
-        private:
-        rmap *parent;
-        rmap_entry mapping;
-      };
-
-      // Oplog operation that implements removing a <vmap*,va> pair from the rmap
-      struct rem_op {
-        rem_op(rmap *p, rmap_entry map): parent(p), mapping(map) {
-          assert(p);
-        }
-        void operator()() {
-          if (parent->rmap_vec.size() == 0) return;
-          std::vector<rmap_entry>::iterator it;
-          it = std::find(parent->rmap_vec.begin(), parent->rmap_vec.end(), mapping);
-          if(it != parent->rmap_vec.end()) {
-            it->first = parent->rmap_vec.back().first;
-            it->second = parent->rmap_vec.back().second;
-            parent->rmap_vec.pop_back();
-          }
-        }
-        void print() {
-          cprintf("Rmap::rem_op rmap:%016lX vmap:%016lX va:%016lX\n", 
-                      (u64)parent, (u64)mapping.first, mapping.second);
-        }
-        private:
-        rmap *parent;
-        rmap_entry mapping;
-      };
-
-      void add_mapping(rmap_entry map) {
-        get_logger(myid())->push<add_op>(add_op(this, map));
-      }
-
-      void remove_mapping(rmap_entry map) {
-        get_logger(myid())->push<rem_op>(rem_op(this, map));
-      }
-
-      void sync(std::vector<rmap_entry> &vec) {
-        auto guard = synchronize_with_spinlock();
-        for (auto it = rmap_vec.begin(); it != rmap_vec.end(); it++)
-          vec.emplace_back(*it);
-        rmap_vec.clear();
-      }
-
-      void sync() {
-        auto guard = synchronize_with_spinlock();
-      }
-
-    protected:
-      std::vector<rmap_entry> rmap_vec;
-  };
-
-  page_info() {
-    rmap_pte = new rmap(false); // use_sleeplock = false.
-    for (int cpu = 0; cpu < NCPU; cpu++)
-      outstanding_ops[cpu] = 0;
-  }
-
-  ~page_info() {
-    delete rmap_pte;
-  }
-
   // Only placement new is allowed, because page_info must only be
   // constructed in the page_info_array.
   static void* operator new(unsigned long nbytes, page_info *buf)
@@ -199,43 +111,5 @@ public:
   {
     return p2v(pa());
   }
-
-  // Add an entry to the rmap for this page
-  void add_pte(rmap_entry map) {
-    assert(rmap_pte);
-    int cpu = myid();
-    if (outstanding_ops[cpu] > MAX_OPS) {
-      rmap_pte->sync();
-      outstanding_ops[cpu] = 0;
-    }
-    rmap_pte->add_mapping(map);
-    outstanding_ops[cpu]++;
-  }
-
-  // Remove an entry from the rmap for this page
-  void remove_pte(rmap_entry map) {
-    assert(rmap_pte);
-    int cpu = myid();
-    if (outstanding_ops[cpu] > MAX_OPS) {
-      rmap_pte->sync();
-      outstanding_ops[cpu] = 0;
-    }
-    rmap_pte->remove_mapping(map);
-    outstanding_ops[cpu]++;
-  }
-
-  // Synchronizes the oplog-maintained rmap and returns the <vmap, vaddr> pairs
-  // that have this page mapped.
-  void get_rmap_vector(std::vector<rmap_entry> &vec) {
-    assert(rmap_pte);
-    int cpu = myid();
-    rmap_pte->sync(vec);
-    outstanding_ops[cpu] = 0;
-  }
-
-private:
-  rmap *rmap_pte;
-  percpu<u64> outstanding_ops;
-
 } __attribute__((aligned(16)));
 
@@ -9,9 +9,11 @@
 #include "ilist.hh"
 #include <stdexcept>
 #include "vmalloc.hh"
+#include "gc.hh"
 
 struct pgmap;
 struct gc_handle;
+struct proc_timers;
 class filetable;
 class mnode;
 
@@ -58,6 +60,27 @@ typedef enum procstate {
 
 #define PROC_MAGIC 0xfeedfacedeadd00dULL
 
+// A signal waiting for delivery, on proc::sig_queue.  Entries are
+// normally allocated by post_signal; a preallocated entry is owned by
+// whoever supplied it and is never freed by the signal code, and is
+// queued at most once at a time.
+struct sigqueued {
+  ilink<sigqueued> link;
+  siginfo_t info;
+  bool prealloc = false;
+  bool queued = false;          // On a sig_queue; protected by its sig_lock
+  NEW_DELETE_OPS(sigqueued);
+};
+
+// Hands a reaped proc back to the proc cache once every GC epoch that
+// could have found it through the pid table has ended.
+struct proc_reaper : public rcu_freed {
+  struct proc *p;
+  proc_reaper(struct proc *owner)
+    : rcu_freed("proc", this, sizeof(*this)), p(owner) {}
+  virtual void do_gc(void) override;
+};
+
 // Per-process state
 struct proc {
   sref<vmap> vmap;             // va -> vma
@@ -80,6 +103,8 @@ struct proc {
   struct spinlock lock;
   ilink<proc> child_next;
   ilist<proc,&proc::child_next> childq;
+  ilink<proc> zombie_next;
+  ilist<proc,&proc::zombie_next> zombieq; // Exited children, for wait()
   ilink<proc> sched_link;
   struct condvar *cv;          // for waiting till children exit
   struct gc_handle *gc;
@@ -111,6 +136,21 @@ struct proc {
   u64 magic;
   uptr unmapped_hint;
   sigaction sig[NSIG];
+  bool on_zombieq;             // On parent->zombieq; protected by parent->lock
+
+  // Pending signals.  sig_pending has a bit set for each signal with an
+  // entry on sig_queue, so the return-to-user path can test for work
+  // without taking sig_lock.  sig_blocked is only written by this proc
+  // itself (each thread is its own proc), so it needs no lock.
+  struct spinlock sig_lock;
+  ilist<sigqueued,&sigqueued::link> sig_queue; // Ordered by arrival
+  std::atomic<u64> sig_pending;
+  std::atomic<u64> sig_blocked;
+  u32 sig_nqueued;             // Entries on sig_queue
+  sigqueued sigchld_q;         // Used for SIGCHLD, so exit() never allocates
+  struct condvar *sig_cv;      // For sigtimedwait and signalfd readers
+  struct proc_timers *timers;  // setitimer and timer_create timers
+  proc_reaper reaper;          // Defers recycling past pid_lookup users
 
   static proc* alloc();
   void         set_state(procstate_t s);
@@ -127,13 +167,21 @@ struct proc {
 
   static u64   hash(const u32& p);
 
-  bool deliver_signal(int signo);
+  static int   signal(int pid, const siginfo_t &info);
+  int          post_signal(const siginfo_t &info, sigqueued *rec = nullptr);
+  int          queue_signal(const siginfo_t &info, sigqueued *rec, bool *wake);
+  void         unqueue_signal(sigqueued *rec);
+  bool         dequeue_signal(u64 set, siginfo_t *info);
+  bool         setup_frame(struct trapframe *tf, int signo,
+                           const siginfo_t &info);
+  void         flush_signals(void);
 
   ~proc(void);
   NEW_DELETE_OPS(proc);
 
 private:
   proc(int npid);
+  void reinit(int npid);
   proc& operator=(const proc&);
   proc(const proc& x);
   
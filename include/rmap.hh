@@ -0,0 +1,113 @@
+#pragma once
+
+#include "oplog.hh"
+#include "interval_tree.hh"
+
+#include <vector>
+
+struct vmap;
+
+// A file's reverse map: the set of vmaps that map each range of the
+// file's pages.  Like Linux's i_mmap, this is kept per file and per
+// mapping rather than per page, so mapping a file costs one entry no
+// matter how many of its pages are resident, and finding the mappers
+// of a page (for truncate or eviction) is a query on an interval tree
+// of file page indexes.
+//
+// Mappings change on every mmap, munmap, fork and exit of a process
+// mapping the file, while the rmap is only read to truncate the file or
+// evict its pages.  Changes are therefore logged with OpLog and applied
+// in timestamp order when the rmap is read.
+class file_rmap : public oplog::tsc_logged_object
+{
+public:
+  // A vmap that maps file page i at virtual address start + i*PGSIZE.
+  struct mapper
+  {
+    vmap *vm;
+    intptr_t start;
+
+    bool operator<(const mapper &o) const
+    {
+      return vm < o.vm || (vm == o.vm && start < o.start);
+    }
+
+    bool operator==(const mapper &o) const
+    {
+      return vm == o.vm && start == o.start;
+    }
+  };
+
+  // File pages [lo, hi) are mapped by m.
+  struct range
+  {
+    mapper m;
+    u64 lo, hi;
+  };
+
+  file_rmap() : tsc_logged_object(false) { }
+
+  ~file_rmap()
+  {
+    clear_loggers();
+  }
+
+  // Record that m maps (or no longer maps) file pages [lo, hi).
+  void add(const mapper &m, u64 lo, u64 hi)
+  {
+    log(op(this, op::ADD, m, lo, hi));
+  }
+
+  void remove(const mapper &m, u64 lo, u64 hi)
+  {
+    log(op(this, op::REMOVE, m, lo, hi));
+  }
+
+  // Append to out the mapped ranges that overlap file pages [lo, hi),
+  // clipped to [lo, hi).
+  void lookup(u64 lo, u64 hi, std::vector<range> *out);
+
+  // Like lookup, but also remove the returned ranges from the rmap.
+  // The caller must then unmap them.
+  void take(u64 lo, u64 hi, std::vector<range> *out);
+
+private:
+  // Bound on the operations a core logs for one rmap before it applies
+  // them, so that the logs of a file that is mapped and unmapped over
+  // and over, but never truncated, don't grow without bound.
+  enum { max_logged_ops = 4096 };
+
+  struct op
+  {
+    enum type { ADD, REMOVE };
+
+    op(file_rmap *parent, type t, const mapper &m, u64 lo, u64 hi)
+      : parent(parent), t(t), m(m), lo(lo), hi(hi) { }
+
+    void operator()()
+    {
+      if (t == ADD)
+        parent->apply_add(m, lo, hi);
+      else
+        parent->apply_remove(m, lo, hi);
+    }
+
+    void print()
+    {
+      cprintf("file_rmap::op %s rmap:%016lX vmap:%016lX start:%016lX "
+              "[%lu,%lu)\n", t == ADD ? "add" : "remove", (u64)parent,
+              (u64)m.vm, (u64)m.start, lo, hi);
+    }
+
+    file_rmap *parent;
+    type t;
+    mapper m;
+    u64 lo, hi;
+  };
+
+  void log(op &&o);
+  void apply_add(const mapper &m, u64 lo, u64 hi);
+  void apply_remove(const mapper &m, u64 lo, u64 hi);
+
+  interval_tree<mapper> tree_;
+};
@@ -12,6 +12,7 @@
 class mnode;
 class transaction;
 class mfs_interface;
+struct sync_job;
 class mfs_operation;
 class mfs_operation_create;
 class mfs_operation_link;
@@ -58,7 +59,9 @@ struct tx_queue_info {
 // list in the transaction object.
 struct transaction_diskblock {
   u32 blocknum;           // The disk block number
-  char *blockdata;        // Disk block contents
+  sref<bufpage> page;     // Disk block contents, possibly shared with the
+                          // buffer cache, which won't modify them again.
+  char *blockdata;        // page->data
   u64 timestamp;          // Updates within a transaction should be written out
                           // in timestamp order. A single disk block might have
                           // been updated several times, but the changes not
@@ -68,25 +71,21 @@ struct transaction_diskblock {
 
   NEW_DELETE_OPS(transaction_diskblock);
 
+  transaction_diskblock(u32 n, const sref<bufpage> &p)
+    : blocknum(n), page(p), blockdata(p->data), timestamp(get_tsc()) {}
+
   transaction_diskblock(u32 n, char buf[BSIZE])
+    : blocknum(n), page(make_sref<bufpage>()), blockdata(page->data),
+      timestamp(get_tsc())
   {
-    blockdata = (char *) kmalloc(BSIZE, "transaction_diskblock");
-    blocknum = n;
     memmove(blockdata, buf, BSIZE);
-    timestamp = get_tsc();
   }
 
   transaction_diskblock(u32 n, char buf[BSIZE], u64 blk_timestamp)
+    : blocknum(n), page(make_sref<bufpage>()), blockdata(page->data),
+      timestamp(blk_timestamp)
   {
-    blockdata = (char *) kmalloc(BSIZE, "transaction_diskblock");
-    blocknum = n;
     memmove(blockdata, buf, BSIZE);
-    timestamp = blk_timestamp;
-  }
-
-  ~transaction_diskblock()
-  {
-    kmfree(blockdata, BSIZE);
   }
 
   transaction_diskblock(const transaction_diskblock&) = delete;
@@ -168,6 +167,12 @@ class transaction {
       add_block(std::move(b));
     }
 
+    // Same, but share the block's page instead of copying it.
+    void add_block(u32 bno, const sref<bufpage> &page)
+    {
+      add_block(new transaction_diskblock(bno, page));
+    }
+
     void add_block(transaction_diskblock *b)
     {
       blocks.push_back(std::move(b));
@@ -213,6 +218,9 @@ class transaction {
 
       for (auto &bno : dirty_blocknums) {
         sref<buf> bp = buf::get(1, bno);
+        // add_to_transaction() shares bp's page, so no writer may still
+        // be modifying it.
+        auto locked = bp->write_clean();
         bp->add_to_transaction(this);
       }
 
@@ -607,7 +615,12 @@ class mfs_interface
       // The following fields are used only if this is a start block.
       u8 num_addr_blocks; // No. of address-blocks that follow the start block.
       u8 padding[2];
-      u32 blocknums[1021]; // Block numbers of the data blocks in the transaction.
+      union {
+        u32 blocknums[1021]; // Block numbers of the data blocks in the transaction.
+        // In a commit block: CRC32C of the transaction's start block and
+        // data blocks, so recovery can tell if they were written intact.
+        u32 checksum;
+      };
 
     } journal_header;
 
@@ -720,6 +733,7 @@ class mfs_interface
     void create_file(u64 mnum, u8 type, transaction *tr);
     void create_dir(u64 mnum, u64 parent_mnum, u8 type, transaction *tr);
     void truncate_file(u64 mfile_mnum, u32 offset, transaction *tr);
+    u32 preallocate_file(u64 mfile_mnum, u32 size, transaction *tr);
 
     // Directory functions
     void initialize_dir(sref<mnode> m);
@@ -753,18 +767,18 @@ class mfs_interface
     void print_txq_stats();
     bool fits_in_journal(size_t num_trans_blocks, int cpu);
     void write_journal(char *buf, size_t size, transaction *tr, int cpu);
-    void write_journal_transaction_blocks(const
+    u32 write_journal_transaction_blocks(const
            std::vector<transaction_diskblock*> &vec, const u64 timestamp,
            bitset<NDISK> &disks_written, int cpu);
-    void write_journal_commit_block(u64 timestamp, int cpu);
+    void write_journal_commit_block(u64 timestamp, u32 checksum, int cpu);
     void write_journal_skip_block(u64 timestamp, int cpu,
                                   bool use_async_io = true);
 
     bool get_txn_skip_block(int cpu, u64 *skip_upto_tsc);
     journal_header *get_txn_start_block(int cpu);
     bool get_txn_data_blocks(int cpu, journal_header *hdstartptr,
-                             transaction *trans);
-    bool get_txn_commit_block(int cpu, transaction *trans);
+                             transaction *trans, u32 *checksum);
+    bool get_txn_commit_block(int cpu, transaction *trans, u32 checksum);
     void recover_journal(int cpu, std::vector<transaction*> &trans_vec);
     void reset_journal(int cpu);
     void init_journal(int cpu);
@@ -784,7 +798,9 @@ class mfs_interface
     void sync_dirty_files_and_dirs(int cpu, std::vector<u64> &mnum_list);
     void evict_bufcache();
     void evict_pagecache();
-    void process_metadata_log_and_flush(int cpu);
+    void process_metadata_log_and_flush();
+    void process_subtree_and_flush(sref<mnode> root);
+    void sync_share(sync_job *job, int worker);
     void process_metadata_log(u64 max_tsc, u64 mnode_mnum, int cpu);
     void add_op_to_transaction_queue(mfs_operation *op, int cpu,
                                      transaction *tr = nullptr,
@@ -811,8 +827,9 @@ class mfs_interface
 
     // Block allocator functionality
     void initialize_freeblock_bitmap();
-    u32  alloc_block();
+    u32  alloc_block(u32 goal = 0);
     void free_block(u32 bno);
+    void free_blocks(const std::vector<u32> &blocks);
     void print_free_blocks(print_stream *s);
 
     enum {
@@ -11,6 +11,12 @@
 // per-CPU data nice (unlike creating arrays for each variable), and
 // makes it easy to associate per-CPU variables with the appropriate
 // NUMA nodes.
+//
+// Each CPU's region starts on a cache line, and no two CPUs' regions
+// share one, so per-CPU variables that only their own CPU touches need
+// no padding; packing them keeps a CPU's hot per-CPU data on few lines.
+// A variable that other CPUs write (or read while its CPU writes it)
+// should be __mpalign__ so it doesn't drag its neighbors along.
 
 #pragma once
 
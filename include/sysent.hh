@@ -0,0 +1,59 @@
+#pragma once
+
+// System call dispatch table.  tools/syscalls.py --kvectors generates,
+// for each //SYSCALL, a stub that decodes the raw argument registers
+// into the handler's declared argument types and calls it directly, and
+// a table of these stubs indexed by system call number.
+
+#include "memlayout.h"
+#include "userptr.hh"
+
+// Decodes a raw argument register into a handler argument of type T.
+// check() runs before the handler is entered, so an argument that can
+// never be valid fails the system call without calling the handler.
+template<typename T>
+struct sysarg
+{
+  static constexpr bool check(u64 v) { return true; }
+  static T decode(u64 v) { return (T)v; }
+};
+
+// A userptr must be null or start below USERTOP.  The extent is checked
+// when it is loaded or stored, since its type may be incomplete here.
+template<typename T>
+struct sysarg<userptr<T> >
+{
+  static constexpr bool check(u64 v) { return v < USERTOP; }
+  static userptr<T> decode(u64 v) { return userptr<T>((T*)v); }
+};
+
+// userptr<void> arguments are often address hints or ranges (mmap,
+// munmap, madvise), which their handlers bounds-check themselves.
+template<>
+struct sysarg<userptr<void> >
+{
+  static constexpr bool check(u64 v) { return true; }
+  static userptr<void> decode(u64 v) { return userptr<void>((void*)v); }
+};
+
+// Only the start of a string can be checked here; userptr_str::load
+// and load_alloc bound its length.
+template<>
+struct sysarg<userptr_str>
+{
+  static constexpr bool check(u64 v) { return v < USERTOP; }
+  static userptr_str decode(u64 v) { return userptr_str((const char*)v); }
+};
+
+struct sysent
+{
+  u64 (*fn)(u64, u64, u64, u64, u64, u64);
+  const char *name;
+  // Set by "fast": true in the //SYSCALL annotation, for system calls
+  // that never sleep, allocate, or throw.  syscall() calls these
+  // directly, without the retry loop or mtrace bookkeeping.
+  bool fast;
+};
+
+extern const struct sysent syscalls[];
+extern const int nsyscalls;
@@ -48,6 +48,10 @@ struct vmdesc : public mmu::page_tracker
 
     // Set if the page should be shared across fork().
     FLAG_SHARED = 1<<5,
+
+    // Set if the page may never be made writeable, because what it maps
+    // only allowed a read-only mapping.  mprotect refuses FLAG_WRITE.
+    FLAG_NOWRITE = 1<<6,
   };
 
   // Flags
@@ -125,7 +129,12 @@ void to_stream(class print_stream *s, const vmdesc &vmd);
 
 // An address space. This manages the mapping from virtual addresses
 // to virtual memory descriptors.
-struct vmap : public referenced {
+//
+// Files find the vmaps that map them through their rmaps, which hold
+// plain pointers.  A vmap whose last reference goes away leaves the
+// rmaps at once, but its memory is only freed through gc, so an rmap
+// walker inside a GC epoch may still use any vmap it found.
+struct vmap : public referenced, public rcu_freed {
   static sref<vmap> alloc();
 
   // Copy this vmap's structure and share pages copy-on-write.
@@ -138,13 +147,19 @@ struct vmap : public referenced {
   // Unmap from virtual addresses start to start+len.
   int remove(uptr start, uptr len);
 
-  // Unmap a single virtual page. Called when the mapped file page has been
-  // truncated (or swapped out). The entry is unset from vpfs_ as well.
-  void delete_mapping(uptr addr);
+  // Unmap pages [lo, hi) of file m, which this vmap maps at start (see
+  // vmdesc::start).  Called when those pages have been truncated, after
+  // removing them from m's rmap.  The entries are unset from vpfs_.
+  void unmap_file(const mnode *m, intptr_t start, u64 lo, u64 hi);
+
+  // Harvest the dirty bits of pages [lo, hi) of a file this vmap maps
+  // at start (see harvest_dirty).  Used to sync the file.
+  void harvest_file(intptr_t start, u64 lo, u64 hi);
 
-  // Unmap a single virtual page, but don't unset it from vpfs_. Clear the
-  // mapping from vmdesc. Used while evicting pages from the page-cache.
-  void clear_mapping(uptr addr);
+  // Unmap a single virtual page if it maps pi, but don't unset it from
+  // vpfs_. Clear the mapping from vmdesc. Used while evicting pages from
+  // the page-cache.
+  void clear_mapping(uptr addr, const page_info *pi);
 
   // Populate vmdesc's.
   int willneed(uptr start, uptr len);
@@ -152,6 +167,14 @@ struct vmap : public referenced {
   // Invalidate page caches.
   int invalidate_cache(uptr start, uptr len);
 
+  // Move the hardware dirty bits of shared file mappings in [start,
+  // start+len) into their files' page caches, write-protecting the pages
+  // so that later writes are caught again.  Adds each file mapped shared
+  // in the range to *files, if files is non-null.  Returns the number
+  // of dirty pages found, or -1 if part of the range is unmapped.
+  ssize_t harvest_dirty(uptr start, uptr len,
+                        std::vector<sref<mnode> > *files);
+
   // Modify protection on a range.  flags must be 0 or FLAG_MAPPED.
   int mprotect(uptr start, uptr len, uint64_t flags);
 
@@ -193,6 +216,8 @@ private:
   vmap& operator=(const vmap&);
   ~vmap();
   NEW_DELETE_OPS(vmap)
+  void onzero() override;
+  void do_gc() override { delete this; }
   uptr unmapped_area(size_t n);
 
   mmu::page_map_cache cache;
@@ -216,4 +241,12 @@ private:
   // allocated and cannot be.
   page_info *ensure_page(const vpf_array::iterator &it, access_type type,
                          bool *allocated = nullptr);
+
+  // harvest_dirty for [begin, end), which the caller has locked.
+  size_t harvest_dirty(const vpf_array::iterator &begin,
+                       const vpf_array::iterator &end,
+                       std::vector<sref<mnode> > *files);
+  // One chunk of that, at most dirty_bits::max_pages long.
+  size_t harvest_chunk(const vpf_array::iterator &begin,
+                       const vpf_array::iterator &end);
 };
@@ -2,5 +2,24 @@
 
 #include "types.h"
 
-int zlib_decompress(unsigned char *src, u64 srclen, u64 dstlen,
-                    void (*copy_output)(const char *buf, u64 offset, u64 size));
+// fsimgz_decompress flags.
+enum {
+  // Output the blocks of hole chunks as zeroes, rather than skipping them.
+  FSIMGZ_FILL_HOLES = 1,
+  // Unpack the chunks holding the file system's metadata (the boot
+  // block through the last bitmap block) in order on the calling core,
+  // before any other chunk.
+  FSIMGZ_METADATA_FIRST = 2,
+  // Call copy_output only on the calling core, in order of offset.
+  // Otherwise it may be called concurrently on any core, in any order.
+  FSIMGZ_SERIAL_OUTPUT = 4,
+};
+
+// Unpack the fsimgz image src (see fsimgz.h), of dstlen bytes
+// uncompressed, calling copy_output for each chunk.  Any core that
+// calls fsimgz_help while this runs helps unpack the image.
+int fsimgz_decompress(const u8 *src, u64 srclen, u64 dstlen, int flags,
+                      void (*copy_output)(const char *buf, u64 offset, u64 size));
+
+// Claim and unpack one chunk of the image being unpacked, if any.
+void fsimgz_help(void);
@@ -54,7 +54,8 @@ buf::put(u32 dev, u64 block)
 
   sref<buf> bp = bufcache.lookup(k);
   if (bp.get() != nullptr) {
-    auto locked = bp->write_clean();
+    // Just the lock, not write_clean(): that would copy a frozen page.
+    lock_guard<sleeplock> l(&bp->write_lock_);
     if (!bp->dirty()) {
       bp->cache_pin(false); // drop it from the cache
     }
@@ -108,10 +109,27 @@ buf::add_to_transaction(transaction *trans)
   // ->writeback().
   mark_clean();
 
-  // We can't issue a read() to read the contents of the buf because we are
-  // already holding the seq-lock for write (hence we'll end up in a self-
-  // deadlock if we do so). So read directly from data_ instead.
-  trans->add_block(block_, data_->data);
+  // Rather than copying the contents, share the page with the transaction.
+  // This freezes the page; the next write() moves the buf to a copy unless
+  // the transaction has let go of it by then.
+  trans->add_block(block_, page_);
+}
+
+// Give the buf a page of its own, copying the contents if the current page
+// is frozen by a transaction.  Must be invoked with the buf's write_lock_
+// and write seqlock held.
+buf::bufdata *
+buf::unshare()
+{
+  // Only transactions take references to page_, and only with write_lock_
+  // held, so the count can drop behind our back but can't rise.
+  if (page_->get_consistent() > 1) {
+    sref<bufpage> copy = make_sref<bufpage>();
+    memmove(copy->data, page_->data, BSIZE);
+    data_ = (bufdata *) copy->data;
+    page_ = std::move(copy);
+  }
+  return data_;
 }
 
 void
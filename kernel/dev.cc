@@ -4,10 +4,20 @@
 #include "file.hh"
 #include "major.h"
 #include "kstats.hh"
+#include "cpu.hh"
+#include "ipi.hh"
+#include "mfs.hh"
+#include "page_info.hh"
+
+#include <uk/mman.h>
 
 extern const char *kconfig;
 
-DEFINE_PERCPU(struct kstats, mykstats, NO_CRITICAL);
+DEFINE_PERCPU(struct kstats_cpu, mykstats, NO_CRITICAL);
+
+// The pages mmap maps for /dev/kstats: a kstats_header followed by
+// each CPU's kstats page.  Set by initkstats.
+static sref<mnode> kstats_file;
 
 static int
 kconfigread(mdev*, char *dst, u32 off, u32 n)
@@ -28,16 +38,71 @@ kstatsread(mdev*, char *dst, u32 off, u32 n)
   if (off >= sizeof total)
     return 0;
   for (size_t i = 0; i < ncpu; ++i)
-    total += mykstats[i];
+    total += *mykstats[i].get();
   if (n > sizeof total - off)
     n = sizeof total - off;
   memmove(dst, (char*)&total + off, n);
   return n;
 }
 
+static sref<mnode>
+kstatsmmap(mdev*, int prot)
+{
+  if (prot & PROT_WRITE)
+    return sref<mnode>();
+  return kstats_file;
+}
+
+// Move each CPU's kstats to a zeroed page on its own NUMA node and
+// gather those pages, behind a kstats_header, into kstats_file.
+void
+initkstats(void)
+{
+  static_assert(sizeof(kstats) <= PGSIZE, "kstats doesn't fit on a page");
+  static kstats *pages[NCPU];
+
+  bitset<NCPU> all;
+  for (int i = 0; i < ncpu; i++)
+    all.set(i);
+  // This runs with interrupts disabled, so nothing on this CPU
+  // counts between the copy and the switch.
+  run_on_cpus(all, []() {
+      kstats_cpu *kc = &*mykstats;
+      kstats *k = (kstats*)zalloc("kstats");
+      if (!k)
+        throw_bad_alloc();
+      *k = kc->early;
+      kc->off = (char*)k - (char*)&kc->early;
+      pages[myid()] = k;
+    });
+
+  kstats_header *hdr = (kstats_header*)zalloc("kstats_header");
+  if (!hdr)
+    throw_bad_alloc();
+  hdr->magic = KSTATS_MAGIC;
+  hdr->layout = KSTATS_LAYOUT;
+  hdr->ncpu = ncpu;
+  hdr->cpu_offset = PGSIZE;
+  hdr->cpu_stride = PGSIZE;
+
+  sref<mnode> m = anon_fs->alloc(mnode::types::file).mn();
+  {
+    auto resizer = m->as_file()->write_size();
+    auto append = [&](void *p) {
+      auto pi = sref<page_info>::transfer(new (page_info::of(p)) page_info());
+      resizer.resize_append(resizer.read_size() + PGSIZE, pi);
+    };
+    append(hdr);
+    for (int i = 0; i < ncpu; i++)
+      append(pages[i]);
+  }
+  kstats_file = m;
+}
+
 void
 initdev(void)
 {
   devsw[MAJ_KCONFIG].pread = kconfigread;
   devsw[MAJ_KSTATS].pread = kstatsread;
+  devsw[MAJ_KSTATS].mmap = kstatsmmap;
 }
@@ -16,10 +16,6 @@ extern u64 _fs_imgz_size;
 static u64 nblocks = NMEGS * BLKS_PER_MEG;
 static const u64 _fs_img_size = nblocks * BSIZE;
 
-#define WB_SIZE	64*1024
-static char write_buffer[WB_SIZE];
-static u64 wb_offset;
-
 void
 write_output(const char *buf, u64 offset, u64 size)
 {
@@ -27,26 +23,16 @@ write_output(const char *buf, u64 offset, u64 size)
    // moment, the scheduler panics ("EMBRYO -> 1") when the AHCI driver tries to
    // put the async request to sleep on the cmdslot_alloc_cv condvar inside
    // alloc_cmdslot(). This is probably because we are doing this way too early
-   // in the boot sequence.
+   // in the boot sequence.  For the same reason, only the core running
+   // initdisk writes (FSIMGZ_SERIAL_OUTPUT), while other cores unpack the
+   // chunks ahead of it.
 
-   assert(size == BSIZE);
-   if ((offset/BSIZE) % 100000 == 0)
+   if ((offset/BSIZE) / 100000 != (offset/BSIZE + size/BSIZE) / 100000)
      cprintf("Writing block %8lu / %lu\r", offset/BSIZE, _fs_img_size/BSIZE);
 
-   // We use disk_writev() to write out the data in bigger (accumulated) chunks
-   // to the disk below, but its correctness heavily depends on the assumption
-   // that all the writes are going to be sequential/contiguous (which holds
-   // good for zlib_decompress(), the way it is implemented).
-   memcpy(write_buffer + wb_offset, buf, size);
-   wb_offset += size;
-
-   // If the write-buffer is full or if this is the last write, write out all
-   // the buffered data to the disk.
-   if (wb_offset == WB_SIZE || offset == (_fs_img_size - BSIZE)) {
-     kiovec iov = { (void *) write_buffer, wb_offset };
-     disk_writev(1, &iov, 1, offset - (wb_offset - BSIZE));
-     wb_offset = 0;
-   }
+   // Each chunk is written straight from the buffer it was unpacked into.
+   kiovec iov = { (void *) buf, size };
+   disk_writev(1, &iov, 1, offset);
 }
 
 void
@@ -62,8 +48,10 @@ initdisk()
   cprintf("initdisk: Flashing the filesystem image on the disk(s)\n");
 
   gettimeofday(&before, NULL);
-  zlib_decompress(_fs_imgz_start, _fs_imgz_size,
-                  _fs_img_size, write_output);
+  // Blocks in holes are unallocated, so whatever the disk holds there
+  // will do.
+  fsimgz_decompress(_fs_imgz_start, _fs_imgz_size,
+                    _fs_img_size, FSIMGZ_SERIAL_OUTPUT, write_output);
 
   gettimeofday(&after, NULL);
 
@@ -294,7 +294,12 @@ load_image(proc *p, const char *path, const char * const *argv,
   p->tf->r13 = elf->phnum;   // AT_PHNUM
   p->run_cpuid_ = myid();
   p->data_cpuid = myid();
-  memset(p->sig, 0, sizeof(p->sig));
+  // Caught signals revert to their default action; ignored ones stay
+  // ignored.  The mask and pending signals are kept.
+  for (auto &sa : p->sig)
+    if (sa.sa_handler != SIG_IGN)
+      memset(&sa, 0, sizeof(sa));
+  timers_exec(p);
 
   const char *s, *last;
   for(last=s=path; *s; s++)
@@ -15,13 +15,20 @@ file_mnode::fsync() {
   if (!m)
     return -1;
 
+  if (m->type() == mnode::types::file) {
+    m->as_file()->fsync();
+    return 0;
+  }
+
+  // Nothing to write back for memory-only files (memfd, shm_open).
+  if (m->fs_ != root_fs)
+    return 0;
+
   int cpu = myid();
   u64 fsync_tsc = get_tsc();
   rootfs_interface->process_metadata_log(fsync_tsc, m->mnum_, cpu);
 
-  if (m->type() == mnode::types::file)
-    m->as_file()->sync_file(cpu);
-  else if (m->type() == mnode::types::dir)
+  if (m->type() == mnode::types::dir)
     m->as_dir()->sync_dir(cpu);
 
   rootfs_interface->flush_transaction_queue(cpu);
@@ -44,7 +51,7 @@ file_mnode::stat(struct stat *st, enum stat_flags flags)
   st->st_dev = (uintptr_t) m->fs_;
   st->st_ino = m->mnum_;
   if (!(flags & STAT_OMIT_NLINK))
-    st->st_nlink = m->nlink_.get_consistent();
+    st->st_nlink = m->stat_nlink();
   st->st_size = 0;
   if (m->type() == mnode::types::file)
     st->st_size = *m->as_file()->read_size();
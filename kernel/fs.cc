@@ -103,13 +103,16 @@ throw_out_of_blocks()
 
 // Allocate a disk block. This makes changes only to the in-memory
 // free-bit-vector (maintained by rootfs_interface), not the one on the disk.
+// If @goal is non-zero, prefer that block number if it is free, so that
+// consecutive blocks of a file end up contiguous on the disk.
 static u32
-balloc(u32 dev, transaction *trans = NULL, bool zero_on_alloc = false)
+balloc(u32 dev, transaction *trans = NULL, bool zero_on_alloc = false,
+       u32 goal = 0)
 {
   int b;
 
   if (dev == 1) {
-    b = rootfs_interface->alloc_block();
+    b = rootfs_interface->alloc_block(goal);
     if (b < sb_root.size) {
       if (trans)
         trans->add_allocated_block(b);
@@ -721,28 +724,69 @@ iunlock(sref<inode> ip)
 // The next NINDIRECT blocks are listed in the block ip->addrs[NDIRECT].
 // The next NINDIRECT^2 blocks are doubly-indirect from ip->addrs[NDIRECT+1].
 
+// Allocation goal for the block that logically follows block @b, so that
+// files written (or fallocate()d) sequentially are laid out contiguously.
+static inline u32
+next_block(u32 b)
+{
+  return b ? BLOCK_ADDR(b) + 1 : 0;
+}
+
+// How bmap() treats the data block it maps (see BLOCK_UNWRITTEN).
+enum bmap_mode {
+  BMAP_WRITE,     // Allocate the block if needed; the caller writes to it.
+  BMAP_READ,      // As above, but return an unwritten block with its flag set.
+  BMAP_PREALLOC,  // Allocate the block if needed, marked unwritten.
+};
+
+// Fill in the data block address @*a, whose allocation goal is @goal.
+// Returns true if @*a changed, in which case the block holding it must be
+// logged.
+static bool
+bmap_data(sref<inode> ip, u32 *a, u32 goal, transaction *trans,
+          bool zero_on_alloc, bmap_mode mode)
+{
+  if (*a == 0) {
+    *a = balloc(ip->dev, trans, zero_on_alloc && mode != BMAP_PREALLOC, goal);
+    if (mode == BMAP_PREALLOC)
+      *a |= BLOCK_UNWRITTEN;
+    return true;
+  }
+
+  if ((*a & BLOCK_UNWRITTEN) && mode == BMAP_WRITE) {
+    // First write to a fallocate()d block: its old contents must not show
+    // through a partial write.
+    *a = BLOCK_ADDR(*a);
+    if (zero_on_alloc)
+      bzero(ip->dev, *a);
+    return true;
+  }
+  return false;
+}
+
 // Return the disk block address of the nth block in inode ip. If there is no
 // such block, bmap allocates one. The caller must hold ilock() for write if
-// invoking bmap() from writei().
+// invoking bmap() from writei(). Only BMAP_READ can return an address with
+// BLOCK_UNWRITTEN set.
 static u32
 bmap(sref<inode> ip, u32 bn, transaction *trans = NULL, bool zero_on_alloc = false,
-     bool lazy_trans_update = false)
+     bool lazy_trans_update = false, bmap_mode mode = BMAP_WRITE)
 {
   scoped_gc_epoch e;
   bool skip_disk_read = false;
   u32* ap;
 
   if (bn < NDIRECT) {
-    if (ip->addrs[bn] == 0)
-      ip->addrs[bn] = balloc(ip->dev, trans, zero_on_alloc);
-
+    bmap_data(ip, &ip->addrs[bn], bn ? next_block(ip->addrs[bn-1]) : 0,
+              trans, zero_on_alloc, mode);
     return ip->addrs[bn];
   }
   bn -= NDIRECT;
 
   if (bn < NINDIRECT) {
     if (ip->addrs[NDIRECT] == 0) {
-      ip->addrs[NDIRECT] = balloc(ip->dev, trans, true);
+      ip->addrs[NDIRECT] = balloc(ip->dev, trans, true,
+                                  next_block(ip->addrs[NDIRECT-1]));
       // We allocated the block just now. So need to read it from the disk.
       skip_disk_read = true;
     }
@@ -752,14 +796,13 @@ bmap(sref<inode> ip, u32 bn, transaction *trans = NULL, bool zero_on_alloc = fal
     auto locked = bp->write();
     ap = (u32 *)locked->data;
 
-    if (ap[bn] == 0) {
-      ap[bn] = balloc(ip->dev, trans, zero_on_alloc);
-      if (trans) {
-        if (lazy_trans_update)
-          bp->add_blocknum_to_transaction(trans);
-        else
-          bp->add_to_transaction(trans);
-      }
+    if (bmap_data(ip, &ap[bn],
+                  next_block(bn ? ap[bn-1] : ip->addrs[NDIRECT]),
+                  trans, zero_on_alloc, mode) && trans) {
+      if (lazy_trans_update)
+        bp->add_blocknum_to_transaction(trans);
+      else
+        bp->add_to_transaction(trans);
     }
 
     return ap[bn];
@@ -770,7 +813,8 @@ bmap(sref<inode> ip, u32 bn, transaction *trans = NULL, bool zero_on_alloc = fal
     panic("bmap: %d out of range", bn);
 
   if (ip->addrs[NDIRECT+1] == 0) {
-    ip->addrs[NDIRECT+1] = balloc(ip->dev, trans, true);
+    ip->addrs[NDIRECT+1] = balloc(ip->dev, trans, true,
+                                  next_block(ip->addrs[NDIRECT]));
     // We allocated the block just now. So need to read it from the disk.
     skip_disk_read = true;
   }
@@ -782,7 +826,8 @@ bmap(sref<inode> ip, u32 bn, transaction *trans = NULL, bool zero_on_alloc = fal
   ap = (u32 *)flocked->data;
 
   if (ap[bn / NINDIRECT] == 0) {
-    ap[bn / NINDIRECT] = balloc(ip->dev, trans, true);
+    ap[bn / NINDIRECT] = balloc(ip->dev, trans, true,
+                                next_block(ip->addrs[NDIRECT+1]));
     // We allocated the block just now. So need to read it from the disk.
     skip_disk_read = true;
 
@@ -800,19 +845,42 @@ bmap(sref<inode> ip, u32 bn, transaction *trans = NULL, bool zero_on_alloc = fal
   auto slocked = sp->write();
   ap = (u32 *)slocked->data;
 
-  if (ap[bn % NINDIRECT] == 0) {
-    ap[bn % NINDIRECT] = balloc(ip->dev, trans, zero_on_alloc);
-    if (trans) {
-      if (lazy_trans_update)
-        sp->add_blocknum_to_transaction(trans);
-      else
-        sp->add_to_transaction(trans);
-    }
+  if (bmap_data(ip, &ap[bn % NINDIRECT],
+                next_block(bn % NINDIRECT ? ap[bn % NINDIRECT - 1] :
+                                            (u32)sp->block()),
+                trans, zero_on_alloc, mode) && trans) {
+    if (lazy_trans_update)
+      sp->add_blocknum_to_transaction(trans);
+    else
+      sp->add_to_transaction(trans);
   }
 
   return ap[bn % NINDIRECT];
 }
 
+// Allocate the data blocks of @ip from its current size up to @size, marked
+// BLOCK_UNWRITTEN so that fallocate() does not have to write zeroes to them.
+// The indirect blocks are logged lazily. Returns the size up to which blocks
+// were allocated, which is less than @size if the disk filled up.
+//
+// The caller must hold ilock() for write, and must then update the size and
+// call trans->add_dirty_blocks_lazy().
+u32
+iprealloc(sref<inode> ip, u32 size, transaction *trans)
+{
+  scoped_gc_epoch e;
+
+  for (u32 bn = BLOCKROUNDUP(ip->size); bn < BLOCKROUNDUP(size); bn++) {
+    try {
+      bmap(ip, bn, trans, false, true, BMAP_PREALLOC);
+    } catch (out_of_blocks& e) {
+      console.println("iprealloc: out of blocks");
+      return std::max(ip->size, bn * BSIZE);
+    }
+  }
+  return size;
+}
+
 // Caller must hold ilock for write. The caller must also arrange to invoke
 // iupdate() when suitable, to flush the new inode size to the disk.
 void
@@ -852,7 +920,7 @@ itrunc(sref<inode> ip, u32 offset, transaction *trans)
     for (u32 i = start_index; i < NDIRECT; i++) {
       if (!ip->addrs[i])
         break;
-      bfree(ip->dev, ip->addrs[i], trans, true);
+      bfree(ip->dev, BLOCK_ADDR(ip->addrs[i]), trans, true);
       ip->addrs[i] = 0;
     }
     start_index = 0; // Fall through to next stage.
@@ -871,7 +939,7 @@ itrunc(sref<inode> ip, u32 offset, transaction *trans)
         if (!ap[i])
           break;
 
-        bfree(ip->dev, ap[i], trans, true);
+        bfree(ip->dev, BLOCK_ADDR(ap[i]), trans, true);
         ap[i] = 0;
       }
 
@@ -910,11 +978,13 @@ itrunc(sref<inode> ip, u32 offset, transaction *trans)
             if (!ap2[j])
               break;
 
-            bfree(ip->dev, ap2[j], trans, true);
+            bfree(ip->dev, BLOCK_ADDR(ap2[j]), trans, true);
             ap2[j] = 0;
           }
 
-          if (!ap2[0])
+          // Log the second-level block only if it survives the truncation;
+          // otherwise it is freed below and its contents don't matter.
+          if (begin % NINDIRECT != 0)
             bp2->add_to_transaction(trans);
         }
 
@@ -956,7 +1026,7 @@ drop_bufcache(sref<inode> ip)
 
   for (int i = 0; i < NDIRECT; i++) {
     if (ip->addrs[i])
-      buf::put(ip->dev, ip->addrs[i]);
+      buf::put(ip->dev, BLOCK_ADDR(ip->addrs[i]));
   }
 
   // Note: If the indirect or doubly indirect blocks are themselves not in the
@@ -970,7 +1040,7 @@ drop_bufcache(sref<inode> ip)
     u32 *a = (u32*)copy->data;
     for (int i = 0; i < NINDIRECT; i++) {
       if (a[i])
-        buf::put(ip->dev, a[i]);
+        buf::put(ip->dev, BLOCK_ADDR(a[i]));
     }
     // Drop the indirect block.
     buf::put(ip->dev, ip->addrs[NDIRECT]);
@@ -988,7 +1058,7 @@ drop_bufcache(sref<inode> ip)
         u32 *a2 = (u32*)copy2->data;
         for (int j = 0; j < NINDIRECT; j++) {
           if (a2[j])
-            buf::put(ip->dev, a2[j]);
+            buf::put(ip->dev, BLOCK_ADDR(a2[j]));
         }
         // Drop the second-level doubly-indirect block.
         buf::put(ip->dev, a1[i]);
@@ -1033,14 +1103,22 @@ readi(sref<inode> ip, char *dst, u32 off, u32 n)
     n = ip->size - off;
 
   for (tot=0; tot<n; tot+=m, off+=m, dst+=m) {
+    u32 blocknum;
     try {
-      bp = buf::get(ip->dev, bmap(ip, off/BSIZE, NULL, true));
+      blocknum = bmap(ip, off/BSIZE, NULL, true, false, BMAP_READ);
     } catch (out_of_blocks& e) {
       // Read operations should never cause out-of-blocks conditions
       panic("readi: out of blocks");
     }
     m = std::min(n - tot, BSIZE - off%BSIZE);
 
+    // A fallocate()d block that was never written holds no data on the disk.
+    if (blocknum & BLOCK_UNWRITTEN) {
+      memset(dst, 0, m);
+      continue;
+    }
+
+    bp = buf::get(ip->dev, blocknum);
     auto copy = bp->read();
     memmove(dst, copy->data + off%BSIZE, m);
   }
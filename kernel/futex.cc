@@ -9,6 +9,7 @@
 #include "cpu.hh"
 #include "spercpu.hh"
 #include "kmtrace.hh"
+#include "crc32c.hh"
 
 //
 // futexkey
@@ -23,7 +24,7 @@ typedef u64* futexkey_t;
 u64
 futexkey_hash(futexkey_t const& key)
 {
-  return (u64)key;
+  return crc32c_u64(~0u, (u64)key);
 }
 
 u64
@@ -585,13 +585,17 @@ namespace mmu_shared_page_table {
 
   void
   page_map_cache::__invalidate(
-    uintptr_t start, uintptr_t len, shootdown *sd)
+    uintptr_t start, uintptr_t len, shootdown *sd, dirty_bits *dirty)
   {
     sd->set_cache_tracker(this);
     for (auto it = pml4->find(start); it.index() < start + len;
          it += it.span()) {
       if (it.is_set()) {
-        it->store(0, memory_order_relaxed);
+        // Another core may set the dirty bit until the PTE is clear, so
+        // read it atomically with clearing.
+        pme_t old = it->exchange(0, memory_order_relaxed);
+        if (dirty && (old & PTE_D))
+          dirty->set(it.index());
         sd->add_range(it.index(), it.index() + it.span());
       }
     }
@@ -654,7 +658,7 @@ namespace mmu_per_core_page_table {
   }
 
   void
-  page_map_cache::clear(uintptr_t start, uintptr_t end)
+  page_map_cache::clear(uintptr_t start, uintptr_t end, dirty_bits *dirty)
   {
     // Are we the current page_map_cache on this core?  (Depending on
     // MMU_SCHEME, *cur_page_map_cache may not be this type of
@@ -669,7 +673,9 @@ namespace mmu_per_core_page_table {
     assert(mypml4);
     for (auto it = mypml4->find(start); it.index() < end; it += it.span()) {
       if (it.is_set()) {
-        it->store(0, memory_order_relaxed);
+        pme_t old = it->exchange(0, memory_order_relaxed);
+        if (dirty && (old & PTE_D))
+          dirty->set(it.index());
         if (current)
           invlpg((void*)it.index());
       }
@@ -690,7 +696,7 @@ namespace mmu_per_core_page_table {
     kstats::inc(&kstats::tlb_shootdown_targets, targets.count());
     kstats::timer timer(&kstats::tlb_shootdown_cycles);
     run_on_cpus(targets, [this]() {
-        cache->clear(start, end);
+        cache->clear(start, end, dirty);
       });
   }
 }
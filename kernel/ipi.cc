@@ -8,6 +8,7 @@
 
 using namespace std;
 
+// Other CPUs lock and append to this, so it gets lines of its own.
 struct ipi_queue
 {
   spinlock lock;
@@ -18,7 +19,7 @@ struct ipi_queue
   ipi_queue()
     : lock("ipi_queue::lock"), head(nullptr), tail(&head),
       ipicall_active(false) { }
-};
+} __mpalign__;
 
 DEFINE_PERCPU(struct ipi_queue, myipi);
 
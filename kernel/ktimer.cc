@@ -0,0 +1,156 @@
+// Per-core kernel timers
+
+#include "types.h"
+#include "kernel.hh"
+#include "amd64.h"
+#include "spinlock.hh"
+#include "condvar.hh"
+#include "cpu.hh"
+#include "percpu.hh"
+#include "apic.hh"
+#include "ktimer.hh"
+
+// Timers can be cancelled from other CPUs, so this gets lines of its own.
+struct timer_queue {
+  struct spinlock lock;
+  ilist<ktimer, &ktimer::link_> timers; // Ordered by deadline
+  // Earliest deadline on timers, or ~0.  Read without the lock so the
+  // timer interrupt can skip the queue when nothing is due.
+  std::atomic<u64> next;
+  // When this core's next scheduling tick is due, or 0 if its LAPIC
+  // timer is periodic and every timer interrupt is a tick.  Only this
+  // core touches it, with interrupts disabled.
+  u64 next_tick;
+
+  timer_queue()
+    : lock("timer_queue", LOCKSTAT_TIMER), next(~0ull), next_tick(0) { }
+} __mpalign__;
+
+DEFINE_PERCPU(struct timer_queue, timer_queues, NO_CRITICAL);
+
+// Insert t into q in deadline order.  Called with q->lock held.
+static void
+enqueue(timer_queue *q, ktimer *t)
+{
+  auto it = q->timers.begin();
+  while (it != q->timers.end() && it->deadline() <= t->deadline())
+    ++it;
+  q->timers.insert(it, t);
+  q->next = q->timers.front().deadline();
+}
+
+// Arm this core's LAPIC timer for its next tick or timer deadline.
+// Called with interrupts disabled.
+static void
+rearm(timer_queue *q)
+{
+  u64 now = nsectime();
+  u64 when = std::min(q->next_tick, q->next.load());
+  if (!lapic->arm_timer(when > now ? when - now : 0))
+    q->next_tick = 0;
+}
+
+void
+ktimer::arm(u64 deadline, u64 interval)
+{
+  cancel();
+  if (!deadline)
+    return;
+
+  deadline_ = (deadline + slack_ - 1) / slack_ * slack_;
+  interval_ = interval;
+
+  pushcli();
+  int cpu = myid();
+  timer_queue *q = &timer_queues[cpu];
+  {
+    scoped_acquire l(&q->lock);
+    cpu_ = cpu;
+    enqueue(q, this);
+  }
+  // If this is now the core's earliest event, the LAPIC timer is armed
+  // for too late.
+  if (q->next_tick && deadline_ < q->next_tick && q->next == deadline_)
+    rearm(q);
+  popcli();
+}
+
+void
+ktimer::cancel()
+{
+  for (;;) {
+    int cpu = cpu_;
+    if (cpu >= 0) {
+      timer_queue *q = &timer_queues[cpu];
+      scoped_acquire l(&q->lock);
+      // The timer may have expired, or moved queues, before we got
+      // the lock.
+      if (cpu_ != cpu)
+        continue;
+      q->timers.erase(q->timers.iterator_to(this));
+      q->next = q->timers.empty() ? ~0ull : q->timers.front().deadline();
+      cpu_ = -1;
+    }
+    break;
+  }
+  while (running_)
+    nop_pause();
+  deadline_ = 0;
+  interval_ = 0;
+}
+
+bool
+ktimer_tick(void)
+{
+  timer_queue *q = &timer_queues[myid()];
+  u64 now = nsectime();
+  // Allow for the LAPIC and nsectime clocks disagreeing slightly, so a
+  // tick that fires a little early isn't put off by a whole quantum.
+  if (q->next_tick && now + ktimer::default_slack_ns < q->next_tick)
+    return false;
+  q->next_tick = now + QUANTUM * 1000000ull;
+  return true;
+}
+
+void
+ktimer_rearm(void)
+{
+  rearm(&timer_queues[myid()]);
+}
+
+void
+ktimer_expire(void)
+{
+  timer_queue *q = &timer_queues[myid()];
+  u64 now = nsectime();
+  if (now < q->next)
+    return;
+
+  q->lock.acquire();
+  while (!q->timers.empty() && q->timers.front().deadline() <= now) {
+    ktimer *t = &q->timers.front();
+    q->timers.pop_front();
+    // Set before cpu_ changes, so cancel() can't see the timer as
+    // neither queued nor running.
+    t->running_ = true;
+
+    u64 nexp = 1;
+    if (t->interval_) {
+      nexp += (now - t->deadline_) / t->interval_;
+      t->deadline_ += nexp * t->interval_;
+      enqueue(q, t);
+    } else {
+      t->deadline_ = 0;
+      t->cpu_ = -1;
+    }
+    q->next = q->timers.empty() ? ~0ull : q->timers.front().deadline();
+
+    // Drop the lock while the timer runs, so expire() can take locks
+    // that are held while arming or cancelling other timers.
+    q->lock.release();
+    t->expire(nexp);
+    t->running_ = false;
+    q->lock.acquire();
+  }
+  q->lock.release();
+}
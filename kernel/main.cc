@@ -12,6 +12,7 @@
 #include "apic.hh"
 #include "codex.hh"
 #include "mfs.hh"
+#include "zlib-decompress.hh"
 
 void initpic(void);
 void initextpic(void);
@@ -21,6 +22,7 @@ void initcga(void);
 void initconsole(void);
 void initpg(void);
 void cleanuppg(void);
+void initkstats(void);
 void inittls(struct cpu *);
 void initnmi(void);
 void initdblflt(void);
@@ -66,13 +68,17 @@ void initdev(void);
 void inithpet(void);
 void initrtc(void);
 void initmfs(void);
+void initcrc32c(void);
 void idleloop(void);
+void wdpoke(void);
 void init_scalefs(void);
 
 #define IO_RTC  0x70
 
 static std::atomic<int> bstate;
 static cpuid_t bcpuid;
+// Set once CPU 0 has finished booting and the other CPUs may schedule.
+static std::atomic<bool> bootdone;
 
 void
 mpboot(void)
@@ -97,6 +103,14 @@ mpboot(void)
   initnmi();
   initwd();                     // Requires initnmi
   bstate.store(1);
+
+  // Help CPU 0 unpack the file system image in initdisk, then wait for
+  // it to finish booting.
+  while (!bootdone.load()) {
+    fsimgz_help();
+    wdpoke();
+    nop_pause();
+  }
   idleloop();
 }
 
@@ -185,6 +199,7 @@ cmain(u64 mbmagic, u64 mbaddr)
   initphysmem(mbaddr);
   initpg();                // Requires initphysmem
   inithz();        // CPU Hz, microdelay
+  initcrc32c();            // Requires nothing
   initseg(&cpus[0]);
   inittls(&cpus[0]);       // Requires initseg
 
@@ -246,6 +261,12 @@ cmain(u64 mbmagic, u64 mbaddr)
   initnet();
   initrtc();               // Requires inithpet
   initdev();               // Misc /dev nodes
+  // Start the other processors now, so they can help initdisk.  They
+  // wait in mpboot until the end of cmain.
+#if CODEX
+  initcodex();
+#endif
+  bootothers();    // start other processors
   initdisk();      // disk
 
   initinode_early();     // inode cache
@@ -263,11 +284,9 @@ cmain(u64 mbmagic, u64 mbaddr)
 
   init_scalefs();
 
-#if CODEX
-  initcodex();
-#endif
-  bootothers();    // start other processors
+  bootdone.store(true);
   cleanuppg();             // Requires bootothers
+  initkstats();            // Requires bootothers, initmfs
   initcpprt();
   initwd();                // Requires initnmi
 
@@ -94,16 +94,20 @@ static memdisk* md;
 // Our filesystem supports per-cpu inode- and block- allocators. So we use the
 // same logic to identify the regions belonging to different CPUs among the disk
 // blocks, and allocate (NUMA) node-local memory for those regions.
+//
+// The metadata blocks (up to the last bitmap block) must be passed in order,
+// on one core (FSIMGZ_METADATA_FIRST).  By then every data block has its
+// memory, so the data blocks may then be passed concurrently, in any order.
 void
 init_fs_state(const char *buf, u64 offset, u64 size)
 {
   static superblock sb;
-  static u32 current_blknum, read_upto_blknum;
+  static u32 read_upto_blknum;
   static u32 first_free_inode_block, first_free_bitmap_block;
   static u32 inodeblocks_per_cpu, bitmapblocks_per_cpu;
 
   assert(offset % BSIZE == 0 && size == BSIZE);
-  current_blknum = offset/BSIZE;
+  u32 current_blknum = offset/BSIZE;
 
   if (current_blknum % 100000 == 0)
     cprintf("Writing block %8d / %lu\r", current_blknum, _fs_img_size/BSIZE);
@@ -242,6 +246,13 @@ out:
   memmove(md->data_ptr_[current_blknum], buf, BSIZE);
 }
 
+static void
+init_fs_chunk(const char *buf, u64 offset, u64 size)
+{
+  for (u64 off = 0; off < size; off += BSIZE)
+    init_fs_state(buf + off, offset + off, BSIZE);
+}
+
 // Check that every logical disk block has a corresponding memory page backing it.
 void
 verify_backing_memory(u64 disk_size_bytes)
@@ -268,8 +279,8 @@ initdisk(void)
   cprintf("initdisk: Flashing the filesystem image on the memdisk(s)\n");
 
   gettimeofday(&before, NULL);
-  zlib_decompress(_fs_imgz_start, _fs_imgz_size,
-                  _fs_img_size, init_fs_state);
+  fsimgz_decompress(_fs_imgz_start, _fs_imgz_size, _fs_img_size,
+                    FSIMGZ_FILL_HOLES | FSIMGZ_METADATA_FIRST, init_fs_chunk);
 
   verify_backing_memory(_fs_img_size);
   gettimeofday(&after, NULL);
@@ -8,6 +8,7 @@
 u64 root_mnum;
 mfs* root_fs;
 mfs* anon_fs;
+sref<mnode> shm_root;
 mfs_interface* rootfs_interface;
 
 // This hash table stores mappings from mnode numbers in memory to inode numbers
@@ -180,9 +181,9 @@ writem(sref<mnode> m, const char* buf, u64 start, u64 nbytes,
        * What happens when writing past the end of the file but within
        * the file's last page?  One worry might be that we're exposing
        * some non-zero bytes left over in the part of the last page that
-       * is past the end of the file.  Our plan is to ensure that any
-       * file truncate zeroes out any partial pages.  Currently, we only
-       * have O_TRUNC, which discards all pages.
+       * is past the end of the file.  mfile::resizer::resize_nogrow
+       * zeroes the tail of the last page whenever the file is truncated
+       * into the middle of a page, so those bytes are always zero.
        */
 
       memmove((char*) pi->va() + pgoff, buf + off, pgend - pgoff);
@@ -204,21 +205,8 @@ writem(sref<mnode> m, const char* buf, u64 start, u64 nbytes,
        * a few zero pages.  We do not support sparse files -- the
        * holes are filled in with zeroed pages.
        */
-      u64 msize = resize->read_size();
-      while (msize < pgbase) {
-        if (msize % PGSIZE) {
-          resize->resize_nogrow(msize - (msize % PGSIZE) + PGSIZE);
-        } else {
-          char* p = zalloc("file page");
-          if (!p)
-            break;
-
-          pi = sref<page_info>::transfer(new (page_info::of(p)) page_info());
-          resize->resize_append(msize + PGSIZE, pi);
-        }
-
-        msize = resize->read_size();
-      }
+      if (!resize->resize_grow(pgbase))
+        break;
 
       char* p = zalloc("file page");
       if (!p)
@@ -235,6 +223,47 @@ writem(sref<mnode> m, const char* buf, u64 start, u64 nbytes,
   return off ?: -1;
 }
 
+// Copy nbytes of file in, starting at in_start, to file out at out_start.
+// Each piece is written by writem straight from in's page cache, so the
+// data is copied once, with no intermediate buffer.  Stops at the end of
+// in.  Returns the number of bytes copied, or -1 if the first write fails.
+s64
+copym(sref<mnode> in, u64 in_start, sref<mnode> out, u64 out_start,
+      u64 nbytes)
+{
+  if (in->type() != mnode::types::file || out->type() != mnode::types::file)
+    return -1;
+
+  u64 off = 0;
+  while (off < nbytes) {
+    u64 pos = in_start + off;
+    u64 pgbase = PGROUNDDOWN(pos);
+
+    mfile::page_state ps = in->as_file()->get_page(pgbase / PGSIZE);
+    sref<page_info> pi = ps.get_page_info();
+    if (!pi)
+      break;
+
+    u64 n = std::min(nbytes - off, PGSIZE - (pos - pgbase));
+    if (ps.is_partial_page()) {
+      u64 msize = *in->as_file()->read_size();
+      if (pos >= msize)
+        break;
+      n = std::min(n, msize - pos);
+    }
+
+    s64 r = writem(out, (const char*) pi->va() + (pos - pgbase),
+                   out_start + off, n);
+    if (r < 0)
+      return off ?: -1;
+    off += r;
+    if (r < n)
+      break;
+  }
+
+  return off;
+}
+
 static int
 mfsstatsread(mdev*, char *dst, u32 off, u32 n)
 {
@@ -247,4 +276,5 @@ void
 initmfs(void)
 {
   devsw[MAJ_MFSSTATS].pread = mfsstatsread;
+  shm_root = anon_fs->alloc(mnode::types::dir).mn();
 }
@@ -1,22 +1,18 @@
 #include "types.h"
 #include "kernel.hh"
 #include "mnode.hh"
-#include "weakcache.hh"
 #include "atomic_util.hh"
 #include "percpu.hh"
 #include "vm.hh"
 #include "file.hh"
-
-namespace {
-  // 32MB mcache (XXX make this proportional to physical RAM)
-  weakcache<pair<mfs*, u64>, mnode> mnode_cache(32 << 20);
-};
+#include "mfs.hh"
+#include "cacheline.hh"
 
 sref<mnode>
 mfs::mget(u64 mnum)
 {
   for (;;) {
-    sref<mnode> m = mnode_cache.lookup(make_pair(this, mnum));
+    sref<mnode> m = cache_.lookup(mnum);
     if (m) {
       // Wait for the mnode to be ready.
       while (!m->valid_) {
@@ -61,7 +57,7 @@ mfs::alloc(u8 type, u64 parent_mnum)
     panic("unknown type in mnum 0x%lx", mnum);
   }
 
-  if (!mnode_cache.insert(make_pair(this, mnum), m.get()))
+  if (!cache_.insert(mnum, m.get()))
     panic("mnode_cache insert failed (duplicate mnumber?)");
 
   if (this == root_fs && (type == mnode::types::dir ||
@@ -77,9 +73,13 @@ mfs::alloc(u8 type, u64 parent_mnum)
 }
 
 mnode::mnode(mfs* fs, u64 mnum)
-  : fs_(fs), mnum_(mnum), initialized_(false), cache_pin_(false), dirty_(false),
-    valid_(false), delete_inode_(false)
+  : fs_(fs), mnum_(mnum), nlink_snap_(0), initialized_(false),
+    cache_pin_(false), dirty_(false), valid_(false), delete_inode_(false)
 {
+  // Link count updates shouldn't disturb lookups reading mnum_ or
+  // the flags.
+  CACHELINE_APART(mnode, mnum_, nlink_);
+  CACHELINE_APART(mnode, nlink_, initialized_);
   kstats::inc(&kstats::mnode_alloc);
 }
 
@@ -132,11 +132,75 @@ mnode::onzero()
   if (type() == types::file)
     this->as_file()->remove_pgtable_mappings(0);
 
-  mnode_cache.cleanup(weakref_);
+  fs_->cache_.cleanup(weakref_);
   kstats::inc(&kstats::mnode_free);
   delete this;
 }
 
+enum : u64 {
+  nlink_snap_valid = 1ull << 31,
+  nlink_snap_pending = 1ull << 30,
+  nlink_snap_count = nlink_snap_pending - 1,
+  nlink_snap_gen = 1ull << 32,
+};
+
+u64
+mnode::stat_nlink()
+{
+  u64 snap = nlink_snap_.load(std::memory_order_acquire);
+  if (snap & nlink_snap_valid)
+    return snap & nlink_snap_count;
+
+  // Announce the snapshot before reading the count.  A change that
+  // get_consistent misses must come after the announcement, so it sees
+  // the pending bit, bumps the generation, and fails our publish.
+  kstats::inc(&kstats::mnode_nlink_snap_miss);
+  bool announced = true;
+  if (!(snap & nlink_snap_pending)) {
+    u64 want = snap | nlink_snap_pending;
+    announced = nlink_snap_.compare_exchange_strong(snap, want);
+    snap = want;
+  }
+  u64 nlink = nlink_.get_consistent();
+  if (announced && nlink <= nlink_snap_count)
+    nlink_snap_.compare_exchange_strong(
+      snap, (snap & ~nlink_snap_pending) | nlink_snap_valid | nlink);
+  return nlink;
+}
+
+void
+mnode::nlink_changed()
+{
+  // Order the count update before reading the snapshot, pairing with
+  // the exchange that sets the pending bit in stat_nlink.  Unless a
+  // snapshot is valid or pending, there's nothing to invalidate, and
+  // concurrent changes don't contend on nlink_snap_.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  u64 snap = nlink_snap_.load(std::memory_order_relaxed);
+  // Advance to the next generation, clearing the count and flags.
+  while ((snap & (nlink_snap_valid | nlink_snap_pending)) &&
+         !nlink_snap_.compare_exchange_weak(
+           snap, (snap | (nlink_snap_gen - 1)) + 1))
+    ;
+}
+
+void
+mnode::linkcount::inc()
+{
+  FS_NLINK_REFCOUNT referenced::inc();
+  container_from_member(this, &mnode::nlink_)->nlink_changed();
+}
+
+// Callers hold a reference to the mnode, so it survives even if this
+// drops the last link.
+void
+mnode::linkcount::dec()
+{
+  mnode* m = container_from_member(this, &mnode::nlink_);
+  FS_NLINK_REFCOUNT referenced::dec();
+  m->nlink_changed();
+}
+
 void
 mnode::linkcount::onzero()
 {
@@ -168,9 +232,64 @@ mfile::resizer::resize_nogrow(u64 newsize)
     /* Shrunk, and last page is partial */
     mf_->pages_.find(newsize / PGSIZE)->set_partial_page(true);
   }
+
+  if (newsize < oldsize && PGOFFSET(newsize)) {
+    /*
+     * Shrunk into the middle of a page.  Zero the truncated tail of that
+     * page, so that a later extension of the file (by a write past EOF
+     * or by ftruncate) reads back zeroes rather than stale data.  If the
+     * page is not in the page cache, the tail is never loaded from disk.
+     */
+    auto it = mf_->pages_.find(newsize / PGSIZE);
+    page_state ps = it->copy_consistent();
+    sref<page_info> pi = ps.get_page_info();
+    if (pi) {
+      memset((char*)pi->va() + PGOFFSET(newsize), 0,
+             PGSIZE - PGOFFSET(newsize));
+      it->set_dirty_bit(true);
+    }
+  }
   mf_->dirty(true);
 }
 
+// Extend the file to newsize, filling the gap with zeroed pages.  We do not
+// support sparse files, so every page up to the new size is materialized in
+// the page cache.  Returns false if we ran out of memory part way through,
+// in which case the file has been extended as far as possible.
+bool
+mfile::resizer::resize_grow(u64 newsize)
+{
+  u64 size = mf_->size_;
+  if (newsize <= size)
+    return true;
+
+  if (PGOFFSET(size)) {
+    /*
+     * Bring the partial last page into the page cache before extending
+     * past its end (get_page would otherwise read past the end of the
+     * file on disk), and mark it dirty so that its zeroed tail reaches
+     * the disk along with the new size.
+     */
+    mf_->get_page(size / PGSIZE);
+    mf_->set_page_dirty(size / PGSIZE);
+  }
+
+  while (size < newsize) {
+    if (PGOFFSET(size)) {
+      resize_nogrow(std::min((u64)PGROUNDUP(size), newsize));
+    } else {
+      char* p = zalloc("file page");
+      if (!p)
+        return false;
+
+      auto pi = sref<page_info>::transfer(new (page_info::of(p)) page_info());
+      resize_append(std::min(size + PGSIZE, newsize), pi);
+    }
+    size = mf_->size_;
+  }
+  return true;
+}
+
 void
 mfile::resizer::resize_append(u64 size, sref<page_info> pi)
 {
@@ -203,6 +322,21 @@ mfile::set_page_dirty(u64 pageidx)
   it->set_dirty_bit(true);
 }
 
+// Extend the file to size with pages that are demand-loaded from the disk,
+// which already holds the file up to size.  The file must end on a page
+// boundary.
+void
+mfile::resizer::extend_from_disk(u64 size)
+{
+  assert(PGOFFSET(mf_->size_) == 0);
+  auto begin = mf_->pages_.find(mf_->size_ / PGSIZE);
+  auto end = mf_->pages_.find(PGROUNDUP(size) / PGSIZE);
+  auto lock = mf_->pages_.acquire(begin, end);
+  page_state ps(true);
+  mf_->pages_.fill(begin, end, ps);
+  mf_->size_ = size;
+}
+
 void
 mfile::resizer::initialize_from_disk(u64 size)
 {
@@ -266,39 +400,103 @@ mfile::put_page(u64 pageidx)
 
     it->reset_page_info();
 
-    std::vector<page_info::rmap_entry> rmap_vec;
-    pi->get_rmap_vector(rmap_vec);
-    for (auto rmap_it = rmap_vec.begin(); rmap_it != rmap_vec.end(); rmap_it++)
-      rmap_it->first->clear_mapping(rmap_it->second);
+    std::vector<file_rmap::range> ranges;
+    scoped_gc_epoch e;          // Keeps the vmaps we find alive (see vmap)
+    rmap_.lookup(pageidx, pageidx + 1, &ranges);
+    for (auto &r : ranges)
+      r.m.vm->clear_mapping(r.m.start + pageidx * PGSIZE, pi.get());
 
     pi->dec();
 
   }
 }
 
+// Collect the writes made through shared mappings of this file, which
+// are recorded only in the mappers' PTE dirty bits, into the page cache.
+void
+mfile::harvest_mappings()
+{
+  if (!shared_mapped_ || fs_ != root_fs)
+    return;
+
+  std::vector<file_rmap::range> ranges;
+  scoped_gc_epoch e;            // Keeps the vmaps we find alive (see vmap)
+  rmap_.lookup(0, maxidx, &ranges);
+  for (auto &r : ranges)
+    r.m.vm->harvest_file(r.m.start, r.lo, r.hi);
+}
+
+// Write this file's dirty pages and pending metadata to disk, as for
+// fsync.  Memory-only files (memfd, shm_open) have nothing to write.
+void
+mfile::fsync()
+{
+  if (fs_ != root_fs)
+    return;
+
+  int cpu = myid();
+  rootfs_interface->process_metadata_log(get_tsc(), mnum_, cpu);
+  sync_file(cpu);
+  rootfs_interface->flush_transaction_queue(cpu);
+}
+
+// Extend the file to newsize with blocks allocated on the disk, for
+// fallocate.  The new blocks are marked unwritten on the disk rather than
+// written out as zeroes, and the new pages are left to be demand-loaded
+// (as zeroes) like the rest of a file read from the disk, so preallocating
+// a large file neither writes its data nor pins it in memory.  Returns
+// false if we ran out of memory or disk space part way through.
+bool
+mfile::preallocate(u64 newsize)
+{
+  if (fs_ != root_fs || newsize <= PGROUNDUP(*read_size()))
+    return write_size().resize_grow(newsize);
+
+  int cpu = myid();
+  rootfs_interface->process_metadata_log(get_tsc(), mnum_, cpu);
+
+  bool ok = true;
+  {
+    // Same lock order as sync_file(), which must not see the new on-disk
+    // size before the mfile has grown to match it.
+    auto lock = fsync_lock_.guard();
+    auto guard = rootfs_interface->fs_journal[cpu]->commitq_insert_lock.guard();
+    auto resizer = write_size();
+
+    u64 mlen = resizer.read_size();
+    if (newsize <= mlen)
+      return true;
+    // Zero and dirty a partial last page, so the new pages start on a
+    // block boundary.
+    if (!resizer.resize_grow(PGROUNDUP(mlen)))
+      return false;
+
+    transaction *trans = new transaction();
+    // Drop any blocks of a not yet synced truncation; they must not show
+    // through the new pages.
+    if (rootfs_interface->get_file_size(mnum_) > mlen)
+      rootfs_interface->truncate_file(mnum_, mlen, trans);
+    u64 size = rootfs_interface->preallocate_file(mnum_, newsize, trans);
+    if (size > resizer.read_size())
+      resizer.extend_from_disk(size);
+    ok = size == newsize;
+    rootfs_interface->add_transaction_to_queue(trans, cpu);
+  }
+  rootfs_interface->flush_transaction_queue(cpu);
+  return ok;
+}
+
 // This function gets called when a file is truncated. Page table mappings for
 // any pages that are no longer a part of the file need to be cleared from vmaps
-// that have the file mmapped. Each page_info object keeps track of these vmaps
-// via an oplog-maintained reverse map. This rmap is now traversed to unmap the
-// truncated pages from the vmaps in question.
+// that have the file mmapped. These are found, and removed, from the file's
+// rmap, which records the ranges of the file each vmap maps.
 void
 mfile::remove_pgtable_mappings(u64 start_offset) {
-  auto page_trunc_start = pages_.find(PGROUNDUP(start_offset) / PGSIZE);
-  for (auto it = page_trunc_start; it != pages_.end(); ) {
-    // Skip unset spans
-    if (!it.is_set()) {
-      it += it.base_span();
-      continue;
-    }
-    auto pg_info = it->get_page_info();
-    if (pg_info) {
-      std::vector<page_info::rmap_entry> rmap_vec;
-      pg_info->get_rmap_vector(rmap_vec);
-      for (auto rmap_it = rmap_vec.begin(); rmap_it != rmap_vec.end(); rmap_it++)
-        rmap_it->first->delete_mapping(rmap_it->second);
-    }
-    ++it;
-  }
+  std::vector<file_rmap::range> ranges;
+  scoped_gc_epoch e;            // Keeps the vmaps we find alive (see vmap)
+  rmap_.take(PGROUNDUP(start_offset) / PGSIZE, maxidx, &ranges);
+  for (auto &r : ranges)
+    r.m.vm->unmap_file(this, r.m.start, r.lo, r.hi);
 }
 
 // Drop the (clean) page-cache pages associated with this file.
@@ -333,6 +531,7 @@ mfile::drop_pagecache()
 void
 mfile::sync_file(int cpu)
 {
+  harvest_mappings();
   if (!is_dirty())
     return;
 
@@ -409,11 +608,14 @@ mdir::sync_dir(int cpu)
   dirty(false);
 }
 
-void
-mfsprint(print_stream *s)
+static void
+mnode_cache_print(print_stream *s, const char *name, const mfs *fs)
 {
-  auto stats = mnode_cache.get_stats();
-  s->println("mnode cache:");
+  struct mnode_cache::stats stats{};
+  fs->cache_stats(&stats);
+  s->println("mnode cache (", name, "):");
+  if (!stats.total_buckets)
+    return;
   s->println("  ", stats.items, " items");
   s->println("  ", stats.used_buckets, " used / ",
              stats.total_buckets, " total buckets (",
@@ -423,3 +625,10 @@ mfsprint(print_stream *s)
   if (stats.used_buckets)
     s->println("  ", stats.items / stats.used_buckets, " avg used chain length");
 }
+
+void
+mfsprint(print_stream *s)
+{
+  mnode_cache_print(s, "root", root_fs);
+  mnode_cache_print(s, "anon", anon_fs);
+}
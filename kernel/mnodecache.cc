@@ -0,0 +1,208 @@
+// Sharded, resizable cache of live mnodes
+
+#include "types.h"
+#include "kernel.hh"
+#include "mnode.hh"
+#include "mnodecache.hh"
+#include "gc.hh"
+#include "hash.hh"
+#include "kstats.hh"
+
+// Initial number of buckets in a shard's table.  A table doubles when
+// it averages more than two items per bucket.
+enum { initial_buckets = 64 };
+
+struct mnode_cache::item : public rcu_freed
+{
+  const u64 mnum_;
+  const refcache::weakref<mnode> weakref_;
+  shard * const parent_;
+  // Bucket chain links.  A table uses link_[gen], and a replacement
+  // table the other, so the old table's chains stay intact for
+  // lookups that are still walking them.
+  std::atomic<item*> link_[2];
+
+  item(u64 mnum, mnode *m, shard *parent)
+    : rcu_freed("mnode_cache::item", this, sizeof(*this)),
+      mnum_(mnum), weakref_(m), parent_(parent), link_{} { }
+  void do_gc() override { delete this; }
+  NEW_DELETE_OPS(item);
+};
+
+struct mnode_cache::table : public rcu_freed
+{
+  shard * const parent_;
+  const int gen_;
+  const u64 mask_;
+  std::atomic<item*> * const buckets_;
+
+  table(shard *parent, int gen, u64 nbuckets)
+    : rcu_freed("mnode_cache::table", this, sizeof(*this)),
+      parent_(parent), gen_(gen), mask_(nbuckets - 1),
+      buckets_((std::atomic<item*>*)
+               kmalloc(nbuckets * sizeof(*buckets_), "mnode_cache"))
+  {
+    if (!buckets_)
+      throw_bad_alloc();
+    for (u64 i = 0; i < nbuckets; i++)
+      new (&buckets_[i]) std::atomic<item*>(nullptr);
+  }
+
+  ~table()
+  {
+    kmfree(buckets_, (mask_ + 1) * sizeof(*buckets_));
+  }
+
+  std::atomic<item*> *bucket(u64 mnum) const
+  {
+    return &buckets_[hash(mnum) & mask_];
+  }
+
+  void do_gc() override
+  {
+    parent_->retiring_.store(false, std::memory_order_release);
+    delete this;
+  }
+  NEW_DELETE_OPS(table);
+};
+
+mnode_cache::~mnode_cache()
+{
+  panic("mnode_cache::~mnode_cache");
+}
+
+const mnode_cache::shard *
+mnode_cache::shard_for(u64 mnum) const
+{
+  return &shards_[mnode::mnumber(mnum).cpu() % NCPU];
+}
+
+sref<mnode>
+mnode_cache::lookup(u64 mnum) const
+{
+  scoped_gc_epoch reader;
+  table *t = shard_for(mnum)->table_.load(std::memory_order_acquire);
+  if (t) {
+    for (item *i = t->bucket(mnum)->load(std::memory_order_acquire); i;
+         i = i->link_[t->gen_].load(std::memory_order_acquire)) {
+      if (i->mnum_ != mnum)
+        continue;
+      sref<mnode> m = i->weakref_.get();
+      kstats::inc(m ? &kstats::mnode_cache_hit : &kstats::mnode_cache_miss);
+      return m;
+    }
+  }
+  kstats::inc(&kstats::mnode_cache_miss);
+  return sref<mnode>();
+}
+
+bool
+mnode_cache::insert(u64 mnum, mnode *m)
+{
+  shard *s = shard_for(mnum);
+  scoped_acquire l(&s->lock_);
+  table *t = s->table_.load(std::memory_order_relaxed);
+  if (!t) {
+    t = new table(s, 0, initial_buckets);
+    s->table_.store(t, std::memory_order_release);
+  }
+
+  auto b = t->bucket(mnum);
+  for (item *i = b->load(std::memory_order_relaxed); i;
+       i = i->link_[t->gen_].load(std::memory_order_relaxed))
+    if (i->mnum_ == mnum)
+      return false;
+
+  item *n = new item(mnum, m, s);
+  n->link_[t->gen_].store(b->load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+  b->store(n, std::memory_order_release);
+  if (++s->items_ > 2 * (t->mask_ + 1))
+    s->grow();
+  return true;
+}
+
+// Replace this shard's table with one twice the size.  Items are
+// relinked through their other link, so lookups on the old table are
+// undisturbed; the old table is freed once they are done, and until
+// then the shard doesn't grow again.  Must hold lock_.
+void
+mnode_cache::shard::grow()
+{
+  if (retiring_.load(std::memory_order_acquire))
+    return;
+
+  table *old = table_.load(std::memory_order_relaxed);
+  table *t;
+  try {
+    t = new table(this, !old->gen_, 2 * (old->mask_ + 1));
+  } catch (std::bad_alloc &e) {
+    // Keep using the old table; its chains just get longer.
+    return;
+  }
+
+  for (u64 i = 0; i <= old->mask_; i++) {
+    for (item *it = old->buckets_[i].load(std::memory_order_relaxed); it;
+         it = it->link_[old->gen_].load(std::memory_order_relaxed)) {
+      auto b = t->bucket(it->mnum_);
+      it->link_[t->gen_].store(b->load(std::memory_order_relaxed),
+                               std::memory_order_relaxed);
+      b->store(it, std::memory_order_relaxed);
+    }
+  }
+
+  retiring_.store(true, std::memory_order_relaxed);
+  table_.store(t, std::memory_order_release);
+  gc_delayed(old);
+  kstats::inc(&kstats::mnode_cache_resize);
+}
+
+void
+mnode_cache::shard::remove(item *victim)
+{
+  scoped_acquire l(&lock_);
+  table *t = table_.load(std::memory_order_relaxed);
+  std::atomic<item*> *prev = t->bucket(victim->mnum_);
+  for (;;) {
+    item *i = prev->load(std::memory_order_relaxed);
+    assert(i);
+    if (i == victim)
+      break;
+    prev = &i->link_[t->gen_];
+  }
+  prev->store(victim->link_[t->gen_].load(std::memory_order_relaxed),
+              std::memory_order_release);
+  items_--;
+  gc_delayed(victim);
+}
+
+void
+mnode_cache::cleanup(refcache::weakref<refcache::weak_referenced> *refp)
+{
+  auto vrefp = reinterpret_cast<const refcache::weakref<mnode>*>(refp);
+  item *i = container_from_member(vrefp, &item::weakref_);
+  i->parent_->remove(i);
+}
+
+void
+mnode_cache::get_stats(struct stats *stats) const
+{
+  for (const shard &s : shards_) {
+    scoped_gc_epoch reader;
+    table *t = s.table_.load(std::memory_order_acquire);
+    if (!t)
+      continue;
+    stats->total_buckets += t->mask_ + 1;
+    for (u64 b = 0; b <= t->mask_; b++) {
+      size_t n = 0;
+      for (item *i = t->buckets_[b].load(std::memory_order_acquire); i;
+           i = i->link_[t->gen_].load(std::memory_order_acquire))
+        n++;
+      stats->items += n;
+      if (n)
+        stats->used_buckets++;
+      if (n > stats->max_chain)
+        stats->max_chain = n;
+    }
+  }
+}
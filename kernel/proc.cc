@@ -10,9 +10,12 @@
 #include "kmtrace.hh"
 #include "kalloc.hh"
 #include "vm.hh"
-#include "ns.hh"
+#include "radix_array.hh"
+#include "bit_spinlock.hh"
 #include "work.hh"
 #include "filetable.hh"
+#include "percpu.hh"
+#include "crc32c.hh"
 #include <uk/fcntl.h>
 #include <uk/unistd.h>
 #include <uk/wait.h>
@@ -20,10 +23,9 @@
 u64
 proc::hash(const u32 &p)
 {
-  return p;
+  return crc32c_u64(~0u, p);
 }
 
-xns<u32, proc*, proc::hash> *xnspid __mpalign__;
 struct proc *bootproc __mpalign__;
 
 #if MTRACE
@@ -40,16 +42,62 @@ proc::proc(int npid) :
   user_fs_(0), unmap_tlbreq_(0), data_cpuid(-1), in_exec_(0), 
   uaccess_(0), yield_(false),
   upath(nullptr), uargv(nullptr),
-  exception_inuse(0), magic(PROC_MAGIC), unmapped_hint(0), state_(EMBRYO)
+  exception_inuse(0), magic(PROC_MAGIC), unmapped_hint(0),
+  on_zombieq(false), sig_lock("proc::sig_lock", LOCKSTAT_PROC),
+  sig_pending(0), sig_blocked(0), sig_nqueued(0), timers(nullptr),
+  reaper(this), state_(EMBRYO)
 {
   snprintf(lockname, sizeof(lockname), "cv:proc:%d", pid);
   lock = spinlock(lockname+3, LOCKSTAT_PROC);
   cv = new condvar(lockname);
+  sig_cv = new condvar("proc::sig_cv");
+  sigchld_q.prealloc = true;
   gc = new gc_handle();
   memset(__cxa_eh_global, 0, sizeof(__cxa_eh_global));
   memset(sig, 0, sizeof(sig));
 }
 
+// Bring a recycled proc back to the state the constructor leaves it in,
+// keeping its kernel stack, condvar and gc handle.  The caller has
+// already dropped the references and FPU state of the previous user.
+void
+proc::reinit(int npid)
+{
+  pid = npid;
+  parent = 0;
+  status = 0;
+  tf = 0;
+  context = 0;
+  killed = 0;
+  name[0] = 0;
+  tsc = 0;
+  curcycles = 0;
+  cpuid = 0;
+  cpu_pin = 0;
+  oncv = 0;
+  cv_wakeup = 0;
+  user_fs_ = 0;
+  unmap_tlbreq_ = 0;
+  data_cpuid = -1;
+  run_cpuid_ = 0;
+  in_exec_ = 0;
+  uaccess_ = 0;
+  yield_ = false;
+  upath = nullptr;
+  uargv = nullptr;
+  exception_inuse = 0;
+  magic = PROC_MAGIC;
+  unmapped_hint = 0;
+  on_zombieq = false;
+  state_ = EMBRYO;
+  // lock and cv name themselves from lockname, so this renames them too.
+  snprintf(lockname, sizeof(lockname), "cv:proc:%d", pid);
+  memset(__cxa_eh_global, 0, sizeof(__cxa_eh_global));
+  memset(sig, 0, sizeof(sig));
+  sig_blocked = 0;
+  timers = nullptr;
+}
+
 proc::~proc(void)
 {
   magic = 0;
@@ -152,25 +200,33 @@ exit(int status)
   if(myproc() == bootproc)
     panic("init exiting");
 
+  // Stop our timers before anything can post to a dead proc.
+  timers_exit(myproc());
+
   myproc()->ftable.reset();
 
   myproc()->cwd.reset();
 
   myproc()->status = (status & __WAIT_STATUS_VAL_MASK) | __WAIT_STATUS_EXITED;
 
-  // Pass abandoned children to init.
+  // Pass abandoned children to init.  Hold our own lock so that children
+  // exiting concurrently see a stable parent (see below).
   wakeupinit = 0;
+  acquire(&myproc()->lock);
   while (!myproc()->childq.empty()) {
     auto &p = myproc()->childq.front();
     myproc()->childq.pop_front();
     scoped_acquire pl(&p.lock);
     scoped_acquire bl(&bootproc->lock);
     p.parent = bootproc;
-    if(p.get_state() == ZOMBIE)  {
+    if (p.on_zombieq) {
+      myproc()->zombieq.erase(myproc()->zombieq.iterator_to(&p));
+      bootproc->zombieq.push_back(&p);
       wakeupinit = 1;
     }
     bootproc->childq.push_back(&p);
   }
+  release(&myproc()->lock);
 
   // Release vmap
   if (myproc()->vmap != nullptr) {
@@ -180,16 +236,48 @@ exit(int status)
     switchvm(myproc());
   }
 
-  // Lock the parent first, since otherwise we might deadlock.
-  if (myproc()->parent != nullptr)
-    acquire(&myproc()->parent->lock);
+  // Lock the parent first, since otherwise we might deadlock.  If the
+  // parent is exiting too, it may hand us to init before we get its lock,
+  // so check that it is still our parent once we hold it.
+  struct proc *parent;
+  for (;;) {
+    parent = myproc()->parent;
+    if (parent == nullptr)
+      break;
+    acquire(&parent->lock);
+    if (myproc()->parent == parent)
+      break;
+    release(&parent->lock);
+  }
 
   acquire(&(myproc()->lock));
 
   // Kernel threads might not have a parent
-  if (myproc()->parent != nullptr) {
-    release(&myproc()->parent->lock);
-    myproc()->parent->cv->wake_all();
+  if (parent != nullptr) {
+    // Queue ourselves for wait().  Our lock stays held until sched() has
+    // switched away from this stack, and wait() acquires it before
+    // reaping us.
+    myproc()->on_zombieq = true;
+    parent->zombieq.push_back(myproc());
+
+    // Queue SIGCHLD while parent can't go away.  Standard signals are
+    // pending at most once, so parent's preallocated record is free
+    // whenever it's needed and this can't fail.
+    siginfo_t info = {};
+    info.si_signo = SIGCHLD;
+    info.si_code = CLD_EXITED;
+    info.si_pid = myproc()->pid;
+    info.si_status = status & __WAIT_STATUS_VAL_MASK;
+    bool sigwake;
+    parent->queue_signal(info, &parent->sigchld_q, &sigwake);
+    release(&parent->lock);
+
+    // wake_all takes the sleepers' locks, so it can't run under
+    // parent->lock.  Parent still can't be freed: to exit it has to take
+    // our lock to hand us to init, and we hold that until sched().
+    parent->cv->wake_all();
+    if (sigwake)
+      parent->sig_cv->wake_all();
   } else {
     idlezombie(myproc());
   }
@@ -212,45 +300,321 @@ exit(int status)
   panic("zombie exit");
 }
 
+// Exited processes go into a small per-core cache so that fork/exit-heavy
+// workloads reuse constructed proc objects and warm kernel stacks (already
+// surrounded by guard pages under KSTACK_DEBUG) instead of going back to
+// kalloc and vmalloc.  A proc that has been in the pid table only reaches
+// the cache (or kfree) through gc_delayed, since kill(pid) and signal()
+// find procs without a lock and may still hold one after its pid is gone.
+//
+// Pids come from per-core pools.  Core c owns the blocks of PID_BLOCK pids
+// numbered c, c + NCPU, c + 2*NCPU, ...; each block fills exactly one leaf
+// of the pid table, so no two cores ever write the same cache line when
+// allocating fresh pids, and no shared counter is involved.  A released
+// pid goes on the tail of a FIFO free list on the core that releases it
+// (for fork/wait that is usually the core that allocated it).  Freed pids
+// are only reused once that list holds a full block's worth, oldest first,
+// so a pid stays unused for at least PID_BLOCK releases after it dies and
+// a kill or signal aimed at a just-reaped pid does not reach a new
+// process.  A core whose own pool runs dry steals another core's free
+// list, so pids reaped on one core but forked on another are not lost.
+enum { PROC_CACHE_MAX = 16, PID_BLOCK = PGSIZE / sizeof(u64),
+       PID_MAX = 1 << 22 };
+
+// A slot in the pid table.  A slot holds a live proc or, once its pid has
+// been released, the next pid on a free list.  Slots are never unset after
+// their first use, so a lookup is a lock-free read that cannot race with
+// the radix_array discarding the slot.  Each slot has a single writer at
+// a time (the core holding the pid), so the radix_array lock bit is only
+// here to satisfy its interface.
+class pid_slot
+{
+  enum {
+    FLAG_LOCK_BIT = 0,
+    FLAG_LOCK = 1 << FLAG_LOCK_BIT,
+    FLAG_FREE = 1 << 1,
+    FLAG_MASK = FLAG_LOCK | FLAG_FREE,
+  };
+
+  u64 value_;
+
+public:
+  pid_slot() : value_(0) { }
+  explicit pid_slot(proc *p) : value_((u64)p) { }
+  pid_slot(const pid_slot &o) : value_(o.value_) { }
+
+  pid_slot &operator=(const pid_slot &o)
+  {
+    value_ = o.value_;
+    return *this;
+  }
+
+  static pid_slot released(u32 next)
+  {
+    pid_slot s;
+    s.value_ = ((u64)next << 2) | FLAG_FREE;
+    return s;
+  }
+
+  proc *get() const
+  {
+    u64 v = *(volatile u64*)&value_;
+    return (v & FLAG_FREE) ? nullptr : (proc*)(v & ~(u64)FLAG_MASK);
+  }
+
+  u32 next_free() const
+  {
+    assert(value_ & FLAG_FREE);
+    return value_ >> 2;
+  }
+
+  bool is_set() const
+  {
+    return (value_ & ~(u64)FLAG_LOCK) != 0;
+  }
+
+  bit_spinlock get_lock()
+  {
+    return bit_spinlock(&value_, FLAG_LOCK_BIT);
+  }
+};
+
+typedef radix_array<pid_slot, PID_MAX, PGSIZE,
+                    kalloc_allocator<pid_slot>> pid_table;
+static pid_table *pidtab __mpalign__;
+
+struct proc_cache {
+  struct spinlock lock;
+  ilist<proc, &proc::child_next> procs;
+  u32 count;
+  u32 nextpid;
+  u32 endpid;
+  u32 nblocks;                  // Fresh pid blocks taken so far
+  u32 freepid;                  // Oldest released pid, or 0
+  u32 freetail;                 // Newest released pid, or 0
+  u32 nfree;                    // Length of the released pid list
+
+  proc_cache()
+    : lock("proc_cache", LOCKSTAT_PROC), count(0), nextpid(0), endpid(0),
+      nblocks(0), freepid(0), freetail(0), nfree(0) { }
+};
+
+DEFINE_PERCPU(struct proc_cache, proc_caches, NO_CRITICAL);
+
+// Pop the oldest pid off pc's free list.  Called with pc->lock held.
+static u32
+pid_pop(struct proc_cache *pc)
+{
+  u32 pid = pc->freepid;
+  pc->freepid = pidtab->find(pid)->next_free();
+  if (!pc->freepid)
+    pc->freetail = 0;
+  pc->nfree--;
+  return pid;
+}
+
+// Take a pid from this core's pool.  Returns 0 if the pool is exhausted.
+// Called with pc->lock held.
+static u32
+pid_get(struct proc_cache *pc)
+{
+  if (pc->nfree >= PID_BLOCK)
+    return pid_pop(pc);
+  if (pc->nextpid == pc->endpid) {
+    u64 block = (u64)pc->nblocks * NCPU + myid();
+    if ((block + 1) * PID_BLOCK > PID_MAX)
+      // Out of fresh blocks; fall back on whatever has been released.
+      return pc->freepid ? pid_pop(pc) : 0;
+    pc->nblocks++;
+    pc->nextpid = block * PID_BLOCK;
+    pc->endpid = pc->nextpid + PID_BLOCK;
+    // pid 0 is never handed out
+    if (pc->nextpid == 0)
+      pc->nextpid++;
+  }
+  return pc->nextpid++;
+}
+
+// Take a pid from another core's free list, once this core's pool is
+// exhausted.  We take the whole list, keep its oldest pid and append the
+// rest to our own list, so a core that forks while others reap steals
+// once per batch of reaped pids.  Returns 0 if no core has a free pid.
+// Called without any proc_cache lock held, since we lock other cores'
+// caches.
+static u32
+pid_steal(struct proc_cache *mine)
+{
+  for (int i = 0; i < NCPU; i++) {
+    struct proc_cache *pc = &proc_caches[i];
+    if (pc == mine || !pc->freepid)
+      continue;
+
+    u32 head, tail, n;
+    {
+      scoped_acquire l(&pc->lock);
+      head = pc->freepid;
+      tail = pc->freetail;
+      n = pc->nfree;
+      pc->freepid = pc->freetail = pc->nfree = 0;
+    }
+    if (!head)
+      continue;
+
+    u32 rest = pidtab->find(head)->next_free();
+    if (rest) {
+      scoped_acquire l(&mine->lock);
+      if (mine->freetail)
+        pidtab->fill(pidtab->find(mine->freetail), pid_slot::released(rest));
+      else
+        mine->freepid = rest;
+      mine->freetail = tail;
+      mine->nfree += n - 1;
+    }
+    return head;
+  }
+  return 0;
+}
+
+// Make p visible under its pid.
+static void
+pid_insert(proc *p)
+{
+  pidtab->fill(pidtab->find(p->pid), pid_slot(p));
+}
+
+// Remove p from the pid table and release its pid to this core's pool.
+static void
+pid_remove(proc *p)
+{
+  u32 pid = p->pid;
+  auto it = pidtab->find(pid);
+  if (!it.is_set() || it->get() != p)
+    panic("pid_remove: pid %u is not %p", pid, p);
+
+  struct proc_cache *pc = &proc_caches[myid()];
+  scoped_acquire l(&pc->lock);
+  pidtab->fill(it, pid_slot::released(0));
+  if (pc->freetail)
+    pidtab->fill(pidtab->find(pc->freetail), pid_slot::released(pid));
+  else
+    pc->freepid = pid;
+  pc->freetail = pid;
+  pc->nfree++;
+}
+
+// Return the proc with the given pid, or null.  This takes no locks.
+static proc*
+pid_lookup(u32 pid)
+{
+  auto it = pidtab->find(pid);
+  if (it == pidtab->end() || !it.is_set())
+    return nullptr;
+  return it->get();
+}
+
 static void
 freeproc(struct proc *p)
 {
+  if (p->kstack) {
+    // Drop everything that belongs to the previous incarnation now, rather
+    // than when the proc is reused.
+    p->vmap.reset();
+    p->ftable.reset();
+    p->cwd.reset();
+    p->cwd_m.reset();
+    if (p->fpu_state) {
+      kmfree(p->fpu_state, FXSAVE_BYTES);
+      p->fpu_state = nullptr;
+    }
+
+    struct proc_cache *pc = &proc_caches[myid()];
+    scoped_acquire l(&pc->lock);
+    if (pc->count < PROC_CACHE_MAX) {
+      pc->procs.push_front(p);
+      pc->count++;
+      return;
+    }
+  }
+
+#if !KSTACK_DEBUG
+  if (p->kstack)
+    kfree(p->kstack, KSTACKSIZE);
+#endif
   delete p;
 }
 
+// Free or cache p once no lock-free pid_lookup can still be using it.
+// p must already be out of the pid table.
+static void
+retireproc(struct proc *p)
+{
+  // gc_delayed checks for double frees with _rcu_next, which the gc
+  // leaves set, so clear it before each reuse of p->reaper.
+  p->reaper._rcu_next = nullptr;
+  gc_delayed(&p->reaper);
+}
+
+void
+proc_reaper::do_gc(void)
+{
+  freeproc(p);
+}
+
 proc*
 proc::alloc(void)
 {
   char *sp;
-  proc* p;
+  proc* p = nullptr;
+  u32 pid;
+
+  {
+    struct proc_cache *pc = &proc_caches[myid()];
+    scoped_acquire l(&pc->lock);
+    pid = pid_get(pc);
+    if (!pc->procs.empty()) {
+      p = &pc->procs.front();
+      pc->procs.pop_front();
+      pc->count--;
+    }
+  }
 
-  p = new proc(xnspid->allockey());
-  if (p == nullptr)
+  if (pid == 0 && (pid = pid_steal(&proc_caches[myid()])) == 0) {
+    if (p)
+      freeproc(p);
     throw_bad_alloc();
+  }
+
+  if (p) {
+    p->reinit(pid);
+  } else {
+    p = new proc(pid);
+    if (p == nullptr)
+      throw_bad_alloc();
+  }
 
   p->cpuid = mycpu()->id;
 #if MTRACE
   p->mtrace_stacks.curr = -1;
 #endif
 
-  if (!xnspid->insert(p->pid, p))
-    panic("allocproc: ns_insert");
+  pid_insert(p);
 
-  // Allocate kernel stack.
+  // Allocate kernel stack, unless this proc came with one.
   try {
+    if (!p->kstack) {
 #if KSTACK_DEBUG
-    // vmalloc the stack to surround it with guard pages so we can
-    // detect stack over/underflows.
-    p->kstack_vm = vmalloc<char[]>(KSTACKSIZE);
-    p->kstack = p->kstack_vm.get();
+      // vmalloc the stack to surround it with guard pages so we can
+      // detect stack over/underflows.
+      p->kstack_vm = vmalloc<char[]>(KSTACKSIZE);
+      p->kstack = p->kstack_vm.get();
 #else
-    if(!(p->kstack = (char*) kalloc("kstack", KSTACKSIZE)))
-      throw_bad_alloc();
+      if(!(p->kstack = (char*) kalloc("kstack", KSTACKSIZE)))
+        throw_bad_alloc();
 #endif
+    }
   } catch (...) {
-    if (!xnspid->remove(p->pid, &p))
-      panic("allocproc: ns_remove");
-    freeproc(p);
+    pid_remove(p);
+    retireproc(p);
     throw;
   }
 
@@ -281,8 +645,8 @@ proc::alloc(void)
 void
 initproc(void)
 {
-  xnspid = new xns<u32, proc*, proc::hash>(false);
-  if (xnspid == 0)
+  pidtab = new pid_table();
+  if (pidtab == 0)
     panic("pinit");
 }
 
@@ -316,17 +680,30 @@ proc::kill(int pid)
 {
   struct proc *p;
 
-  // XXX The one use of lookup and it is wrong: it should return a locked
-  // proc structure, or be in an RCU epoch.  Now another process can delete
-  // p between lookup and kill.
-  p = xnspid->lookup(pid);
-  if (p == 0) {
-    panic("kill");
+  // A reaped proc is only recycled after a GC epoch, so p stays a valid
+  // (if possibly exited) proc while we are in one.
+  scoped_gc_epoch e;
+  p = pid_lookup(pid);
+  if (p == 0)
     return -1;
-  }
   return p->kill();
 }
 
+// Post a signal to pid.  A signal number of 0 only checks that pid
+// exists.
+int
+proc::signal(int pid, const siginfo_t &info)
+{
+  // See kill(int).
+  scoped_gc_epoch e;
+  proc *p = pid_lookup(pid);
+  if (p == 0 || p->get_state() == ZOMBIE)
+    return -1;
+  if (info.si_signo == 0)
+    return 0;
+  return p->post_signal(info);
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
@@ -348,7 +725,11 @@ procdumpall(void)
   const char *state;
   uptr pc[10];
 
-  for (proc *p : xnspid) {
+  for (auto it = pidtab->begin(), end = pidtab->end(); it != end;
+       it += it.span()) {
+    proc *p;
+    if (!it.is_set() || !(p = it->get()))
+      continue;
     if(p->get_state() >= 0 && p->get_state() < NELEM(states) && 
        states[p->get_state()])
       state = states[p->get_state()];
@@ -392,8 +773,7 @@ doclone(clone_flags flags)
     return nullptr;
 
   auto proc_cleanup = scoped_cleanup([&np]() {
-    if (!xnspid->remove(np->pid, &np))
-      panic("fork: ns_remove");
+    pid_remove(np);
     freeproc(np);
   });
 
@@ -411,6 +791,7 @@ doclone(clone_flags flags)
   np->run_cpuid_ = myproc()->run_cpuid_;
   np->user_fs_ = myproc()->user_fs_;
   memcpy(np->sig, myproc()->sig, sizeof(np->sig));
+  np->sig_blocked = myproc()->sig_blocked.load();
 
   // Clear %eax so that fork returns 0 in the child.
   np->tf->rax = 0;
@@ -442,18 +823,15 @@ doclone(clone_flags flags)
 void
 finishproc(struct proc *p, bool removepid)
 {
-  if (removepid && !xnspid->remove(p->pid, &p))
-    panic("finishproc: ns_remove");
-#if !KSTACK_DEBUG
-  if (p->kstack)
-    kfree(p->kstack, KSTACKSIZE);
-#endif
+  if (removepid)
+    pid_remove(p);
 
   p->pid = 0;
   p->parent = 0;
   p->name[0] = 0;
   p->killed = 0;
-  freeproc(p);
+  p->flush_signals();
+  retireproc(p);
 }
 
 struct finishproc_work : public dwork
@@ -472,54 +850,77 @@ struct finishproc_work : public dwork
 };
 
 
-// Wait for a child process to exit and return its pid.
-// Return -1 if this process has no children.
+// Wait for a child process to exit and return its pid.  Exited children
+// are queued on the parent's zombieq by exit(), so reaping one costs O(1)
+// rather than a scan of every child.  With wpid != -1, the child is found
+// through the pid table.  Return -1 if this process has no matching
+// children, or 0 if WNOHANG is set and none has exited yet.
 int
-wait(int wpid,  userptr<int> status)
-{
-  int havekids, pid;
-
-  for(;;){
-    // Scan children for ZOMBIEs
-    havekids = 0;
-    acquire(&myproc()->lock);
-    for (auto it = myproc()->childq.begin(); it != myproc()->childq.end(); it++) {
-      proc &p = *it;
-      acquire(&p.lock);
-      if (wpid == -1 || wpid == p.pid) {
-	havekids = 1;
-	if(p.get_state() == ZOMBIE){
-	  release(&p.lock);	// noone else better be trying to lock p
-	  pid = p.pid;
-          myproc()->childq.erase(it);
-	  release(&myproc()->lock);
-
-          if (status) {
-            status.store(&p.status);
-          }
-
-          proc *np = &p;
-          if (!xnspid->remove(pid, &np))
-            panic("wait: ns_remove");
-
-          finishproc_work *w = new finishproc_work(&p);
-          assert(dwork_push(w, p.run_cpuid_) >= 0);
-	  return pid;
-	}
+wait(int wpid, userptr<int> status, int options)
+{
+  proc *me = myproc();
+  proc *p;
+  int pid;
+
+  for (;;) {
+    p = nullptr;
+    acquire(&me->lock);
+    if (wpid == -1) {
+      if (me->childq.empty()) {
+        release(&me->lock);
+        return -1;
       }
-      release(&p.lock);
+      if (!me->zombieq.empty())
+        p = &me->zombieq.front();
+    } else {
+      // Our children can only be reparented or reaped by us, so holding
+      // our lock keeps c->parent stable if c is one of them.
+      proc *c = pid_lookup(wpid);
+      if (c == nullptr || c->parent != me) {
+        release(&me->lock);
+        return -1;
+      }
+      if (c->on_zombieq)
+        p = c;
     }
 
-    // No point waiting if we don't have any children.
-    if(!havekids || myproc()->killed){
-      release(&myproc()->lock);
+    if (p)
+      break;
+
+    if (me->killed) {
+      release(&me->lock);
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
-    myproc()->cv->sleep(&myproc()->lock);
-    release(&myproc()->lock);
+    if (options & WNOHANG) {
+      release(&me->lock);
+      return 0;
+    }
+
+    // Wait for children to exit.  (See wake_all call in exit.)
+    me->cv->sleep(&me->lock);
+    release(&me->lock);
   }
+
+  me->zombieq.erase(me->zombieq.iterator_to(p));
+  me->childq.erase(me->childq.iterator_to(p));
+  p->on_zombieq = false;
+  release(&me->lock);
+
+  // exit() holds p->lock until p has switched off its kernel stack.
+  acquire(&p->lock);
+  assert(p->get_state() == ZOMBIE);
+  release(&p->lock);
+
+  pid = p->pid;
+  if (status)
+    status.store(&p->status);
+
+  pid_remove(p);
+
+  finishproc_work *w = new finishproc_work(p);
+  assert(dwork_push(w, p->run_cpuid_) >= 0);
+  return pid;
 }
 
 void
@@ -541,8 +942,7 @@ threadalloc(void (*fn)(void *), void *arg)
     return 0;
 
   auto proc_cleanup = scoped_cleanup([&p]() {
-    if (!xnspid->remove(p->pid, &p))
-      panic("fork: ns_remove");
+    pid_remove(p);
     freeproc(p);
   });
 
@@ -578,28 +978,3 @@ threadpin(void (*fn)(void*), void *arg, const char *name, int cpu)
   release(&p->lock);
   return p;
 }
-
-bool
-proc::deliver_signal(int signo)
-{
-  if (signo < 0 || signo >= NSIG)
-    return false;
-
-  if (sig[signo].sa_handler == 0)
-    return false;
-
-  trapframe tf_save = *tf;
-  tf->rsp -= 128;   // skip redzone
-  tf->rsp -= sizeof(tf_save);
-  if (putmem((void*) tf->rsp, &tf_save, sizeof(tf_save)) < 0)
-    return false;
-
-  tf->rsp -= 8;
-  if (putmem((void*) tf->rsp, &sig[signo].sa_restorer, 8) < 0)
-    return false;
-
-  tf->rip = (u64) sig[signo].sa_handler;
-  tf->rdi = signo;
-  return true;
-}
-
@@ -0,0 +1,86 @@
+// Per-file reverse maps
+
+#include "types.h"
+#include "kernel.hh"
+#include "cpu.hh"
+#include "rmap.hh"
+
+typedef interval_tree<file_rmap::mapper>::node rmap_node;
+
+void
+file_rmap::log(op &&o)
+{
+  size_t n;
+  {
+    auto l = get_logger(myid());
+    l->push(std::move(o));
+    n = l->size();
+  }
+  if (n > max_logged_ops)
+    synchronize_with_spinlock();
+}
+
+void
+file_rmap::apply_add(const mapper &m, u64 lo, u64 hi)
+{
+  // Merge with any ranges of m that touch [lo, hi), so fork and
+  // page-at-a-time faults don't fragment the tree.
+  std::vector<rmap_node*> adj;
+  tree_.query(lo ? lo - 1 : 0, hi + 1, [&](rmap_node *n) {
+      if (n->val == m)
+        adj.push_back(n);
+    });
+  for (rmap_node *n : adj) {
+    lo = std::min(lo, n->lo);
+    hi = std::max(hi, n->hi);
+    tree_.erase(n);
+  }
+  tree_.insert(lo, hi, m);
+}
+
+void
+file_rmap::apply_remove(const mapper &m, u64 lo, u64 hi)
+{
+  std::vector<rmap_node*> overlap;
+  tree_.query(lo, hi, [&](rmap_node *n) {
+      if (n->val == m)
+        overlap.push_back(n);
+    });
+  for (rmap_node *n : overlap) {
+    u64 nlo = n->lo, nhi = n->hi;
+    tree_.erase(n);
+    if (nlo < lo)
+      tree_.insert(nlo, lo, m);
+    if (nhi > hi)
+      tree_.insert(hi, nhi, m);
+  }
+}
+
+void
+file_rmap::lookup(u64 lo, u64 hi, std::vector<range> *out)
+{
+  auto guard = synchronize_with_spinlock();
+  tree_.query(lo, hi, [&](rmap_node *n) {
+      out->push_back(range{n->val, std::max(lo, n->lo), std::min(hi, n->hi)});
+    });
+}
+
+void
+file_rmap::take(u64 lo, u64 hi, std::vector<range> *out)
+{
+  auto guard = synchronize_with_spinlock();
+  std::vector<rmap_node*> overlap;
+  tree_.query(lo, hi, [&](rmap_node *n) {
+      overlap.push_back(n);
+    });
+  for (rmap_node *n : overlap) {
+    mapper m = n->val;
+    u64 nlo = n->lo, nhi = n->hi;
+    out->push_back(range{m, std::max(lo, nlo), std::min(hi, nhi)});
+    tree_.erase(n);
+    if (nlo < lo)
+      tree_.insert(nlo, lo, m);
+    if (nhi > hi)
+      tree_.insert(hi, nhi, m);
+  }
+}
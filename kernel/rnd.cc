@@ -6,7 +6,6 @@
 
 struct state {
   u64 seed;
- __padout__;
 };
 
 DEFINE_PERCPU(state, rstate);
@@ -85,7 +85,14 @@ initrtc(void)
   rtc_nsec0 = rtc_now * 1000000000ull - nsectime_now;
 }
 
-//SYSCALL
+// The UNIX epoch time, in nanoseconds, of nsectime() 0.
+uint64_t
+rtc_epoch_nsec(void)
+{
+  return rtc_nsec0;
+}
+
+//SYSCALL {"fast": true}
 uint64_t
 sys_time_nsec(void)
 {
@@ -83,7 +83,7 @@ private:
 public:
   bool log(const struct pmuevent &ev);
   void flush();
-} __mpalign__;
+};
 
 DEFINE_PERCPU(struct pmulog, pmulog);
 
@@ -7,6 +7,8 @@
 #include "scalefs.hh"
 #include "kstream.hh"
 #include "major.h"
+#include "crc32c.hh"
+#include "work.hh"
 
 
 mfs_interface::mfs_interface()
@@ -201,6 +203,27 @@ mfs_interface::truncate_file(u64 mfile_mnum, u32 offset, transaction *tr)
     m->as_file()->remove_pgtable_mappings(offset);
 }
 
+// Extends a file on disk to the specified size with unwritten blocks, which
+// read as zeroes until they are first written. Returns the new size, which
+// falls short of @size if the disk filled up.
+u32
+mfs_interface::preallocate_file(u64 mfile_mnum, u32 size, transaction *tr)
+{
+  scoped_gc_epoch e;
+
+  sref<inode> ip = prepare_sync_file_pages(mfile_mnum, tr);
+  if (size <= ip->size) {
+    iunlock(ip);
+    return ip->size;
+  }
+  size = iprealloc(ip, size, tr);
+  tr->add_dirty_blocks_lazy();
+  iunlock(ip);
+
+  update_size(ip, size, tr);
+  return size;
+}
+
 // Returns an inode locked for write, on success.
 sref<inode>
 mfs_interface::alloc_inode_for_mnode(u64 mnum, u8 type)
@@ -553,48 +576,147 @@ mfs_interface::get_mfslog_linkcount(u64 mnum)
   return count;
 }
 
-// Applies all metadata operations logged in the logical logs. Called on sync.
-void
-mfs_interface::process_metadata_log_and_flush(int cpu)
+// sync() and syncfs() split their work across a sync worker thread pinned to
+// each CPU.  Worker w processes every nworkers'th dirty mnode into journal w,
+// so the workers don't contend for journals, and then flushes the journals
+// congruent to w.  Every worker processes its metadata logs before any worker
+// syncs a file or directory.
+struct sync_job
 {
-  // Invoke process_metadata_log() on every dirty mnode.
-  std::vector<u64> mnum_list;
-  metadata_log_htab->enumerate([&](const u64 &mnum, mfs_logical_log* &mfs_log)->bool {
+  std::vector<u64> mnums;
+  // Also delete the inodes queued by mnode::onzero() (sync, but not syncfs).
+  bool deletes;
 
-    sref<mnode> m = root_fs->mget(mnum);
-    if (m && m->is_dirty()) {
-      // In process_metadata_log(), we make decisions based on the mnode's
-      // refcount (i.e., whether to free the on-disk inode or postpone it until
-      // reboot). So to avoid interference with the refcount, we store the mnode
-      // numbers here, and not references to the mnodes themselves (which would
-      // have bumped up the refcount inadvertently!).
-      mnum_list.push_back(mnum);
+  spinlock lock;
+  condvar cv;
+  int nworkers;
+  int arrived;                  // Workers waiting at the current barrier
+  int phase;                    // Barriers passed
+  int left;                     // Workers done with the job
+
+  sync_job(std::vector<u64> &&mnums, bool deletes)
+    : mnums(std::move(mnums)), deletes(deletes),
+      lock("sync_job", LOCKSTAT_FS), cv("sync_job"),
+      nworkers(ncpu), arrived(0), phase(0), left(0) { }
+
+  // Wait for every worker to get here.
+  void rendezvous()
+  {
+    scoped_acquire l(&lock);
+    int p = phase;
+    if (++arrived == nworkers) {
+      arrived = 0;
+      phase++;
+      cv.wake_all();
+      return;
     }
+    while (phase == p)
+      cv.sleep(&lock);
+  }
 
-      // We call process_metadata_log() outside enumerate() because it does a
-      // lookup on metadata_log_htab itself, which causes weird interactions.
+  // Called by each worker as its last access to the job.
+  void leave()
+  {
+    scoped_acquire l(&lock);
+    if (++left == nworkers)
+      cv.wake_all();
+  }
 
-    return false;
-  });
+  // Wait for every worker to finish.  The job lives on the caller's stack,
+  // so this can't return until no worker can touch it again, which a
+  // final barrier wouldn't ensure: the workers woken from it still have to
+  // reacquire the lock on their way out.
+  void wait()
+  {
+    scoped_acquire l(&lock);
+    while (left < nworkers)
+      cv.sleep(&lock);
+  }
+};
 
-  for (auto &mnum : mnum_list) {
+struct sync_worker
+{
+  spinlock lock;
+  condvar cv;
+  sync_job *job;
+};
+
+static sync_worker sync_workers[NCPU];
+// Serializes sync jobs, since each worker runs one job at a time.
+static sleeplock sync_lock;
+
+static void
+sync_worker_thread(void *arg)
+{
+  int worker = (uintptr_t)arg;
+  sync_worker *w = &sync_workers[worker];
+
+  acquire(&w->lock);
+  for (;;) {
+    while (!w->job)
+      w->cv.sleep(&w->lock);
+    sync_job *job = w->job;
+    w->job = nullptr;
+    release(&w->lock);
+    rootfs_interface->sync_share(job, worker);
+    acquire(&w->lock);
+  }
+}
+
+static void
+sync_run(sync_job *job)
+{
+  auto l = sync_lock.guard();
+  for (int i = 0; i < job->nworkers; i++) {
+    scoped_acquire wl(&sync_workers[i].lock);
+    sync_workers[i].job = job;
+    sync_workers[i].cv.wake_all();
+  }
+  job->wait();
+}
+
+// Start the sync workers.
+static void
+initsync(void)
+{
+  for (int c = 0; c < ncpu; c++) {
+    sync_workers[c].lock = spinlock("sync_worker", LOCKSTAT_FS);
+    sync_workers[c].cv = condvar("sync_worker");
+    char namebuf[32];
+    snprintf(namebuf, sizeof(namebuf), "sync_%u", c);
+    threadpin(sync_worker_thread, (void*)(uintptr_t)c, namebuf, c);
+  }
+}
+
+// Worker's share of job.  Runs on CPU worker, which is also the journal its
+// transactions go to.
+void
+mfs_interface::sync_share(sync_job *job, int worker)
+{
+  int cpu = worker;
+  std::vector<u64> mine;
+  for (size_t i = worker; i < job->mnums.size(); i += job->nworkers)
+    mine.push_back(job->mnums[i]);
+
+  for (auto &mnum : mine) {
     sref<mnode> m = root_fs->mget(mnum);
     if (m && m->is_dirty())
       process_metadata_log(get_tsc(), m->mnum_, cpu);
   }
 
+  job->rendezvous();
+
   // Transactions enqueued to the same journal queue (indexed by the cpu number)
   // are always flushed in the order they are enqueued. Hence the transactions
   // generated by process_metadata_log() above go to disk first, followed by
   // those generated by sync_dirty_files_and_dirs().
 
-  sync_dirty_files_and_dirs(cpu, mnum_list);
+  sync_dirty_files_and_dirs(cpu, mine);
 
-  {
-    // Commit all these transactions via our CPU's per-core journal.
+  if (job->deletes) {
     auto commit_insert_guard = fs_journal[cpu]->commitq_insert_lock.guard();
 
-    for (int i = 0; i < NCPU; i++)  {
+    for (int i = worker; i < NCPU; i += job->nworkers)  {
       // Delete all the inodes marked for lazy deletion by mnode::onzero()
       std::vector<u64> del_mnum_list;
       {
@@ -605,22 +727,93 @@ mfs_interface::process_metadata_log_and_flush(int cpu)
       for (auto &del_mnum : del_mnum_list) {
         transaction *tr = new transaction();
         delete_mnum_inode_safe(del_mnum, tr, true, true);
-
-	// Note: Queueing dependent transactions on different journals will
-	// cause a deadlock here (because we try to flush each journal
-	// completely before moving onto the next one). We sidestep this
-	// deadlock by committing all these transactions via the same journal
-	// (our per-core journal); that's why the second argument has to be
-	// 'cpu', as opposed to 'i'.
         add_transaction_to_queue(tr, cpu);
       }
     }
   }
 
   // Commit and apply pending transactions from ALL the per-core queues, not
-  // just the queue we added transactions to above.
-  for (int i = 0; i < NCPU; i++)
+  // just the queues the workers added transactions to above.  Transactions
+  // with dependencies on other journals wait for the workers flushing those.
+  for (int i = worker; i < NCPU; i += job->nworkers)
     flush_transaction_queue(i, true);
+
+  job->leave();
+}
+
+// Whether sync has to look at m: it's dirty, or it's a file that may have
+// been written through a shared mapping, which sync_file harvests.
+static bool
+needs_sync(const sref<mnode> &m)
+{
+  return m->is_dirty() ||
+    (m->type() == mnode::types::file && m->as_file()->shared_mapped());
+}
+
+// Applies all metadata operations logged in the logical logs. Called on sync.
+void
+mfs_interface::process_metadata_log_and_flush()
+{
+  // Find every dirty mnode.
+  std::vector<u64> mnum_list;
+  metadata_log_htab->enumerate([&](const u64 &mnum, mfs_logical_log* &mfs_log)->bool {
+
+    sref<mnode> m = root_fs->mget(mnum);
+    if (m && needs_sync(m)) {
+      // In process_metadata_log(), we make decisions based on the mnode's
+      // refcount (i.e., whether to free the on-disk inode or postpone it until
+      // reboot). So to avoid interference with the refcount, we store the mnode
+      // numbers here, and not references to the mnodes themselves (which would
+      // have bumped up the refcount inadvertently!).
+      mnum_list.push_back(mnum);
+    }
+
+      // We call process_metadata_log() outside enumerate() because it does a
+      // lookup on metadata_log_htab itself, which causes weird interactions.
+
+    return false;
+  });
+
+  sync_job job(std::move(mnum_list), true);
+  sync_run(&job);
+}
+
+// Like process_metadata_log_and_flush(), but only for the dirty mnodes in the
+// subtree rooted at root (or just root, if it isn't a directory).  Inodes
+// queued for deletion are left for the next sync.  Called on syncfs.
+void
+mfs_interface::process_subtree_and_flush(sref<mnode> root)
+{
+  std::vector<u64> mnum_list;
+  std::vector<sref<mnode>> dirs;
+
+  if (needs_sync(root))
+    mnum_list.push_back(root->mnum_);
+  if (root->type() == mnode::types::dir)
+    dirs.push_back(root);
+
+  while (!dirs.empty()) {
+    sref<mnode> d = std::move(dirs.back());
+    dirs.pop_back();
+
+    strbuf<DIRSIZ> name;
+    const strbuf<DIRSIZ> *prev = nullptr;
+    while (d->as_dir()->enumerate(prev, &name)) {
+      prev = &name;
+      if (name == "." || name == "..")
+        continue;
+      sref<mnode> m = d->as_dir()->lookup(name);
+      if (!m)
+        continue;
+      if (needs_sync(m))
+        mnum_list.push_back(m->mnum_);
+      if (m->type() == mnode::types::dir)
+        dirs.push_back(std::move(m));
+    }
+  }
+
+  sync_job job(std::move(mnum_list), false);
+  sync_run(&job);
 }
 
 void
@@ -637,7 +830,7 @@ mfs_interface::sync_dirty_files_and_dirs(int cpu, std::vector<u64> &mnum_list)
       continue;
 
     sref<mnode> m = root_fs->mget(mnum);
-    if (m && m->is_dirty()) {
+    if (m && needs_sync(m)) {
       if (m->type() == mnode::types::file)
         m->as_file()->sync_file(cpu);
       else if (m->type() == mnode::types::dir)
@@ -1578,16 +1771,38 @@ mfs_interface::pre_process_transaction(transaction *tr)
     bfree_on_disk(tr->free_block_list, tr);
 }
 
+// Returns the blocks freed by a committed transaction to the in-memory
+// free-bit-vector, off the commit path.
+struct free_blocks_work : public dwork
+{
+  free_blocks_work(std::vector<u32>&& blocks)
+    : dwork(), blocks_(std::move(blocks)) {}
+
+  virtual void run() override {
+    rootfs_interface->free_blocks(blocks_);
+    delete this;
+  }
+
+  std::vector<u32> blocks_;
+
+  NEW_DELETE_OPS(free_blocks_work)
+};
+
 void
 mfs_interface::post_process_transaction(transaction *tr)
 {
   tr->deduplicate_freeblock_list();
   tr->deduplicate_freeinum_list();
 
-  // Now that the transaction has been committed, mark the freed blocks as
-  // free in the in-memory free-bit-vector.
-  for (auto &f : tr->free_block_list)
-    free_block(f);
+  // Now that the transaction has been committed, the freed blocks can be
+  // marked free in the in-memory free-bit-vector. Truncating or deleting a
+  // large file frees thousands of blocks, so hand them to a deferred worker
+  // instead of making the committer wait for it.
+  if (!tr->free_block_list.empty()) {
+    free_blocks_work *w = new free_blocks_work(std::move(tr->free_block_list));
+    assert(dwork_push(w, myid()) >= 0);
+    tr->free_block_list.clear();
+  }
 
   // Make the freed inode numbers available again for reuse.
   for (auto &inum : tr->free_inum_list)
@@ -1617,11 +1832,12 @@ mfs_interface::commit_transaction_to_disk(int cpu, transaction *trans)
 
   // Write the transaction's start block and the data blocks to the on-disk
   // journal.
-  write_journal_transaction_blocks(trans->blocks, trans->commit_tsc,
-                                   trans->disks_written, cpu);
+  u32 checksum = write_journal_transaction_blocks(trans->blocks,
+                                                  trans->commit_tsc,
+                                                  trans->disks_written, cpu);
 
   // Commit the transaction to the on-disk journal with the given timestamp.
-  write_journal_commit_block(trans->commit_tsc, cpu);
+  write_journal_commit_block(trans->commit_tsc, checksum, cpu);
   iunlock(sv6_journal[cpu]);
 
   post_process_transaction(trans);
@@ -2008,9 +2224,9 @@ mfs_interface::write_journal(char *buf, size_t size, transaction *tr, int cpu)
 
 // Write a transaction's disk blocks to the on-disk journal. The only thing
 // remaining to write to the journal on the disk after this function returns,
-// would be the commit block.
+// would be the commit block. Returns the checksum for the commit block.
 // Caller must hold ilock for write on sv6_journal.
-void
+u32
 mfs_interface::write_journal_transaction_blocks(
     const std::vector<transaction_diskblock*> &datablocks,
     const u64 timestamp, bitset<NDISK> &disks_written, int cpu)
@@ -2049,14 +2265,17 @@ mfs_interface::write_journal_transaction_blocks(
   transaction *jrnl_trans = new transaction();
 
   write_journal((char *)&hdr_start, sizeof(hdr_start), jrnl_trans, cpu);
+  u32 checksum = crc32c(~0u, &hdr_start, sizeof(hdr_start));
 
   // Write out the address block(s), if we have any.
   if (hdr_start.num_addr_blocks)
     write_journal((char *)&hdr_addr, sizeof(hdr_addr), jrnl_trans, cpu);
 
   // Write out the data blocks themselves to the in-memory journal.
-  for (auto &b : datablocks)
+  for (auto &b : datablocks) {
     write_journal(b->blockdata, BSIZE, jrnl_trans, cpu);
+    checksum = crc32c(checksum, b->blockdata, BSIZE);
+  }
 
   // Merge the disks_written obtained from any previous disk writes by the
   // given transaction.
@@ -2067,14 +2286,16 @@ mfs_interface::write_journal_transaction_blocks(
   jrnl_trans->write_to_disk_and_flush();
 
   delete jrnl_trans;
+  return ~checksum;
 }
 
 // Caller must hold ilock for write on sv6_journal.
 void
-mfs_interface::write_journal_commit_block(u64 timestamp, int cpu)
+mfs_interface::write_journal_commit_block(u64 timestamp, u32 checksum, int cpu)
 {
   // The transaction ends with a commit block containing the same timestamp.
   journal_header_block hdr_commit(timestamp, JOURNAL_TXN_COMMIT);
+  hdr_commit.checksum = checksum;
 
   transaction *jrnl_trans = new transaction();
   write_journal((char *)&hdr_commit, sizeof(hdr_commit), jrnl_trans, cpu);
@@ -2148,32 +2369,35 @@ mfs_interface::get_txn_start_block(int cpu)
 
 bool
 mfs_interface::get_txn_data_blocks(int cpu, journal_header *hdstartptr,
-                                   transaction *trans)
+                                   transaction *trans, u32 *checksum)
 {
-  static char databuf[BSIZE];
   u32 offset = fs_journal[cpu]->current_offset();
   int num_blks = sizeof(hdstartptr->blocknums) / sizeof(u32);
   u32 datablock_offset = hdstartptr->num_addr_blocks ?
                          offset + sizeof(journal_addr_block) : offset;
+  u32 crc = crc32c(~0u, hdstartptr, sizeof(*hdstartptr));
 
   for (int i = 0; i < num_blks && hdstartptr->blocknums[i]; i++) {
-
-    if (readi(sv6_journal[cpu], databuf, datablock_offset, BSIZE) != BSIZE) {
+    // Read straight into the page the transaction will hold.
+    sref<bufpage> page = make_sref<bufpage>();
+    if (readi(sv6_journal[cpu], page->data, datablock_offset, BSIZE) != BSIZE) {
       delete trans;
       return false;
     }
 
     datablock_offset += BSIZE;
-    trans->add_block(hdstartptr->blocknums[i], databuf);
+    crc = crc32c(crc, page->data, BSIZE);
+    trans->add_block(hdstartptr->blocknums[i], page);
   }
 
   assert(!hdstartptr->num_addr_blocks); // TODO: Handle this case later.
   fs_journal[cpu]->update_offset(datablock_offset);
+  *checksum = ~crc;
   return true;
 }
 
 bool
-mfs_interface::get_txn_commit_block(int cpu, transaction *trans)
+mfs_interface::get_txn_commit_block(int cpu, transaction *trans, u32 checksum)
 {
   static char commitbuf[BSIZE];
   size_t hdr_size = sizeof(journal_header_block);
@@ -2194,6 +2418,13 @@ mfs_interface::get_txn_commit_block(int cpu, transaction *trans)
     return false;
   }
 
+  if (hdcommitptr->checksum != checksum) {
+    cprintf("recover_journal: transaction %lu fails its checksum\n",
+            trans->commit_tsc);
+    delete trans;
+    return false;
+  }
+
   return true;
 }
 
@@ -2231,10 +2462,11 @@ mfs_interface::recover_journal(int cpu, std::vector<transaction*> &trans_vec)
     transaction *trans = new transaction(hdstartptr->timestamp);
     trans->commit_tsc = hdstartptr->timestamp;
 
-    if (!get_txn_data_blocks(cpu, hdstartptr, trans))
+    u32 checksum;
+    if (!get_txn_data_blocks(cpu, hdstartptr, trans, &checksum))
       break;
 
-    if (!get_txn_commit_block(cpu, trans))
+    if (!get_txn_commit_block(cpu, trans, checksum))
       break;
 
     assert(trans);
@@ -2479,13 +2711,31 @@ mfs_interface::initialize_freeblock_bitmap()
 
 // Allocate a block from the freeblock_bitmap.
 u32
-mfs_interface::alloc_block()
+mfs_interface::alloc_block(u32 goal)
 {
   u32 bno;
   superblock sb;
   int cpu = myid();
   static bool warned_once = false;
 
+  // If the caller asked for a particular block (typically the one following
+  // the previous block of the same file) and it is free, hand it out, so that
+  // the file stays contiguous on the disk. The block may sit on any CPU's
+  // freelist; free_block() will return it to that same list later.
+  if (goal && goal < freeblock_bitmap.bit_vector.size()) {
+    free_bit *bit = freeblock_bitmap.bit_vector.at(goal);
+    if (bit->is_free) {
+      auto &fl = bit->cpu < NCPU ? freeblock_bitmap.freelists[bit->cpu] :
+                                   freeblock_bitmap.reserve_freelist;
+      auto list_lock = fl.list_lock.guard();
+      if (bit->is_free) {
+        bit->is_free = false;
+        fl.bit_freelist.erase(fl.bit_freelist.iterator_to(bit));
+        return goal;
+      }
+    }
+  }
+
   // Use the linked-list representation of the free-bits to perform block
   // allocation in O(1) time. This list only contains the blocks that are
   // actually free, so we can allocate any one of them.
@@ -2583,6 +2833,29 @@ mfs_interface::free_block(u32 bno)
   }
 }
 
+// Mark a sorted list of blocks as free, as free_block() does, but take each
+// freelist's lock once per run of blocks that belong to it rather than once
+// per block.  Truncating or deleting a large file frees its blocks this way,
+// from a deferred worker, after its transaction commits.
+void
+mfs_interface::free_blocks(const std::vector<u32> &blocks)
+{
+  for (auto b = blocks.begin(); b != blocks.end(); ) {
+    int cpu = freeblock_bitmap.bit_vector.at(*b)->cpu;
+    auto &fl = cpu < NCPU ? freeblock_bitmap.freelists[cpu] :
+                            freeblock_bitmap.reserve_freelist;
+    auto list_lock = fl.list_lock.guard();
+    do {
+      free_bit *bit = freeblock_bitmap.bit_vector.at(*b);
+      if (bit->cpu != cpu)
+        break;
+      assert(!bit->is_free);
+      bit->is_free = true;
+      fl.bit_freelist.push_back(bit);
+    } while (++b != blocks.end());
+  }
+}
+
 void
 mfs_interface::print_free_blocks(print_stream *s)
 {
@@ -2837,6 +3110,8 @@ init_scalefs()
 
   rootfs_interface->alloc_inodebitmap_locks();
 
+  initsync();
+
   devsw[MAJ_BLKSTATS].pread = blkstatsread;
   devsw[MAJ_EVICTCACHES].write = evict_caches;
 
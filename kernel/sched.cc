@@ -16,16 +16,20 @@
 #include "ilist.hh"
 #include "kstream.hh"
 #include "file.hh"
+#include "cacheline.hh"
 
 enum { sched_debug = 0 };
 
+// A CPU's run queue.  Its fields are grouped by who touches them, so
+// that a remote CPU checking whether there is anything to steal doesn't
+// take the line the owner updates on every context switch.
 struct schedule : public balance_pool<schedule> {
 public:
   schedule(int id);
   ~schedule() {};
   NEW_DELETE_OPS(schedule);
   
-  int id_;    // XXX false sharing on this var???
+  const int id_;
 
   void enq(proc* entry);
   proc* deq();
@@ -37,29 +41,38 @@ public:
   void balance_move_to(schedule *other);
   u64 balance_count() const;
 
-  sched_stat stats_;
-  u64 ncansteal_;
+  // Cycles spent idle and busy, written by the owner on every context
+  // switch.
+  u64 idle_ __mpalign__;
+  u64 busy_;
+  u64 schedstart_;
+
 private:
   void sanity(void);
 
+  // Everything protected by lock_, which remote CPUs take to enqueue
+  // and steal.  Failed steals count misses_ without the lock.
   struct spinlock lock_ __mpalign__;
   ilist<proc, &proc::sched_link> proc_;
   isqueue<dwork, &dwork::link_> work_;
+  u64 ncansteal_;
+  u64 enqs_, deqs_;
+  std::atomic<u64> steals_, misses_;
+
+  // Polled by every CPU looking for work to steal.
   volatile bool cansteal_ __mpalign__;
   __padout__;
 };
 
 schedule::schedule(int id)
-  : balance_pool(1), id_(id), lock_("schedule::lock_", LOCKSTAT_SCHED)
+  : balance_pool(1), id_(id), idle_(0), busy_(0), schedstart_(0),
+    lock_("schedule::lock_", LOCKSTAT_SCHED), ncansteal_(0),
+    enqs_(0), deqs_(0), steals_(0), misses_(0), cansteal_(false)
 {
-  ncansteal_ = 0;
-  stats_.enqs = 0;
-  stats_.deqs = 0;
-  stats_.steals = 0;
-  stats_.misses = 0;
-  stats_.idle = 0;
-  stats_.busy = 0;
-  stats_.schedstart = 0;
+  CACHELINE_APART(schedule, id_, idle_);
+  CACHELINE_SAME(schedule, idle_, schedstart_);
+  CACHELINE_APART(schedule, schedstart_, lock_);
+  CACHELINE_START(schedule, cansteal_);
 }
 
 u64 
@@ -92,7 +105,7 @@ schedule::balance_move_to(schedule* target)
   }
   release(&lock_);
   if (!victim) {
-    ++stats_.misses;
+    ++misses_;
     return;
   }
 
@@ -105,10 +118,10 @@ schedule::balance_move_to(schedule* target)
     target->enq(victim);
     release(&victim->lock);
     //cprintf("%d: stole %s from %d\n", mycpu()->id, victim->name, id_);
-    ++stats_.steals;
+    ++steals_;
     return;
   }
-  ++stats_.misses;
+  ++misses_;
   cprintf("%d: don't steal %s---hasn't run long enough\n", 
           mycpu()->id, victim->name);
 #if 0
@@ -131,7 +144,7 @@ schedule::enq(proc* p)
       cansteal_ = true;
     }
   sanity();
-  stats_.enqs++;
+  enqs_++;
 }
 
 proc*
@@ -149,14 +162,15 @@ schedule::deq(void)
     if (--ncansteal_ == 0)
       cansteal_ = false;
   sanity();
-  stats_.deqs++;
+  deqs_++;
   return &p;
 }
 
 void
 schedule::dump(print_stream *s)
 {
-  s->print(" enq ", stats_.enqs, " deqs ", stats_.deqs, " steals ", stats_.steals, " misses ", stats_.misses);
+  s->print(" enq ", enqs_, " deqs ", deqs_, " steals ", steals_.load(),
+           " misses ", misses_.load());
 }
 
 void
@@ -265,11 +279,12 @@ public:
     next = this->next();
 
     u64 t = rdtsc();
+    schedule *s = schedule_[mycpu()->id];
     if (myproc() == idleproc())
-      schedule_[mycpu()->id]->stats_.idle += t - schedule_[mycpu()->id]->stats_.schedstart;
+      s->idle_ += t - s->schedstart_;
     else
-      schedule_[mycpu()->id]->stats_.busy += t - schedule_[mycpu()->id]->stats_.schedstart;
-    schedule_[mycpu()->id]->stats_.schedstart = t;
+      s->busy_ += t - s->schedstart_;
+    s->schedstart_ = t;
   
     if (next == nullptr) {
       if (myproc()->get_state() != RUNNABLE ||
@@ -0,0 +1,436 @@
+// POSIX signals.
+//
+// Each proc has its own queue of pending signals, its own signal mask,
+// and its own handler table.  Since every sv6 thread is a separate proc,
+// this makes masks and queues per-thread, and a thread changes its mask
+// without any lock at all.  Standard signals are pending at most once;
+// real-time signals (SIGRTMIN..SIGRTMAX) queue every instance along with
+// its siginfo, and are delivered lowest-numbered first.
+//
+// Signals are delivered on the way back to user space, either by running
+// a handler (see setup_frame), or by dequeuing them synchronously with
+// rt_sigtimedwait or a signalfd.
+
+#include "types.h"
+#include "kernel.hh"
+#include "amd64.h"
+#include "spinlock.hh"
+#include "condvar.hh"
+#include "proc.hh"
+#include "cpu.hh"
+#include "file.hh"
+
+#include <uk/fcntl.h>
+
+// Maximum number of signals queued on one proc.  Standard signals never
+// need more than one entry each, so this only limits real-time signals.
+#define SIGQUEUE_MAX 1024
+
+static inline u64
+sigbit(int signo)
+{
+  return 1ull << (signo - 1);
+}
+
+// Signals that can't be caught, blocked or ignored.
+static const u64 sig_unblockable = 1ull << (SIGKILL - 1);
+
+// Signals whose default action is to do nothing.
+static bool
+sig_default_ignore(int signo)
+{
+  return signo == SIGCHLD || signo == SIGCONT || signo == SIGURG ||
+    signo == SIGWINCH;
+}
+
+static bool
+sig_ignored(proc *p, int signo)
+{
+  auto handler = p->sig[signo].sa_handler;
+  return handler == SIG_IGN ||
+    (handler == SIG_DFL && sig_default_ignore(signo));
+}
+
+// Queue info.si_signo for delivery to this proc.  Returns 0 if it was
+// queued, coalesced with an already-pending instance, or discarded
+// because it is ignored, and -1 if the queue is full.  If rec is
+// non-null it's queued instead of a newly allocated entry (see
+// queue_signal), so this doesn't allocate.
+int
+proc::post_signal(const siginfo_t &info, sigqueued *rec)
+{
+  if (info.si_signo == SIGKILL)
+    return kill();
+
+  bool wake;
+  int r = queue_signal(info, rec, &wake);
+  // Waiters re-check sig_pending under sig_lock before sleeping, so
+  // it's safe to wake them after dropping it.
+  if (wake)
+    sig_cv->wake_all();
+  return r;
+}
+
+// The queueing half of post_signal, for callers that hold locks
+// sig_cv->wake_all can't run under.  If rec is non-null it's used
+// instead of allocating an entry, and if it's still queued from an
+// earlier post, this one coalesces with it.  Sets *wake if the caller
+// must wake sig_cv once it can.  Doesn't handle SIGKILL.
+int
+proc::queue_signal(const siginfo_t &info, sigqueued *rec, bool *wake)
+{
+  int signo = info.si_signo;
+  assert(signo > 0 && signo < NSIG && signo != SIGKILL);
+  *wake = false;
+
+  u64 bit = sigbit(signo);
+  if (!(sig_blocked & bit) && sig_ignored(this, signo))
+    return 0;
+
+  scoped_acquire l(&sig_lock);
+  if ((signo < SIGRTMIN && (sig_pending & bit)) || (rec && rec->queued))
+    return 0;
+  if (sig_nqueued >= SIGQUEUE_MAX)
+    return -1;
+
+  sigqueued *q = rec ? rec : new sigqueued();
+  q->info = info;
+  q->queued = true;
+  sig_queue.push_back(q);
+  sig_nqueued++;
+  sig_pending |= bit;
+  *wake = true;
+  return 0;
+}
+
+static void
+free_sigqueued(sigqueued *q)
+{
+  if (q->prealloc)
+    q->queued = false;
+  else
+    delete q;
+}
+
+// Take the preallocated entry rec off the queue, if it's there, before
+// its owner frees it.
+void
+proc::unqueue_signal(sigqueued *rec)
+{
+  scoped_acquire l(&sig_lock);
+  if (!rec->queued)
+    return;
+  int signo = rec->info.si_signo;
+  sig_queue.erase(sig_queue.iterator_to(rec));
+  sig_nqueued--;
+  rec->queued = false;
+  for (auto &q : sig_queue)
+    if (q.info.si_signo == signo)
+      return;
+  sig_pending &= ~sigbit(signo);
+}
+
+// Remove the lowest-numbered pending signal in set from the queue and
+// return its siginfo in *info.  Returns false if there is none.
+bool
+proc::dequeue_signal(u64 set, siginfo_t *info)
+{
+  scoped_acquire l(&sig_lock);
+  u64 ready = sig_pending & set;
+  if (!ready)
+    return false;
+
+  int signo = __builtin_ctzll(ready) + 1;
+  bool more = false;
+  sigqueued *found = nullptr;
+  for (auto &q : sig_queue) {
+    if (q.info.si_signo != signo)
+      continue;
+    if (found) {
+      more = true;
+      break;
+    }
+    found = &q;
+  }
+  assert(found);
+
+  sig_queue.erase(sig_queue.iterator_to(found));
+  sig_nqueued--;
+  if (!more)
+    sig_pending &= ~sigbit(signo);
+  *info = found->info;
+  free_sigqueued(found);
+  return true;
+}
+
+// Discard any pending instances of signo.
+static void
+discard_signal(proc *p, int signo)
+{
+  scoped_acquire l(&p->sig_lock);
+  if (!(p->sig_pending & sigbit(signo)))
+    return;
+  for (auto it = p->sig_queue.begin(); it != p->sig_queue.end(); ) {
+    sigqueued *q = &*it++;
+    if (q->info.si_signo == signo) {
+      p->sig_queue.erase(p->sig_queue.iterator_to(q));
+      p->sig_nqueued--;
+      free_sigqueued(q);
+    }
+  }
+  p->sig_pending &= ~sigbit(signo);
+}
+
+void
+proc::flush_signals(void)
+{
+  scoped_acquire l(&sig_lock);
+  while (!sig_queue.empty()) {
+    sigqueued *q = &sig_queue.front();
+    sig_queue.pop_front();
+    free_sigqueued(q);
+  }
+  sig_nqueued = 0;
+  sig_pending = 0;
+}
+
+// Arrange for tf to return to signo's handler.  The user stack gets, from
+// the top down: the red zone, the siginfo, a copy of *tf, the signal mask
+// to restore, and the handler's return address (sa_restorer), which must
+// reload both and return to the interrupted code.
+bool
+proc::setup_frame(struct trapframe *tf, int signo, const siginfo_t &info)
+{
+  struct sigaction *sa = &sig[signo];
+  u64 sp = tf->rsp - 128;       // Skip the red zone
+
+  sp = (sp - sizeof(info)) & ~15ull;
+  u64 uinfo = sp;
+  if (putmem((void*)uinfo, &info, sizeof(info)) < 0)
+    return false;
+
+  static_assert(sizeof(*tf) % 16 == 0, "trapframe breaks stack alignment");
+  sp -= sizeof(*tf);
+  if (putmem((void*)sp, tf, sizeof(*tf)) < 0)
+    return false;
+
+  u64 oldmask[2] = { sig_blocked, 0 };
+  sp -= sizeof(oldmask);
+  if (putmem((void*)sp, oldmask, sizeof(oldmask)) < 0)
+    return false;
+
+  // The handler starts as if called, with sp+8 16-byte aligned.
+  sp -= 8;
+  if (putmem((void*)sp, &sa->sa_restorer, 8) < 0)
+    return false;
+
+  tf->rsp = sp;
+  tf->rip = (u64)sa->sa_handler;
+  tf->rdi = signo;
+  tf->rsi = uinfo;
+  tf->rdx = 0;
+
+  u64 mask = sa->sa_mask;
+  if (!(sa->sa_flags & SA_NODEFER))
+    mask |= sigbit(signo);
+  sig_blocked |= mask & ~sig_unblockable;
+  if (sa->sa_flags & SA_RESETHAND) {
+    sa->sa_handler = SIG_DFL;
+    sa->sa_flags &= ~SA_SIGINFO;
+  }
+  return true;
+}
+
+// Called on the way back to user space with the trapframe that will be
+// restored.  Runs the default action of, or sets up the handler for, the
+// lowest-numbered deliverable signal.  Any others are picked up on a
+// later return to user space, at the latest when the handler's
+// sa_restorer restores the signal mask.
+void
+handle_signals(struct trapframe *tf)
+{
+  proc *p = myproc();
+  siginfo_t info;
+
+  while (p->dequeue_signal(~p->sig_blocked, &info)) {
+    int signo = info.si_signo;
+    auto handler = p->sig[signo].sa_handler;
+    if (handler == SIG_IGN)
+      continue;
+    if (handler == SIG_DFL) {
+      if (sig_default_ignore(signo))
+        continue;
+      p->killed = 1;
+      return;
+    }
+    if (!p->setup_frame(tf, signo, info))
+      p->killed = 1;
+    return;
+  }
+}
+
+//SYSCALL {"uargs":["int signo", "const struct sigaction *act", "struct sigaction *oact"]}
+int
+sys_rt_sigaction(int signo, userptr<struct sigaction> act,
+                 userptr<struct sigaction> oact)
+{
+  proc *p = myproc();
+  if (signo <= 0 || signo >= NSIG)
+    return -1;
+  if (oact && !oact.store(&p->sig[signo]))
+    return -1;
+  if (act) {
+    struct sigaction sa;
+    if (signo == SIGKILL || !act.load(&sa))
+      return -1;
+    p->sig[signo] = sa;
+    // POSIX: setting a pending signal to be ignored discards it.
+    if (sig_ignored(p, signo))
+      discard_signal(p, signo);
+  }
+  return 0;
+}
+
+//SYSCALL {"uargs":["int how", "const u64 *set", "u64 *oset"]}
+int
+sys_rt_sigprocmask(int how, userptr<u64> set, userptr<u64> oset)
+{
+  proc *p = myproc();
+  u64 old = p->sig_blocked;
+  if (oset && !oset.store(&old))
+    return -1;
+  if (!set)
+    return 0;
+
+  u64 s;
+  if (!set.load(&s))
+    return -1;
+  switch (how) {
+  case SIG_BLOCK:
+    s |= old;
+    break;
+  case SIG_UNBLOCK:
+    s = old & ~s;
+    break;
+  case SIG_SETMASK:
+    break;
+  default:
+    return -1;
+  }
+  // Only this proc writes its own mask.  Newly unblocked signals are
+  // delivered on the way out of this system call.
+  p->sig_blocked = s & ~sig_unblockable;
+  return 0;
+}
+
+//SYSCALL
+int
+sys_rt_sigqueue(int pid, int signo, u64 value)
+{
+  if (signo <= 0 || signo >= NSIG)
+    return -1;
+  if (signo == SIGKILL)
+    return proc::kill(pid);
+
+  siginfo_t info = {};
+  info.si_signo = signo;
+  info.si_code = SI_QUEUE;
+  info.si_pid = myproc()->pid;
+  info.si_value.sival_ptr = (void*)value;
+  return proc::signal(pid, info);
+}
+
+// Wait until a signal in set is pending, then dequeue it into *info.
+// timeout_ns < 0 waits forever and 0 polls.
+static bool
+wait_signal(u64 set, siginfo_t *info, s64 timeout_ns)
+{
+  proc *p = myproc();
+  u64 deadline = timeout_ns > 0 ? nsectime() + timeout_ns : 0;
+
+  for (;;) {
+    if (p->dequeue_signal(set, info))
+      return true;
+    if (timeout_ns == 0 || (deadline && nsectime() >= deadline))
+      return false;
+    scoped_acquire l(&p->sig_lock);
+    if (!(p->sig_pending & set))
+      p->sig_cv->sleep_to(&p->sig_lock, deadline);
+  }
+}
+
+//SYSCALL {"uargs":["const u64 *set", "struct siginfo *info", "s64 timeout_ns"]}
+int
+sys_rt_sigtimedwait(userptr<u64> uset, userptr<siginfo_t> uinfo,
+                    s64 timeout_ns)
+{
+  u64 set;
+  siginfo_t info;
+  if (!uset.load(&set))
+    return -1;
+  if (!wait_signal(set & ~sig_unblockable, &info, timeout_ns))
+    return -1;
+  if (uinfo && !uinfo.store(&info))
+    return -1;
+  return info.si_signo;
+}
+
+// A signalfd dequeues signals in its mask from the queue of whichever
+// thread reads it, as on Linux.  Readers sleep on the reader's sig_cv.
+struct file_signalfd : public refcache::referenced, public file
+{
+  file_signalfd(u64 mask, bool nonblock)
+    : mask_(mask & ~sig_unblockable), nonblock_(nonblock) {}
+  NEW_DELETE_OPS(file_signalfd);
+
+  void inc() override { referenced::inc(); }
+  void dec() override { referenced::dec(); }
+
+  ssize_t
+  read(char *addr, size_t n) override
+  {
+    struct signalfd_siginfo ssi;
+    siginfo_t info;
+    size_t done = 0;
+
+    while (done + sizeof(ssi) <= n) {
+      if (!wait_signal(mask_, &info, (done || nonblock_) ? 0 : -1))
+        break;
+      memset(&ssi, 0, sizeof(ssi));
+      ssi.ssi_signo = info.si_signo;
+      ssi.ssi_errno = info.si_errno;
+      ssi.ssi_code = info.si_code;
+      ssi.ssi_pid = info.si_pid;
+      ssi.ssi_uid = info.si_uid;
+      ssi.ssi_status = info.si_status;
+      ssi.ssi_int = info.si_value.sival_int;
+      ssi.ssi_ptr = (u64)info.si_value.sival_ptr;
+      ssi.ssi_addr = (u64)info.si_addr;
+      memmove(addr + done, &ssi, sizeof(ssi));
+      done += sizeof(ssi);
+    }
+    return done ? done : -1;
+  }
+
+  void
+  onzero() override
+  {
+    delete this;
+  }
+
+private:
+  const u64 mask_;
+  const bool nonblock_;
+};
+
+//SYSCALL {"uargs":["int fd", "const u64 *mask", "int flags"]}
+int
+sys_signalfd(int fd, userptr<u64> umask, int flags)
+{
+  u64 mask;
+  // Changing the mask of an existing signalfd is not supported.
+  if (fd != -1 || (flags & ~(SFD_NONBLOCK|SFD_CLOEXEC)) || !umask.load(&mask))
+    return -1;
+  sref<file> f = make_sref<file_signalfd>(mask, flags & SFD_NONBLOCK);
+  return fdalloc(std::move(f), (flags & SFD_CLOEXEC) ? O_CLOEXEC : 0);
+}
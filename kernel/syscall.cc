@@ -8,6 +8,8 @@
 #include "cpu.hh"
 #include "kmtrace.hh"
 #include "errno.h"
+#include "kstats.hh"
+#include "sysent.hh"
 
 extern "C" int __uaccess_mem(void* dst, const void* src, u64 size);
 extern "C" int __uaccess_str(char* dst, const char* src, u64 size);
@@ -97,33 +99,38 @@ userptr_str::load_alloc(std::size_t limit, std::size_t *len_out) const
   return res;
 }
 
-extern u64 (*syscalls[])(u64, u64, u64, u64, u64, u64);
-extern const char* syscall_names[];
-extern const int nsyscalls;
-
 u64
 syscall(u64 a0, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 num)
 {
+#if SYSCALL_STATS
+  kstats::inc(&kstats::syscall_count);
+  kstats::timer timer(&kstats::syscall_cycles);
+#endif
+
+  if (num >= nsyscalls || !syscalls[num].fn) {
+    cprintf("%d %s: unknown sys call %ld\n",
+            myproc()->pid, myproc()->name, num);
+    return -1;
+  }
+
+  const sysent *ent = &syscalls[num];
+  if (ent->fast)
+    return ent->fn(a0, a1, a2, a3, a4, a5);
+
   for (;;) {
 #if EXCEPTIONS
     try {
 #endif
-      if(num < nsyscalls && syscalls[num]) {
-        u64 r;
-        mtstart(syscalls[num], myproc());
-        mtrec();
-        {
-          mt_ascope ascope("syscall:%ld", num);
-          r = syscalls[num](a0, a1, a2, a3, a4, a5);
-        }
-        mtstop(myproc());
-        mtign();
-        return r;
-      } else {
-        cprintf("%d %s: unknown sys call %ld\n",
-                myproc()->pid, myproc()->name, num);
-        return -1;
+      u64 r;
+      mtstart(ent->fn, myproc());
+      mtrec();
+      {
+        mt_ascope ascope("syscall:%ld", num);
+        r = ent->fn(a0, a1, a2, a3, a4, a5);
       }
+      mtstop(myproc());
+      mtign();
+      return r;
 #if EXCEPTIONS
     } catch (std::bad_alloc& e) {
       cprintf("%d: syscall retry\n", myproc()->pid);
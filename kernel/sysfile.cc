@@ -13,6 +13,7 @@
 #include "mfs.hh"
 #include <uk/fcntl.h>
 #include <uk/stat.h>
+#include <uk/mman.h>
 #include "kstats.hh"
 #include <vector>
 #include "kstream.hh"
@@ -128,6 +129,96 @@ sys_lseek(int fd, off_t offset, int whence)
   return new_offset;
 }
 
+// Set the size of file m to length, dropping the pages past the new end of
+// the file or filling in zeroed pages up to it.  Only the in-memory file is
+// resized here; the on-disk inode is truncated (and its blocks freed) lazily,
+// the next time the file is synced (see mfile::sync_file).
+static int
+truncatem(sref<mnode> m, off_t length)
+{
+  if (m->type() != mnode::types::file)
+    return -1;                  // EISDIR/EINVAL
+  if (length < 0 || length > (off_t)MAXFILE * BSIZE)
+    return -1;                  // EINVAL/EFBIG
+
+  mfile* mf = m->as_file();
+  auto resize = mf->write_size();
+  u64 size = resize.read_size();
+  if (length > size)
+    return resize.resize_grow(length) ? 0 : -1;
+
+  if (length < size) {
+    // Tear down user mappings of the discarded pages while we can still
+    // find them through the page cache.
+    mf->remove_pgtable_mappings(length);
+    resize.resize_nogrow(length);
+  }
+  return 0;
+}
+
+static file_mnode*
+writable_file_mnode(const sref<file>& f)
+{
+  file* ff = f.get();
+  if (!ff || &typeid(*ff) != &typeid(file_mnode))
+    return nullptr;
+
+  file_mnode* fm = static_cast<file_mnode*>(ff);
+  if (!fm->writable || fm->m->type() != mnode::types::file)
+    return nullptr;
+  return fm;
+}
+
+//SYSCALL
+int
+sys_ftruncate(int fd, off_t length)
+{
+  sref<file> f = getfile(fd);
+  file_mnode* fm = writable_file_mnode(f);
+  if (!fm)
+    return -1;
+  return truncatem(fm->m, length);
+}
+
+//SYSCALL
+int
+sys_truncate(userptr_str path, off_t length)
+{
+  char path_copy[PATH_MAX];
+  if (!path.load(path_copy, sizeof(path_copy)))
+    return -1;
+
+  sref<mnode> m = namei(myproc()->cwd_m, path_copy);
+  if (!m)
+    return -1;
+  return truncatem(m, length);
+}
+
+// Make sure [offset, offset+len) is backed by disk blocks.  Since files are
+// never sparse, only the part past the end of the file needs allocating;
+// mfile::preallocate() allocates it as unwritten blocks, which read as
+// zeroes without being written, and bmap() places them contiguously after
+// the file's last block.  We only support the
+// default mode (no FALLOC_FL_* flags).
+//SYSCALL
+int
+sys_fallocate(int fd, int mode, off_t offset, off_t len)
+{
+  if (mode != 0 || offset < 0 || len <= 0 || offset + len < offset)
+    return -1;
+
+  sref<file> f = getfile(fd);
+  file_mnode* fm = writable_file_mnode(f);
+  if (!fm)
+    return -1;
+  if (offset + len > (off_t)MAXFILE * BSIZE)
+    return -1;                  // EFBIG
+
+  if (!fm->m->as_file()->preallocate(offset + len))
+    return -1;                  // ENOSPC
+  return 0;
+}
+
 //SYSCALL
 int
 sys_close(int fd)
@@ -144,8 +235,27 @@ sys_close(int fd)
 void
 sys_sync(void)
 {
-  int cpu = myid();
-  rootfs_interface->process_metadata_log_and_flush(cpu);
+  rootfs_interface->process_metadata_log_and_flush();
+}
+
+// Unlike Linux's syncfs, which syncs the whole file system containing
+// fd, this syncs only the subtree rooted at fd (or just fd, if it isn't
+// a directory).  Like sync, it does so on all cores in parallel.
+//SYSCALL
+int
+sys_syncfs(int fd)
+{
+  sref<file> f = getfile(fd);
+  if (!f)
+    return -1;
+  sref<mnode> m = f->get_mnode();
+  if (!m)
+    return -1;
+  // Nothing to write back for memory-only files (memfd, shm_open).
+  if (m->fs_ != root_fs)
+    return 0;
+  rootfs_interface->process_subtree_and_flush(m);
+  return 0;
 }
 
 
@@ -266,6 +376,78 @@ sys_pwrite(int fd, const void *ubuf, size_t count, off_t offset)
   return f->pwrite(b, count, offset);
 }
 
+// Copy len bytes from fd_in to fd_out without passing them through user
+// space: each page goes straight from fd_in's page cache into fd_out's.
+// As on Linux, a null offset pointer means to use and advance the file's
+// own offset; otherwise the offset is read from and stored back to user
+// memory.  The ranges may not overlap within one file.
+//SYSCALL
+ssize_t
+sys_copy_file_range(int fd_in, userptr<off_t> off_in,
+                    int fd_out, userptr<off_t> off_out,
+                    size_t len, unsigned int flags)
+{
+  if (flags != 0)
+    return -1;
+
+  sref<file> fin = getfile(fd_in);
+  sref<file> fout = getfile(fd_out);
+  file* ffin = fin.get();
+  if (!ffin || &typeid(*ffin) != &typeid(file_mnode))
+    return -1;
+  file_mnode* in = static_cast<file_mnode*>(ffin);
+  file_mnode* out = writable_file_mnode(fout);
+  if (!in->readable || in->m->type() != mnode::types::file || !out ||
+      out->append)
+    return -1;
+
+  // Lock the file offsets we use, in address order so that two copies in
+  // opposite directions can't deadlock.
+  file_mnode* lock0 = off_in ? nullptr : in;
+  file_mnode* lock1 = off_out ? nullptr : out;
+  if (lock0 == lock1)
+    lock1 = nullptr;
+  else if (lock0 && lock1 && lock1 < lock0)
+    std::swap(lock0, lock1);
+  lock_guard<sleeplock> l0, l1;
+  if (lock0)
+    l0 = lock0->off_lock.guard();
+  if (lock1)
+    l1 = lock1->off_lock.guard();
+
+  off_t pos_in = in->off, pos_out = out->off;
+  if ((off_in && !off_in.load(&pos_in)) ||
+      (off_out && !off_out.load(&pos_out)))
+    return -1;
+  if (pos_in < 0 || pos_out < 0)
+    return -1;
+  if (len > (u64)MAXFILE * BSIZE)
+    len = (u64)MAXFILE * BSIZE;
+  if (in->m == out->m && pos_in < pos_out + (off_t)len &&
+      pos_out < pos_in + (off_t)len)
+    return -1;                  // EINVAL
+
+  ssize_t r = copym(in->m, pos_in, out->m, pos_out, len);
+  if (r <= 0)
+    return r;
+
+  if (off_in) {
+    pos_in += r;
+    if (!off_in.store(&pos_in))
+      return -1;
+  } else {
+    in->off += r;
+  }
+  if (off_out) {
+    pos_out += r;
+    if (!off_out.store(&pos_out))
+      return -1;
+  } else {
+    out->off += r;
+  }
+  return r;
+}
+
 //SYSCALL
 int
 sys_fstatx(int fd, userptr<struct stat> st, enum stat_flags flags)
@@ -800,7 +982,7 @@ sys_openat(int dirfd, userptr_str path, int omode, ...)
 
   if (m->type() == mnode::types::file && (omode & O_TRUNC))
     if (*m->as_file()->read_size())
-      m->as_file()->write_size().resize_nogrow(0);
+      truncatem(m, 0);
 
   sref<file> f = make_sref<file_mnode>(
     m, !(rwmode == O_WRONLY), !(rwmode == O_RDONLY), !!(omode & O_APPEND));
@@ -943,6 +1125,95 @@ sys_pipe(userptr<int> fd)
   return sys_pipe2(fd, 0);
 }
 
+// Shared memory objects are mfiles in anon_fs, which has no
+// rootfs_interface backing: their pages live only in the page cache and
+// are shared directly by every mapping, with no disk I/O.  memfd_create
+// objects are unnamed; shm_open names live in the anon_fs directory
+// shm_root.
+//SYSCALL
+int
+sys_memfd_create(userptr_str name, unsigned int flags)
+{
+  // Linux uses the name only for debugging, and so do we (not at all).
+  if (flags & ~MFD_CLOEXEC)
+    return -1;
+
+  sref<mnode> m = anon_fs->alloc(mnode::types::file).mn();
+  sref<file> f = make_sref<file_mnode>(m, true, true, false);
+  return fdalloc(std::move(f), (flags & MFD_CLOEXEC) ? O_CLOEXEC : 0);
+}
+
+// Copy a shm_open name ("/name", with no other slashes) into name.
+static bool
+shm_name(userptr_str path, strbuf<DIRSIZ>* name)
+{
+  char path_copy[DIRSIZ + 2];
+  if (!path.load(path_copy, sizeof(path_copy)))
+    return false;
+
+  const char* p = path_copy[0] == '/' ? path_copy + 1 : path_copy;
+  size_t len = strlen(p);
+  if (len == 0 || len > DIRSIZ || strchr(p, '/'))
+    return false;
+  *name = strbuf<DIRSIZ>(p);
+  return true;
+}
+
+//SYSCALL
+int
+sys_shm_open(userptr_str path, int omode, mode_t mode)
+{
+  strbuf<DIRSIZ> name;
+  if (!shm_name(path, &name))
+    return -1;
+
+  mdir* md = shm_root->as_dir();
+  mlinkref ilink;
+  for (;;) {
+    ilink = md->lookup_link(name);
+    if (ilink.mn()) {
+      if ((omode & O_CREAT) && (omode & O_EXCL))
+        return -1;
+      break;
+    }
+    if (!(omode & O_CREAT))
+      return -1;
+
+    ilink = anon_fs->alloc(mnode::types::file);
+    if (md->insert(name, &ilink))
+      break;
+    // Somebody else created it first; use theirs.
+  }
+
+  // There are no permissions to apply mode to.
+  sref<mnode> m = ilink.mn();
+  int rwmode = omode & (O_RDONLY|O_WRONLY|O_RDWR);
+  if (rwmode == O_WRONLY)
+    return -1;
+
+  if ((omode & O_TRUNC) && rwmode == O_RDWR)
+    if (*m->as_file()->read_size())
+      truncatem(m, 0);
+
+  sref<file> f = make_sref<file_mnode>(m, true, rwmode == O_RDWR, false);
+  return fdalloc(std::move(f), omode);
+}
+
+//SYSCALL
+int
+sys_shm_unlink(userptr_str path)
+{
+  strbuf<DIRSIZ> name;
+  if (!shm_name(path, &name))
+    return -1;
+
+  mdir* md = shm_root->as_dir();
+  sref<mnode> m = md->lookup(name);
+  if (!m || !md->remove(name, m))
+    return -1;
+  return 0;
+}
+
 //SYSCALL
 int
 sys_readdir(int dirfd, const userptr<char> prevptr, userptr<char> nameptr)
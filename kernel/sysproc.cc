@@ -43,31 +43,40 @@ sys_exit(int status)
 int
 sys_waitpid(int pid,  userptr<int> status, int options)
 {
-  return wait(pid, status);
+  return wait(pid, status, options);
 }
 
 //SYSCALL
 int
 sys_wait(userptr<int> status)
 {
-  return wait(-1, status);
+  return wait(-1, status, 0);
 }
 
 //SYSCALL
 int
-sys_kill(int pid)
+sys_kill(int pid, int signo)
 {
-  return proc::kill(pid);
+  if (signo < 0 || signo >= NSIG)
+    return -1;
+  if (signo == SIGKILL)
+    return proc::kill(pid);
+
+  siginfo_t info = {};
+  info.si_signo = signo;
+  info.si_code = SI_USER;
+  info.si_pid = myproc()->pid;
+  return proc::signal(pid, info);
 }
 
-//SYSCALL
+//SYSCALL {"fast": true}
 int
 sys_getpid(void)
 {
   return myproc()->pid;
 }
 
-//SYSCALL
+//SYSCALL {"fast": true}
 int
 sys_getppid(void)
 {
@@ -105,7 +114,7 @@ sys_nsleep(u64 nsec)
 
 // return how many clock tick interrupts have occurred
 // since boot.
-//SYSCALL
+//SYSCALL {"fast": true}
 u64
 sys_uptime(void)
 {
@@ -118,6 +127,7 @@ sys_mmap(userptr<void> addr, size_t len, int prot, int flags, int fd,
          off_t offset)
 {
   sref<mnode> m;
+  bool nowrite = false;
 
   if (!(prot & (PROT_READ | PROT_WRITE))) {
     cprintf("not implemented: !(prot & (PROT_READ | PROT_WRITE))\n");
@@ -145,6 +155,15 @@ sys_mmap(userptr<void> addr, size_t len, int prot, int flags, int fd,
       return MAP_FAILED;
 
     m = f->get_mnode();
+    if (m && m->type() == mnode::types::dev) {
+      u16 major = m->as_dev()->major();
+      if (major >= NDEV || !devsw[major].mmap)
+        return MAP_FAILED;
+      m = devsw[major].mmap(m->as_dev(), prot);
+      // The device only agreed to a mapping with these permissions.
+      if (!(prot & PROT_WRITE))
+        nowrite = true;
+    }
     if (!m || m->type() != mnode::types::file)
       return MAP_FAILED;
   }
@@ -163,6 +182,8 @@ sys_mmap(userptr<void> addr, size_t len, int prot, int flags, int fd,
   }
   if (!(prot & PROT_WRITE))
     desc.flags &= ~vmdesc::FLAG_WRITE;
+  if (nowrite)
+    desc.flags |= vmdesc::FLAG_NOWRITE;
   if (flags & MAP_SHARED)
     desc.flags |= vmdesc::FLAG_SHARED;
   if (m && (flags & MAP_PRIVATE))
@@ -183,6 +204,31 @@ sys_munmap(userptr<void> addr, size_t len)
   return 0;
 }
 
+//SYSCALL
+int
+sys_msync(userptr<void> addr, size_t len, int flags)
+{
+  if ((uptr)addr % PGSIZE)
+    return -1;                  // EINVAL
+  if ((flags & ~(MS_ASYNC | MS_SYNC | MS_INVALIDATE)) ||
+      ((flags & MS_ASYNC) && (flags & MS_SYNC)))
+    return -1;                  // EINVAL
+  uptr align_len = PGROUNDUP(len);
+  if ((uptr)addr + align_len > USERTOP || (uptr)addr + align_len < (uptr)addr)
+    return -1;                  // ENOMEM
+
+  // Page-cache pages are shared with every mapping, so MS_INVALIDATE
+  // has nothing to do.  MS_ASYNC leaves the harvested dirty pages for
+  // the next sync.
+  std::vector<sref<mnode> > files;
+  if (myproc()->vmap->harvest_dirty((uptr)addr, align_len, &files) < 0)
+    return -1;                  // ENOMEM
+  if (flags & MS_SYNC)
+    for (auto &m : files)
+      m->as_file()->fsync();
+  return 0;
+}
+
 //SYSCALL
 int
 sys_madvise(userptr<void> addr, size_t len, int advice)
@@ -243,7 +289,7 @@ sys_halt(void)
   panic("halt returned");
 }
 
-//SYSCALL
+//SYSCALL {"fast": true}
 long
 sys_cpuhz(void)
 {
@@ -332,19 +378,6 @@ sys_dup_page(userptr<void> dest, userptr<void> src)
   return myproc()->vmap->dup_page((uptr)dest, (uptr)src);
 }
 
-//SYSCALL
-int
-sys_sigaction(int signo, userptr<struct sigaction> act, userptr<struct sigaction> oact)
-{
-  if (signo < 0 || signo >= NSIG)
-    return -1;
-  if (oact && !oact.store(&myproc()->sig[signo]))
-    return -1;
-  if (act && !act.load(&myproc()->sig[signo]))
-    return -1;
-  return 0;
-}
-
 //SYSCALL
 void
 sys_kmbalance(void)
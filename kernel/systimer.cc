@@ -0,0 +1,443 @@
+// Interval timers (setitimer, timer_create) and timerfd, built on the
+// per-core ktimers.  A proc's timers post their signal to that proc, so,
+// since each thread is its own proc, timers are per-thread.
+
+#include "types.h"
+#include "kernel.hh"
+#include "amd64.h"
+#include "spinlock.hh"
+#include "condvar.hh"
+#include "proc.hh"
+#include "cpu.hh"
+#include "file.hh"
+#include "ktimer.hh"
+#include "sys/time.h"
+
+#include <uk/fcntl.h>
+#include <uk/time.h>
+
+#define NPTIMER 32              // timer_create timers per proc
+
+// A timer that posts a signal to its owner.
+struct ptimer : public ktimer {
+  proc *owner;
+  siginfo_t info;
+  bool notify;
+  int clockid;                  // For absolute settime
+  std::atomic<u64> overrun;     // Expirations missed at the last expiry
+  // expire runs in the timer interrupt, so it posts this instead of
+  // allocating.  While it's queued, further expiries coalesce with it.
+  sigqueued rec;
+
+  ptimer(proc *p, int signo, int code, sigval value, bool notify,
+         int clockid = CLOCK_MONOTONIC)
+    : owner(p), info{}, notify(notify), clockid(clockid), overrun(0)
+  {
+    info.si_signo = signo;
+    info.si_code = code;
+    info.si_value = value;
+    rec.prealloc = true;
+  }
+  NEW_DELETE_OPS(ptimer);
+
+  ~ptimer()
+  {
+    owner->unqueue_signal(&rec);
+  }
+
+  void
+  expire(u64 nexp) override
+  {
+    overrun = nexp - 1;
+    if (notify)
+      owner->post_signal(info, &rec);
+  }
+};
+
+// A proc's timers.  Only the owning proc creates, changes or deletes
+// them, so the table needs no lock.
+struct proc_timers {
+  ptimer *real;                 // ITIMER_REAL
+  ptimer *posix[NPTIMER];       // timer_create, indexed by timer_t
+
+  proc_timers() : real(nullptr), posix{} { }
+  NEW_DELETE_OPS(proc_timers);
+};
+
+static proc_timers *
+my_timers(void)
+{
+  proc *p = myproc();
+  if (!p->timers)
+    p->timers = new proc_timers();
+  return p->timers;
+}
+
+static void
+destroy(ptimer **t)
+{
+  if (*t) {
+    (*t)->cancel();
+    delete *t;
+    *t = nullptr;
+  }
+}
+
+// Timers created by timer_create don't survive exec; ITIMER_REAL does.
+void
+timers_exec(proc *p)
+{
+  if (p->timers)
+    for (auto &t : p->timers->posix)
+      destroy(&t);
+}
+
+void
+timers_exit(proc *p)
+{
+  if (!p->timers)
+    return;
+  timers_exec(p);
+  destroy(&p->timers->real);
+  delete p->timers;
+  p->timers = nullptr;
+}
+
+static bool
+valid_ts(const struct timespec &ts)
+{
+  return ts.tv_sec >= 0 && ts.tv_nsec >= 0 && ts.tv_nsec < 1000000000;
+}
+
+static u64
+ts_to_ns(const struct timespec &ts)
+{
+  return (u64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct timespec
+ns_to_ts(u64 ns)
+{
+  struct timespec ts;
+  ts.tv_sec = ns / 1000000000;
+  ts.tv_nsec = ns % 1000000000;
+  return ts;
+}
+
+// Current state of t, with it_value relative to now.
+static struct itimerspec
+get_spec(const ktimer *t)
+{
+  struct itimerspec spec;
+  u64 deadline = t ? t->deadline() : 0, now = nsectime();
+  spec.it_value = ns_to_ts(deadline > now ? deadline - now : 0);
+  spec.it_interval = ns_to_ts(t ? t->interval() : 0);
+  return spec;
+}
+
+// Arm t according to spec, where an absolute it_value is on clockid.
+static void
+set_spec(ktimer *t, int clockid, int flags, const struct itimerspec &spec)
+{
+  u64 value = ts_to_ns(spec.it_value);
+  if (!value) {
+    t->cancel();
+    return;
+  }
+
+  u64 now = nsectime(), deadline;
+  if (flags & TIMER_ABSTIME) {
+    if (clockid == CLOCK_REALTIME)
+      value = value > rtc_epoch_nsec() ? value - rtc_epoch_nsec() : 0;
+    // An absolute time that has already passed expires right away.
+    deadline = value > now ? value : now;
+  } else {
+    deadline = now + value;
+  }
+  t->arm(deadline, ts_to_ns(spec.it_interval));
+}
+
+static bool
+valid_clock(int clockid)
+{
+  return clockid == CLOCK_REALTIME || clockid == CLOCK_MONOTONIC;
+}
+
+static bool
+load_spec(userptr<struct itimerspec> uspec, struct itimerspec *spec)
+{
+  return uspec.load(spec) && valid_ts(spec->it_value) &&
+    valid_ts(spec->it_interval);
+}
+
+//SYSCALL {"uargs":["int which", "const struct itimerval *new_value", "struct itimerval *old_value"]}
+int
+sys_setitimer(int which, userptr<struct itimerval> unew,
+              userptr<struct itimerval> uold)
+{
+  if (which != ITIMER_REAL)
+    return -1;
+
+  struct itimerval nv;
+  if (unew) {
+    if (!unew.load(&nv) || nv.it_value.tv_sec < 0 ||
+        nv.it_value.tv_usec < 0 || nv.it_value.tv_usec >= 1000000 ||
+        nv.it_interval.tv_sec < 0 || nv.it_interval.tv_usec < 0 ||
+        nv.it_interval.tv_usec >= 1000000)
+      return -1;
+  }
+
+  proc_timers *pt = my_timers();
+  if (!pt->real) {
+    sigval v = {};
+    pt->real = new ptimer(myproc(), SIGALRM, SI_KERNEL, v, true);
+  }
+
+  if (uold) {
+    struct itimerspec spec = get_spec(pt->real);
+    struct itimerval ov;
+    ov.it_value.tv_sec = spec.it_value.tv_sec;
+    ov.it_value.tv_usec = spec.it_value.tv_nsec / 1000;
+    ov.it_interval.tv_sec = spec.it_interval.tv_sec;
+    ov.it_interval.tv_usec = spec.it_interval.tv_nsec / 1000;
+    if (!uold.store(&ov))
+      return -1;
+  }
+
+  if (unew) {
+    struct itimerspec spec;
+    spec.it_value.tv_sec = nv.it_value.tv_sec;
+    spec.it_value.tv_nsec = nv.it_value.tv_usec * 1000;
+    spec.it_interval.tv_sec = nv.it_interval.tv_sec;
+    spec.it_interval.tv_nsec = nv.it_interval.tv_usec * 1000;
+    set_spec(pt->real, CLOCK_MONOTONIC, 0, spec);
+  }
+  return 0;
+}
+
+//SYSCALL
+int
+sys_getitimer(int which, userptr<struct itimerval> ucur)
+{
+  return sys_setitimer(which, nullptr, ucur);
+}
+
+//SYSCALL {"uargs":["int clockid", "struct sigevent *sevp", "int *timerid"]}
+int
+sys_timer_create(int clockid, userptr<struct sigevent> usev,
+                 userptr<int> uid)
+{
+  if (!valid_clock(clockid))
+    return -1;
+
+  proc_timers *pt = my_timers();
+  int id;
+  for (id = 0; id < NPTIMER && pt->posix[id]; id++)
+    ;
+  if (id == NPTIMER)
+    return -1;
+
+  struct sigevent sev;
+  if (usev) {
+    if (!usev.load(&sev))
+      return -1;
+    if (sev.sigev_notify != SIGEV_SIGNAL && sev.sigev_notify != SIGEV_NONE)
+      return -1;
+    if (sev.sigev_notify == SIGEV_SIGNAL &&
+        (sev.sigev_signo <= 0 || sev.sigev_signo >= NSIG))
+      return -1;
+  } else {
+    sev.sigev_notify = SIGEV_SIGNAL;
+    sev.sigev_signo = SIGALRM;
+    sev.sigev_value.sival_ptr = nullptr;
+    sev.sigev_value.sival_int = id;
+  }
+  if (!uid.store(&id))
+    return -1;
+
+  pt->posix[id] = new ptimer(myproc(), sev.sigev_signo, SI_TIMER,
+                             sev.sigev_value,
+                             sev.sigev_notify == SIGEV_SIGNAL, clockid);
+  return 0;
+}
+
+static ptimer *
+get_ptimer(int id)
+{
+  proc_timers *pt = myproc()->timers;
+  if (!pt || id < 0 || id >= NPTIMER)
+    return nullptr;
+  return pt->posix[id];
+}
+
+//SYSCALL {"uargs":["int timerid", "int flags", "const struct itimerspec *new_value", "struct itimerspec *old_value"]}
+int
+sys_timer_settime(int id, int flags, userptr<struct itimerspec> unew,
+                  userptr<struct itimerspec> uold)
+{
+  ptimer *t = get_ptimer(id);
+  struct itimerspec spec;
+  if (!t || !load_spec(unew, &spec))
+    return -1;
+  if (uold) {
+    struct itimerspec old = get_spec(t);
+    if (!uold.store(&old))
+      return -1;
+  }
+  set_spec(t, t->clockid, flags, spec);
+  return 0;
+}
+
+//SYSCALL {"uargs":["int timerid", "struct itimerspec *curr_value"]}
+int
+sys_timer_gettime(int id, userptr<struct itimerspec> ucur)
+{
+  ptimer *t = get_ptimer(id);
+  if (!t)
+    return -1;
+  struct itimerspec cur = get_spec(t);
+  return ucur.store(&cur) ? 0 : -1;
+}
+
+//SYSCALL {"uargs":["int timerid"]}
+int
+sys_timer_getoverrun(int id)
+{
+  ptimer *t = get_ptimer(id);
+  return t ? (int)t->overrun : -1;
+}
+
+//SYSCALL {"uargs":["int timerid"]}
+int
+sys_timer_delete(int id)
+{
+  if (!get_ptimer(id))
+    return -1;
+  destroy(&myproc()->timers->posix[id]);
+  return 0;
+}
+
+// A timerfd counts expirations; read() returns the count as a u64 and
+// resets it, waiting for the first expiry if there hasn't been one.
+struct file_timerfd : public refcache::referenced, public file
+{
+  struct timer : public ktimer {
+    file_timerfd *f;
+    void
+    expire(u64 nexp) override
+    {
+      {
+        scoped_acquire l(&f->lock_);
+        f->expirations_ += nexp;
+      }
+      f->cv_.wake_all();
+    }
+  };
+
+  file_timerfd(int clockid, bool nonblock)
+    : lock_("timerfd", LOCKSTAT_TIMER), cv_("timerfd"), expirations_(0),
+      clockid_(clockid), nonblock_(nonblock)
+  {
+    timer_.f = this;
+  }
+  NEW_DELETE_OPS(file_timerfd);
+
+  void inc() override { referenced::inc(); }
+  void dec() override { referenced::dec(); }
+
+  ssize_t
+  read(char *addr, size_t n) override
+  {
+    if (n < sizeof(u64))
+      return -1;
+    scoped_acquire l(&lock_);
+    while (!expirations_) {
+      if (nonblock_)
+        return -1;
+      cv_.sleep(&lock_);
+    }
+    memmove(addr, &expirations_, sizeof(u64));
+    expirations_ = 0;
+    return sizeof(u64);
+  }
+
+  void
+  settime(int flags, const struct itimerspec &spec)
+  {
+    // Expirations from the old setting no longer count.
+    timer_.cancel();
+    {
+      scoped_acquire l(&lock_);
+      expirations_ = 0;
+    }
+    set_spec(&timer_, clockid_, flags, spec);
+  }
+
+  struct itimerspec
+  gettime()
+  {
+    return get_spec(&timer_);
+  }
+
+  void
+  onzero() override
+  {
+    timer_.cancel();
+    delete this;
+  }
+
+private:
+  struct spinlock lock_;
+  struct condvar cv_;
+  u64 expirations_;
+  const int clockid_;
+  const bool nonblock_;
+  timer timer_;
+};
+
+//SYSCALL
+int
+sys_timerfd_create(int clockid, int flags)
+{
+  if (!valid_clock(clockid) || (flags & ~(TFD_NONBLOCK|TFD_CLOEXEC)))
+    return -1;
+  sref<file> f = make_sref<file_timerfd>(clockid, flags & TFD_NONBLOCK);
+  return fdalloc(std::move(f), (flags & TFD_CLOEXEC) ? O_CLOEXEC : 0);
+}
+
+static file_timerfd *
+get_timerfd(const sref<file> &f)
+{
+  return f ? dynamic_cast<file_timerfd*>(f.get()) : nullptr;
+}
+
+//SYSCALL {"uargs":["int fd", "int flags", "const struct itimerspec *new_value", "struct itimerspec *old_value"]}
+int
+sys_timerfd_settime(int fd, int flags, userptr<struct itimerspec> unew,
+                    userptr<struct itimerspec> uold)
+{
+  sref<file> f = getfile(fd);
+  file_timerfd *tf = get_timerfd(f);
+  struct itimerspec spec;
+  if (!tf || (flags & ~TFD_TIMER_ABSTIME) || !load_spec(unew, &spec))
+    return -1;
+  if (uold) {
+    struct itimerspec old = tf->gettime();
+    if (!uold.store(&old))
+      return -1;
+  }
+  tf->settime(flags, spec);
+  return 0;
+}
+
+//SYSCALL
+int
+sys_timerfd_gettime(int fd, userptr<struct itimerspec> ucur)
+{
+  sref<file> f = getfile(fd);
+  file_timerfd *tf = get_timerfd(f);
+  if (!tf)
+    return -1;
+  struct itimerspec cur = tf->gettime();
+  return ucur.store(&cur) ? 0 : -1;
+}
@@ -16,6 +16,7 @@
 #include "hwvm.hh"
 #include "refcache.hh"
 #include "cpuid.hh"
+#include "ktimer.hh"
 
 extern "C" void __uaccess_end(void);
 
@@ -49,6 +50,20 @@ sysentry_c(u64 a0, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5, u64 num)
   myproc()->tf = tf;
   u64 r = syscall(a0, a1, a2, a3, a4, a5, num);
 
+  if (myproc()->sig_pending & ~myproc()->sig_blocked) {
+    // The handler's frame saves *tf on the user stack and sa_restorer
+    // returns with IRET, so fill in what the SYSRET path leaves out
+    // (and don't leak stale kernel stack contents).
+    tf->rax = r;
+    tf->rcx = tf->rip;
+    tf->r11 = tf->rflags;
+    tf->r8 = tf->r9 = tf->r10 = 0;
+    tf->trapno = tf->err = 0;
+    tf->cs = UCSEG | 0x3;
+    tf->ds = tf->ss = UDSEG | 0x3;
+    handle_signals(tf);
+  }
+
   if(myproc()->killed) {
     mtstart(trap, myproc());
     exit(-1);
@@ -173,8 +188,19 @@ trap_c(struct trapframe *tf)
 static void
 trap(struct trapframe *tf)
 {
+  // Whether a timer interrupt is a scheduling tick, rather than just a
+  // ktimer deadline.
+  bool tick = false;
+
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    tick = ktimer_tick();
+    if (!tick) {
+      ktimer_expire();
+      ktimer_rearm();
+      lapiceoi();
+      break;
+    }
     kstats::inc(&kstats::sched_tick_count);
     // for now, just care about timer interrupts
 #if CODEX
@@ -198,7 +224,9 @@ trap(struct trapframe *tf)
     }
     if (mycpu()->id == 0)
       timerintr();
+    ktimer_expire();
     refcache::mycache->tick();
+    ktimer_rearm();
     lapiceoi();
     if (mycpu()->no_sched_count) {
       kstats::inc(&kstats::sched_blocked_tick_count);
@@ -298,8 +326,17 @@ trap(struct trapframe *tf)
         return;
 
       // XXX distinguish between SIGSEGV and SIGBUS?
-      if (myproc()->deliver_signal(SIGSEGV))
-        return;
+      // A fault can't wait in the queue, so it is delivered now, even
+      // if SIGSEGV is blocked.
+      auto handler = myproc()->sig[SIGSEGV].sa_handler;
+      if (handler != SIG_DFL && handler != SIG_IGN) {
+        siginfo_t info = {};
+        info.si_signo = SIGSEGV;
+        info.si_code = SI_KERNEL;
+        info.si_addr = (void*)rcr2();
+        if (myproc()->setup_frame(tf, SIGSEGV, info))
+          return;
+      }
     }
 
     if (myproc() == 0 || (tf->cs&3) == 0)
@@ -314,6 +351,10 @@ trap(struct trapframe *tf)
     myproc()->killed = 1;
   }
 
+  if (myproc() && (tf->cs&3) == 0x3 &&
+      (myproc()->sig_pending & ~myproc()->sig_blocked))
+    handle_signals(tf);
+
   // Force process exit if it has been killed and is in user space.
   // (If it is still executing in the kernel, let it keep running
   // until it gets to the regular system call return.)
@@ -323,7 +364,7 @@ trap(struct trapframe *tf)
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->get_state() == RUNNING &&
-     (tf->trapno == T_IRQ0+IRQ_TIMER || myproc()->yield_)) {
+     (tick || myproc()->yield_)) {
     yield();
   }
 
@@ -39,6 +39,7 @@ void to_stream(class print_stream *s, const vmdesc &vmd)
         {"ANON", vmdesc::FLAG_ANON},
         {"WRITE", vmdesc::FLAG_WRITE},
         {"SHARED", vmdesc::FLAG_SHARED},
+        {"NOWRITE", vmdesc::FLAG_NOWRITE},
       }), " ");
   if (vmd.page)
     s->print((void*)vmd.page->pa(), "}");
@@ -106,17 +107,58 @@ public:
     }
     new (&cur->pages[cur->used++]) sref<class page_info>(std::move(page));
   }
+};
+
+// Records file-backed page frames of a vmap in (or removes them from)
+// their files' rmaps.  Consecutive page frames that map consecutive
+// pages of the same file are coalesced into one rmap range.
+class rmap_updater
+{
+  vmap *vm_;
+  bool add_;
+  sref<mnode> inode_;
+  intptr_t start_;
+  u64 lo_, hi_;
 
-  // Collects the page and removes the rmap entry in the corresponding page_info 
-  void add(sref<class page_info> &&page, std::pair<vmap*, uptr> rmap)
+public:
+  rmap_updater(vmap *vm, bool add) : vm_(vm), add_(add) { }
+
+  ~rmap_updater()
   {
-    if (cur->used == curmax) {
-      cur->next = new (kalloc("page_holder::batch")) batch();
-      cur = cur->next;
-      curmax = NHEAP;
+    flush();
+  }
+
+  // Note the npages page frames starting at virtual page vpn, all of
+  // which are described by desc.
+  void note(u64 vpn, u64 npages, const vmdesc &desc)
+  {
+    if (!desc.inode || myproc() == bootproc)
+      return;
+    if (add_ && (desc.flags & vmdesc::FLAG_SHARED))
+      desc.inode->as_file()->note_shared_mapping();
+    u64 lo = (u64)((intptr_t)(vpn * PGSIZE) - desc.start) / PGSIZE;
+    if (inode_ && inode_.get() == desc.inode.get() && start_ == desc.start &&
+        hi_ == lo) {
+      hi_ += npages;
+      return;
     }
-    page->remove_pte(rmap);
-    new (&cur->pages[cur->used++]) sref<class page_info>(std::move(page));
+    flush();
+    inode_ = desc.inode;
+    start_ = desc.start;
+    lo_ = lo;
+    hi_ = lo + npages;
+  }
+
+  void flush()
+  {
+    if (!inode_)
+      return;
+    file_rmap::mapper m{vm_, start_};
+    if (add_)
+      inode_->as_file()->rmap()->add(m, lo_, hi_);
+    else
+      inode_->as_file()->rmap()->remove(m, lo_, hi_);
+    inode_.reset();
   }
 };
 
@@ -131,24 +173,37 @@ vmap::alloc(void)
 }
 
 vmap::vmap() : 
+  rcu_freed("vmap", this, sizeof(*this)),
   brk_(0), brklock_("brk_lock", LOCKSTAT_VM)
 {
 }
 
 vmap::~vmap()
 {
-  for (auto it = vpfs_.begin(), end = vpfs_.end(); it != end; ) {
-    // Skip unset spans
-    if (!it.is_set()) {
-      it += it.base_span();
-      continue;
-    }
-    if (myproc() != bootproc && it->page && it->inode) {
-      std::pair<vmap*, uptr> rmap = std::make_pair(&*this, it.index()*PGSIZE);
-      it->page->remove_pte(rmap);
+}
+
+void
+vmap::onzero()
+{
+  // Writes through shared file mappings are only recorded in the PTEs,
+  // which go away with this vmap.
+  {
+    auto lock = vpfs_.acquire(vpfs_.begin(), vpfs_.end());
+    harvest_dirty(vpfs_.begin(), vpfs_.end(), nullptr);
+  }
+
+  {
+    rmap_updater unmapped(this, false);
+    for (auto it = vpfs_.begin(), end = vpfs_.end(); it != end;
+         it += it.span()) {
+      if (it.is_set())
+        unmapped.note(it.index(), it.span(), *it);
     }
-    ++it;
   }
+
+  // Files' rmaps no longer lead here, but a walker may have found us
+  // before the removes above were logged.
+  gc_delayed(this);
 }
 
 sref<vmap>
@@ -161,6 +216,7 @@ vmap::copy()
   mmu::shootdown shootdown;
 
   {
+    rmap_updater mapped(nm.get(), true);
     auto out = nm->vpfs_.begin();
     auto lock = vpfs_.acquire(vpfs_.begin(), vpfs_.end());
     for (auto it = vpfs_.begin(), end = vpfs_.end(); it != end; ) {
@@ -187,10 +243,7 @@ vmap::copy()
 
       // Copy the descriptor
       nm->vpfs_.fill(out, it->dup());
-      if (myproc() != bootproc && out->page && out->inode) {
-        std::pair<vmap*, uptr> rmap = std::make_pair(&*(nm.get()), out.index()*PGSIZE);
-        out->page->add_pte(rmap);
-      }
+      mapped.note(out.index(), 1, *out);
 
       // Next page
       ++out;
@@ -235,6 +288,7 @@ again:
 
   {
     auto lock = vpfs_.acquire(begin, end);
+    rmap_updater unmapped(this, false), mapped(this, true);
 
     for (auto it = begin; it < end; it += it.span()) {
       if (!it.is_set())
@@ -242,12 +296,12 @@ again:
       // Verify unmapped region now that we hold the lock
       if (!fixed)
         goto again;
-      if (myproc() != bootproc && it->page && it->inode) {
-        std::pair<vmap*, uptr> rmap = std::make_pair(&*this, it.index()*PGSIZE);
-        pages.add(std::move(it->page), rmap);
-      } else
-        pages.add(std::move(it->page));
+      unmapped.note(it.index(), std::min(it.span(), end.index() - it.index()),
+                    *it);
+      pages.add(std::move(it->page));
     }
+    // Log the removal before the (possibly overlapping) new mapping
+    unmapped.flush();
 
     cache.invalidate(start, len, begin, &shootdown);
 
@@ -257,8 +311,10 @@ again:
       vmdesc d2(desc);
       d2.start += start;
       vpfs_.fill(begin, end, d2, true);
+      mapped.note(start / PGSIZE, len / PGSIZE, d2);
     } else {
       vpfs_.fill(begin, end, desc);
+      mapped.note(start / PGSIZE, len / PGSIZE, desc);
     }
 
     shootdown.perform();
@@ -283,13 +339,13 @@ vmap::remove(uptr start, uptr len)
     auto begin = vpfs_.find(start / PGSIZE);
     auto end = vpfs_.find((start + len) / PGSIZE);
     auto lock = vpfs_.acquire(begin, end);
+    harvest_dirty(begin, end, nullptr);
+    rmap_updater unmapped(this, false);
     for (auto it = begin; it < end; it += it.span()) {
       if (it.is_set()) {
-        if (myproc() != bootproc && it->page && it->inode) {
-          std::pair<vmap*, uptr> rmap = std::make_pair(&*this, it.index()*PGSIZE);
-          pages.add(std::move(it->page), rmap);
-        } else
-          pages.add(std::move(it->page));
+        unmapped.note(it.index(),
+                      std::min(it.span(), end.index() - it.index()), *it);
+        pages.add(std::move(it->page));
       }
     }
     cache.invalidate(start, len, begin, &shootdown);
@@ -303,25 +359,50 @@ vmap::remove(uptr start, uptr len)
 }
 
 void
-vmap::delete_mapping(uptr addr)
+vmap::unmap_file(const mnode *m, intptr_t start, u64 lo, u64 hi)
 {
+  uptr va = start + lo * PGSIZE;
+  uptr len = (hi - lo) * PGSIZE;
   mmu::shootdown shootdown;
-  auto vpf = vpfs_.find(addr/PGSIZE);
-  auto lock = vpfs_.acquire(vpf,vpf+1);
-  if (vpf.is_set())
-    vpfs_.unset(vpf,vpf+1);
-  cache.invalidate(addr, PGSIZE, vpf, &shootdown);
+  page_holder pages;
+
+  auto begin = vpfs_.find(va / PGSIZE);
+  auto end = vpfs_.find((va + len) / PGSIZE);
+  auto lock = vpfs_.acquire(begin, end);
+  for (auto it = begin; it < end; ) {
+    // Skip anything remapped since the caller looked at the rmap
+    if (!it.is_set() || it->inode.get() != m || it->start != start) {
+      it += it.span();
+      continue;
+    }
+    auto next = it + std::min(it.span(), end.index() - it.index());
+    pages.add(std::move(it->page));
+    cache.invalidate(it.index() * PGSIZE, (next.index() - it.index()) * PGSIZE,
+                     it, &shootdown);
+    vpfs_.unset(it, next);
+    it = next;
+  }
   shootdown.perform();
 }
 
 void
-vmap::clear_mapping(uptr addr)
+vmap::harvest_file(intptr_t start, u64 lo, u64 hi)
+{
+  auto begin = vpfs_.find((start + lo * PGSIZE) / PGSIZE);
+  auto end = vpfs_.find((start + hi * PGSIZE) / PGSIZE);
+  auto lock = vpfs_.acquire(begin, end);
+  harvest_dirty(begin, end, nullptr);
+}
+
+void
+vmap::clear_mapping(uptr addr, const page_info *pi)
 {
   mmu::shootdown shootdown;
   auto vpf = vpfs_.find(addr/PGSIZE);
   auto lock = vpfs_.acquire(vpf);
 
-  if (vpf.is_set()) {
+  // A private mapping may have replaced the file page with its own copy
+  if (vpf.is_set() && vpf->page.get() == pi) {
     auto &desc = *vpf;
     if (vpf.base_span() == 1) {
       // Safe to update in place
@@ -356,11 +437,7 @@ retry:
       bool writable = (it->flags & vmdesc::FLAG_WRITE);
       if (writable && (it->flags & vmdesc::FLAG_COW)) {
         sref<page_info> old_page = it->page;
-        if (myproc() != bootproc && old_page && it->inode) {
-          std::pair<vmap*, uptr> rmap = std::make_pair(&*this, it.index()*PGSIZE);
-          pages.add(std::move(old_page), rmap);
-        } else
-          pages.add(std::move(old_page));
+        pages.add(std::move(old_page));
         cache.invalidate(it.index() * PGSIZE, PGSIZE, it, &shootdown);
       }
 
@@ -391,6 +468,7 @@ vmap::invalidate_cache(uptr start, uptr len)
   auto begin = vpfs_.find(start / PGSIZE);
   auto end = vpfs_.find((start + len) / PGSIZE);
   auto lock = vpfs_.acquire(begin, end);
+  harvest_dirty(begin, end, nullptr);
 
   mmu::shootdown shootdown;
 
@@ -405,6 +483,97 @@ vmap::invalidate_cache(uptr start, uptr len)
   return 0;
 }
 
+// Whether desc maps a file's page cache shared, so that its PTEs' dirty
+// bits are the only record of writes through it.
+static bool
+is_shared_file(const vmdesc &desc)
+{
+  return (desc.flags & vmdesc::FLAG_SHARED) && desc.inode &&
+    desc.inode->fs_ == root_fs;
+}
+
+size_t
+vmap::harvest_dirty(const vpf_array::iterator &begin,
+                    const vpf_array::iterator &end,
+                    std::vector<sref<mnode> > *files)
+{
+  bool any = false;
+  for (auto it = begin; it < end; it += it.span()) {
+    if (!it.is_set() || !is_shared_file(*it))
+      continue;
+    if (files && std::find(files->begin(), files->end(), it->inode) ==
+        files->end())
+      files->push_back(it->inode);
+    if (it->page)
+      any = true;
+  }
+  if (!any)
+    return 0;
+
+  // Harvest a chunk at a time, each starting at a resident shared file
+  // page, so the bitmap stays small however large and sparse the range.
+  size_t ndirty = 0;
+  for (auto it = begin; it < end; ) {
+    if (!it.is_set() || !is_shared_file(*it) || !it->page) {
+      it += it.span();
+      continue;
+    }
+    auto next = vpfs_.find(std::min(end.index(),
+                                    it.index() + dirty_bits::max_pages));
+    ndirty += harvest_chunk(it, next);
+    it = next;
+  }
+  return ndirty;
+}
+
+size_t
+vmap::harvest_chunk(const vpf_array::iterator &begin,
+                    const vpf_array::iterator &end)
+{
+  // Clearing the PTEs both collects their dirty bits and write-protects
+  // the pages: the next write faults the PTE back in, clean.
+  dirty_bits dirty(begin.index() * PGSIZE, end.index() - begin.index());
+  mmu::shootdown shootdown;
+  for (auto it = begin; it < end; it += it.span()) {
+    if (it.is_set() && is_shared_file(*it) && it->page) {
+      u64 n = std::min(it.span(), end.index() - it.index());
+      cache.invalidate(it.index() * PGSIZE, n * PGSIZE, it, &shootdown,
+                       &dirty);
+    }
+  }
+  shootdown.perform();
+
+  size_t ndirty = 0;
+  for (auto it = begin; it < end; it += it.span()) {
+    if (!it.is_set() || !is_shared_file(*it) || !it->page)
+      continue;
+    u64 n = std::min(it.span(), end.index() - it.index());
+    for (u64 i = 0; i < n; i++) {
+      uptr va = (it.index() + i) * PGSIZE;
+      if (!dirty.test(va))
+        continue;
+      mfile *mf = it->inode->as_file();
+      mf->set_page_dirty((va - it->start) / PGSIZE);
+      mf->dirty(true);
+      ndirty++;
+    }
+  }
+  return ndirty;
+}
+
+ssize_t
+vmap::harvest_dirty(uptr start, uptr len, std::vector<sref<mnode> > *files)
+{
+  auto begin = vpfs_.find(start / PGSIZE);
+  auto end = vpfs_.find((start + len) / PGSIZE);
+  auto lock = vpfs_.acquire(begin, end);
+
+  for (auto it = begin; it < end; it += it.span())
+    if (!it.is_set())
+      return -1;                // ENOMEM
+  return harvest_dirty(begin, end, files);
+}
+
 int
 vmap::mprotect(uptr start, uptr len, uint64_t flags)
 {
@@ -412,6 +581,11 @@ vmap::mprotect(uptr start, uptr len, uint64_t flags)
   auto end = vpfs_.find((start + len) / PGSIZE);
   auto lock = vpfs_.acquire(begin, end);
 
+  // Don't lose writes through shared file mappings that this
+  // write-protects.
+  if (!(flags & vmdesc::FLAG_WRITE))
+    harvest_dirty(begin, end, nullptr);
+
   mmu::shootdown shootdown;
 
   for (auto it = begin; it < end; it += it.span()) {
@@ -430,6 +604,10 @@ vmap::mprotect(uptr start, uptr len, uint64_t flags)
       // (we'll just get a spurious fault), but we do need to check
       // that these permissions are okay.  Conveniently, POSIX allows
       // a partial mprotect, so we can check this as we go.
+      if (it->flags & vmdesc::FLAG_NOWRITE) {
+        shootdown.perform();
+        return -1;              // EACCES
+      }
 
       // XXX This should fail if this is a mapped file that was opened
       // O_RDONLY (we don't check this in mmap either).
@@ -463,10 +641,7 @@ vmap::dup_page(uptr dest, uptr src)
     auto lock = vpfs_.acquire(destit);
     assert(!destit.is_set());
     vpfs_.fill(destit, desc);
-    if (myproc() != bootproc && destit->page && destit->inode) {
-      std::pair<vmap*, uptr> rmap = std::make_pair(&*this, destit.index()*PGSIZE);
-      destit->page->add_pte(rmap);
-    }
+    rmap_updater(this, true).note(destit.index(), 1, *destit);
   }
 
   return 0;
@@ -518,10 +693,6 @@ vmap::pagefault(uptr va, u32 err)
     // down.
     if (type == access_type::WRITE && (desc.flags & vmdesc::FLAG_COW)) {
       old_page = desc.page;
-      if (myproc() != bootproc && old_page && desc.inode) {
-        std::pair<vmap*, uptr> rmap = std::make_pair(&*this, it.index()*PGSIZE);
-        old_page->remove_pte(rmap);
-      }
       cache.invalidate(va, PGSIZE, it, &shootdown);
     }
 
@@ -834,10 +1005,6 @@ vmap::ensure_page(const vmap::vpf_array::iterator &it, vmap::access_type type,
     // save extraneous reference counting
     vpfs_.fill(it, std::move(n));
   }
-  if (myproc() != bootproc && it->page && it->inode) {
-    std::pair<vmap*, uptr> rmap = std::make_pair(&*this, it.index()*PGSIZE);
-    it->page->add_pte(rmap);
-  }
   return page.get();
 }
 
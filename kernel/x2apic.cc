@@ -61,6 +61,7 @@ public:
   void send_ipi(struct cpu *c, int ino) override;
   void mask_pc(bool mask) override;
   void start_ap(struct cpu *c, u32 addr) override;
+  bool arm_timer(u64 ns) override;
   bool is_x2apic() override;
   void dump() override;
 private:
@@ -171,6 +172,16 @@ x2apic_lapic::is_x2apic()
   return true;
 }
 
+bool
+x2apic_lapic::arm_timer(u64 ns)
+{
+  // Nothing waits longer than a quantum, and this keeps the count in
+  // range.  A count of 0 would stop the timer.
+  ns = std::min(ns, (u64)QUANTUM * 1000000);
+  writemsr(TICR, std::max(ns * x2apichz / 1000000000, (u64)1));
+  return true;
+}
+
 void
 x2apic_lapic::clearintr()
 {
@@ -268,10 +279,11 @@ x2apic_lapic::cpu_init()
   if (count > 0xffffffff)
     panic("initx2apic: QUANTUM too large");
 
-  // The timer repeatedly counts down at bus frequency
-  // from xapic[TICR] and then issues an interrupt.  
+  // The timer counts down once at bus frequency from TICR and then
+  // issues an interrupt.  The timer interrupt rearms it (see
+  // ktimer_rearm).
   writemsr(TDCR, X1);
-  writemsr(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  writemsr(TIMER, T_IRQ0 + IRQ_TIMER);
   writemsr(TICR, count); 
 
   // Clear error status register (requires back-to-back writes).
@@ -70,6 +70,7 @@ public:
   void send_ipi(struct cpu *c, int ino) override;
   void mask_pc(bool mask) override;
   void start_ap(struct cpu *c, u32 addr) override;
+  bool arm_timer(u64 ns) override;
   void dump() override;
 private:
   void dumpall();
@@ -140,10 +141,11 @@ xapic_lapic::cpu_init()
   if (count > 0xffffffff)
     panic("initxapic: QUANTUM too large");
 
-  // The timer repeatedly counts down at bus frequency
-  // from xapic[TICR] and then issues an interrupt.  
+  // The timer counts down once at bus frequency from xapic[TICR] and
+  // then issues an interrupt.  The timer interrupt rearms it (see
+  // ktimer_rearm).
   xapicw(TDCR, X1);
-  xapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
+  xapicw(TIMER, T_IRQ0 + IRQ_TIMER);
   xapicw(TICR, count); 
 
   // Disable logical interrupt lines.
@@ -175,6 +177,16 @@ xapic_lapic::cpu_init()
   xapicw(TPR, 0);
 }
 
+bool
+xapic_lapic::arm_timer(u64 ns)
+{
+  // Nothing waits longer than a quantum, and this keeps the count in
+  // range.  A count of 0 would stop the timer.
+  ns = std::min(ns, (u64)QUANTUM * 1000000);
+  xapicw(TICR, std::max(ns * xapichz / 1000000000, (u64)1));
+  return true;
+}
+
 void
 xapic_lapic::mask_pc(bool mask)
 {
@@ -1,7 +1,12 @@
 #include "types.h"
 #include "kernel.hh"
+#include "amd64.h"
+#include "cpu.hh"
 #include "zlib.h"
 #include "fs.h"
+#include "fsimgz.h"
+#include "zlib-decompress.hh"
+#include <atomic>
 
 void *
 zlib_alloc(void *opaque, unsigned count, unsigned nbytes)
@@ -18,69 +23,251 @@ zlib_free(void *opaque, void *p)
   kmfree(x-1, x[-1] + sizeof(u64));
 }
 
-#define CHUNK BSIZE
-
-int
-zlib_decompress(unsigned char *src, u64 srclen, u64 dstlen,
-                void (*copy_output)(const char *buf, u64 offset, u64 size))
+// Inflate the zlib stream src into dst, which it must fill exactly.
+static void
+inflate_chunk(const u8 *src, u64 srclen, u8 *dst, u64 dstlen)
 {
-  unsigned char out[CHUNK];
   z_stream stream;
-  u64 have;
   int err;
 
   stream.zalloc = zlib_alloc;
   stream.zfree  = zlib_free;
   stream.opaque = (void *)"zlib";
-
-  stream.next_in = src;
+  stream.next_in = (u8 *)src;
   stream.avail_in = srclen;
-  stream.next_out = out;
-  stream.avail_out = CHUNK;
+  stream.next_out = dst;
+  stream.avail_out = dstlen;
 
   err = inflateInit(&stream);
   if (err != Z_OK)
     panic("%s: inflateInit() failed!\n", __func__);
 
-  u64 i = 0;
-  do {
-    if (srclen == 0)
-      break;
-    stream.avail_in = srclen;
-    stream.next_in = src;
-
-    // Run inflate() on input until the output buffer is not full.
-    do {
-      stream.avail_out = CHUNK;
-      stream.next_out = out;
-      err = inflate(&stream, Z_NO_FLUSH);
-      assert(err != Z_STREAM_ERROR); // state not clobbered
-
-      switch (err) {
-      case Z_NEED_DICT:
-        err = Z_DATA_ERROR; // fall through
-      case Z_DATA_ERROR:
-      case Z_MEM_ERROR:
-        inflateEnd(&stream);
-        panic("%s: inflate() failed with error %d\n", __func__, err);
+  err = inflate(&stream, Z_FINISH);
+  if (err != Z_STREAM_END || stream.total_out != dstlen)
+    panic("%s: inflate() failed with error %d\n", __func__, err);
+  inflateEnd(&stream);
+}
+
+// Number of chunk buffers between the unpacking cores and the calling
+// core with FSIMGZ_SERIAL_OUTPUT.  This bounds how far unpacking can
+// run ahead of output.
+enum { nslots = 16 };
+
+// An image being unpacked.  Any core can claim and unpack the next
+// chunk; the core that called fsimgz_decompress waits for the rest and,
+// with FSIMGZ_SERIAL_OUTPUT, passes the chunks to copy_output in order.
+class fsimgz_unpacker
+{
+  typedef void (*output_fn)(const char *buf, u64 offset, u64 size);
+
+  const u8 * const src_;
+  const u64 srclen_, dstlen_;
+  const int flags_;
+  const output_fn copy_output_;
+  const fsimgz_chunk *chunks_;
+  u64 nchunks_;
+
+  // Next chunk to claim, and number of chunks finished (unpacked and
+  // output, or with FSIMGZ_SERIAL_OUTPUT, handed to the caller).
+  std::atomic<u64> next_, done_;
+  // With FSIMGZ_SERIAL_OUTPUT, the number of chunks output.  Chunk c
+  // is unpacked into slot c % nslots, which is free once chunk
+  // c - nslots has been output.
+  std::atomic<u64> written_;
+  struct slot
+  {
+    u8 *buf;
+    u64 len;
+    std::atomic<u64> chunk;
+  } slots_[nslots];
+  // Otherwise, each core's buffer to unpack into.
+  u8 *bufs_[NCPU];
+
+public:
+  NEW_DELETE_OPS(fsimgz_unpacker);
+
+  fsimgz_unpacker(const u8 *src, u64 srclen, u64 dstlen, int flags,
+                  output_fn copy_output)
+    : src_(src), srclen_(srclen), dstlen_(dstlen), flags_(flags),
+      copy_output_(copy_output), next_(0), done_(0), written_(0), slots_{},
+      bufs_{}
+  {
+    auto hdr = (const fsimgz_header *)src;
+    if (srclen < sizeof(*hdr) || hdr->magic != FSIMGZ_MAGIC)
+      panic("fsimgz: bad image magic\n");
+    if (hdr->size != dstlen ||
+        srclen < sizeof(*hdr) + hdr->nchunks * sizeof(*chunks_))
+      panic("fsimgz: bad image header\n");
+    chunks_ = (const fsimgz_chunk *)(hdr + 1);
+    nchunks_ = hdr->nchunks;
+
+    if (flags_ & FSIMGZ_SERIAL_OUTPUT) {
+      for (int i = 0; i < nslots; i++) {
+        slots_[i].buf = alloc_buf();
+        slots_[i].chunk.store(~0ull, std::memory_order_relaxed);
       }
+    }
+  }
+
+  ~fsimgz_unpacker()
+  {
+    for (int i = 0; i < nslots; i++)
+      if (slots_[i].buf)
+        kmfree(slots_[i].buf, FSIMGZ_CHUNK);
+    for (int i = 0; i < NCPU; i++)
+      if (bufs_[i])
+        kmfree(bufs_[i], FSIMGZ_CHUNK);
+  }
 
-      have = CHUNK - stream.avail_out;
-      assert(have == CHUNK || have == 0);
-      if (have) {
-        copy_output((const char *)out, i*CHUNK, have);
-        i++;
+  // Unpack the chunks holding the file system's metadata, in order, on
+  // this core.  They all precede the first chunk that anyone can claim.
+  void unpack_metadata()
+  {
+    u8 *buf = my_buf();
+    u64 end = 1;
+    for (u64 c = 0; c < std::min(end, nchunks_); c++) {
+      u64 len = unpack(c, buf);
+      if (c == 0) {
+        // Block 1 is the superblock.
+        superblock sb;
+        memmove(&sb, buf + BSIZE, sizeof(sb));
+        u64 mend = (BBLOCK(sb.size - 1, sb.ninodes) + 1) * (u64)BSIZE;
+        end = (mend + FSIMGZ_CHUNK - 1) / FSIMGZ_CHUNK;
       }
-    } while (stream.avail_out == 0);
+      if (len)
+        copy_output_((const char *)buf, c * FSIMGZ_CHUNK, len);
+    }
+    next_ = done_ = written_ = std::min(end, nchunks_);
+  }
 
-    // done when inflate() says its done!
-  } while (err != Z_STREAM_END);
+  // Claim and unpack one chunk, if there is one this core can take now.
+  // Returns false if there are no chunks left to claim.
+  bool help()
+  {
+    u64 c = next_.load();
+    for (;;) {
+      if (c >= nchunks_)
+        return false;
+      if ((flags_ & FSIMGZ_SERIAL_OUTPUT) && c >= written_.load() + nslots)
+        return true;
+      if (next_.compare_exchange_weak(c, c + 1))
+        break;
+    }
 
-  if (stream.total_out != dstlen)
-    panic("%s: inflate() total_out != dstlen\n", __func__);
+    if (flags_ & FSIMGZ_SERIAL_OUTPUT) {
+      slot *s = &slots_[c % nslots];
+      s->len = unpack(c, s->buf);
+      s->chunk.store(c, std::memory_order_release);
+    } else {
+      u8 *buf = my_buf();
+      u64 len = unpack(c, buf);
+      if (len)
+        copy_output_((const char *)buf, c * FSIMGZ_CHUNK, len);
+    }
+    done_++;
+    return true;
+  }
 
-  assert(i == dstlen/CHUNK);
-  inflateEnd(&stream);
-  assert(err == Z_STREAM_END);
+  // Help until every chunk is unpacked and output.
+  void finish()
+  {
+    if (!(flags_ & FSIMGZ_SERIAL_OUTPUT)) {
+      while (done_ < nchunks_)
+        if (!help())
+          nop_pause();
+      return;
+    }
+
+    for (u64 w = written_; w < nchunks_; ) {
+      slot *s = &slots_[w % nslots];
+      if (s->chunk.load(std::memory_order_acquire) != w) {
+        if (!help())
+          nop_pause();
+        continue;
+      }
+      if (s->len)
+        copy_output_((const char *)s->buf, w * FSIMGZ_CHUNK, s->len);
+      written_ = ++w;
+    }
+  }
+
+private:
+  static u8 *alloc_buf()
+  {
+    u8 *buf = (u8 *)kmalloc(FSIMGZ_CHUNK, "fsimgz");
+    if (!buf)
+      panic("fsimgz: out of memory\n");
+    return buf;
+  }
+
+  u8 *my_buf()
+  {
+    u8 *&buf = bufs_[myid()];
+    if (!buf)
+      buf = alloc_buf();
+    return buf;
+  }
+
+  // Unpack chunk c into buf.  Returns the number of bytes to output,
+  // which is zero for a hole unless FSIMGZ_FILL_HOLES is set.
+  u64 unpack(u64 c, u8 *buf)
+  {
+    u64 len = std::min((u64)FSIMGZ_CHUNK, dstlen_ - c * FSIMGZ_CHUNK);
+    const fsimgz_chunk *ch = &chunks_[c];
+
+    switch (ch->type) {
+    case FSIMGZ_HOLE:
+      if (!(flags_ & FSIMGZ_FILL_HOLES))
+        return 0;
+      // fall through
+    case FSIMGZ_ZERO:
+      memset(buf, 0, len);
+      return len;
+
+    case FSIMGZ_DATA:
+      if (ch->off + ch->len > srclen_)
+        panic("fsimgz: chunk %lu out of range\n", c);
+      inflate_chunk(src_ + ch->off, ch->len, buf, len);
+      return len;
+
+    default:
+      panic("fsimgz: chunk %lu has bad type %u\n", c, ch->type);
+    }
+  }
+};
+
+static std::atomic<fsimgz_unpacker*> active_unpacker;
+// Cores in fsimgz_help.  This is counted outside the unpacker, and
+// before loading active_unpacker, so that fsimgz_decompress can't free
+// an unpacker that a helper is about to use.
+static std::atomic<int> fsimgz_helpers;
+
+void
+fsimgz_help(void)
+{
+  fsimgz_helpers++;
+  fsimgz_unpacker *u = active_unpacker.load();
+  if (u)
+    u->help();
+  fsimgz_helpers--;
+}
+
+int
+fsimgz_decompress(const u8 *src, u64 srclen, u64 dstlen, int flags,
+                  void (*copy_output)(const char *buf, u64 offset, u64 size))
+{
+  fsimgz_unpacker *u = new fsimgz_unpacker(src, srclen, dstlen, flags,
+                                           copy_output);
+  if (flags & FSIMGZ_METADATA_FIRST)
+    u->unpack_metadata();
+
+  active_unpacker = u;
+  u->finish();
+  // Once active_unpacker is cleared, any helper that could still see u
+  // is counted in fsimgz_helpers.
+  active_unpacker = nullptr;
+  while (fsimgz_helpers)
+    nop_pause();
+  delete u;
   return 0;
 }
@@ -0,0 +1,77 @@
+#include "types.h"
+#include "user.h"
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// fs.h's on-disk struct dirent clashes with <dirent.h>'s, so repeat its
+// name length here.
+#define DIRSIZ 14
+
+// Directory streams on top of the readdir system call, which enumerates a
+// directory by returning the entry that follows a given name.
+struct __dirstream {
+  int fd;
+  int started;
+  char prev[DIRSIZ+1];
+};
+
+DIR *
+fdopendir(int fd)
+{
+  DIR *dir = malloc(sizeof(*dir));
+  if (!dir)
+    return NULL;
+  dir->fd = fd;
+  dir->started = 0;
+  dir->prev[0] = 0;
+  return dir;
+}
+
+DIR *
+opendir(const char *name)
+{
+  int fd = open(name, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  DIR *dir = fdopendir(fd);
+  if (!dir)
+    close(fd);
+  return dir;
+}
+
+int
+readdir_r(DIR *dir, struct dirent *entry, struct dirent **result)
+{
+  char name[DIRSIZ+1];
+  int r = readdir(dir->fd, dir->started ? dir->prev : NULL, name);
+  if (r < 0)
+    return -1;
+  if (r == 0) {
+    *result = NULL;
+    return 0;
+  }
+
+  dir->started = 1;
+  memcpy(dir->prev, name, sizeof(name));
+  entry->d_ino = 0;
+  strncpy(entry->d_name, name, sizeof(entry->d_name));
+  *result = entry;
+  return 0;
+}
+
+int
+closedir(DIR *dir)
+{
+  int r = close(dir->fd);
+  free(dir);
+  return r;
+}
+
+int
+dirfd(DIR *dir)
+{
+  return dir->fd;
+}
@@ -1,15 +1,153 @@
+#include "types.h"
+#include "user.h"
 #include <signal.h>
+#include <sys/signalfd.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 void sig_restore(void);
 
+int
+sigaction(int sig, const struct sigaction* act, struct sigaction* oact)
+{
+  struct sigaction sa;
+  if (act) {
+    sa = *act;
+    sa.sa_restorer = sig_restore;
+    act = &sa;
+  }
+  return rt_sigaction(sig, act, oact);
+}
+
 sighandler_t
 signal(int sig, sighandler_t func)
 {
   struct sigaction act, oact;
   act.sa_handler = func;
-  act.sa_restorer = sig_restore;
+  act.sa_mask = 0;
+  act.sa_flags = 0;
   if (sigaction(sig, &act, &oact) < 0)
     return SIG_ERR;
   else
     return oact.sa_handler;
 }
+
+// Called by sig_restore when a handler returns.
+void
+__sig_setmask(sigset_t mask)
+{
+  rt_sigprocmask(SIG_SETMASK, &mask, NULL);
+}
+
+sigset_t
+__sig_getmask(void)
+{
+  sigset_t mask = 0;
+  rt_sigprocmask(SIG_BLOCK, NULL, &mask);
+  return mask;
+}
+
+int
+sigprocmask(int how, const sigset_t *set, sigset_t *oset)
+{
+  return rt_sigprocmask(how, set, oset);
+}
+
+// Each thread is a separate process, so the process-wide mask is the
+// calling thread's mask.
+int
+pthread_sigmask(int how, const sigset_t *set, sigset_t *oset)
+{
+  return rt_sigprocmask(how, set, oset);
+}
+
+int
+sigqueue(int pid, int sig, const union sigval value)
+{
+  return rt_sigqueue(pid, sig, (u64)value.sival_ptr);
+}
+
+int
+sigwaitinfo(const sigset_t *set, siginfo_t *info)
+{
+  return rt_sigtimedwait(set, info, -1);
+}
+
+int
+sigtimedwait(const sigset_t *set, siginfo_t *info,
+             const struct timespec *timeout)
+{
+  s64 ns = -1;
+  if (timeout)
+    ns = timeout->tv_sec * 1000000000ll + timeout->tv_nsec;
+  return rt_sigtimedwait(set, info, ns);
+}
+
+int
+sigwait(const sigset_t *set, int *sig)
+{
+  int r = rt_sigtimedwait(set, NULL, -1);
+  if (r < 0)
+    return -1;
+  *sig = r;
+  return 0;
+}
+
+int
+raise(int sig)
+{
+  return kill(getpid(), sig);
+}
+
+int
+sigemptyset(sigset_t *set)
+{
+  *set = 0;
+  return 0;
+}
+
+int
+sigfillset(sigset_t *set)
+{
+  *set = ~0ul;
+  return 0;
+}
+
+int
+sigaddset(sigset_t *set, int sig)
+{
+  if (sig <= 0 || sig >= NSIG)
+    return -1;
+  *set |= 1ul << (sig - 1);
+  return 0;
+}
+
+int
+sigdelset(sigset_t *set, int sig)
+{
+  if (sig <= 0 || sig >= NSIG)
+    return -1;
+  *set &= ~(1ul << (sig - 1));
+  return 0;
+}
+
+int
+sigismember(const sigset_t *set, int sig)
+{
+  if (sig <= 0 || sig >= NSIG)
+    return -1;
+  return (*set >> (sig - 1)) & 1;
+}
+
+// alarm() is ITIMER_REAL with no interval.
+unsigned
+alarm(unsigned seconds)
+{
+  struct itimerval it = {}, old;
+
+  it.it_value.tv_sec = seconds;
+  if (setitimer(ITIMER_REAL, &it, &old) < 0)
+    return 0;
+  // Round up, so a pending alarm never reports 0 seconds left.
+  return old.it_value.tv_sec + (old.it_value.tv_usec != 0);
+}
@@ -0,0 +1,199 @@
+#pragma once
+
+// Message-queue IPC between processes over a pair of single-producer,
+// single-consumer rings in a shared memory object.  Messages are copied
+// straight into the peer's ring, so there is one copy per message and no
+// allocation.  The kernel is entered only to sleep on a futex when a ring
+// is empty (receiver) or full (sender), and to wake a peer that has gone
+// to sleep.
+//
+// msgq::create() returns a memfd holding both rings.  Pass it to the peer
+// (e.g., across fork) and have each end call msgq::attach(fd, side) with
+// a different side; side 0 sends on ring 0 and receives on ring 1.
+
+#include "types.h"
+#include "user.h"
+#include "amd64.h"
+#include "futex.h"
+
+#include <atomic>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+class msgq
+{
+  struct ring
+  {
+    // Written by the producer
+    std::atomic<u64> tail __mpalign__;
+    std::atomic<u64> producer_waiting;
+    // Written by the consumer
+    std::atomic<u64> head __mpalign__;
+    std::atomic<u64> consumer_waiting;
+    __padout__;
+  };
+
+  struct header
+  {
+    u64 nslots;
+    u64 msgsize;
+    ring rings[2];
+  };
+
+  // Spin this many times on an empty or full ring before sleeping.
+  enum { spin_iters = 256 };
+  enum { page_size = 4096 };
+
+  header *hdr_;
+  size_t maplen_;
+  ring *tx_, *rx_;
+  char *txslots_, *rxslots_;
+
+  msgq(header *hdr, size_t maplen, int side)
+    : hdr_(hdr), maplen_(maplen),
+      tx_(&hdr->rings[side]), rx_(&hdr->rings[!side]),
+      txslots_(slots(hdr, side)), rxslots_(slots(hdr, !side)) { }
+
+  static size_t slotsize(u64 msgsize)
+  {
+    return (sizeof(u64) + msgsize + 63) & ~63ul;
+  }
+
+  static size_t mapsize(u64 nslots, u64 msgsize)
+  {
+    return (sizeof(header) + 2 * nslots * slotsize(msgsize) + page_size - 1) &
+      ~(size_t)(page_size - 1);
+  }
+
+  static char *slots(header *hdr, int side)
+  {
+    return (char*)(hdr + 1) + side * hdr->nslots * slotsize(hdr->msgsize);
+  }
+
+  // Wait until *word != val.  *waiting tells the other end to wake us.
+  static void wait(std::atomic<u64> *word, u64 val,
+                   std::atomic<u64> *waiting)
+  {
+    for (int i = 0; i < spin_iters; i++) {
+      if (word->load(std::memory_order_acquire) != val)
+        return;
+      nop_pause();
+    }
+    for (;;) {
+      waiting->store(1);
+      if (word->load() != val)
+        break;
+      futex((u64*)word, FUTEX_WAIT, val, 0);
+    }
+    waiting->store(0, std::memory_order_relaxed);
+  }
+
+  static void wake(std::atomic<u64> *word, std::atomic<u64> *waiting)
+  {
+    if (waiting->load() && waiting->exchange(0))
+      futex((u64*)word, FUTEX_WAKE, 1, 0);
+  }
+
+public:
+  msgq(const msgq&) = delete;
+  msgq &operator=(const msgq&) = delete;
+
+  ~msgq()
+  {
+    munmap(hdr_, maplen_);
+  }
+
+  // Create a channel of two rings, each holding nslots messages of up to
+  // msgsize bytes.  Returns the channel's fd, or -1.
+  static int create(u64 nslots, u64 msgsize)
+  {
+    int fd = memfd_create("msgq", 0);
+    if (fd < 0)
+      return -1;
+    size_t len = mapsize(nslots, msgsize);
+    if (ftruncate(fd, len) < 0) {
+      close(fd);
+      return -1;
+    }
+    header *hdr = (header*)mmap(nullptr, len, PROT_READ|PROT_WRITE,
+                                MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+      close(fd);
+      return -1;
+    }
+    // The file starts out zeroed, so only the geometry needs setting.
+    hdr->nslots = nslots;
+    hdr->msgsize = msgsize;
+    munmap(hdr, len);
+    return fd;
+  }
+
+  // Map an end of the channel in fd.  Returns nullptr on failure.
+  static msgq *attach(int fd, int side)
+  {
+    header *hdr = (header*)mmap(nullptr, sizeof(header), PROT_READ,
+                                MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED)
+      return nullptr;
+    size_t len = mapsize(hdr->nslots, hdr->msgsize);
+    munmap(hdr, sizeof(header));
+
+    hdr = (header*)mmap(nullptr, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED)
+      return nullptr;
+    return new msgq(hdr, len, side);
+  }
+
+  size_t msgsize() const
+  {
+    return hdr_->msgsize;
+  }
+
+  // Send a message of len bytes.  If the ring is full, wait for room
+  // unless nonblock is set.  Returns 0, or -1 if the message is too
+  // large or the ring is full and nonblock is set.
+  int send(const void *msg, size_t len, bool nonblock = false)
+  {
+    if (len > hdr_->msgsize)
+      return -1;
+
+    u64 tail = tx_->tail.load(std::memory_order_relaxed);
+    u64 head = tx_->head.load(std::memory_order_acquire);
+    if (tail - head == hdr_->nslots) {
+      if (nonblock)
+        return -1;
+      wait(&tx_->head, head, &tx_->producer_waiting);
+    }
+
+    char *slot = txslots_ + (tail % hdr_->nslots) * slotsize(hdr_->msgsize);
+    *(u64*)slot = len;
+    memmove(slot + sizeof(u64), msg, len);
+    // seq_cst, so the store is ordered before wake()'s load of the flag.
+    tx_->tail.store(tail + 1);
+    wake(&tx_->tail, &tx_->consumer_waiting);
+    return 0;
+  }
+
+  // Receive a message into buf, waiting for one unless nonblock is set.
+  // Returns the message's length, or -1 if buf is too small or the ring
+  // is empty and nonblock is set.
+  ssize_t recv(void *buf, size_t len, bool nonblock = false)
+  {
+    u64 head = rx_->head.load(std::memory_order_relaxed);
+    if (rx_->tail.load(std::memory_order_acquire) == head) {
+      if (nonblock)
+        return -1;
+      wait(&rx_->tail, head, &rx_->consumer_waiting);
+    }
+
+    char *slot = rxslots_ + (head % hdr_->nslots) * slotsize(hdr_->msgsize);
+    u64 n = *(u64*)slot;
+    if (n > len)
+      return -1;
+    memmove(buf, slot + sizeof(u64), n);
+    rx_->head.store(head + 1);
+    wake(&rx_->head, &rx_->producer_waiting);
+    return n;
+  }
+};
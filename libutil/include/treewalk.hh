@@ -0,0 +1,126 @@
+#pragma once
+
+// A parallel directory-tree walker, for du, ls -R, rm -r and the like.
+//
+// treewalk::run walks the tree below a path with a pool of threads.
+// Each thread keeps a deque of directories waiting to be read.  It
+// pushes the subdirectories it finds onto the back of its own deque and
+// takes from the back, so it works depth-first through its part of the
+// tree.  A thread whose deque is empty steals from the front of another
+// thread's, taking the shallowest directory and hence likely the most
+// work.  Entries are opened relative to their directory's fd, so the
+// walk looks up one name per entry rather than a whole path.
+//
+// A subclass says what to do with the tree by overriding the hooks
+// below.  They are called concurrently from all of the walker's
+// threads; thread is the calling thread's number, from 0 to nthreads-1,
+// for indexing per-thread state.
+
+#include "libutil.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <new>
+
+class treewalk
+{
+public:
+  struct entry
+  {
+    int dirfd;                  // The directory holding the entry, or -1
+    const char *name;           // The entry's name in dirfd
+    const char *path;           // The path of the entry, from the root
+    const struct stat &st;
+  };
+
+  treewalk() : queues_(nullptr), nthreads_(0) { }
+  virtual ~treewalk() { }
+
+  // Walk root, and the tree below it if it's a directory, with nthreads
+  // threads.  Returns the number of entries visited, or -1 if root
+  // can't be stat'ed.
+  long run(const char *root, int nthreads);
+
+  // The number of threads to walk with by default: one per CPU.
+  static int default_threads();
+
+  // An array of per-thread state for the hooks to index by thread.  T
+  // should be __mpalign__; each element then gets its own cache lines.
+  // (new[] can't allocate such a T in the C++0x build.)
+  template<class T>
+  class per_thread
+  {
+    void *mem_;
+    T *elems_;
+    int n_;
+
+  public:
+    per_thread(int n) : mem_(malloc(n * sizeof(T) + CACHELINE)), n_(n)
+    {
+      if (!mem_)
+        die("treewalk: out of memory");
+      elems_ = (T*)(((uintptr_t)mem_ + CACHELINE - 1) &
+                    ~(uintptr_t)(CACHELINE - 1));
+      for (int i = 0; i < n_; i++)
+        new (&elems_[i]) T();
+    }
+
+    ~per_thread()
+    {
+      for (int i = 0; i < n_; i++)
+        elems_[i].~T();
+      free(mem_);
+    }
+
+    per_thread(const per_thread&) = delete;
+    per_thread &operator=(const per_thread&) = delete;
+
+    T &operator[](int i) { return elems_[i]; }
+    int size() const { return n_; }
+  };
+
+protected:
+  // Called for root and each entry below it.  For a directory, return
+  // true to walk into it.
+  virtual bool visit(int thread, const entry &e) = 0;
+
+  // Called for each directory walked into, by the thread that read it,
+  // right after visiting its entries.  dirfd is still open.
+  virtual void listed(int thread, const entry &dir) { }
+
+  // Called for each directory walked into, once everything below it
+  // has been left, so in post-order.  dirfd is -1.
+  virtual void leave(int thread, const entry &dir) { }
+
+  // Called for entries that can't be stat'ed and directories that can't
+  // be read.
+  virtual void error(int thread, const char *path) { }
+
+private:
+  struct dir;
+  struct queue;
+
+  void push(int thread, dir *d);
+  dir *pop(int thread);
+  dir *steal(int thread);
+  void work(int thread);
+  void read(int thread, dir *d);
+  void finish(int thread, dir *d);
+  static void *worker(void *arg);
+
+  per_thread<queue> *queues_;
+  int nthreads_;
+
+  // Directories queued or being read.  The walk is done when this
+  // reaches zero.
+  std::atomic<long> outstanding_;
+
+  // Queued directories that are holding an open fd.  Past
+  // max_queued_fds, a queued directory is reopened by path instead, so
+  // a wide tree can't run the process out of fds.
+  std::atomic<int> queued_fds_;
+  enum { max_queued_fds = 64 };
+};
@@ -0,0 +1,329 @@
+#include "treewalk.hh"
+#include "libutil.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#if defined(XV6_USER)
+#include "fs.h"
+#include "pthread.h"
+#include "sysstubs.h"
+#else
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// A directory to be read, and then left once all its subdirectories
+// have been.
+struct treewalk::dir
+{
+  dir *parent;
+  std::string path;
+  size_t name;                  // Offset of the last element in path
+  struct stat st;
+  int fd;                       // -1 to reopen path when read
+  // Subdirectories not yet left, plus one until this has been read.
+  std::atomic<int> pending;
+
+  dir(dir *parent, std::string path, size_t name, const struct stat &st,
+      int fd)
+    : parent(parent), path(path), name(name), st(st), fd(fd), pending(1) { }
+};
+
+struct treewalk::queue
+{
+  pthread_mutex_t lock;
+  // The owner pushes and pops at the back of dirs; thieves take from
+  // head.  Both are reset when the queue empties.
+  std::vector<dir*> dirs;
+  size_t head;
+  std::atomic<size_t> size;     // Queued dirs, readable without lock
+  long visited;
+
+  queue() : head(0), size(0), visited(0)
+  {
+    pthread_mutex_init(&lock, nullptr);
+  }
+
+  void update()
+  {
+    if (head == dirs.size()) {
+      dirs.clear();
+      head = 0;
+    }
+    size = dirs.size() - head;
+  }
+} __mpalign__;
+
+struct worker_arg
+{
+  treewalk *tw;
+  int thread;
+};
+
+int
+treewalk::default_threads()
+{
+#if defined(XV6_USER)
+  return NCPU;
+#else
+  return sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+}
+
+// Stat name in dirfd.  If it's a directory, also return an fd for it in
+// *fd, or -1 if it can't be opened; otherwise set *fd to -1.
+static int
+stat_entry(int dirfd, const char *name, struct stat *st, int *fd)
+{
+#if defined(XV6_USER)
+  // fstatat opens the entry anyway, so open it just once and keep the
+  // fd if it's a directory.
+  *fd = openat(dirfd, name, O_RDONLY | O_ANYFD);
+  if (*fd < 0)
+    return -1;
+  if (fstat(*fd, st) < 0) {
+    close(*fd);
+    *fd = -1;
+    return -1;
+  }
+  if (!S_ISDIR(st->st_mode)) {
+    close(*fd);
+    *fd = -1;
+  }
+  return 0;
+#else
+  *fd = -1;
+  if (fstatat(dirfd, name, st, AT_SYMLINK_NOFOLLOW) < 0)
+    return -1;
+  if (S_ISDIR(st->st_mode))
+    *fd = openat(dirfd, name, O_RDONLY | O_DIRECTORY);
+  return 0;
+#endif
+}
+
+// Read the names in directory fd, except . and .., into names.
+static bool
+list_dir(int fd, std::vector<std::string> *names)
+{
+#if defined(XV6_USER)
+  char buf[DIRSIZ+1] = {};
+  char *prev = nullptr;
+  for (;;) {
+    int r = readdir(fd, prev, buf);
+    if (r < 0)
+      return false;
+    if (r == 0)
+      return true;
+    prev = buf;
+    if (strcmp(buf, ".") != 0 && strcmp(buf, "..") != 0)
+      names->push_back(buf);
+  }
+#else
+  int dfd = dup(fd);
+  if (dfd < 0)
+    return false;
+  DIR *dir = fdopendir(dfd);
+  if (!dir) {
+    close(dfd);
+    return false;
+  }
+  struct dirent *de;
+  while ((de = readdir(dir)))
+    if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0)
+      names->push_back(de->d_name);
+  closedir(dir);
+  return true;
+#endif
+}
+
+long
+treewalk::run(const char *root, int nthreads)
+{
+  struct stat st;
+  int fd;
+  if (stat_entry(AT_FDCWD, root, &st, &fd) < 0) {
+    error(0, root);
+    return -1;
+  }
+
+  const char *slash = strrchr(root, '/');
+  const char *name = slash && slash[1] ? slash + 1 : root;
+  if (!visit(0, entry{AT_FDCWD, name, root, st}) || !S_ISDIR(st.st_mode)) {
+    if (fd >= 0)
+      close(fd);
+    return 1;
+  }
+
+  nthreads_ = nthreads < 1 ? 1 : nthreads;
+  queues_ = new per_thread<queue>(nthreads_);
+  queued_fds_ = fd >= 0;
+  outstanding_ = 1;
+  push(0, new dir(nullptr, root, name - root, st, fd));
+
+  pthread_t *tids = new pthread_t[nthreads_];
+  worker_arg *args = new worker_arg[nthreads_];
+  for (int i = 1; i < nthreads_; i++) {
+    args[i] = worker_arg{this, i};
+    if (pthread_create(&tids[i], nullptr, worker, &args[i]) < 0)
+      die("treewalk: pthread_create failed");
+  }
+  work(0);
+  for (int i = 1; i < nthreads_; i++)
+    pthread_join(tids[i], nullptr);
+  delete[] tids;
+  delete[] args;
+
+  long visited = 1;
+  for (int i = 0; i < nthreads_; i++)
+    visited += (*queues_)[i].visited;
+  delete queues_;
+  queues_ = nullptr;
+  return visited;
+}
+
+void *
+treewalk::worker(void *arg)
+{
+  worker_arg *a = (worker_arg*)arg;
+  a->tw->work(a->thread);
+  return nullptr;
+}
+
+void
+treewalk::push(int thread, dir *d)
+{
+  queue *q = &(*queues_)[thread];
+  pthread_mutex_lock(&q->lock);
+  q->dirs.push_back(d);
+  q->update();
+  pthread_mutex_unlock(&q->lock);
+}
+
+treewalk::dir *
+treewalk::pop(int thread)
+{
+  queue *q = &(*queues_)[thread];
+  dir *d = nullptr;
+  pthread_mutex_lock(&q->lock);
+  if (q->dirs.size() > q->head) {
+    d = q->dirs.back();
+    q->dirs.pop_back();
+    q->update();
+  }
+  pthread_mutex_unlock(&q->lock);
+  return d;
+}
+
+treewalk::dir *
+treewalk::steal(int thread)
+{
+  for (int i = 1; i < nthreads_; i++) {
+    queue *q = &(*queues_)[(thread + i) % nthreads_];
+    // Peek without the lock first, so idle threads don't bounce the
+    // locks of busy ones.
+    if (q->size == 0)
+      continue;
+    dir *d = nullptr;
+    pthread_mutex_lock(&q->lock);
+    if (q->dirs.size() > q->head) {
+      d = q->dirs[q->head++];
+      q->update();
+    }
+    pthread_mutex_unlock(&q->lock);
+    if (d)
+      return d;
+  }
+  return nullptr;
+}
+
+void
+treewalk::work(int thread)
+{
+  for (;;) {
+    dir *d = pop(thread);
+    if (!d)
+      d = steal(thread);
+    if (d) {
+      read(thread, d);
+      continue;
+    }
+    if (outstanding_ == 0)
+      return;
+    // Let a busy thread have the CPU if we share one.
+#if defined(XV6_USER)
+    yield();
+#else
+    sched_yield();
+#endif
+  }
+}
+
+// Visit d's entries, queue its subdirectories, and finish d's read.
+void
+treewalk::read(int thread, dir *d)
+{
+  if (d->fd >= 0)
+    --queued_fds_;
+  else
+    d->fd = open(d->path.c_str(), O_RDONLY);
+
+  std::vector<std::string> names;
+  if (d->fd < 0 || !list_dir(d->fd, &names))
+    error(thread, d->path.c_str());
+
+  for (auto &name : names) {
+    std::string path = d->path + '/' + name;
+    struct stat st;
+    int fd;
+    if (stat_entry(d->fd, name.c_str(), &st, &fd) < 0) {
+      error(thread, path.c_str());
+      continue;
+    }
+    (*queues_)[thread].visited++;
+
+    if (!visit(thread, entry{d->fd, name.c_str(), path.c_str(), st}) ||
+        !S_ISDIR(st.st_mode)) {
+      if (fd >= 0)
+        close(fd);
+      continue;
+    }
+
+    if (fd >= 0 && ++queued_fds_ > max_queued_fds) {
+      --queued_fds_;
+      close(fd);
+      fd = -1;
+    }
+    d->pending++;
+    outstanding_++;
+    push(thread, new dir(d, path, d->path.size() + 1, st, fd));
+  }
+
+  if (d->fd >= 0) {
+    listed(thread, entry{d->fd, d->path.c_str() + d->name, d->path.c_str(),
+                         d->st});
+    close(d->fd);
+    d->fd = -1;
+  }
+  finish(thread, d);
+  outstanding_--;
+}
+
+// Drop d's read or one of its subdirectories from d's pending count,
+// leaving d, and perhaps its parents in turn, if that was the last.
+void
+treewalk::finish(int thread, dir *d)
+{
+  while (d && --d->pending == 0) {
+    leave(thread, entry{-1, d->path.c_str() + d->name, d->path.c_str(),
+                        d->st});
+    dir *parent = d->parent;
+    delete d;
+    d = parent;
+  }
+}
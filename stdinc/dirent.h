@@ -0,0 +1,23 @@
+#pragma once
+
+#include "compiler.h"
+#include <sys/types.h>
+
+BEGIN_DECLS
+
+struct dirent {
+  ino_t d_ino;
+  char d_name[256];
+};
+
+typedef struct __dirstream DIR;
+
+// Note that readdir(DIR*) is not provided: the name is taken by the xv6
+// readdir(fd, prev, name) system call.  Use readdir_r instead.
+DIR *opendir(const char *name);
+DIR *fdopendir(int fd);
+int readdir_r(DIR *dir, struct dirent *entry, struct dirent **result);
+int closedir(DIR *dir);
+int dirfd(DIR *dir);
+
+END_DECLS
@@ -4,3 +4,4 @@
 #define EWOULDBLOCK     EAGAIN  /* Operation would block */
 #define EINTR           4
 #define ENOSPC          28
+#define EINVAL          22
@@ -8,5 +8,6 @@ BEGIN_DECLS
 
 int open(const char*, int, ...);
 int openat(int, const char *, int, ...);
+int fallocate(int fd, int mode, off_t offset, off_t len);
 
 END_DECLS
@@ -3,4 +3,9 @@
 
 #include_next <limits.h>
 
+// Must match include/fs.h
+#ifndef PATH_MAX
+#define PATH_MAX 256
+#endif
+
 #endif
@@ -1,17 +1,19 @@
 #pragma once
 
-/*
- * We do not currently have signal masking.
- */
-
 BEGIN_DECLS
 
 struct __jmp_env {
   long regs[8];
 };
 
+struct __sigjmp_env {
+  long regs[8];
+  long savemask;
+  unsigned long mask;           // Signal mask, if savemask
+};
+
 typedef struct __jmp_env jmp_buf[1];
-typedef struct __jmp_env sigjmp_buf[1];
+typedef struct __sigjmp_env sigjmp_buf[1];
 
 int   setjmp(jmp_buf env);
 void  longjmp(jmp_buf env, int val);
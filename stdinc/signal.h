@@ -1,12 +1,27 @@
 #pragma once
 
 #include <uk/signal.h>
+#include <time.h>
 
 BEGIN_DECLS
 
 typedef void (*sighandler_t)(int);
 
 sighandler_t signal(int sig, sighandler_t func);
-int sigaction(int sig, struct sigaction* act, struct sigaction* oact);
+int sigaction(int sig, const struct sigaction* act, struct sigaction* oact);
+int sigprocmask(int how, const sigset_t *set, sigset_t *oset);
+int pthread_sigmask(int how, const sigset_t *set, sigset_t *oset);
+int sigqueue(int pid, int sig, const union sigval value);
+int sigwaitinfo(const sigset_t *set, siginfo_t *info);
+int sigtimedwait(const sigset_t *set, siginfo_t *info,
+                 const struct timespec *timeout);
+int sigwait(const sigset_t *set, int *sig);
+int raise(int sig);
+
+int sigemptyset(sigset_t *set);
+int sigfillset(sigset_t *set);
+int sigaddset(sigset_t *set, int sig);
+int sigdelset(sigset_t *set, int sig);
+int sigismember(const sigset_t *set, int sig);
 
 END_DECLS
@@ -10,5 +10,9 @@ void *mmap(void *addr, size_t length, int prot, int flags,
 int munmap(void *addr, size_t length);
 int mprotect(void *addr, size_t length, int prot);
 int madvise(void *addr, size_t length, int advice);
+int msync(void *addr, size_t length, int flags);
+int shm_open(const char *name, int oflag, mode_t mode);
+int shm_unlink(const char *name);
+int memfd_create(const char *name, unsigned int flags);
 
 END_DECLS
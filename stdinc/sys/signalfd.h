@@ -0,0 +1,11 @@
+#pragma once
+
+#include "compiler.h"
+#include <uk/signal.h>
+
+BEGIN_DECLS
+
+// Only fd == -1 (create a new signalfd) is supported.
+int signalfd(int fd, const sigset_t *mask, int flags);
+
+END_DECLS
@@ -15,8 +15,22 @@ struct timezone
   // Not implemented
 };
 
+struct itimerval
+{
+  struct timeval it_interval;
+  struct timeval it_value;
+};
+
+// Only ITIMER_REAL is supported.
+#define ITIMER_REAL    0
+#define ITIMER_VIRTUAL 1
+#define ITIMER_PROF    2
+
 BEGIN_DECLS
 
 int gettimeofday(struct timeval *tv, struct timezone *tz);
+int setitimer(int which, const struct itimerval *new_value,
+              struct itimerval *old_value);
+int getitimer(int which, struct itimerval *curr_value);
 
 END_DECLS
@@ -0,0 +1,13 @@
+#pragma once
+
+#include "compiler.h"
+#include <uk/time.h>
+
+BEGIN_DECLS
+
+int timerfd_create(int clockid, int flags);
+int timerfd_settime(int fd, int flags, const struct itimerspec *new_value,
+                    struct itimerspec *old_value);
+int timerfd_gettime(int fd, struct itimerspec *curr_value);
+
+END_DECLS
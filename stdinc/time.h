@@ -15,4 +15,13 @@ char *asctime(const struct tm *tm);
 char *ctime_r(const time_t *timep, char *buf);
 char *ctime(const time_t *timep);
 
+struct sigevent;
+int timer_create(clockid_t clockid, struct sigevent *sevp, timer_t *timerid);
+int timer_settime(timer_t timerid, int flags,
+                  const struct itimerspec *new_value,
+                  struct itimerspec *old_value);
+int timer_gettime(timer_t timerid, struct itimerspec *curr_value);
+int timer_getoverrun(timer_t timerid);
+int timer_delete(timer_t timerid);
+
 END_DECLS
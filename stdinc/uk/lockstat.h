@@ -46,5 +46,6 @@ struct klockstat;
 #define LOCKSTAT_PIPE      1
 #define LOCKSTAT_PROC      1
 #define LOCKSTAT_SCHED     1
+#define LOCKSTAT_TIMER     1
 #define LOCKSTAT_VM        1
 #define LOCKSTAT_WQ        1
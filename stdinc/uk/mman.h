@@ -15,5 +15,11 @@
 
 #define MADV_WILLNEED 3
 
+#define MS_ASYNC      0x1
+#define MS_INVALIDATE 0x2
+#define MS_SYNC       0x4
+
+#define MFD_CLOEXEC   0x1
+
 // xv6 extension: invalidate all page tables
 #define MADV_INVALIDATE_CACHE 1000
@@ -1,15 +1,114 @@
 #pragma once
 
+#define SIGHUP    1
+#define SIGINT    2
+#define SIGQUIT   3
+#define SIGILL    4
+#define SIGTRAP   5
+#define SIGABRT   6
 #define SIGBUS    7
+#define SIGFPE    8
+#define SIGKILL   9
+#define SIGUSR1   10
 #define SIGSEGV   11
+#define SIGUSR2   12
 #define SIGPIPE   13
-#define NSIG      16
+#define SIGALRM   14
+#define SIGTERM   15
+#define SIGCHLD   17
+#define SIGCONT   18
+#define SIGURG    23
+#define SIGWINCH  28
+
+// Signals SIGRTMIN through SIGRTMAX are real-time: each one sent is
+// queued, and they are delivered lowest-numbered first.  Lower signals
+// are pending at most once.
+#define SIGRTMIN  32
+#define SIGRTMAX  64
+#define NSIG      65
 
 #define SIG_DFL   ((void (*)(int)) 0)
 #define SIG_IGN   ((void (*)(int)) 1)
 #define SIG_ERR   ((void (*)(int)) -1)
 
+// sigprocmask how
+#define SIG_BLOCK   0
+#define SIG_UNBLOCK 1
+#define SIG_SETMASK 2
+
+// sa_flags
+#define SA_SIGINFO   0x00000004
+#define SA_NODEFER   0x40000000
+#define SA_RESETHAND 0x80000000
+
+// si_code
+#define SI_USER    0            // kill()
+#define SI_KERNEL  0x80
+#define SI_QUEUE   (-1)         // sigqueue()
+#define SI_TIMER   (-2)
+#define CLD_EXITED 1
+#define CLD_KILLED 2
+
+// Bit n-1 stands for signal n.
+typedef unsigned long sigset_t;
+
+union sigval {
+  int sival_int;
+  void *sival_ptr;
+};
+
+typedef struct siginfo {
+  int si_signo;
+  int si_errno;
+  int si_code;
+  int si_pid;
+  int si_uid;
+  int si_status;                // SIGCHLD exit status
+  union sigval si_value;        // sigqueue() or timer value
+  void *si_addr;                // Faulting address
+} siginfo_t;
+
+// sigev_notify
+#define SIGEV_SIGNAL 0
+#define SIGEV_NONE   1
+
+struct sigevent {
+  union sigval sigev_value;
+  int sigev_signo;
+  int sigev_notify;
+};
+
 struct sigaction {
-  void (*sa_handler)(int);
+  union {
+    void (*sa_handler)(int);
+    void (*sa_sigaction)(int, siginfo_t *, void *);
+  };
   void (*sa_restorer)(void);
+  sigset_t sa_mask;             // Blocked while the handler runs
+  int sa_flags;
 };
+
+// Records returned by read() on a signalfd.  Same layout as Linux.
+struct signalfd_siginfo {
+  unsigned int ssi_signo;
+  int ssi_errno;
+  int ssi_code;
+  unsigned int ssi_pid;
+  unsigned int ssi_uid;
+  int ssi_fd;
+  unsigned int ssi_tid;
+  unsigned int ssi_band;
+  unsigned int ssi_overrun;
+  unsigned int ssi_trapno;
+  int ssi_status;
+  int ssi_int;
+  unsigned long ssi_ptr;
+  unsigned long ssi_utime;
+  unsigned long ssi_stime;
+  unsigned long ssi_addr;
+  unsigned char __pad[48];
+};
+
+// signalfd flags
+#define SFD_NONBLOCK 0x800
+#define SFD_CLOEXEC  0x80000
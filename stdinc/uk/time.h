@@ -14,6 +14,31 @@ struct tm {
   int tm_isdst;       /* daylight saving time */
 };
 
+struct timespec {
+  time_t tv_sec;
+  long tv_nsec;
+};
+
+struct itimerspec {
+  struct timespec it_interval;  // Period, or 0 for a one-shot timer
+  struct timespec it_value;     // Time until (or of) the next expiry
+};
+
+typedef int clockid_t;
+typedef int timer_t;
+
+// Both clocks advance with nsectime(); they differ only in their epoch.
+#define CLOCK_REALTIME  0
+#define CLOCK_MONOTONIC 1
+
+// timer_settime and timerfd_settime flags
+#define TIMER_ABSTIME     1
+#define TFD_TIMER_ABSTIME TIMER_ABSTIME
+
+// timerfd_create flags
+#define TFD_NONBLOCK 0x800
+#define TFD_CLOEXEC  0x80000
+
 BEGIN_DECLS
 
 // These math functions are shared by user space and the kernel
@@ -1,5 +1,7 @@
 #pragma once
 
+#define WNOHANG 1
+
 #define __WAIT_STATUS_VAL_MASK  0xFF
 #define __WAIT_STATUS_TYPE_MASK 0xFF00
 #define __WAIT_STATUS_EXITED    (0 << 8)
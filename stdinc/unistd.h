@@ -12,6 +12,8 @@ ssize_t write(int fd, const void *buf, size_t count);
 ssize_t read(int fd, void *buf, size_t count);
 ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset);
 ssize_t pread(int fd, void *buf, size_t count, off_t offset);
+ssize_t copy_file_range(int fd_in, off_t *off_in, int fd_out, off_t *off_out,
+                        size_t len, unsigned int flags);
 int close(int fd);
 int link(const char *oldpath, const char *newpath);
 int unlink(const char *pathname);
@@ -24,9 +26,13 @@ int pipe(int pipefd[2]);
 int pipe2(int pipefd[2], int flags);
 void sync(void);
 int fsync(int fd);
+int syncfs(int fd);
+int truncate(const char *path, off_t length);
+int ftruncate(int fd, off_t length);
 
 unsigned sleep(unsigned);
 unsigned usleep(unsigned);
+unsigned alarm(unsigned);
 pid_t getpid(void);
 pid_t getppid(void);
 pid_t fork(void);
@@ -4,10 +4,21 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sys/stat.h>
 
 #include "include/types.h"
 #include "include/fs.h"
 
+// mkfs lays out the whole file system in memory first: the inode
+// table, directory contents and indirect blocks are built in memory,
+// and each file's data is recorded as a list of extents of the image
+// to copy it to.  The image is then written in parallel, one file per
+// worker thread, while the main thread writes the metadata.  The image
+// starts out as a sparse file of the full size, and only blocks that
+// aren't all zeroes are written, so unallocated (and zero) extents take
+// neither time nor space.
+
 int ninodes = NINODES;
 u32 size = NMEGS * BLKS_PER_MEG;
 
@@ -18,14 +29,45 @@ u32 freeblock;
 u32 usedblocks;
 u32 bitblocks;
 u32 freeinode = 1;
+struct dinode *inodes;
+
+// A metadata block (a directory or indirect block) built in memory.
+struct mblock {
+  u32 bno;
+  char buf[BSIZE];
+};
+struct mblock **mblocks;
+int nmblocks, maxmblocks;
+
+// nblocks blocks at block bno of the image hold the file's data starting
+// at file offset off.
+struct extent {
+  u32 bno;
+  u32 nblocks;
+  off_t off;
+};
+
+// A file whose data a worker copies into the image.
+struct job {
+  const char *path;
+  off_t size;
+  struct extent *extents;
+  int nextents, maxextents;
+};
+struct job *jobs;
+int njobs;
+int nextjob;
 
 void balloc(int);
 void wsect(u32, void*);
 void winode(u32, struct dinode*);
 void rinode(u32 inum, struct dinode *ip);
-void rsect(u32 sec, void *buf);
+char *mblock(u32 bno);
 u32 ialloc(u16 type);
+u32 bmap(struct dinode *din, u32 fbn);
 void iappend(u32 inum, void *p, int n);
+void iappendfile(u32 inum, struct job *job);
+void *worker(void *arg);
 
 // convert to intel byte order
 u16
@@ -53,12 +95,14 @@ xint(u32 x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
+  int i, fd;
   u32 rootino, inum, off;
   struct dirent de;
   char buf[BSIZE];
   struct dinode din;
-  int nblocks;
+  struct stat st;
+  int nblocks, nthreads;
+  pthread_t *threads;
 
   if(argc < 2){
     fprintf(stderr, "Usage: mkfs fs.img files...\n");
@@ -83,8 +127,18 @@ main(int argc, char *argv[])
   printf("used %d (bit %d ninode %zu) free %u total %d\n", usedblocks,
          bitblocks, ninodes/IPB + 1, freeblock, nblocks+usedblocks);
 
-  for(i = 0; i < nblocks + usedblocks; i++)
-    wsect(i, zeroes);
+  // Every block reads as zero until it is written.
+  if(ftruncate(fsfd, (off_t)(nblocks + usedblocks) * BSIZE) < 0){
+    perror("ftruncate");
+    exit(1);
+  }
+
+  inodes = calloc(ninodes + IPB, sizeof(struct dinode));
+  jobs = calloc(argc, sizeof(struct job));
+  if(!inodes || !jobs){
+    perror("calloc");
+    exit(1);
+  }
 
   sb.size = xint(size);
   sb.nblocks = xint(nblocks); // so whole disk is size sectors
@@ -104,10 +158,15 @@ main(int argc, char *argv[])
   iappend(rootino, &de, sizeof(de));
 
   for(i = 2; i < argc; i++){
-    if((fd = open(argv[i], 0)) < 0){
+    if((fd = open(argv[i], 0)) < 0 || fstat(fd, &st) < 0){
       perror(argv[i]);
       exit(1);
     }
+    close(fd);
+
+    struct job *job = &jobs[njobs++];
+    job->path = argv[i];
+    job->size = st.st_size;
 
     // Lop off parent directories
     if (index(argv[i], '/'))
@@ -134,14 +193,26 @@ main(int argc, char *argv[])
       sb.journal_blknums[jnum].start_blknum = xint(freeblock);
     }
 
-    while((cc = read(fd, buf, sizeof(buf))) > 0)
-      iappend(inum, buf, cc);
+    iappendfile(inum, job);
 
     if (strncmp(argv[i], "sv6journal", 10) == 0) {
       sb.journal_blknums[jnum].end_blknum = xint(freeblock - 1); // Inclusive
     }
+  }
 
-    close(fd);
+  // The layout is now fixed.  Copy the files' data in parallel while
+  // this thread writes the metadata.
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(nthreads < 1)
+    nthreads = 1;
+  if(nthreads > njobs)
+    nthreads = njobs;
+  threads = calloc(nthreads ?: 1, sizeof(pthread_t));
+  for(i = 0; i < nthreads; i++){
+    if(pthread_create(&threads[i], NULL, worker, NULL) != 0){
+      fprintf(stderr, "pthread_create failed\n");
+      exit(1);
+    }
   }
 
   memset(buf, 0, sizeof(buf));
@@ -155,68 +226,69 @@ main(int argc, char *argv[])
   din.size = xint(off);
   winode(rootino, &din);
 
+  for(i = 0; i < nmblocks; i++)
+    wsect(mblocks[i]->bno, mblocks[i]->buf);
+  for(inum = 0; inum < freeinode; inum += IPB)
+    wsect(IBLOCK(inum), &inodes[inum]);
+
   balloc(usedblocks);
 
+  for(i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
   exit(0);
 }
 
 void
 wsect(u32 sec, void *buf)
 {
-  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
-    perror("lseek");
-    exit(1);
-  }
-  if(write(fsfd, buf, BSIZE) != BSIZE){
+  if(pwrite(fsfd, buf, BSIZE, sec * (long)BSIZE) != BSIZE){
     perror("write");
     exit(1);
   }
 }
 
-u32
-i2b(u32 inum)
-{
-  return (inum / IPB) + 2;
-}
-
 void
 winode(u32 inum, struct dinode *ip)
 {
-  char buf[BSIZE];
-  u32 bn;
-  struct dinode *dip;
-
-  bn = i2b(inum);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *dip = *ip;
-  wsect(bn, buf);
+  assert(inum < ninodes);
+  inodes[inum] = *ip;
 }
 
 void
 rinode(u32 inum, struct dinode *ip)
 {
-  char buf[BSIZE];
-  u32 bn;
-  struct dinode *dip;
-
-  bn = i2b(inum);
-  rsect(bn, buf);
-  dip = ((struct dinode*)buf) + (inum % IPB);
-  *ip = *dip;
+  assert(inum < ninodes);
+  *ip = inodes[inum];
 }
 
-void
-rsect(u32 sec, void *buf)
+// Return the in-memory copy of metadata block bno, creating it (zeroed)
+// if necessary.
+char*
+mblock(u32 bno)
 {
-  if(lseek(fsfd, sec * (long)BSIZE, 0) != sec * (long)BSIZE){
-    perror("lseek");
-    exit(1);
+  int i;
+
+  for(i = nmblocks - 1; i >= 0; i--)
+    if(mblocks[i]->bno == bno)
+      return mblocks[i]->buf;
+
+  if(nmblocks == maxmblocks){
+    maxmblocks = maxmblocks ? 2 * maxmblocks : 64;
+    mblocks = realloc(mblocks, maxmblocks * sizeof(*mblocks));
+    if(!mblocks){
+      perror("realloc");
+      exit(1);
+    }
   }
-  if(read(fsfd, buf, BSIZE) != BSIZE){
-    perror("read");
+  struct mblock *mb = calloc(1, sizeof(*mb));
+  if(!mb){
+    perror("calloc");
     exit(1);
   }
+  mb->bno = bno;
+  mblocks[nmblocks++] = mb;
+  return mb->buf;
 }
 
 u32
@@ -256,14 +328,63 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Return the block holding block fbn of din, allocating it (and any
+// indirect blocks it needs) if necessary.
+u32
+bmap(struct dinode *din, u32 fbn)
+{
+  u32 *indirect;
+
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0){
+      din->addrs[fbn] = xint(freeblock++);
+      usedblocks++;
+    }
+    return xint(din->addrs[fbn]);
+  } else if (fbn < NDIRECT + NINDIRECT) {
+    if(xint(din->addrs[NDIRECT]) == 0){
+      din->addrs[NDIRECT] = xint(freeblock++);
+      usedblocks++;
+    }
+    indirect = (u32*)mblock(xint(din->addrs[NDIRECT]));
+    if(indirect[fbn - NDIRECT] == 0){
+      indirect[fbn - NDIRECT] = xint(freeblock++);
+      usedblocks++;
+    }
+    return xint(indirect[fbn-NDIRECT]);
+  } else {
+    int i1 = (fbn - NDIRECT - NINDIRECT) / NINDIRECT;
+    int i2 = (fbn - NDIRECT - NINDIRECT) % NINDIRECT;
+
+    if (xint(din->addrs[NDIRECT+1]) == 0) {
+      din->addrs[NDIRECT+1] = xint(freeblock++);
+      usedblocks++;
+    }
+
+    indirect = (u32*)mblock(xint(din->addrs[NDIRECT+1]));
+    if (indirect[i1] == 0) {
+      indirect[i1] = xint(freeblock++);
+      usedblocks++;
+    }
+
+    indirect = (u32*)mblock(xint(indirect[i1]));
+    if (indirect[i2] == 0) {
+      indirect[i2] = xint(freeblock++);
+      usedblocks++;
+    }
+
+    return xint(indirect[i2]);
+  }
+}
+
+// Append n bytes at p to inum, whose data blocks are kept in memory.
 void
 iappend(u32 inum, void *xp, int n)
 {
   char *p = (char*)xp;
   u32 fbn, off, n1;
   struct dinode din;
-  char buf[BSIZE];
-  u32 indirect[NINDIRECT];
   u32 x;
 
   rinode(inum, &din);
@@ -271,58 +392,9 @@ iappend(u32 inum, void *xp, int n)
   off = xint(din.size);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-        usedblocks++;
-      }
-      x = xint(din.addrs[fbn]);
-    } else if (fbn < NDIRECT + NINDIRECT) {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        // printf("allocate indirect block\n");
-        din.addrs[NDIRECT] = xint(freeblock++);
-        usedblocks++;
-      }
-      // printf("read indirect block\n");
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        usedblocks++;
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    } else {
-      int i1 = (fbn - NDIRECT - NINDIRECT) / NINDIRECT;
-      int i2 = (fbn - NDIRECT - NINDIRECT) % NINDIRECT;
-      int diblock;
-
-      if (xint(din.addrs[NDIRECT+1]) == 0) {
-        din.addrs[NDIRECT+1] = xint(freeblock++);
-        usedblocks++;
-      }
-
-      rsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
-      if (indirect[i1] == 0) {
-        indirect[i1] = xint(freeblock++);
-        usedblocks++;
-        wsect(xint(din.addrs[NDIRECT+1]), (char*)indirect);
-      }
-
-      diblock = indirect[i1];
-      rsect(xint(diblock), (char*)indirect);
-      if (indirect[i2] == 0) {
-        indirect[i2] = xint(freeblock++);
-        usedblocks++;
-        wsect(xint(diblock), (char*)indirect);
-      }
-
-      x = xint(indirect[i2]);
-    }
+    x = bmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
-    rsect(x, buf);
-    bcopy(p, buf + off - (fbn * BSIZE), n1);
-    wsect(x, buf);
+    bcopy(p, mblock(x) + off - (fbn * BSIZE), n1);
     n -= n1;
     off += n1;
     p += n1;
@@ -330,3 +402,97 @@ iappend(u32 inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Allocate the blocks of job's file to the empty file inum, recording
+// where its data goes in job's extents.
+void
+iappendfile(u32 inum, struct job *job)
+{
+  struct dinode din;
+  struct extent *e;
+  u32 fbn, x;
+
+  rinode(inum, &din);
+  assert(xint(din.size) == 0);
+
+  for(fbn = 0; (off_t)fbn * BSIZE < job->size; fbn++){
+    x = bmap(&din, fbn);
+    e = job->nextents ? &job->extents[job->nextents - 1] : NULL;
+    if(e && e->bno + e->nblocks == x){
+      e->nblocks++;
+      continue;
+    }
+    if(job->nextents == job->maxextents){
+      job->maxextents = job->maxextents ? 2 * job->maxextents : 8;
+      job->extents = realloc(job->extents,
+                             job->maxextents * sizeof(*job->extents));
+      if(!job->extents){
+        perror("realloc");
+        exit(1);
+      }
+    }
+    e = &job->extents[job->nextents++];
+    e->bno = x;
+    e->nblocks = 1;
+    e->off = (off_t)fbn * BSIZE;
+  }
+
+  din.size = xint(job->size);
+  winode(inum, &din);
+}
+
+#define COPYBLOCKS 256
+
+// Copy files' data into the image until there are no jobs left.  Runs
+// of all-zero blocks are left as holes.
+void*
+worker(void *arg)
+{
+  char *buf = malloc(COPYBLOCKS * BSIZE);
+  struct job *job;
+  struct extent *e;
+  int i, fd;
+  u32 done, n, b, run;
+  ssize_t cc;
+
+  if(!buf){
+    perror("malloc");
+    exit(1);
+  }
+
+  while((i = __sync_fetch_and_add(&nextjob, 1)) < njobs){
+    job = &jobs[i];
+    if((fd = open(job->path, O_RDONLY)) < 0){
+      perror(job->path);
+      exit(1);
+    }
+    for(e = job->extents; e < job->extents + job->nextents; e++){
+      for(done = 0; done < e->nblocks; done += n){
+        n = min(e->nblocks - done, COPYBLOCKS);
+        memset(buf, 0, n * BSIZE);
+        cc = pread(fd, buf, n * BSIZE, e->off + (off_t)done * BSIZE);
+        if(cc < 0 || (cc < n * BSIZE &&
+                      e->off + done * BSIZE + cc != job->size)){
+          perror(job->path);
+          exit(1);
+        }
+        for(b = 0; b < n; b += run){
+          int zero = memcmp(buf + b * BSIZE, zeroes, BSIZE) == 0;
+          for(run = 1; b + run < n; run++)
+            if((memcmp(buf + (b + run) * BSIZE, zeroes, BSIZE) == 0) != zero)
+              break;
+          if(zero)
+            continue;
+          if(pwrite(fsfd, buf + b * BSIZE, run * BSIZE,
+                    (off_t)(e->bno + done + b) * BSIZE) != run * BSIZE){
+            perror("write");
+            exit(1);
+          }
+        }
+      }
+    }
+    close(fd);
+  }
+  free(buf);
+  return NULL;
+}
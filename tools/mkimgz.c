@@ -0,0 +1,178 @@
+// Compress a file system image built by mkfs into the chunked format
+// of include/fsimgz.h.
+//
+// Usage: mkimgz fs.img fs.imgz
+//
+// Chunks are compressed in parallel.  A chunk whose blocks are all
+// zero is stored without data: as a hole if the free bitmap says none
+// of its blocks are allocated (so initdisk can skip it), and otherwise
+// as a zero chunk (which initdisk must zero).
+
+#include <stdio.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+// fs.h has the kernel's PATH_MAX.
+#undef PATH_MAX
+
+#include "include/types.h"
+#include "include/fs.h"
+#include "include/fsimgz.h"
+
+const u8 *img;
+u64 imgsize;
+struct superblock sb;
+u64 nchunks;
+struct fsimgz_chunk *chunks;
+u8 **data;
+u64 nextchunk;
+
+int
+allocated(u64 bno)
+{
+  const u8 *bitmap = img + BBLOCK(0, sb.ninodes) * (u64)BSIZE;
+
+  if(bno >= sb.size)
+    return 0;
+  return (bitmap[bno / 8] >> (bno % 8)) & 1;
+}
+
+int
+iszero(const u8 *p, u64 n)
+{
+  u64 i;
+
+  for(i = 0; i < n; i++)
+    if(p[i])
+      return 0;
+  return 1;
+}
+
+void*
+worker(void *arg)
+{
+  u64 c, len, bno;
+  uLongf zlen;
+  const u8 *p;
+  int used;
+
+  while((c = __sync_fetch_and_add(&nextchunk, 1)) < nchunks){
+    p = img + c * FSIMGZ_CHUNK;
+    len = imgsize - c * FSIMGZ_CHUNK;
+    if(len > FSIMGZ_CHUNK)
+      len = FSIMGZ_CHUNK;
+
+    if(iszero(p, len)){
+      used = 0;
+      for(bno = c * FSIMGZ_CHUNK / BSIZE;
+          bno < (c * FSIMGZ_CHUNK + len) / BSIZE; bno++)
+        used |= allocated(bno);
+      chunks[c].type = used ? FSIMGZ_ZERO : FSIMGZ_HOLE;
+      continue;
+    }
+
+    zlen = compressBound(len);
+    data[c] = malloc(zlen);
+    if(!data[c]){
+      perror("malloc");
+      exit(1);
+    }
+    if(compress2(data[c], &zlen, p, len, Z_BEST_COMPRESSION) != Z_OK){
+      fprintf(stderr, "mkimgz: compress2 failed\n");
+      exit(1);
+    }
+    chunks[c].type = FSIMGZ_DATA;
+    chunks[c].len = zlen;
+  }
+  return NULL;
+}
+
+void
+xwrite(int fd, const void *buf, u64 n)
+{
+  if(write(fd, buf, n) != n){
+    perror("write");
+    exit(1);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct fsimgz_header hdr;
+  struct stat st;
+  pthread_t *threads;
+  int fd, i, nthreads;
+  u64 c, off;
+
+  if(argc != 3){
+    fprintf(stderr, "Usage: mkimgz fs.img fs.imgz\n");
+    exit(1);
+  }
+
+  if((fd = open(argv[1], O_RDONLY)) < 0 || fstat(fd, &st) < 0){
+    perror(argv[1]);
+    exit(1);
+  }
+  imgsize = st.st_size;
+  assert(imgsize % BSIZE == 0 && imgsize >= 2 * BSIZE);
+  img = mmap(NULL, imgsize, PROT_READ, MAP_SHARED, fd, 0);
+  if(img == MAP_FAILED){
+    perror("mmap");
+    exit(1);
+  }
+  close(fd);
+  memmove(&sb, img + BSIZE, sizeof(sb));
+  assert(sb.size * (u64)BSIZE == imgsize);
+
+  nchunks = (imgsize + FSIMGZ_CHUNK - 1) / FSIMGZ_CHUNK;
+  chunks = calloc(nchunks, sizeof(*chunks));
+  data = calloc(nchunks, sizeof(*data));
+  if(!chunks || !data){
+    perror("calloc");
+    exit(1);
+  }
+
+  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+  if(nthreads < 1)
+    nthreads = 1;
+  threads = calloc(nthreads, sizeof(pthread_t));
+  for(i = 0; i < nthreads; i++){
+    if(pthread_create(&threads[i], NULL, worker, NULL) != 0){
+      fprintf(stderr, "pthread_create failed\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < nthreads; i++)
+    pthread_join(threads[i], NULL);
+
+  off = sizeof(hdr) + nchunks * sizeof(*chunks);
+  for(c = 0; c < nchunks; c++){
+    if(chunks[c].type != FSIMGZ_DATA)
+      continue;
+    chunks[c].off = off;
+    off += chunks[c].len;
+  }
+
+  if((fd = open(argv[2], O_WRONLY|O_CREAT|O_TRUNC, 0666)) < 0){
+    perror(argv[2]);
+    exit(1);
+  }
+  hdr.magic = FSIMGZ_MAGIC;
+  hdr.size = imgsize;
+  hdr.nchunks = nchunks;
+  xwrite(fd, &hdr, sizeof(hdr));
+  xwrite(fd, chunks, nchunks * sizeof(*chunks));
+  for(c = 0; c < nchunks; c++)
+    if(chunks[c].type == FSIMGZ_DATA)
+      xwrite(fd, data[c], chunks[c].len);
+  close(fd);
+  exit(0);
+}
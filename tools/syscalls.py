@@ -28,6 +28,7 @@ def main():
     if options.kvectors:
         print "#include \"types.h\""
         print "#include \"kernel.hh\""
+        print "#include \"sysent.hh\""
         print "#include <uk/unistd.h>"
         print "#include <uk/signal.h>"
         print
@@ -36,23 +37,44 @@ def main():
                                          ", ".join(syscall.kargs))
         print
 
-        print "u64 (*syscalls[])(u64, u64, u64, u64, u64, u64) = {"
-        bynum = dict((s.num, s) for s in syscalls)
-        for num in range(max(bynum.keys()) + 1):
-            if num not in bynum:
-                print "  nullptr,"
+        # Per-syscall stubs that decode and check the raw arguments
+        for syscall in syscalls:
+            print "static u64"
+            print "sysent_%s(u64 a0, u64 a1, u64 a2, u64 a3, u64 a4, u64 a5)" % \
+                syscall.basename
+            print "{"
+            args = []
+            for i, atype in enumerate(syscall.katypes()):
+                if atype == "...":
+                    # Pass the remaining registers through
+                    args.extend("a%d" % j for j in range(i, 6))
+                    break
+                # Avoid ">>", which C++0x may not parse
+                targ = atype + (" " if atype.endswith(">") else "")
+                if atype.startswith("userptr") and atype != "userptr<void>":
+                    print "  if (!sysarg<%s>::check(a%d))" % (targ, i)
+                    print "    return -1;"
+                args.append("sysarg<%s>::decode(a%d)" % (targ, i))
+            call = "%s(%s)" % (syscall.kname, ", ".join(args))
+            if syscall.rettype == "void":
+                print "  %s;" % call
+                print "  return 0;"
             else:
-                print "  (u64(*)(u64,u64,u64,u64,u64,u64))%s," % bynum[num].kname
-        print "};"
-        print
+                print "  return (u64)%s;" % call
+            print "}"
+            print
 
-        print 'const char* syscall_names[] = {'
+        print "extern constexpr struct sysent syscalls[] = {"
+        bynum = dict((s.num, s) for s in syscalls)
         for num in range(max(bynum.keys()) + 1):
             if num not in bynum:
-                print '  nullptr,'
+                print "  { nullptr, nullptr, false },"
             else:
-                print '  "%s",' % bynum[num].kname
-        print '};'
+                s = bynum[num]
+                print '  { sysent_%s, "%s", %s },' % \
+                    (s.basename, s.kname,
+                     "true" if s.flags.get("fast") else "false")
+        print "};"
         print
 
         print "extern const int nsyscalls = %d;" % (max(bynum.keys()) + 1)
@@ -105,6 +127,29 @@ class Syscall(object):
         else:
             self.uargs = self.__make_uargs(kargs)
 
+    def katypes(self):
+        """The kernel argument types, with const dropped from userptrs
+        (which are passed by value)."""
+        res = []
+        for karg in self.kargs:
+            atype = Syscall.__argtype(karg)
+            if atype == "void":
+                continue
+            atype = re.sub(r"^const +(userptr)", r"\1", atype)
+            res.append(atype)
+        return res
+
+    @staticmethod
+    def __argtype(karg):
+        m = re.match("(.*?) *[a-z_0-9]+$", karg)
+        if karg.strip() == "void":
+            return "void"
+        elif karg.strip() == "...":
+            return "..."
+        elif m:
+            return m.group(1)
+        raise ParseError("<syscall>", "could not parse arg %r" % karg)
+
     @staticmethod
     def __make_uargs(kargs):
         uargs = []